@@ -0,0 +1,157 @@
+/*  Detection of the active picture area inside letterboxed or pillarboxed frames
+
+    Every ACTIVE_AREA_INTERVAL_FRAMES frames a sparse set of rows and columns of the
+    luma plane is scanned from the outside in. A row or column belongs to the picture
+    as soon as enough of its samples are brighter than BLACK_THRESHOLD.
+
+    The result is applied with hysteresis: a larger rectangle is taken immediately so
+    no content is ever cut off, a smaller or shifted one only after it was detected
+    STABLE_ANALYSES times in a row (within EDGE_TOLERANCE pixels). Frames that are
+    completely black (fades, scene cuts) or would leave less than MIN_AREA_PERCENT
+    of the frame are ignored.
+*/
+
+#include "active_area.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Luma value above which a sample counts as picture content (video black is 16)
+#define BLACK_THRESHOLD 32
+// Number of samples taken along each scanned row or column
+#define SAMPLES_PER_LINE 64
+// Samples above the threshold needed for a line to count as content
+#define MIN_BRIGHT_SAMPLES 3
+#define STABLE_ANALYSES 3
+#define EDGE_TOLERANCE 4
+#define MIN_AREA_PERCENT 20
+
+static int frame_width = 0;
+static int frame_height = 0;
+static FrameRect current = {0, 0, 0, 0};
+static FrameRect candidate = {0, 0, 0, 0};
+static int candidate_count = 0;
+
+void active_area_init(int width, int height) {
+    frame_width = width;
+    frame_height = height;
+    current.x = 0;
+    current.y = 0;
+    current.width = width;
+    current.height = height;
+    candidate = current;
+    candidate_count = 0;
+}
+
+bool active_area_due(unsigned int frame_number) {
+    return frame_number % ACTIVE_AREA_INTERVAL_FRAMES == 0;
+}
+
+void active_area_get(FrameRect *rect) {
+    *rect = current;
+}
+
+static bool row_has_content(const unsigned char *luma, int pixel_step, int stride, int y) {
+    const unsigned char *row = luma + (size_t)y * stride;
+    int step = frame_width / SAMPLES_PER_LINE;
+    if (step < 1) step = 1;
+    int bright = 0;
+    for (int x = step / 2; x < frame_width; x += step) {
+        if (row[(size_t)x * pixel_step] > BLACK_THRESHOLD && ++bright >= MIN_BRIGHT_SAMPLES) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool column_has_content(const unsigned char *luma, int pixel_step, int stride, int x) {
+    int step = frame_height / SAMPLES_PER_LINE;
+    if (step < 1) step = 1;
+    int bright = 0;
+    for (int y = step / 2; y < frame_height; y += step) {
+        if (luma[(size_t)y * stride + (size_t)x * pixel_step] > BLACK_THRESHOLD && ++bright >= MIN_BRIGHT_SAMPLES) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool rect_close(const FrameRect *a, const FrameRect *b) {
+    return abs(a->x - b->x) <= EDGE_TOLERANCE &&
+           abs(a->y - b->y) <= EDGE_TOLERANCE &&
+           abs(a->x + a->width - b->x - b->width) <= EDGE_TOLERANCE &&
+           abs(a->y + a->height - b->y - b->height) <= EDGE_TOLERANCE;
+}
+
+static bool rect_contains(const FrameRect *outer, const FrameRect *inner) {
+    return inner->x >= outer->x && inner->y >= outer->y &&
+           inner->x + inner->width <= outer->x + outer->width &&
+           inner->y + inner->height <= outer->y + outer->height;
+}
+
+bool active_area_analyze(const unsigned char *luma, int pixel_step, int stride) {
+    if (frame_width <= 0 || frame_height <= 0) return false;
+
+    int top = 0;
+    while (top < frame_height && !row_has_content(luma, pixel_step, stride, top)) top++;
+    if (top == frame_height) {
+        return false; // black frame, keep the current area
+    }
+    int bottom = frame_height - 1;
+    while (bottom > top && !row_has_content(luma, pixel_step, stride, bottom)) bottom--;
+    int left = 0;
+    while (left < frame_width - 1 && !column_has_content(luma, pixel_step, stride, left)) left++;
+    int right = frame_width - 1;
+    while (right > left && !column_has_content(luma, pixel_step, stride, right)) right--;
+
+    // Snap outwards to even coordinates so chroma siting and YUYV pairs stay aligned
+    FrameRect detected;
+    detected.x = left & ~1;
+    detected.y = top & ~1;
+    detected.width = ((right + 2) & ~1) - detected.x;
+    detected.height = ((bottom + 2) & ~1) - detected.y;
+    if (detected.x + detected.width > frame_width) detected.width = (frame_width - detected.x) & ~1;
+    if (detected.y + detected.height > frame_height) detected.height = (frame_height - detected.y) & ~1;
+
+    if ((long)detected.width * detected.height * 100 < (long)frame_width * frame_height * MIN_AREA_PERCENT) {
+        return false;
+    }
+
+    if (rect_close(&detected, &current)) {
+        candidate_count = 0;
+        return false;
+    }
+
+    if (!rect_contains(&current, &detected)) {
+        // Content appeared outside of the current area, grow immediately
+        FrameRect grown;
+        grown.x = detected.x < current.x ? detected.x : current.x;
+        grown.y = detected.y < current.y ? detected.y : current.y;
+        int grown_right = detected.x + detected.width > current.x + current.width ?
+                          detected.x + detected.width : current.x + current.width;
+        int grown_bottom = detected.y + detected.height > current.y + current.height ?
+                           detected.y + detected.height : current.y + current.height;
+        grown.width = grown_right - grown.x;
+        grown.height = grown_bottom - grown.y;
+        current = grown;
+        candidate_count = 0;
+        printf("Active area: grown to %dx%d+%d+%d\n", current.width, current.height, current.x, current.y);
+        return true;
+    }
+
+    if (candidate_count > 0 && rect_close(&detected, &candidate)) {
+        candidate_count++;
+    } else {
+        candidate = detected;
+        candidate_count = 1;
+    }
+    if (candidate_count < STABLE_ANALYSES) {
+        return false;
+    }
+
+    current = candidate;
+    candidate_count = 0;
+    printf("Active area: %dx%d+%d+%d of %dx%d\n", current.width, current.height, current.x, current.y,
+           frame_width, frame_height);
+    return true;
+}
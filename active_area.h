@@ -0,0 +1,26 @@
+#ifndef ACTIVE_AREA_H
+#define ACTIVE_AREA_H
+
+#include <stdbool.h>
+
+#include "utility.h"
+
+// Frames between two analyses of the incoming luma
+#define ACTIVE_AREA_INTERVAL_FRAMES 15
+
+// Resets the detector to the full frame of the given size
+void active_area_init(int width, int height);
+
+// Returns true if the frame with this sequence number should be analyzed
+bool active_area_due(unsigned int frame_number);
+
+// Analyzes one frame. luma points at the first luma sample, pixel_step is the distance
+// between two horizontally neighbouring samples (1 for NV24 Y, 2 for YUYV, 3 for RGB)
+// and stride the distance between two rows in bytes.
+// Returns true if the active rectangle changed.
+bool active_area_analyze(const unsigned char *luma, int pixel_step, int stride);
+
+// The current active rectangle. Always inside the frame with even offsets and size.
+void active_area_get(FrameRect *rect);
+
+#endif // ACTIVE_AREA_H
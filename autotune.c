@@ -0,0 +1,459 @@
+/*  Pipeline autotuner
+
+    Which pipeline is fastest depends on the machine more than on anything else: libjpeg
+    against the IDCT shaders, H.264 from the device against MJPEG, and how many V4L2 buffers
+    the capture needs before it stops dropping frames. --autotune switches the running
+    source through every combination that is available, lets each settle, measures it for
+    a few seconds and writes the winner to a machine profile that later runs load.
+
+    A candidate is measured by the frames it publishes per second, the time from capture to
+    texture update and the CPU time of the whole process. The frame rate is usually capped
+    by the device, so every candidate within AUTOTUNE_RATE_TOLERANCE of the best rate
+    competes on the median latency, and nearly equal latencies are decided by CPU load.
+
+    Without a capture device only the MJPEG decoder can be chosen: a generated frame is
+    encoded with libjpeg and decoded both ways.
+*/
+
+#include "autotune.h"
+#include "mjpeg_gpu.h"
+#include "stats.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <jpeglib.h>
+
+#define MAX_CANDIDATES 16
+#define MAX_LATENCY_SAMPLES 4096
+
+typedef enum {
+    PHASE_IDLE,
+    PHASE_SWITCHING,    // waiting for the source to come up with the next candidate
+    PHASE_WARMUP,
+    PHASE_MEASURING
+} Phase;
+
+typedef struct {
+    PipelineConfig config;      // as it ran
+    AutotuneResult result;
+    bool valid;
+} Candidate;
+
+static Phase phase = PHASE_IDLE;
+static PipelineConfig queue[MAX_CANDIDATES];
+static int queue_length = 0;
+static int queue_next = 0;
+static Candidate candidates[MAX_CANDIDATES];
+static int candidate_count = 0;
+static Candidate *current = NULL;
+
+static double phase_start_us = 0.0;
+static unsigned int phase_start_frames = 0;
+static double phase_start_cpu_us = 0.0;
+// Written from display(), read when the measurement ends on the same thread
+static double latency_samples[MAX_LATENCY_SAMPLES];
+static int latency_sample_count = 0;
+
+static double process_cpu_us(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static bool same_config(const PipelineConfig *a, const PipelineConfig *b) {
+    return a->compressed_input == b->compressed_input && a->mjpeg_gpu == b->mjpeg_gpu &&
+           a->buffer_count == b->buffer_count;
+}
+
+static void describe_config(const PipelineConfig *config, char *text, size_t size) {
+    snprintf(text, size, "%s%s, %d buffers", config->compressed_input ? "compressed, " : "",
+             config->mjpeg_gpu ? "GPU MJPEG" : "CPU MJPEG", config->buffer_count);
+}
+
+void autotune_start(bool try_compressed, bool try_mjpeg_gpu) {
+    static const int buffer_counts[] = AUTOTUNE_BUFFER_COUNTS;
+    queue_length = 0;
+    queue_next = 0;
+    candidate_count = 0;
+    current = NULL;
+    for (int c = 0; c <= (try_compressed ? 1 : 0); c++) {
+        for (int g = 0; g <= (try_mjpeg_gpu ? 1 : 0); g++) {
+            for (size_t b = 0; b < sizeof(buffer_counts) / sizeof(buffer_counts[0]); b++) {
+                PipelineConfig *config = &queue[queue_length++];
+                config->compressed_input = c;
+                config->mjpeg_gpu = g;
+                config->buffer_count = buffer_counts[b];
+            }
+        }
+    }
+    phase = PHASE_SWITCHING;
+    printf("Autotune: %d configurations, %.1f s each\n", queue_length, AUTOTUNE_WARMUP_S + AUTOTUNE_MEASURE_S);
+}
+
+bool autotune_active(void) {
+    return phase != PHASE_IDLE;
+}
+
+bool autotune_measuring(void) {
+    return phase == PHASE_MEASURING;
+}
+
+bool autotune_next(PipelineConfig *config) {
+    if (phase == PHASE_IDLE || queue_next >= queue_length) {
+        return false;
+    }
+    *config = queue[queue_next++];
+    phase = PHASE_SWITCHING;
+    return true;
+}
+
+void autotune_measure(const PipelineConfig *effective, const char *format, unsigned int frames_published, double now_us) {
+    current = NULL;
+    if (phase != PHASE_SWITCHING) {
+        return;
+    }
+    char text[64];
+    describe_config(effective, text, sizeof(text));
+    if (!format) {
+        printf("Autotune: %s could not be started, skipped\n", text);
+        phase = PHASE_WARMUP;
+        phase_start_us = now_us - AUTOTUNE_WARMUP_S * 1e6; // done on the next update
+        return;
+    }
+    // The device lacking H.264 or the shaders rejecting the JPEGs turns several candidates into the same one
+    for (int i = 0; i < candidate_count; i++) {
+        if (same_config(&candidates[i].config, effective) && strcmp(candidates[i].result.format, format) == 0) {
+            printf("Autotune: %s (%s) was already measured, skipped\n", text, format);
+            phase = PHASE_WARMUP;
+            phase_start_us = now_us - AUTOTUNE_WARMUP_S * 1e6;
+            return;
+        }
+    }
+    if (candidate_count >= MAX_CANDIDATES) {
+        return;
+    }
+    current = &candidates[candidate_count++];
+    memset(current, 0, sizeof(*current));
+    current->config = *effective;
+    snprintf(current->result.format, sizeof(current->result.format), "%s", format);
+    printf("Autotune: measuring %s (%s)\n", text, format);
+    phase = PHASE_WARMUP;
+    phase_start_us = now_us;
+    phase_start_frames = frames_published;
+}
+
+bool autotune_update(unsigned int frames_published, double now_us) {
+    if (phase == PHASE_SWITCHING) {
+        return true;
+    }
+    double elapsed_s = (now_us - phase_start_us) / 1e6;
+    if (phase == PHASE_WARMUP && elapsed_s >= AUTOTUNE_WARMUP_S) {
+        if (!current) {
+            phase = PHASE_SWITCHING; // skipped candidate
+            return true;
+        }
+        phase = PHASE_MEASURING;
+        phase_start_us = now_us;
+        phase_start_frames = frames_published;
+        phase_start_cpu_us = process_cpu_us();
+        latency_sample_count = 0;
+        return false;
+    }
+    if (phase != PHASE_MEASURING || elapsed_s < AUTOTUNE_MEASURE_S) {
+        return false;
+    }
+
+    AutotuneResult *result = &current->result;
+    result->frames_per_second = (frames_published - phase_start_frames) / elapsed_s;
+    result->cpu_percent = (process_cpu_us() - phase_start_cpu_us) / (now_us - phase_start_us) * 100.0;
+    if (latency_sample_count > 0) {
+        qsort(latency_samples, latency_sample_count, sizeof(double), compare_double);
+        result->latency_p50_us = latency_samples[latency_sample_count / 2];
+        result->latency_p99_us = latency_samples[(latency_sample_count * 99) / 100];
+    }
+    current->valid = latency_sample_count > 0 && result->frames_per_second > 0.0;
+    printf("Autotune:   %.1f fps, latency p50 %.1f ms p99 %.1f ms, CPU %.0f%%\n",
+           result->frames_per_second, result->latency_p50_us / 1000.0,
+           result->latency_p99_us / 1000.0, result->cpu_percent);
+    current = NULL;
+    phase = PHASE_SWITCHING;
+    return true;
+}
+
+void autotune_frame_shown(double latency_us) {
+    if (phase == PHASE_MEASURING && latency_sample_count < MAX_LATENCY_SAMPLES && latency_us >= 0.0) {
+        latency_samples[latency_sample_count++] = latency_us;
+    }
+}
+
+// True if a is the better configuration, both are valid and run at an acceptable frame rate
+static bool better_candidate(const Candidate *a, const Candidate *b) {
+    double latency_delta = a->result.latency_p50_us - b->result.latency_p50_us;
+    if (latency_delta < -AUTOTUNE_LATENCY_TOLERANCE_US) return true;
+    if (latency_delta > AUTOTUNE_LATENCY_TOLERANCE_US) return false;
+    return a->result.cpu_percent < b->result.cpu_percent;
+}
+
+bool autotune_finish(PipelineConfig *best, AutotuneResult *result) {
+    phase = PHASE_IDLE;
+    current = NULL;
+
+    double best_rate = 0.0;
+    for (int i = 0; i < candidate_count; i++) {
+        if (candidates[i].valid && candidates[i].result.frames_per_second > best_rate) {
+            best_rate = candidates[i].result.frames_per_second;
+        }
+    }
+    const Candidate *winner = NULL;
+    for (int i = 0; i < candidate_count; i++) {
+        const Candidate *c = &candidates[i];
+        if (!c->valid || c->result.frames_per_second < best_rate * (1.0 - AUTOTUNE_RATE_TOLERANCE)) continue;
+        if (!winner || better_candidate(c, winner)) winner = c;
+    }
+
+    printf("\n--- Autotune results ---\n");
+    printf("  %-34s %-6s %8s %9s %9s %6s\n", "Configuration", "Format", "fps", "p50 ms", "p99 ms", "CPU %");
+    for (int i = 0; i < candidate_count; i++) {
+        const Candidate *c = &candidates[i];
+        char text[64];
+        describe_config(&c->config, text, sizeof(text));
+        if (!c->valid) {
+            printf("  %-34s %-6s   no frames\n", text, c->result.format);
+            continue;
+        }
+        printf("%s %-34s %-6s %8.1f %9.1f %9.1f %6.0f\n", c == winner ? "*" : " ", text, c->result.format,
+               c->result.frames_per_second, c->result.latency_p50_us / 1000.0,
+               c->result.latency_p99_us / 1000.0, c->result.cpu_percent);
+    }
+    if (!winner) {
+        fprintf(stderr, "Autotune: No configuration delivered frames, nothing to choose from.\n");
+        return false;
+    }
+    *best = winner->config;
+    *result = winner->result;
+    return true;
+}
+
+// A test pattern with noise, so the JPEG has the entropy of real content
+static unsigned char *encode_synthetic_jpeg(int width, int height, unsigned long *length) {
+    unsigned char *rgb = malloc((size_t)width * height * 3);
+    if (!rgb) return NULL;
+    fill_frame_with_pattern(rgb, width, height);
+    uint32_t noise = 0x12345678;
+    for (size_t i = 0; i < (size_t)width * height * 3; i++) {
+        noise ^= noise << 13;
+        noise ^= noise >> 17;
+        noise ^= noise << 5;
+        int value = rgb[i] + (int)(noise & 15) - 8;
+        rgb[i] = value < 0 ? 0 : (value > 255 ? 255 : value);
+    }
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char *jpeg = NULL;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &jpeg, length);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);   // 4:2:0, like capture devices send
+    jpeg_set_quality(&cinfo, 85, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = rgb + (size_t)cinfo.next_scanline * width * 3;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(rgb);
+    return jpeg;
+}
+
+bool autotune_synthetic(int width, int height, bool gpu_available, PipelineConfig *best, AutotuneResult *result) {
+    unsigned long length = 0;
+    unsigned char *jpeg = encode_synthetic_jpeg(width, height, &length);
+    size_t buffer_size = (size_t)width * height * 3;
+    if (gpu_available && mjpeg_gpu_buffer_size(width, height) > buffer_size) {
+        buffer_size = mjpeg_gpu_buffer_size(width, height);
+    }
+    unsigned char *buffer = malloc(buffer_size);
+    if (!jpeg || !buffer) {
+        free(jpeg);
+        free(buffer);
+        fprintf(stderr, "Autotune: Could not create the synthetic frame.\n");
+        return false;
+    }
+    printf("Autotune: No capture device, timing MJPEG decoding of a synthetic %dx%d frame (%lu bytes)\n",
+           width, height, length);
+
+    AutotuneResult cpu = {"MJPG", 0.0, 0.0, 0.0, 0.0};
+    AutotuneResult gpu = {"MJPG", 0.0, 0.0, 0.0, 0.0};
+    bool gpu_valid = false;
+    for (int pass = 0; pass < 2; pass++) {
+        bool on_gpu = pass == 1;
+        if (on_gpu && !gpu_available) break;
+        AutotuneResult *r = on_gpu ? &gpu : &cpu;
+        GLuint texture = 0;
+        if (on_gpu) {
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        }
+        latency_sample_count = 0;
+        double start_us = stats_now_us();
+        double start_cpu_us = process_cpu_us();
+        double now_us = start_us;
+        int frames = 0;
+        bool ok = true;
+        while (ok && now_us - start_us < (AUTOTUNE_WARMUP_S + AUTOTUNE_MEASURE_S) * 1e6) {
+            double frame_start_us = stats_now_us();
+            if (on_gpu) {
+                // Waits for the GPU, so the time covers the whole decode
+                ok = mjpeg_gpu_read_coefficients(jpeg, length, width, height, buffer, buffer_size) &&
+                     mjpeg_gpu_render(texture, buffer);
+                glFinish();
+            } else {
+                convert_mjpeg_to_rgb(jpeg, length, buffer, width, height);
+            }
+            now_us = stats_now_us();
+            if (frame_start_us - start_us >= AUTOTUNE_WARMUP_S * 1e6 && latency_sample_count < MAX_LATENCY_SAMPLES) {
+                latency_samples[latency_sample_count++] = now_us - frame_start_us;
+            }
+            frames++;
+        }
+        if (on_gpu) glDeleteTextures(1, &texture);
+        if (!ok || latency_sample_count == 0) {
+            fprintf(stderr, "Autotune: %s decoding of the synthetic frame failed.\n", on_gpu ? "GPU" : "CPU");
+            continue;
+        }
+        qsort(latency_samples, latency_sample_count, sizeof(double), compare_double);
+        r->latency_p50_us = latency_samples[latency_sample_count / 2];
+        r->latency_p99_us = latency_samples[(latency_sample_count * 99) / 100];
+        r->frames_per_second = frames / ((now_us - start_us) / 1e6);
+        r->cpu_percent = (process_cpu_us() - start_cpu_us) / (now_us - start_us) * 100.0;
+        printf("Autotune:   %s MJPEG: %.1f fps, decode p50 %.2f ms p99 %.2f ms, CPU %.0f%%\n",
+               on_gpu ? "GPU" : "CPU", r->frames_per_second, r->latency_p50_us / 1000.0,
+               r->latency_p99_us / 1000.0, r->cpu_percent);
+        gpu_valid = on_gpu;
+    }
+    free(jpeg);
+    free(buffer);
+
+    // Each decoder runs flat out here, so the one taking less time per frame wins
+    memset(best, 0, sizeof(*best));
+    best->buffer_count = 0;  // not measured, keeps the default
+    best->mjpeg_gpu = gpu_valid && (cpu.latency_p50_us == 0.0 || gpu.latency_p50_us < cpu.latency_p50_us);
+    *result = best->mjpeg_gpu ? gpu : cpu;
+    if (result->latency_p50_us == 0.0) {
+        return false;
+    }
+    printf("Autotune: Chose %s MJPEG decoding\n", best->mjpeg_gpu ? "GPU" : "CPU");
+    return true;
+}
+
+// mkdir -p for the directory part of path
+static bool make_parent_directories(const char *path) {
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *p = dir + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Autotune: Could not create %s: %s\n", dir, strerror(errno));
+            return false;
+        }
+        *p = '/';
+    }
+    return true;
+}
+
+bool autotune_profile_path(const char *device, int width, int height, char *path, size_t size) {
+    const char *config_home = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+    char base[256];
+    if (config_home && config_home[0] == '/') {
+        snprintf(base, sizeof(base), "%s", config_home);
+    } else if (home && home[0] != '\0') {
+        snprintf(base, sizeof(base), "%s/.config", home);
+    } else {
+        return false;
+    }
+    const char *name = strrchr(device, '/');
+    name = name ? name + 1 : device;
+    int n = snprintf(path, size, "%s/v4l2_gl/profile-%s-%dx%d.conf", base, name[0] ? name : "default", width, height);
+    return n > 0 && (size_t)n < size;
+}
+
+bool autotune_profile_load(const char *path, PipelineConfig *config) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    memset(config, 0, sizeof(*config));
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        char key[64];
+        int value;
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line, " %63[^= ] = %d", key, &value) != 2) {
+            fprintf(stderr, "Autotune: %s:%d: expected key = value\n", path, line_number);
+            continue;
+        }
+        if (strcmp(key, "compressed_input") == 0) {
+            config->compressed_input = value != 0;
+        } else if (strcmp(key, "mjpeg_gpu") == 0) {
+            config->mjpeg_gpu = value != 0;
+        } else if (strcmp(key, "buffers") == 0) {
+            config->buffer_count = value > 0 ? value : 0;
+        } else {
+            fprintf(stderr, "Autotune: %s:%d: unknown key %s\n", path, line_number, key);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+bool autotune_profile_save(const char *path, const char *device, int width, int height,
+                           const PipelineConfig *config, const AutotuneResult *result) {
+    if (!make_parent_directories(path)) {
+        return false;
+    }
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Autotune: Could not write %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    fprintf(file, "# Written by v4l2_gl --autotune for %s at %dx%d\n", device, width, height);
+    fprintf(file, "# Measured: %s, %.1f fps, latency p50 %.1f ms p99 %.1f ms, CPU %.0f%%\n",
+            result->format, result->frames_per_second, result->latency_p50_us / 1000.0,
+            result->latency_p99_us / 1000.0, result->cpu_percent);
+    fprintf(file, "compressed_input = %d\n", config->compressed_input ? 1 : 0);
+    fprintf(file, "mjpeg_gpu = %d\n", config->mjpeg_gpu ? 1 : 0);
+    if (config->buffer_count > 0) {
+        fprintf(file, "buffers = %d\n", config->buffer_count);
+    }
+    bool ok = fclose(file) == 0;
+    if (ok) {
+        printf("Autotune: Profile written to %s\n", path);
+    }
+    return ok;
+}
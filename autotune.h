@@ -0,0 +1,64 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Seconds every candidate runs before and while it is measured
+#define AUTOTUNE_WARMUP_S 1.5
+#define AUTOTUNE_MEASURE_S 4.0
+// Candidates within this fraction of the best frame rate compete on latency, then CPU load
+#define AUTOTUNE_RATE_TOLERANCE 0.03
+// Latencies closer than this count as equal (us)
+#define AUTOTUNE_LATENCY_TOLERANCE_US 1000.0
+// V4L2 buffer counts tried
+#define AUTOTUNE_BUFFER_COUNTS {2, 4, 6}
+
+// The pipeline settings a machine profile holds
+typedef struct {
+    bool compressed_input;  // H.264/HEVC from the device when it has them
+    bool mjpeg_gpu;         // MJPEG IDCT and colour conversion on the GPU
+    int buffer_count;       // V4L2 capture buffers
+} PipelineConfig;
+
+typedef struct {
+    char format[8];             // capture format the configuration ended up with
+    double frames_per_second;   // frames converted and published
+    double latency_p50_us;      // capture timestamp to texture updated
+    double latency_p99_us;
+    double cpu_percent;         // of one core, the whole process
+} AutotuneResult;
+
+// Starts benchmarking every combination of the options that are available.
+void autotune_start(bool try_compressed, bool try_mjpeg_gpu);
+bool autotune_active(void);
+bool autotune_measuring(void);
+
+// The next candidate to switch the source to. False once all of them ran, then call autotune_finish().
+bool autotune_next(PipelineConfig *config);
+
+// The source runs the last candidate now, as it came out (effective), e.g. MJPEG when the device
+// has no H.264. format is NULL if the source could not be started. A configuration that was
+// measured before is not measured again.
+void autotune_measure(const PipelineConfig *effective, const char *format, unsigned int frames_published, double now_us);
+
+// Call regularly from the render loop. Returns true while the autotuner waits for the next candidate.
+bool autotune_update(unsigned int frames_published, double now_us);
+
+// A captured frame reached the texture latency_us after it was captured.
+void autotune_frame_shown(double latency_us);
+
+// Prints every candidate and picks the best one. Returns false if none could be measured.
+bool autotune_finish(PipelineConfig *best, AutotuneResult *result);
+
+// Without a capture device: times libjpeg against mjpeg_gpu on a generated width x height
+// frame and picks the faster decoder. Needs a current GL context when gpu_available is set.
+bool autotune_synthetic(int width, int height, bool gpu_available, PipelineConfig *best, AutotuneResult *result);
+
+// Machine profiles live in $XDG_CONFIG_HOME/v4l2_gl (~/.config/v4l2_gl), one per device and capture size.
+bool autotune_profile_path(const char *device, int width, int height, char *path, size_t size);
+bool autotune_profile_load(const char *path, PipelineConfig *config);
+bool autotune_profile_save(const char *path, const char *device, int width, int height,
+                           const PipelineConfig *config, const AutotuneResult *result);
+
+#endif // AUTOTUNE_H
@@ -0,0 +1,155 @@
+/*  Reading captured frames out of uncached V4L2 buffers
+
+    On many ARM SoCs the V4L2 MMAP buffers are mapped uncached or write-combined, so the
+    device needs no cache maintenance. Every load then goes to DRAM on its own, and the
+    byte-wise loops of the converters crawl. It depends on driver and SoC, so it is measured:
+    the read bandwidth of a mapped buffer against that of ordinary memory. A slow mapping is
+    read either through a cached mapping of the exported dmabuf, made coherent with
+    DMA_BUF_IOCTL_SYNC, or copied in full vector loads into a cached bounce buffer first.
+*/
+
+#include "capture_memory.h"
+
+#include "stats.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef ARCH_X86_64
+#include <smmintrin.h>
+#elif defined(ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+
+#define PROBE_PASSES 3
+
+static volatile uint64_t probe_sink;
+
+bool capture_memory_parse(const char *name, CaptureReadStrategy *strategy) {
+    static const CaptureReadStrategy all[] = {
+        CAPTURE_READ_AUTO, CAPTURE_READ_DIRECT, CAPTURE_READ_DMABUF_SYNC, CAPTURE_READ_BOUNCE
+    };
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        if (strcmp(name, capture_memory_name(all[i])) == 0) {
+            *strategy = all[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *capture_memory_name(CaptureReadStrategy strategy) {
+    switch (strategy) {
+        case CAPTURE_READ_DIRECT: return "direct";
+        case CAPTURE_READ_DMABUF_SYNC: return "dmabuf";
+        case CAPTURE_READ_BOUNCE: return "bounce";
+        default: return "auto";
+    }
+}
+
+double capture_memory_read_bandwidth(const void *data, size_t size) {
+    if (size > CAPTURE_MEMORY_PROBE_BYTES) size = CAPTURE_MEMORY_PROBE_BYTES;
+    size_t words = size / sizeof(uint64_t);
+    if (words == 0) return 0.0;
+    const volatile uint64_t *p = data;
+    double best_us = 0.0;
+    for (int pass = 0; pass < PROBE_PASSES; pass++) {
+        double start = stats_now_us();
+        uint64_t sum = 0;
+        for (size_t i = 0; i < words; i++) {
+            sum += p[i];
+        }
+        double elapsed = stats_now_us() - start;
+        probe_sink = sum;
+        if (pass == 0 || elapsed < best_us) best_us = elapsed;
+    }
+    return best_us > 0.0 ? (double)(words * sizeof(uint64_t)) / best_us : 0.0; // Bytes per us are MB/s
+}
+
+double capture_memory_reference_bandwidth(size_t size) {
+    if (size > CAPTURE_MEMORY_PROBE_BYTES) size = CAPTURE_MEMORY_PROBE_BYTES;
+    unsigned char *cached = malloc(size);
+    if (!cached) return 0.0;
+    memset(cached, 1, size); // Touch every page
+    double bandwidth = capture_memory_read_bandwidth(cached, size);
+    free(cached);
+    return bandwidth;
+}
+
+double capture_memory_copy_bandwidth(const void *data, size_t size) {
+    if (size > CAPTURE_MEMORY_PROBE_BYTES) size = CAPTURE_MEMORY_PROBE_BYTES;
+    unsigned char *bounce = malloc(size);
+    if (!bounce || size == 0) {
+        free(bounce);
+        return 0.0;
+    }
+    memset(bounce, 0, size);
+    double best_us = 0.0;
+    for (int pass = 0; pass < PROBE_PASSES; pass++) {
+        double start = stats_now_us();
+        capture_memory_bulk_copy(bounce, data, size);
+        double elapsed = stats_now_us() - start;
+        if (pass == 0 || elapsed < best_us) best_us = elapsed;
+    }
+    free(bounce);
+    return best_us > 0.0 ? (double)size / best_us : 0.0;
+}
+
+#ifdef ARCH_X86_64
+// MOVNTDQA fetches a whole write-combined line into a streaming buffer, later loads of the
+// line are served from there. On cached memory it behaves like an ordinary load.
+__attribute__((target("sse4.1")))
+static void copy_streaming(unsigned char *dst, const unsigned char *src, size_t size) {
+    size_t head = (16 - ((uintptr_t)src & 15)) & 15;
+    if (head > size) head = size;
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    size -= head;
+    for (; size >= 64; size -= 64, src += 64, dst += 64) {
+        __m128i a = _mm_stream_load_si128((__m128i *)src);
+        __m128i b = _mm_stream_load_si128((__m128i *)(src + 16));
+        __m128i c = _mm_stream_load_si128((__m128i *)(src + 32));
+        __m128i d = _mm_stream_load_si128((__m128i *)(src + 48));
+        _mm_storeu_si128((__m128i *)dst, a);
+        _mm_storeu_si128((__m128i *)(dst + 16), b);
+        _mm_storeu_si128((__m128i *)(dst + 32), c);
+        _mm_storeu_si128((__m128i *)(dst + 48), d);
+    }
+    memcpy(dst, src, size);
+}
+#endif
+
+void capture_memory_bulk_copy(void *dst, const void *src, size_t size) {
+#if defined(ARCH_X86_64)
+    static int streaming = -1;
+    if (streaming < 0) streaming = __builtin_cpu_supports("sse4.1") ? 1 : 0;
+    if (streaming) {
+        copy_streaming(dst, src, size);
+        return;
+    }
+    memcpy(dst, src, size);
+#elif defined(ARCH_ARM64)
+    // One LD1 of four registers is a single 64 byte burst on the bus
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+    for (; size >= 64; size -= 64, s += 64, d += 64) {
+        vst1q_u8_x4(d, vld1q_u8_x4(s));
+    }
+    memcpy(d, s, size);
+#else
+    memcpy(dst, src, size);
+#endif
+}
+
+CaptureReadStrategy capture_memory_choose(double mapped, double reference, double dmabuf_mapped, double bounce) {
+    if (mapped >= reference * CAPTURE_MEMORY_CACHED_RATIO) {
+        return CAPTURE_READ_DIRECT;
+    }
+    // A bounced frame is read twice, once slowly from the buffer and once from the cache
+    double bounced = bounce > 0.0 && reference > 0.0 ? 1.0 / (1.0 / bounce + 1.0 / reference) : 0.0;
+    if (dmabuf_mapped >= bounced && dmabuf_mapped > mapped) {
+        return CAPTURE_READ_DMABUF_SYNC;
+    }
+    return bounced > mapped ? CAPTURE_READ_BOUNCE : CAPTURE_READ_DIRECT;
+}
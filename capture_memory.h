@@ -0,0 +1,43 @@
+#ifndef CAPTURE_MEMORY_H
+#define CAPTURE_MEMORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// How the CPU reads captured frames out of V4L2 MMAP buffers
+typedef enum {
+    CAPTURE_READ_AUTO,          // Measured at init, see capture_memory_choose()
+    CAPTURE_READ_DIRECT,        // The mapping is cached, the converters read it as it is
+    CAPTURE_READ_DMABUF_SYNC,   // Through a cached mapping of the exported dmabuf, DMA_BUF_IOCTL_SYNC around each frame
+    CAPTURE_READ_BOUNCE         // Bulk copied into a cached buffer with wide loads, then converted
+} CaptureReadStrategy;
+
+// Parses auto, direct, dmabuf or bounce. Returns false for anything else.
+bool capture_memory_parse(const char *name, CaptureReadStrategy *strategy);
+const char *capture_memory_name(CaptureReadStrategy strategy);
+
+// Read bandwidth of up to the first CAPTURE_MEMORY_PROBE_BYTES of data in MB/s, the best of
+// a few passes. Word sized loads, like the converters' inner loops.
+#define CAPTURE_MEMORY_PROBE_BYTES (2u << 20)
+double capture_memory_read_bandwidth(const void *data, size_t size);
+
+// The same for a freshly allocated, cached buffer of that size: what the mapping would
+// deliver if it was cached
+double capture_memory_reference_bandwidth(size_t size);
+
+// Bandwidth of capture_memory_bulk_copy() from data, in MB/s of source read
+double capture_memory_copy_bandwidth(const void *data, size_t size);
+
+// Copies from uncached or write-combined memory: every load is a full vector (NEON
+// 4 x 16 bytes, SSE4.1 streaming loads on x86), so each bus transaction fetches as much as
+// it can. dst must be cached memory, src and size may have any alignment.
+void capture_memory_bulk_copy(void *dst, const void *src, size_t size);
+
+// The mapping counts as uncached below this fraction of the reference bandwidth
+#define CAPTURE_MEMORY_CACHED_RATIO 0.5
+
+// The strategy for buffers with the given bandwidths (MB/s). dmabuf_mapped is the cached
+// dmabuf mapping's, 0 if the buffers could not be exported.
+CaptureReadStrategy capture_memory_choose(double mapped, double reference, double dmabuf_mapped, double bounce);
+
+#endif // CAPTURE_MEMORY_H
@@ -0,0 +1,143 @@
+/*  Content adaptive capture throttling
+
+    A static desktop still arrives at the full capture rate and every buffer gets
+    converted, hashed and uploaded. Here a cheap hash of the raw buffer (every
+    CAPTURE_THROTTLE_PHASES-th row, the offset rotating per check so every row is
+    covered after that many checks) tells unchanged buffers apart from changed ones.
+
+    After CAPTURE_THROTTLE_STATIC_BUFFERS unchanged buffers the capture is throttled:
+    only every CAPTURE_THROTTLE_DIVISOR-th buffer is hashed and the rest is handed back
+    to the driver untouched, or, if the caller managed to lower the device frame rate,
+    every delivered buffer is hashed. The first changed buffer ends throttling and is
+    processed right away. A lowered device rate that could not be restored yet is
+    retried by the caller with every buffer, which all get processed meanwhile.
+
+    All functions are called from the capture thread, apart from the stats.
+*/
+
+#include "capture_throttle.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static bool active = false;
+static bool throttled = false;
+static bool device_rate_lowered = false;
+static uint64_t phase_hashes[CAPTURE_THROTTLE_PHASES];
+static bool phase_valid[CAPTURE_THROTTLE_PHASES];
+static unsigned int phase = 0;
+static unsigned int static_buffers = 0;
+static unsigned int skip_counter = 0;
+
+static unsigned long long buffers_seen = 0;
+static unsigned long long buffers_skipped = 0;
+static unsigned long long throttle_periods = 0;
+static unsigned long long failed_restores = 0;
+
+void capture_throttle_init(void) {
+    active = true;
+    capture_throttle_reset();
+    printf("Capture throttle: Static content throttling enabled\n");
+}
+
+bool capture_throttle_active(void) {
+    return active;
+}
+
+void capture_throttle_reset(void) {
+    throttled = false;
+    device_rate_lowered = false;
+    memset(phase_valid, 0, sizeof(phase_valid));
+    phase = 0;
+    static_buffers = 0;
+    skip_counter = 0;
+}
+
+bool capture_throttle_throttled(void) {
+    return throttled;
+}
+
+void capture_throttle_set_device_rate(bool lowered) {
+    if (lowered && device_rate_lowered && !throttled) {
+        if (failed_restores++ == 0) {
+            fprintf(stderr, "Capture throttle: Could not restore the device frame rate, retrying\n");
+        }
+    }
+    device_rate_lowered = lowered;
+}
+
+bool capture_throttle_device_rate_lowered(void) {
+    return device_rate_lowered;
+}
+
+// FNV-1a over 64 bit words of every CAPTURE_THROTTLE_PHASES-th row, starting at row phase
+static uint64_t hash_rows(const ThrottlePlane *planes, int num_planes, unsigned int row_phase) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int p = 0; p < num_planes; p++) {
+        const ThrottlePlane *plane = &planes[p];
+        hash = (hash ^ plane->length) * 0x100000001b3ULL;
+        if (!plane->data || plane->stride == 0) continue;
+        for (size_t row = row_phase * plane->stride; row < plane->length;
+             row += CAPTURE_THROTTLE_PHASES * plane->stride) {
+            size_t end = row + plane->stride < plane->length ? row + plane->stride : plane->length;
+            size_t i = row;
+            for (; i + 8 <= end; i += 8) {
+                uint64_t word;
+                memcpy(&word, plane->data + i, sizeof(word));
+                hash = (hash ^ word) * 0x100000001b3ULL;
+            }
+            for (; i < end; i++) {
+                hash = (hash ^ plane->data[i]) * 0x100000001b3ULL;
+            }
+        }
+    }
+    return hash;
+}
+
+bool capture_throttle_check(const ThrottlePlane *planes, int num_planes) {
+    if (!active) return true;
+    buffers_seen++;
+
+    if (throttled && !device_rate_lowered && ++skip_counter % CAPTURE_THROTTLE_DIVISOR != 0) {
+        buffers_skipped++;
+        return false;
+    }
+
+    uint64_t hash = hash_rows(planes, num_planes, phase);
+    bool changed = !phase_valid[phase] || phase_hashes[phase] != hash;
+    phase_hashes[phase] = hash;
+    phase_valid[phase] = true;
+    phase = (phase + 1) % CAPTURE_THROTTLE_PHASES;
+
+    if (changed) {
+        static_buffers = 0;
+        if (throttled) {
+            throttled = false;
+            printf("Capture throttle: Content changed, back to full rate\n");
+        }
+        return true;
+    }
+
+    static_buffers++;
+    if (throttled) {
+        buffers_skipped++;
+        return false;
+    }
+    if (static_buffers >= CAPTURE_THROTTLE_STATIC_BUFFERS) {
+        throttled = true;
+        skip_counter = 0;
+        throttle_periods++;
+        printf("Capture throttle: Static content, throttling capture\n");
+    }
+    return true;
+}
+
+void capture_throttle_print_stats(FILE *out) {
+    if (!active) return;
+    fprintf(out, "Capture throttle: %s%s, %llu buffers, %llu skipped (%.1f%%), %llu throttled periods, "
+            "%llu failed rate restores\n",
+            throttled ? "throttled" : "full rate",
+            device_rate_lowered ? (throttled ? " (device rate lowered)" : " (restoring device rate)") : "",
+            buffers_seen, buffers_skipped,
+            buffers_seen ? 100.0 * buffers_skipped / buffers_seen : 0.0, throttle_periods, failed_restores);
+}
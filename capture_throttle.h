@@ -0,0 +1,44 @@
+#ifndef CAPTURE_THROTTLE_H
+#define CAPTURE_THROTTLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Unchanged buffers in a row before throttling starts
+#define CAPTURE_THROTTLE_STATIC_BUFFERS 60
+// While throttled only every Nth buffer is looked at (or the device rate is divided by N)
+#define CAPTURE_THROTTLE_DIVISOR 4
+// Rows hashed per check are every Nth row, starting at a rotating offset, so every row is
+// covered after this many checks
+#define CAPTURE_THROTTLE_PHASES 4
+
+// One plane of a raw capture buffer. Compressed data is treated as rows of stride bytes.
+typedef struct {
+    const unsigned char *data;
+    size_t length;      // bytes used
+    size_t stride;      // bytes per row
+} ThrottlePlane;
+
+void capture_throttle_init(void);
+bool capture_throttle_active(void);
+
+// Forgets the content history, e.g. after the source changed. Returns to full rate.
+void capture_throttle_reset(void);
+
+// Decides whether a dequeued buffer has to be converted and shown. Returns false for
+// buffers that are skipped while throttled. Buffers with changed content end throttling.
+bool capture_throttle_check(const ThrottlePlane *planes, int num_planes);
+
+// True while static content is being throttled. The caller may lower the device frame
+// rate by CAPTURE_THROTTLE_DIVISOR while this is set and report success with
+// capture_throttle_set_device_rate(), then every delivered buffer is checked.
+// Once throttling ends the caller restores the rate and reports that the same way;
+// until it does, capture_throttle_device_rate_lowered() stays true.
+bool capture_throttle_throttled(void);
+void capture_throttle_set_device_rate(bool lowered);
+bool capture_throttle_device_rate_lowered(void);
+
+void capture_throttle_print_stats(FILE *out);
+
+#endif // CAPTURE_THROTTLE_H
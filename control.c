@@ -0,0 +1,154 @@
+/*  Runtime control interface on a Unix stream socket
+
+    Clients send one command per line and get a one line answer, e.g.
+
+        echo "plane-distance 1.5" | socat - UNIX-CONNECT:/tmp/v4l2_gl.sock
+
+    Everything runs on the thread calling control_poll(), so the handler may touch
+    the same state as the GLUT callbacks without locking.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "control.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CONTROL_MAX_CLIENTS 4
+#define CONTROL_LINE_MAX 256
+#define CONTROL_REPLY_MAX 512
+
+typedef struct {
+    int fd;
+    char line[CONTROL_LINE_MAX];
+    size_t length;
+} ControlClient;
+
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static ControlClient clients[CONTROL_MAX_CLIENTS];
+
+static void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+bool control_init(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "control_init: Socket path too long: %s\n", path);
+        return false;
+    }
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+        clients[i].length = 0;
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("control_init: socket");
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, CONTROL_MAX_CLIENTS) < 0) {
+        fprintf(stderr, "control_init: Cannot listen on %s: %s\n", path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    set_nonblocking(listen_fd);
+    strncpy(socket_path, path, sizeof(socket_path) - 1);
+
+    printf("Control: Listening on %s\n", path);
+    return true;
+}
+
+static void close_client(ControlClient *client) {
+    close(client->fd);
+    client->fd = -1;
+    client->length = 0;
+}
+
+static void send_reply(ControlClient *client, const char *reply) {
+    size_t length = strlen(reply);
+    // Replies are short, a client that does not read them is dropped
+    if (write(client->fd, reply, length) != (ssize_t)length || write(client->fd, "\n", 1) != 1) {
+        close_client(client);
+    }
+}
+
+static void read_client(ControlClient *client, control_command_fn handler) {
+    char buf[CONTROL_LINE_MAX];
+    ssize_t n = read(client->fd, buf, sizeof(buf));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        close_client(client);
+        return;
+    }
+
+    for (ssize_t i = 0; i < n && client->fd >= 0; i++) {
+        if (buf[i] == '\r') continue;
+        if (buf[i] != '\n') {
+            if (client->length < CONTROL_LINE_MAX - 1) {
+                client->line[client->length++] = buf[i];
+            }
+            continue;
+        }
+        client->line[client->length] = '\0';
+        client->length = 0;
+        if (client->line[0] == '\0') continue;
+
+        char reply[CONTROL_REPLY_MAX];
+        reply[0] = '\0';
+        handler(client->line, reply, sizeof(reply));
+        send_reply(client, reply);
+    }
+}
+
+void control_poll(control_command_fn handler) {
+    if (listen_fd < 0) return;
+
+    int fd;
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        int slot = -1;
+        for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+            if (clients[i].fd < 0) { slot = i; break; }
+        }
+        if (slot < 0) {
+            const char *busy = "error too many clients\n";
+            if (write(fd, busy, strlen(busy)) < 0) { /* closing anyway */ }
+            close(fd);
+            continue;
+        }
+        set_nonblocking(fd);
+        clients[slot].fd = fd;
+        clients[slot].length = 0;
+    }
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            read_client(&clients[i], handler);
+        }
+    }
+}
+
+void control_shutdown(void) {
+    if (listen_fd < 0) return;
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) close_client(&clients[i]);
+    }
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+}
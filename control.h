@@ -0,0 +1,20 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Handles one command line (without the newline) and writes a one line answer into reply
+typedef void (*control_command_fn)(const char *line, char *reply, size_t reply_size);
+
+// Listens on a Unix stream socket at path. An existing socket file is replaced.
+bool control_init(const char *path);
+
+// Accepts new clients and runs the handler for every complete line received.
+// Never blocks, call it regularly from the main loop.
+void control_poll(control_command_fn handler);
+
+// Closes all connections and removes the socket file.
+void control_shutdown(void);
+
+#endif // CONTROL_H
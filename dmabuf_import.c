@@ -0,0 +1,254 @@
+/*  Zero copy import of dmabufs into the renderer
+
+    A dmabuf becomes an EGLImage (EGL_EXT_image_dma_buf_import) and the EGLImage the
+    storage of a texture (GL_OES_EGL_image), so the renderer samples the pixels where the
+    compositor or the display controller left them. Only layouts the driver can sample as
+    GL_TEXTURE_2D are offered, external-only ones would need a samplerExternalOES shader.
+
+    EGLImages are not bound to a context and may be created and destroyed from the capture
+    side, textures only on the GL thread. Textures released there are deleted at once,
+    those released on other threads are queued and deleted by dmabuf_import_collect(),
+    which the render loop calls.
+*/
+
+#include "dmabuf_import.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_GLES
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef USE_GLES
+
+// Initial room for textures of released imports waiting for the GL thread, the queue grows
+// when the render loop falls behind
+#define PENDING_DELETES 32
+
+static bool supported = false;
+static bool have_modifiers = false;
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLContext gl_context = EGL_NO_CONTEXT;
+static PFNEGLCREATEIMAGEKHRPROC create_image = NULL;
+static PFNEGLDESTROYIMAGEKHRPROC destroy_image = NULL;
+static PFNEGLQUERYDMABUFMODIFIERSEXTPROC query_modifiers = NULL;
+static PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture = NULL;
+
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static GLuint *pending_textures = NULL;
+static int pending_count = 0;
+static int pending_capacity = 0;
+
+static bool has_extension(const char *extensions, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = extensions; p && (p = strstr(p, name)) != NULL; p += len) {
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return true;
+    }
+    return false;
+}
+
+bool dmabuf_import_init(void) {
+    supported = false;
+    egl_display = eglGetCurrentDisplay();
+    gl_context = eglGetCurrentContext();
+    if (egl_display == EGL_NO_DISPLAY) {
+        return false;
+    }
+    const char *egl_extensions = eglQueryString(egl_display, EGL_EXTENSIONS);
+    const char *gl_extensions = (const char *)glGetString(GL_EXTENSIONS);
+    if (!has_extension(egl_extensions, "EGL_EXT_image_dma_buf_import") ||
+        !has_extension(gl_extensions, "GL_OES_EGL_image")) {
+        printf("dmabuf import: not supported by the EGL driver\n");
+        return false;
+    }
+    create_image = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+    destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    image_target_texture = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    if (!create_image || !destroy_image || !image_target_texture) {
+        return false;
+    }
+    have_modifiers = has_extension(egl_extensions, "EGL_EXT_image_dma_buf_import_modifiers");
+    if (have_modifiers) {
+        query_modifiers = (PFNEGLQUERYDMABUFMODIFIERSEXTPROC)eglGetProcAddress("eglQueryDmaBufModifiersEXT");
+        have_modifiers = query_modifiers != NULL;
+    }
+    supported = true;
+    printf("dmabuf import: available%s\n", have_modifiers ? " with explicit modifiers" : "");
+    return true;
+}
+
+bool dmabuf_import_supported(void) {
+    return supported;
+}
+
+int dmabuf_import_modifiers(uint32_t format, uint64_t *modifiers, int max) {
+    if (!supported || !have_modifiers || max <= 0) return 0;
+    EGLint count = 0;
+    if (!query_modifiers(egl_display, (EGLint)format, 0, NULL, NULL, &count) || count <= 0) {
+        return 0;
+    }
+    EGLuint64KHR all[count];
+    EGLBoolean external_only[count];
+    if (!query_modifiers(egl_display, (EGLint)format, count, all, external_only, &count)) {
+        return 0;
+    }
+    int n = 0;
+    for (EGLint i = 0; i < count && n < max; i++) {
+        if (!external_only[i]) modifiers[n++] = all[i];
+    }
+    return n;
+}
+
+bool dmabuf_import_create(const DmabufDesc *desc, DmabufImport *import) {
+    static const EGLint plane_attribs[DMABUF_IMPORT_MAX_PLANES][5] = {
+        { EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_OFFSET_EXT, EGL_DMA_BUF_PLANE0_PITCH_EXT,
+          EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT },
+        { EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT, EGL_DMA_BUF_PLANE1_PITCH_EXT,
+          EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT },
+        { EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT, EGL_DMA_BUF_PLANE2_PITCH_EXT,
+          EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT },
+        { EGL_DMA_BUF_PLANE3_FD_EXT, EGL_DMA_BUF_PLANE3_OFFSET_EXT, EGL_DMA_BUF_PLANE3_PITCH_EXT,
+          EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT },
+    };
+    import->image = NULL;
+    import->texture = 0;
+    if (!supported || desc->planes < 1 || desc->planes > DMABUF_IMPORT_MAX_PLANES) return false;
+
+    EGLint attribs[7 + DMABUF_IMPORT_MAX_PLANES * 10 + 1];
+    int n = 0;
+    attribs[n++] = EGL_WIDTH;
+    attribs[n++] = desc->width;
+    attribs[n++] = EGL_HEIGHT;
+    attribs[n++] = desc->height;
+    attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+    attribs[n++] = (EGLint)desc->format;
+    bool explicit_modifier = desc->modifier != DMABUF_IMPORT_MOD_INVALID;
+    if (explicit_modifier && !have_modifiers) return false;
+    for (int i = 0; i < desc->planes; i++) {
+        attribs[n++] = plane_attribs[i][0];
+        attribs[n++] = desc->fds[i];
+        attribs[n++] = plane_attribs[i][1];
+        attribs[n++] = (EGLint)desc->offsets[i];
+        attribs[n++] = plane_attribs[i][2];
+        attribs[n++] = (EGLint)desc->strides[i];
+        if (explicit_modifier) {
+            attribs[n++] = plane_attribs[i][3];
+            attribs[n++] = (EGLint)(desc->modifier & 0xffffffff);
+            attribs[n++] = plane_attribs[i][4];
+            attribs[n++] = (EGLint)(desc->modifier >> 32);
+        }
+    }
+    attribs[n++] = EGL_NONE;
+
+    EGLImageKHR image = create_image(egl_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+    if (image == EGL_NO_IMAGE_KHR) {
+        fprintf(stderr, "dmabuf import: eglCreateImageKHR failed for %dx%d %.4s modifier 0x%016llx (0x%04X)\n",
+                desc->width, desc->height, (const char *)&desc->format,
+                (unsigned long long)desc->modifier, eglGetError());
+        return false;
+    }
+    import->image = image;
+    return true;
+}
+
+GLuint dmabuf_import_texture(DmabufImport *import) {
+    if (!import->image) return 0;
+    if (import->texture) return import->texture;
+
+    while (glGetError() != GL_NO_ERROR) {}
+    glGenTextures(1, &import->texture);
+    glBindTexture(GL_TEXTURE_2D, import->texture);
+    image_target_texture(GL_TEXTURE_2D, (GLeglImageOES)import->image);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        fprintf(stderr, "dmabuf import: glEGLImageTargetTexture2DOES failed (0x%04X)\n", error);
+        glDeleteTextures(1, &import->texture);
+        import->texture = 0;
+    }
+    return import->texture;
+}
+
+void dmabuf_import_release(DmabufImport *import) {
+    if (import->texture && gl_context != EGL_NO_CONTEXT && eglGetCurrentContext() == gl_context) {
+        glDeleteTextures(1, &import->texture);
+        import->texture = 0;
+    }
+    if (import->texture) {
+        pthread_mutex_lock(&pending_lock);
+        if (pending_count == pending_capacity) {
+            int capacity = pending_capacity ? pending_capacity * 2 : PENDING_DELETES;
+            GLuint *textures = realloc(pending_textures, (size_t)capacity * sizeof(GLuint));
+            if (textures) {
+                pending_textures = textures;
+                pending_capacity = capacity;
+            }
+        }
+        if (pending_count < pending_capacity) {
+            pending_textures[pending_count++] = import->texture;
+        } else {
+            fprintf(stderr, "dmabuf import: out of memory, texture %u is not deleted\n", import->texture);
+        }
+        pthread_mutex_unlock(&pending_lock);
+        import->texture = 0;
+    }
+    if (import->image) {
+        destroy_image(egl_display, (EGLImageKHR)import->image);
+        import->image = NULL;
+    }
+}
+
+void dmabuf_import_collect(void) {
+    pthread_mutex_lock(&pending_lock);
+    if (pending_count > 0) {
+        glDeleteTextures(pending_count, pending_textures);
+        pending_count = 0;
+    }
+    pthread_mutex_unlock(&pending_lock);
+}
+
+#else // USE_GLES
+
+// The desktop build renders through GLX, which can't take EGLImages
+
+bool dmabuf_import_init(void) {
+    return false;
+}
+
+bool dmabuf_import_supported(void) {
+    return false;
+}
+
+int dmabuf_import_modifiers(uint32_t format, uint64_t *modifiers, int max) {
+    (void)format;
+    (void)modifiers;
+    (void)max;
+    return 0;
+}
+
+bool dmabuf_import_create(const DmabufDesc *desc, DmabufImport *import) {
+    (void)desc;
+    import->image = NULL;
+    import->texture = 0;
+    return false;
+}
+
+GLuint dmabuf_import_texture(DmabufImport *import) {
+    (void)import;
+    return 0;
+}
+
+void dmabuf_import_release(DmabufImport *import) {
+    import->image = NULL;
+    import->texture = 0;
+}
+
+void dmabuf_import_collect(void) {}
+
+#endif // USE_GLES
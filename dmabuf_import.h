@@ -0,0 +1,53 @@
+#ifndef DMABUF_IMPORT_H
+#define DMABUF_IMPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gl_utility.h"
+
+#define DMABUF_IMPORT_MAX_PLANES 4
+// DRM_FORMAT_MOD_INVALID, the layout is whatever the driver implies
+#define DMABUF_IMPORT_MOD_INVALID 0x00ffffffffffffffULL
+
+// A buffer some other device or process renders into, described the way KMS and the
+// Wayland linux-dmabuf protocol do: a DRM fourcc format and one fd per plane.
+typedef struct {
+    int width;
+    int height;
+    uint32_t format;    // DRM fourcc, e.g. XRGB8888
+    uint64_t modifier;
+    int planes;
+    int fds[DMABUF_IMPORT_MAX_PLANES];
+    uint32_t offsets[DMABUF_IMPORT_MAX_PLANES];
+    uint32_t strides[DMABUF_IMPORT_MAX_PLANES];
+} DmabufDesc;
+
+// The buffer as an EGLImage and the texture sampling it
+typedef struct {
+    void *image;        // EGLImageKHR, NULL if not imported
+    GLuint texture;     // 0 until dmabuf_import_texture() created it
+} DmabufImport;
+
+// Checks the current EGL context for dmabuf import (EGL_EXT_image_dma_buf_import and
+// GL_OES_EGL_image). Call it once on the GL thread with the context current. Only the
+// GLES build renders through EGL, the desktop build always reports no support.
+bool dmabuf_import_init(void);
+bool dmabuf_import_supported(void);
+
+// Fills up to max modifiers the renderer can sample format with as a 2D texture.
+// Returns the count, 0 if the driver can't list them (then only implicit layouts work).
+int dmabuf_import_modifiers(uint32_t format, uint64_t *modifiers, int max);
+
+// Wraps the buffer in an EGLImage. Works from any thread, the fds may be closed afterwards.
+bool dmabuf_import_create(const DmabufDesc *desc, DmabufImport *import);
+
+// The texture of an imported buffer, created on first use. GL thread only.
+GLuint dmabuf_import_texture(DmabufImport *import);
+
+// Destroys the EGLImage. Works from any thread. On the GL thread the texture is deleted
+// right away, elsewhere by the next dmabuf_import_collect() on the GL thread.
+void dmabuf_import_release(DmabufImport *import);
+void dmabuf_import_collect(void);
+
+#endif // DMABUF_IMPORT_H
@@ -0,0 +1,221 @@
+/*  Jitter buffered presentation
+
+    Without pacing a captured frame is shown at whatever vblank happens to come after
+    it was converted. When capture and display rates don't match (59.94 Hz HDMI on a
+    60 Hz panel, 30 fps grabbers on 90 Hz) or conversion time varies, frames that are
+    captured at an even rate end up on screen for an uneven number of refreshes.
+
+    Here every frame gets a target time: its capture timestamp plus a delay made of the
+    average capture to publish latency and a margin that adapts to how much that latency
+    varies. display() only picks up the pending frame once the next vblank is past that
+    target, so the on-screen cadence follows the capture timestamps instead of the
+    conversion and scheduling noise. Frames that arrive after their target are shown at
+    the next vblank. The margin is limited to a fraction of the time a frame can wait
+    before the next one replaces it, so the single pending slot is enough.
+
+    Capture and display at about the same rate (59.94 Hz on 60 Hz) leave no time to
+    hold a frame in the single pending slot: the next one would replace it. The slow
+    drift between the two clocks should cross a vblank once per beat period (1 / rate
+    difference, 16.7 s for 59.94 on 60) as one repeat (capture slower) or one skip
+    (capture faster). With jittery arrival times frames flip back and forth across the
+    vblank for as long as the drift stays within the jitter instead. So the capture
+    thread holds each converted frame until its capture timestamp plus the latency and
+    the margin (frame_pacing_publish_time()), and frames arrive as evenly spaced as they
+    were captured. The resulting repeats and skips are counted as planned.
+
+    Arrival is reported from the capture thread, everything else runs on the GL thread.
+*/
+
+#include "frame_pacing.h"
+#include "stats.h"
+
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+// Weight of a new sample in the smoothed capture interval, jitter and refresh period
+#define SMOOTHING 0.05
+// Inter-arrival and swap intervals outside this range (us) are pauses, not samples
+#define MIN_INTERVAL_US 2000.0
+#define MAX_INTERVAL_US 250000.0
+// Margin in multiples of the smoothed latency deviation
+#define JITTER_FACTOR 2.5
+// Capture and display rates closer than this fraction are paced with planned repeats/skips
+#define MATCHED_RATE_TOLERANCE 0.01
+
+static bool active = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Capture side
+static double last_capture_us = 0.0;
+static double pending_capture_us = 0.0;
+static double capture_interval_us = 0.0;
+static double latency_us = 0.0;         // capture to publish
+static double latency_jitter_us = 0.0;  // mean deviation of the latency
+static unsigned long long arrived = 0;
+static unsigned long long skipped = 0;
+
+// Display side
+static double last_vblank_us = 0.0;
+static double refresh_period_us = 0.0;
+static double last_present_vblank_us = 0.0;
+static double next_vblank_us = 0.0;
+static unsigned long long presented = 0;
+static unsigned long long repeated_vblanks = 0;
+static unsigned long long planned_repeats = 0;  // matched rates, capture slower than display
+static unsigned long long planned_skips = 0;    // matched rates, capture faster than display
+static StatsHistogram present_interval;
+
+void frame_pacing_init(void) {
+    pthread_mutex_lock(&lock);
+    last_capture_us = pending_capture_us = 0.0;
+    capture_interval_us = latency_us = latency_jitter_us = 0.0;
+    arrived = skipped = presented = repeated_vblanks = planned_repeats = planned_skips = 0;
+    last_vblank_us = refresh_period_us = last_present_vblank_us = next_vblank_us = 0.0;
+    memset(&present_interval, 0, sizeof(present_interval));
+    active = true;
+    pthread_mutex_unlock(&lock);
+    printf("Frame pacing: Jitter buffered presentation enabled\n");
+}
+
+void frame_pacing_shutdown(void) {
+    active = false;
+}
+
+bool frame_pacing_active(void) {
+    return active;
+}
+
+static double smooth(double average, double sample) {
+    return average > 0.0 ? average + (sample - average) * SMOOTHING : sample;
+}
+
+static bool rates_matched(void) {
+    return refresh_period_us > 0.0 && capture_interval_us > 0.0 &&
+           fabs(capture_interval_us - refresh_period_us) < refresh_period_us * MATCHED_RATE_TOLERANCE;
+}
+
+static double delay_for_limit(double limit) {
+    if (limit < FRAME_PACING_BASE_DELAY_US) return 0.0;
+    double margin = FRAME_PACING_BASE_DELAY_US + JITTER_FACTOR * latency_jitter_us;
+    if (margin > limit) margin = limit;
+    return latency_us + margin;
+}
+
+static double current_delay_us(void) {
+    // A frame can wait a capture interval minus the refresh it may have to wait for the vblank.
+    // Without that slack (capture about as fast as the display or faster) holding a frame
+    // back only gets it replaced, so frames are shown as soon as they arrive.
+    return delay_for_limit((capture_interval_us - refresh_period_us) * FRAME_PACING_MAX_DELAY_FRACTION);
+}
+
+double frame_pacing_publish_time(double capture_us) {
+    if (!active) return 0.0;
+    pthread_mutex_lock(&lock);
+    // Held frames are published a fraction of a refresh late at most
+    double delay = rates_matched() ? delay_for_limit(refresh_period_us * FRAME_PACING_MAX_DELAY_FRACTION) : 0.0;
+    pthread_mutex_unlock(&lock);
+    return delay > 0.0 ? capture_us + delay : 0.0;
+}
+
+void frame_pacing_frame_arrived(double capture_us, double arrival_us, bool replaced_pending) {
+    if (!active) return;
+    pthread_mutex_lock(&lock);
+    if (last_capture_us > 0.0) {
+        double interval = capture_us - last_capture_us;
+        if (interval > MIN_INTERVAL_US && interval < MAX_INTERVAL_US) {
+            capture_interval_us = smooth(capture_interval_us, interval);
+        }
+    }
+    double latency = arrival_us - capture_us;
+    if (latency >= 0.0 && latency < MAX_INTERVAL_US) {
+        if (latency_us > 0.0) {
+            latency_jitter_us = smooth(latency_jitter_us, fabs(latency - latency_us));
+        }
+        latency_us = smooth(latency_us, latency);
+    }
+    last_capture_us = capture_us;
+    pending_capture_us = capture_us;
+    arrived++;
+    if (replaced_pending) {
+        if (rates_matched() && capture_interval_us < refresh_period_us) {
+            planned_skips++;
+        } else {
+            skipped++;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+bool frame_pacing_frame_due(double now_us) {
+    pthread_mutex_lock(&lock);
+    // The frame rendered now is scanned out at the next vblank, or right away without vsync
+    double show_us = now_us;
+    if (refresh_period_us > 0.0) {
+        show_us = last_vblank_us + refresh_period_us;
+        if (show_us < now_us) {
+            // Rendering is behind: the next vblank is the first one after now
+            show_us += ceil((now_us - show_us) / refresh_period_us) * refresh_period_us;
+        }
+    }
+    bool due = pending_capture_us + current_delay_us() <= show_us;
+    if (due) next_vblank_us = show_us;
+    pthread_mutex_unlock(&lock);
+    return due;
+}
+
+void frame_pacing_frame_presented(void) {
+    pthread_mutex_lock(&lock);
+    if (last_present_vblank_us > 0.0) {
+        double interval = next_vblank_us - last_present_vblank_us;
+        stats_histogram_add(&present_interval, interval);
+        // A frame covers capture_interval / refresh_period vblanks, everything above is a repeat
+        if (refresh_period_us > 0.0 && capture_interval_us > 0.0) {
+            long shown = lround(interval / refresh_period_us);
+            long expected = (long)ceil(capture_interval_us / refresh_period_us - 0.05);
+            if (expected < 1) expected = 1;
+            if (shown == expected + 1 && rates_matched() && capture_interval_us > refresh_period_us) {
+                planned_repeats++;
+            } else if (shown > expected) {
+                repeated_vblanks += (unsigned long long)(shown - expected);
+            }
+        }
+    }
+    last_present_vblank_us = next_vblank_us;
+    presented++;
+    pthread_mutex_unlock(&lock);
+}
+
+void frame_pacing_vblank(double now_us) {
+    if (!active) return;
+    pthread_mutex_lock(&lock);
+    if (last_vblank_us > 0.0) {
+        double interval = now_us - last_vblank_us;
+        if (interval > MIN_INTERVAL_US && interval < MAX_INTERVAL_US) {
+            refresh_period_us = smooth(refresh_period_us, interval);
+        }
+    }
+    last_vblank_us = now_us;
+    pthread_mutex_unlock(&lock);
+}
+
+void frame_pacing_print_stats(FILE *out) {
+    if (!active) return;
+    pthread_mutex_lock(&lock);
+    fprintf(out, "Frame pacing: capture %.2f Hz, latency %.2f ms (jitter %.2f ms), display %.2f Hz, delay %.2f ms, "
+            "%llu arrived, %llu presented, %llu skipped, %llu repeated vblanks\n",
+            capture_interval_us > 0.0 ? 1e6 / capture_interval_us : 0.0,
+            latency_us / 1000.0, latency_jitter_us / 1000.0,
+            refresh_period_us > 0.0 ? 1e6 / refresh_period_us : 0.0, current_delay_us() / 1000.0,
+            arrived, presented, skipped, repeated_vblanks);
+    if (rates_matched()) {
+        double difference_us = fabs(capture_interval_us - refresh_period_us);
+        fprintf(out, "  matched rates: %llu planned repeats, %llu planned skips", planned_repeats, planned_skips);
+        if (difference_us > 1.0) {
+            fprintf(out, ", one every %.1f s expected", capture_interval_us * refresh_period_us / difference_us / 1e6);
+        }
+        fputc('\n', out);
+    }
+    stats_histogram_print(&present_interval, "  presentation interval", out);
+    pthread_mutex_unlock(&lock);
+}
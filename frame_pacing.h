@@ -0,0 +1,40 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Upper limit of the jitter margin as a fraction of the time a frame can wait before a
+// newer one replaces it (capture interval minus refresh period)
+#define FRAME_PACING_MAX_DELAY_FRACTION 0.5
+// Margin added on top of the average capture latency besides the jitter part (us)
+#define FRAME_PACING_BASE_DELAY_US 500.0
+
+// Enables jitter buffered presentation. All times are CLOCK_MONOTONIC microseconds.
+void frame_pacing_init(void);
+void frame_pacing_shutdown(void);
+bool frame_pacing_active(void);
+
+// A frame captured at capture_us was published at arrival_us. replaced_pending is true if
+// it replaced a frame that was never shown.
+void frame_pacing_frame_arrived(double capture_us, double arrival_us, bool replaced_pending);
+
+// When capture and display run at about the same rate, returns the time a frame captured at
+// capture_us should be published at, so it arrives without the conversion jitter. 0 publishes
+// right away. The latency passed to frame_pacing_frame_arrived() is measured before the wait.
+double frame_pacing_publish_time(double capture_us);
+
+// Returns true if the pending frame is due at the vblank the frame rendered now will be
+// shown at (its capture time plus the adaptive delay has passed by then).
+bool frame_pacing_frame_due(double now_us);
+
+// The pending frame was taken for presentation.
+void frame_pacing_frame_presented(void);
+
+// Call right after every buffer swap. With vsync the swap returns at the vblank, which
+// gives the refresh period and the phase of the next vblank.
+void frame_pacing_vblank(double now_us);
+
+void frame_pacing_print_stats(FILE *out);
+
+#endif // FRAME_PACING_H
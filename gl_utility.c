@@ -0,0 +1,306 @@
+/*  Small helpers for the shader based render passes (shader compilation, render targets).
+
+    All functions must be called from the thread that owns the GL context.
+*/
+
+#include "gl_utility.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_GLES
+#include <EGL/egl.h>
+#endif
+
+static GLuint blit_fbo = 0;
+
+#ifdef USE_GLES
+PFNGLQUERYCOUNTEREXTPROC gl_utility_query_counter = NULL;
+PFNGLGETQUERYOBJECTIVEXTPROC gl_utility_get_query_objectiv = NULL;
+PFNGLGETQUERYOBJECTUI64VEXTPROC gl_utility_get_query_objectui64v = NULL;
+
+// State gl_utility_begin_pass() changes, there is no attribute stack on GLES
+static GLint saved_viewport[4];
+static GLboolean saved_depth_test = GL_FALSE;
+#endif
+
+static GLuint compile_shader(const char *name, GLenum type, const char *src) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (ok != GL_TRUE) {
+        char log[2048];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "%s: %s shader compilation failed:\n%s\n", name,
+                type == GL_VERTEX_SHADER ? "vertex" : "fragment", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+GLuint gl_utility_compile_program(const char *name, const char *vertex_src, const char *fragment_src) {
+    GLuint vs = compile_shader(name, GL_VERTEX_SHADER, vertex_src);
+    if (!vs) return 0;
+    GLuint fs = compile_shader(name, GL_FRAGMENT_SHADER, fragment_src);
+    if (!fs) {
+        glDeleteShader(vs);
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (ok != GL_TRUE) {
+        char log[2048];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        fprintf(stderr, "%s: program link failed:\n%s\n", name, log);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+bool gl_utility_create_target(GLRenderTarget *target, int width, int height, GLenum internal_format) {
+    if (target->texture && target->width == width && target->height == height) {
+        return true;
+    }
+    gl_utility_destroy_target(target);
+
+    glGenTextures(1, &target->texture);
+    glBindTexture(GL_TEXTURE_2D, target->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+#ifdef USE_GLES
+    // GLES only accepts the one format/type pair of a sized internal format, storage needs none
+    glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+#else
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+#endif
+
+    glGenFramebuffers(1, &target->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target->texture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "gl_utility_create_target: Framebuffer %dx%d incomplete (0x%04X)\n", width, height, status);
+        gl_utility_destroy_target(target);
+        return false;
+    }
+
+    target->width = width;
+    target->height = height;
+    return true;
+}
+
+bool gl_utility_attach_depth(GLRenderTarget *target) {
+    if (!target->fbo) return false;
+    if (target->depth) return true;
+
+    glGenRenderbuffers(1, &target->depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, target->depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, target->width, target->height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target->depth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "gl_utility_attach_depth: Framebuffer %dx%d incomplete (0x%04X)\n",
+                target->width, target->height, status);
+        glDeleteRenderbuffers(1, &target->depth);
+        target->depth = 0;
+        return false;
+    }
+    return true;
+}
+
+void gl_utility_destroy_target(GLRenderTarget *target) {
+    if (target->depth) glDeleteRenderbuffers(1, &target->depth);
+    if (target->fbo) glDeleteFramebuffers(1, &target->fbo);
+    if (target->texture) glDeleteTextures(1, &target->texture);
+    target->fbo = 0;
+    target->texture = 0;
+    target->depth = 0;
+    target->width = 0;
+    target->height = 0;
+}
+
+#ifdef USE_GLES
+void gl_utility_begin_pass(const GLRenderTarget *target) {
+    glGetIntegerv(GL_VIEWPORT, saved_viewport);
+    saved_depth_test = glIsEnabled(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+    glViewport(0, 0, target->width, target->height);
+    glDisable(GL_DEPTH_TEST);
+}
+
+void gl_utility_end_pass(void) {
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(saved_viewport[0], saved_viewport[1], saved_viewport[2], saved_viewport[3]);
+    if (saved_depth_test) glEnable(GL_DEPTH_TEST);
+}
+
+void gl_utility_draw_fullscreen_quad(void) {
+    static const GLfloat corners[] = {-1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, corners);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glDisableVertexAttribArray(0);
+}
+#else
+void gl_utility_begin_pass(const GLRenderTarget *target) {
+    glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+    glViewport(0, 0, target->width, target->height);
+    glDisable(GL_DEPTH_TEST);
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+}
+
+void gl_utility_end_pass(void) {
+    glUseProgram(0);
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glPopAttrib();
+}
+
+void gl_utility_draw_fullscreen_quad(void) {
+    glBegin(GL_QUADS);
+        glTexCoord2f(0.0f, 0.0f); glVertex2f(-1.0f, -1.0f);
+        glTexCoord2f(1.0f, 0.0f); glVertex2f( 1.0f, -1.0f);
+        glTexCoord2f(1.0f, 1.0f); glVertex2f( 1.0f,  1.0f);
+        glTexCoord2f(0.0f, 1.0f); glVertex2f(-1.0f,  1.0f);
+    glEnd();
+}
+#endif
+
+bool gl_utility_blit_texture(GLuint texture, int src_width, int src_height,
+                             int dst_x, int dst_y, int dst_width, int dst_height) {
+    if (!blit_fbo) glGenFramebuffers(1, &blit_fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, blit_fbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    if (glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        return false;
+    }
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    // A 1:1 copy needs no filtering. Row 0 of the texture is the top of the image while the
+    // window origin is bottom left, so the destination rectangle is given upside down.
+    GLenum filter = (src_width == dst_width && src_height == dst_height) ? GL_NEAREST : GL_LINEAR;
+    glBlitFramebuffer(0, 0, src_width, src_height,
+                      dst_x, dst_y + dst_height, dst_x + dst_width, dst_y,
+                      GL_COLOR_BUFFER_BIT, filter);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    return true;
+}
+
+void gl_utility_cleanup(void) {
+    if (blit_fbo) glDeleteFramebuffers(1, &blit_fbo);
+    blit_fbo = 0;
+}
+
+#ifdef USE_GLES
+bool gl_utility_load_timer_queries(void) {
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "GL_EXT_disjoint_timer_query")) {
+        return false;
+    }
+    gl_utility_query_counter = (PFNGLQUERYCOUNTEREXTPROC)eglGetProcAddress("glQueryCounterEXT");
+    gl_utility_get_query_objectiv = (PFNGLGETQUERYOBJECTIVEXTPROC)eglGetProcAddress("glGetQueryObjectivEXT");
+    gl_utility_get_query_objectui64v = (PFNGLGETQUERYOBJECTUI64VEXTPROC)eglGetProcAddress("glGetQueryObjectui64vEXT");
+    return gl_utility_query_counter && gl_utility_get_query_objectiv && gl_utility_get_query_objectui64v;
+}
+#else
+bool gl_utility_load_timer_queries(void) {
+    return true;
+}
+#endif
+
+void gl_utility_mat4_identity(float m[16]) {
+    memset(m, 0, 16 * sizeof(float));
+    m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+void gl_utility_mat4_multiply(float m[16], const float n[16]) {
+    float r[16];
+    for (int col = 0; col < 4; col++) {
+        for (int row = 0; row < 4; row++) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; k++) {
+                sum += m[k * 4 + row] * n[col * 4 + k];
+            }
+            r[col * 4 + row] = sum;
+        }
+    }
+    memcpy(m, r, sizeof(r));
+}
+
+void gl_utility_mat4_translate(float m[16], float x, float y, float z) {
+    float t[16];
+    gl_utility_mat4_identity(t);
+    t[12] = x;
+    t[13] = y;
+    t[14] = z;
+    gl_utility_mat4_multiply(m, t);
+}
+
+void gl_utility_mat4_rotate(float m[16], float degrees, float x, float y, float z) {
+    float radians = degrees * (float)M_PI / 180.0f;
+    float c = cosf(radians);
+    float s = sinf(radians);
+    float t = 1.0f - c;
+    float r[16] = {
+        x * x * t + c,     y * x * t + z * s, z * x * t - y * s, 0.0f,
+        x * y * t - z * s, y * y * t + c,     z * y * t + x * s, 0.0f,
+        x * z * t + y * s, y * z * t - x * s, z * z * t + c,     0.0f,
+        0.0f,              0.0f,              0.0f,              1.0f
+    };
+    gl_utility_mat4_multiply(m, r);
+}
+
+void gl_utility_mat4_scale(float m[16], float x, float y, float z) {
+    for (int i = 0; i < 4; i++) {
+        m[i] *= x;
+        m[4 + i] *= y;
+        m[8 + i] *= z;
+    }
+}
+
+void gl_utility_mat4_perspective(float m[16], float fovy_degrees, float aspect, float z_near, float z_far) {
+    float f = 1.0f / tanf(fovy_degrees * (float)M_PI / 360.0f);
+    memset(m, 0, 16 * sizeof(float));
+    m[0] = f / aspect;
+    m[5] = f;
+    m[10] = (z_far + z_near) / (z_near - z_far);
+    m[11] = -1.0f;
+    m[14] = 2.0f * z_far * z_near / (z_near - z_far);
+}
@@ -0,0 +1,95 @@
+#ifndef GL_UTILITY_H
+#define GL_UTILITY_H
+
+#include <stdbool.h>
+
+// Shader and framebuffer entry points are GL 2.0/3.0, ask the headers for their prototypes
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES
+#endif
+#ifdef USE_GLES
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+
+// Frame layouts of the desktop build. GLES has no BGR upload formats, the GLES renderer
+// uploads these as GL_RGB(A) and swaps red and blue with a texture swizzle.
+#ifndef GL_BGR
+#define GL_BGR 0x80E0
+#endif
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+
+// Timer queries come from GL_EXT_disjoint_timer_query on GLES and libGLESv2 does not export
+// its entry points, gl_utility_load_timer_queries() looks them up
+#define GL_TIMESTAMP GL_TIMESTAMP_EXT
+#define GL_TIME_ELAPSED GL_TIME_ELAPSED_EXT
+#define glQueryCounter gl_utility_query_counter
+#define glGetQueryObjectiv gl_utility_get_query_objectiv
+#define glGetQueryObjectui64v gl_utility_get_query_objectui64v
+extern PFNGLQUERYCOUNTEREXTPROC gl_utility_query_counter;
+extern PFNGLGETQUERYOBJECTIVEXTPROC gl_utility_get_query_objectiv;
+extern PFNGLGETQUERYOBJECTUI64VEXTPROC gl_utility_get_query_objectui64v;
+#else
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
+
+// A texture with a framebuffer object attached, used as the output of a render pass
+typedef struct {
+    GLuint fbo;
+    GLuint texture;
+    GLuint depth;   // depth renderbuffer, only after gl_utility_attach_depth()
+    int width;
+    int height;
+} GLRenderTarget;
+
+// Compiles and links a program from vertex and fragment shader sources.
+// Errors are printed with the given name. Returns 0 on failure.
+GLuint gl_utility_compile_program(const char *name, const char *vertex_src, const char *fragment_src);
+
+// Creates (or resizes) a render target with a GL_LINEAR filtered color texture.
+bool gl_utility_create_target(GLRenderTarget *target, int width, int height, GLenum internal_format);
+
+// Adds a depth renderbuffer to the target so 3D scenes with depth test can be drawn into it.
+// Creating the target again (other size) removes it.
+bool gl_utility_attach_depth(GLRenderTarget *target);
+
+void gl_utility_destroy_target(GLRenderTarget *target);
+
+// Binds the target and sets up an identity transform and a viewport covering it.
+// Every begin must be paired with gl_utility_end_pass().
+void gl_utility_begin_pass(const GLRenderTarget *target);
+
+// Restores the framebuffer, viewport, matrices and enable state saved by gl_utility_begin_pass().
+void gl_utility_end_pass(void);
+
+// Draws a quad covering the whole viewport with texture coordinates 0..1 (origin bottom left).
+// On GLES there are no fixed function texture coordinates: the quad is attribute 0 (vec2
+// position in -1..1), the shader derives the texture coordinate from it.
+void gl_utility_draw_fullscreen_quad(void);
+
+// Copies texture (src_width x src_height, first row at the top) into the given rectangle
+// of the window framebuffer with glBlitFramebuffer, without any draw call.
+// Returns false if the texture can not be attached to a read framebuffer.
+bool gl_utility_blit_texture(GLuint texture, int src_width, int src_height,
+                             int dst_x, int dst_y, int dst_width, int dst_height);
+
+// Frees the objects used by gl_utility_blit_texture().
+void gl_utility_cleanup(void);
+
+// Makes glQueryCounter() and the 64 bit query results usable. Always true on desktop GL,
+// needs GL_EXT_disjoint_timer_query on GLES.
+bool gl_utility_load_timer_queries(void);
+
+// 4x4 matrices in the column-major order of glLoadMatrixf() and glUniformMatrix4fv().
+// The transform functions multiply onto m from the right, like their fixed function namesakes.
+void gl_utility_mat4_identity(float m[16]);
+void gl_utility_mat4_multiply(float m[16], const float n[16]);
+void gl_utility_mat4_translate(float m[16], float x, float y, float z);
+void gl_utility_mat4_rotate(float m[16], float degrees, float x, float y, float z); // unit axis
+void gl_utility_mat4_scale(float m[16], float x, float y, float z);
+// Replaces m with the projection of gluPerspective()
+void gl_utility_mat4_perspective(float m[16], float fovy_degrees, float aspect, float z_near, float z_far);
+
+#endif // GL_UTILITY_H
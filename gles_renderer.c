@@ -0,0 +1,235 @@
+/*  OpenGL ES 3.0 renderer for the SBC GPUs (Mali on the RK3588, V3D on the Raspberry Pi)
+
+    On these GPUs GLES is the native API and the GL 1.x fixed function path of display()
+    runs through compatibility layers, if at all. This renderer draws the same flat or
+    curved screen with a GLSL ES 3.00 program and vertex buffers, transformed by the
+    matrices display() computes from the IMU pose.
+
+    The screen texture is immutable (glTexStorage2D), so it is created again when the
+    frame size changes. Whole frames go up through a ring of pixel unpack buffers: the
+    frame is copied into a mapped buffer and glTexSubImage2D reads from it on the GPU's
+    schedule instead of copying client memory before it returns. BGR frames (YUYV
+    conversion, BGR24/XBGR32 capture) are uploaded as RGB and swizzled in the sampler.
+*/
+
+#include "gles_renderer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char *plane_vertex_src =
+    "#version 300 es\n"
+    "uniform mat4 transform;\n"
+    "layout(location = 0) in vec3 position;\n"
+    "layout(location = 1) in vec2 texcoord;\n"
+    "out vec2 uv;\n"
+    "void main() {\n"
+    "    uv = texcoord;\n"
+    "    gl_Position = transform * vec4(position, 1.0);\n"
+    "}\n";
+
+// highp: mediump texture coordinates can't address the texels of a 4K frame
+static const char *plane_fragment_src =
+    "#version 300 es\n"
+    "precision highp float;\n"
+    "uniform sampler2D screen;\n"
+    "in vec2 uv;\n"
+    "out vec4 color;\n"
+    "void main() {\n"
+    "    color = vec4(texture(screen, uv).rgb, 1.0);\n"
+    "}\n";
+
+// x, y, z, u, v. Row 0 of the texture is the top of the image.
+#define VERTEX_FLOATS 5
+#define FLAT_VERTICES 4
+#define CURVED_VERTICES (2 * (GLES_RENDERER_CURVE_SEGMENTS + 1))
+
+static GLuint program = 0;
+static GLint transform_location = -1;
+static GLuint vertex_array = 0;
+static GLuint vertex_buffer = 0;
+
+static GLuint texture = 0;
+static int texture_width = 0;
+static int texture_height = 0;
+static GLenum upload_format = GL_RGB;
+static int bytes_per_pixel = 3;
+static GLuint pbos[GLES_RENDERER_PBO_COUNT];
+static int next_pbo = 0;
+static size_t frame_size = 0;
+
+// The geometry is built for an aspect ratio of 1, the curved screen's x and z both grow
+// linearly with the width, so other aspect ratios are a scale in the transform
+static void build_geometry(GLfloat *v) {
+    static const GLfloat flat[FLAT_VERTICES * VERTEX_FLOATS] = {
+        -1.0f, -1.0f, 0.0f, 0.0f, 1.0f,
+         1.0f, -1.0f, 0.0f, 1.0f, 1.0f,
+        -1.0f,  1.0f, 0.0f, 0.0f, 0.0f,
+         1.0f,  1.0f, 0.0f, 1.0f, 0.0f,
+    };
+    memcpy(v, flat, sizeof(flat));
+    v += FLAT_VERTICES * VERTEX_FLOATS;
+
+    const float radius = 1.0f / sinf(GLES_RENDERER_CURVE_ANGLE / 2.0f);
+    for (int i = 0; i <= GLES_RENDERER_CURVE_SEGMENTS; ++i) {
+        float t = (float)i / (float)GLES_RENDERER_CURVE_SEGMENTS;
+        float angle = -GLES_RENDERER_CURVE_ANGLE / 2.0f + t * GLES_RENDERER_CURVE_ANGLE;
+        float x = radius * sinf(angle);
+        float z = radius * (cosf(angle) - 1.0f);
+        for (int row = 0; row < 2; row++) {
+            *v++ = x;
+            *v++ = row ? 1.0f : -1.0f;
+            *v++ = z;
+            *v++ = t;
+            *v++ = row ? 0.0f : 1.0f;
+        }
+    }
+}
+
+bool gles_renderer_init(void) {
+    program = gl_utility_compile_program("GLES renderer", plane_vertex_src, plane_fragment_src);
+    if (!program) {
+        return false;
+    }
+    transform_location = glGetUniformLocation(program, "transform");
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "screen"), 0);
+    glUseProgram(0);
+
+    GLfloat vertices[(FLAT_VERTICES + CURVED_VERTICES) * VERTEX_FLOATS];
+    build_geometry(vertices);
+    glGenVertexArrays(1, &vertex_array);
+    glGenBuffers(1, &vertex_buffer);
+    glBindVertexArray(vertex_array);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(GLfloat), (const void *)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, VERTEX_FLOATS * sizeof(GLfloat),
+                          (const void *)(3 * sizeof(GLfloat)));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffers(GLES_RENDERER_PBO_COUNT, pbos);
+    printf("GLES renderer: %s, %s\n", (const char *)glGetString(GL_VERSION), (const char *)glGetString(GL_RENDERER));
+    return true;
+}
+
+void gles_renderer_cleanup(void) {
+    if (program) glDeleteProgram(program);
+    if (vertex_array) glDeleteVertexArrays(1, &vertex_array);
+    if (vertex_buffer) glDeleteBuffers(1, &vertex_buffer);
+    if (pbos[0]) glDeleteBuffers(GLES_RENDERER_PBO_COUNT, pbos);
+    if (texture) glDeleteTextures(1, &texture);
+    program = 0;
+    vertex_array = 0;
+    vertex_buffer = 0;
+    memset(pbos, 0, sizeof(pbos));
+    texture = 0;
+}
+
+bool gles_renderer_set_texture(int width, int height, GLenum format) {
+    if (texture) glDeleteTextures(1, &texture);
+    bytes_per_pixel = (format == GL_RGBA || format == GL_BGRA) ? 4 : 3;
+    upload_format = bytes_per_pixel == 4 ? GL_RGBA : GL_RGB;
+    bool swap_red_blue = format == GL_BGR || format == GL_BGRA;
+
+    while (glGetError() != GL_NO_ERROR) {}
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, bytes_per_pixel == 4 ? GL_RGBA8 : GL_RGB8, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, swap_red_blue ? GL_BLUE : GL_RED);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, swap_red_blue ? GL_RED : GL_BLUE);
+    texture_width = width;
+    texture_height = height;
+
+    frame_size = (size_t)width * height * bytes_per_pixel;
+    for (int i = 0; i < GLES_RENDERER_PBO_COUNT; i++) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, frame_size, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    next_pbo = 0;
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        fprintf(stderr, "GLES renderer: Could not create a %dx%d texture (0x%04X)\n", width, height, error);
+        return false;
+    }
+    return true;
+}
+
+GLuint gles_renderer_texture(void) {
+    return texture;
+}
+
+void gles_renderer_upload(const unsigned char *frame) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[next_pbo]);
+    next_pbo = (next_pbo + 1) % GLES_RENDERER_PBO_COUNT;
+    // Invalidating lets the driver hand out new storage while the GPU still reads the old one
+    void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, frame_size,
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped) {
+        memcpy(mapped, frame, frame_size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture_width, texture_height, upload_format,
+                        GL_UNSIGNED_BYTE, (const void *)0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    } else {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture_width, texture_height, upload_format,
+                        GL_UNSIGNED_BYTE, frame);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void gles_renderer_upload_region(const unsigned char *frame, int x, int y, int width, int height) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, texture_width);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, upload_format, GL_UNSIGNED_BYTE,
+                    frame + ((size_t)y * texture_width + x) * bytes_per_pixel);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+static void draw(GLuint source, const float transform[16], GLint first, GLsizei count) {
+    glUseProgram(program);
+    glUniformMatrix4fv(transform_location, 1, GL_FALSE, transform);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source);
+    glBindVertexArray(vertex_array);
+    glDrawArrays(GL_TRIANGLE_STRIP, first, count);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+void gles_renderer_draw_plane(GLuint source, float aspect, bool curved,
+                              const float projection[16], const float modelview[16]) {
+    float transform[16];
+    memcpy(transform, projection, sizeof(transform));
+    gl_utility_mat4_multiply(transform, modelview);
+    gl_utility_mat4_scale(transform, aspect, 1.0f, aspect);
+    if (curved) {
+        draw(source, transform, FLAT_VERTICES, CURVED_VERTICES);
+    } else {
+        draw(source, transform, 0, FLAT_VERTICES);
+    }
+}
+
+void gles_renderer_draw_passthrough(GLuint source, int x, int y, int width, int height) {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(x, y, width, height);
+    float identity[16];
+    gl_utility_mat4_identity(identity);
+    draw(source, identity, 0, FLAT_VERTICES);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
@@ -0,0 +1,40 @@
+#ifndef GLES_RENDERER_H
+#define GLES_RENDERER_H
+
+#include <math.h>
+#include <stdbool.h>
+
+#include "gl_utility.h"
+
+// Pixel unpack buffers the whole frame uploads rotate through
+#define GLES_RENDERER_PBO_COUNT 2
+// Geometry of the curved screen, the same as the desktop renderer draws
+#define GLES_RENDERER_CURVE_SEGMENTS 32
+#define GLES_RENDERER_CURVE_ANGLE ((float)M_PI / 4.0f)
+
+// Compiles the GLSL ES 3.00 program and creates the plane geometry. Must be called with a
+// current OpenGL ES 3.0 context.
+bool gles_renderer_init(void);
+void gles_renderer_cleanup(void);
+
+// (Re)creates the immutable screen texture for width x height frames in format (GL_RGB,
+// GL_RGBA, GL_BGR or GL_BGRA, 8 bits per channel). The texture name changes every time.
+bool gles_renderer_set_texture(int width, int height, GLenum format);
+GLuint gles_renderer_texture(void);
+
+// Uploads a whole frame through the next pixel unpack buffer, so the driver does not copy
+// from client memory while the render loop waits.
+void gles_renderer_upload(const unsigned char *frame);
+
+// Uploads a rectangle of a frame (rows as wide as the texture) directly, for the upload scheduler
+void gles_renderer_upload_region(const unsigned char *frame, int x, int y, int width, int height);
+
+// Draws the screen plane (2 * aspect x 2 units, flat or curved) with texture, transformed by
+// projection * modelview
+void gles_renderer_draw_plane(GLuint texture, float aspect, bool curved,
+                              const float projection[16], const float modelview[16]);
+
+// Draws texture unscaled into the window rectangle (window coordinates, origin bottom left)
+void gles_renderer_draw_passthrough(GLuint texture, int x, int y, int width, int height);
+
+#endif // GLES_RENDERER_H
@@ -0,0 +1,195 @@
+/*  GPU time of the render loop stages
+
+    Timing glTexSubImage2D or the buffer swap on the CPU mostly measures how long the
+    driver takes to queue the work. Here GL_TIMESTAMP queries are written between the
+    stages of display() and read back from a ring a few frames later, so the CPU never
+    waits for the GPU. The CPU time of the same stages is recorded at the same marks,
+    which shows whether a configuration is limited by the CPU or by the GPU.
+
+    Timestamps are used rather than GL_TIME_ELAPSED because elapsed time queries can't
+    nest, and render_scale.c brackets the scene with one. With
+    GL_EXT_disjoint_timer_query, results of a frame during which the GPU clock was
+    disjoint (power state change, ...) are dropped.
+*/
+
+#include "gpu_timer.h"
+#include "stats.h"
+
+#include <string.h>
+
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+static const char *stage_names[GPU_STAGE_COUNT] = {"upload", "draw", "post"};
+
+typedef struct {
+    GLuint queries[GPU_TIMER_MAX_MARKS];
+    GpuStage stages[GPU_TIMER_MAX_MARKS];   // stage ending at mark i (entry 0 is the frame start)
+    int marks;
+    double cpu_us[GPU_STAGE_COUNT];
+    bool stage_used[GPU_STAGE_COUNT];
+    bool pending;
+} FrameQueries;
+
+static bool active = false;
+static bool check_disjoint = false;
+static FrameQueries ring[GPU_TIMER_RING_SIZE];
+static int ring_head = 0;       // slot of the next frame
+static int ring_tail = 0;       // oldest slot that may be pending
+static FrameQueries *current = NULL;  // frame being recorded, NULL outside of a frame or when skipped
+static double last_mark_us = 0.0;
+
+static StatsHistogram cpu_time[GPU_STAGE_COUNT];
+static StatsHistogram gpu_time[GPU_STAGE_COUNT];
+static StatsHistogram cpu_frame_time;
+static StatsHistogram gpu_frame_time;
+static unsigned long long skipped_frames = 0;
+static unsigned long long disjoint_frames = 0;
+
+bool gpu_timer_init(void) {
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    check_disjoint = extensions && strstr(extensions, "GL_EXT_disjoint_timer_query");
+    if (!extensions || (!check_disjoint && !strstr(extensions, "GL_ARB_timer_query")) ||
+        !gl_utility_load_timer_queries()) {
+        fprintf(stderr, "GPU timer: GL_ARB_timer_query is not available\n");
+        return false;
+    }
+    // Software renderers rasterize in glFinish() or on their own threads, their timestamps
+    // don't follow the work of the stages
+    const char *renderer = (const char *)glGetString(GL_RENDERER);
+    if (renderer && (strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe") || strstr(renderer, "Software"))) {
+        printf("GPU timer: %s is a software renderer, the GPU times are CPU work done by the driver.\n", renderer);
+    }
+
+    for (int i = 0; i < GPU_TIMER_RING_SIZE; i++) {
+        glGenQueries(GPU_TIMER_MAX_MARKS, ring[i].queries);
+        ring[i].pending = false;
+    }
+    ring_head = ring_tail = 0;
+    current = NULL;
+    memset(cpu_time, 0, sizeof(cpu_time));
+    memset(gpu_time, 0, sizeof(gpu_time));
+    memset(&cpu_frame_time, 0, sizeof(cpu_frame_time));
+    memset(&gpu_frame_time, 0, sizeof(gpu_frame_time));
+    skipped_frames = disjoint_frames = 0;
+    active = true;
+    printf("GPU timer: Timing upload, draw and post-processing with GL_TIMESTAMP queries.\n");
+    return true;
+}
+
+void gpu_timer_cleanup(void) {
+    if (!active) return;
+    for (int i = 0; i < GPU_TIMER_RING_SIZE; i++) {
+        glDeleteQueries(GPU_TIMER_MAX_MARKS, ring[i].queries);
+    }
+    current = NULL;
+    active = false;
+}
+
+bool gpu_timer_active(void) {
+    return active;
+}
+
+// Reads the timestamps of every frame the GPU has finished, oldest first
+static void collect_frames(void) {
+    if (check_disjoint) {
+        // Reading the flag also clears it. Whatever is in flight spans the disjoint event.
+        GLint disjoint = 0;
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+        if (disjoint) {
+            while (ring[ring_tail].pending) {
+                ring[ring_tail].pending = false;
+                ring_tail = (ring_tail + 1) % GPU_TIMER_RING_SIZE;
+                disjoint_frames++;
+            }
+            return;
+        }
+    }
+
+    while (ring[ring_tail].pending) {
+        FrameQueries *frame = &ring[ring_tail];
+        // The last timestamp is written last, once it is there all of them are
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(frame->queries[frame->marks - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+
+        GLuint64 timestamps[GPU_TIMER_MAX_MARKS];
+        for (int i = 0; i < frame->marks; i++) {
+            glGetQueryObjectui64v(frame->queries[i], GL_QUERY_RESULT, &timestamps[i]);
+        }
+        double stage_us[GPU_STAGE_COUNT] = {0.0};
+        for (int i = 1; i < frame->marks; i++) {
+            stage_us[frame->stages[i]] += (timestamps[i] - timestamps[i - 1]) / 1000.0;
+        }
+        for (int s = 0; s < GPU_STAGE_COUNT; s++) {
+            if (frame->stage_used[s]) stats_histogram_add(&gpu_time[s], stage_us[s]);
+        }
+        stats_histogram_add(&gpu_frame_time, (timestamps[frame->marks - 1] - timestamps[0]) / 1000.0);
+
+        frame->pending = false;
+        ring_tail = (ring_tail + 1) % GPU_TIMER_RING_SIZE;
+    }
+}
+
+void gpu_timer_frame_begin(void) {
+    if (!active) return;
+    collect_frames();
+    current = NULL;
+    if (ring[ring_head].pending) {
+        skipped_frames++;
+        return;
+    }
+    current = &ring[ring_head];
+    current->marks = 1;
+    memset(current->cpu_us, 0, sizeof(current->cpu_us));
+    memset(current->stage_used, 0, sizeof(current->stage_used));
+    glQueryCounter(current->queries[0], GL_TIMESTAMP);
+    last_mark_us = stats_now_us();
+}
+
+void gpu_timer_mark(GpuStage stage) {
+    if (!current || current->marks >= GPU_TIMER_MAX_MARKS) return;
+    double now = stats_now_us();
+    current->cpu_us[stage] += now - last_mark_us;
+    current->stage_used[stage] = true;
+    last_mark_us = now;
+    current->stages[current->marks] = stage;
+    glQueryCounter(current->queries[current->marks], GL_TIMESTAMP);
+    current->marks++;
+}
+
+void gpu_timer_frame_end(void) {
+    if (!current) return;
+    double frame_cpu_us = 0.0;
+    for (int s = 0; s < GPU_STAGE_COUNT; s++) {
+        if (!current->stage_used[s]) continue;
+        stats_histogram_add(&cpu_time[s], current->cpu_us[s]);
+        frame_cpu_us += current->cpu_us[s];
+    }
+    if (current->marks > 1) {
+        stats_histogram_add(&cpu_frame_time, frame_cpu_us);
+        current->pending = true;
+        ring_head = (ring_head + 1) % GPU_TIMER_RING_SIZE;
+    }
+    current = NULL;
+}
+
+void gpu_timer_print_stats(FILE *out) {
+    if (!active) return;
+    double cpu_mean = cpu_frame_time.count ? cpu_frame_time.sum / cpu_frame_time.count : 0.0;
+    double gpu_mean = gpu_frame_time.count ? gpu_frame_time.sum / gpu_frame_time.count : 0.0;
+    fprintf(out, "GPU timer: %.2f ms GPU / %.2f ms CPU per frame, %s, %llu frames unmeasured (GPU behind), %llu disjoint\n",
+            gpu_mean / 1000.0, cpu_mean / 1000.0,
+            gpu_frame_time.count == 0 ? "no results yet" : gpu_mean > cpu_mean ? "GPU-bound" : "CPU-bound",
+            skipped_frames, disjoint_frames);
+    char label[32];
+    for (int s = 0; s < GPU_STAGE_COUNT; s++) {
+        snprintf(label, sizeof(label), "%s GPU", stage_names[s]);
+        stats_histogram_print(&gpu_time[s], label, out);
+        snprintf(label, sizeof(label), "%s CPU", stage_names[s]);
+        stats_histogram_print(&cpu_time[s], label, out);
+    }
+    stats_histogram_print(&gpu_frame_time, "frame GPU", out);
+    stats_histogram_print(&cpu_frame_time, "frame CPU", out);
+}
@@ -0,0 +1,37 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "gl_utility.h"
+
+// Frames whose timestamps may be in flight at once. When the GPU is further behind,
+// frames go unmeasured instead of the CPU waiting for results.
+#define GPU_TIMER_RING_SIZE 4
+// Stage boundaries recorded per frame at most (the frame start included)
+#define GPU_TIMER_MAX_MARKS 8
+
+typedef enum {
+    GPU_STAGE_UPLOAD,   // texture upload, GPU colour conversion and mip levels
+    GPU_STAGE_DRAW,     // the plane (or the passthrough blit)
+    GPU_STAGE_POST,     // upscale passes and the render scale blit
+    GPU_STAGE_COUNT
+} GpuStage;
+
+// Sets up GL_TIMESTAMP queries (GL_ARB_timer_query or GL_EXT_disjoint_timer_query).
+// Must be called with a current GL context. Returns false if they are not available.
+bool gpu_timer_init(void);
+void gpu_timer_cleanup(void);
+bool gpu_timer_active(void);
+
+// Brackets the work of one display() call. The time since the previous mark (or the frame
+// start) is added to the given stage, on the CPU right away and on the GPU once the
+// timestamps are available a few frames later. End the frame before the buffer swap.
+void gpu_timer_frame_begin(void);
+void gpu_timer_mark(GpuStage stage);
+void gpu_timer_frame_end(void);
+
+void gpu_timer_print_stats(FILE *out);
+
+#endif // GPU_TIMER_H
@@ -0,0 +1,370 @@
+/*  Capture of the local display from KMS
+
+    When the board drives a monitor itself, the picture already sits in the framebuffer a
+    CRTC scans out, no compositor has to hand it over. Every poll asks the CRTC which
+    framebuffer it shows; a different one means the compositor flipped, i.e. a new frame.
+    Framebuffers are exported as dmabufs (drmModeGetFB2, drmPrimeHandleToFD) the first time
+    they show up and kept in a small cache by framebuffer id, a compositor flips between
+    the same two or three. With a renderer that imports dmabufs they become textures that
+    are sampled in place, otherwise linear framebuffers are mapped and copied, bracketed by
+    DMA_BUF_IOCTL_SYNC for devices that are not cache coherent.
+
+    Only the primary plane is captured, cursor and overlay planes are composed by the
+    display controller and never land in memory.
+*/
+
+#include "kms_source.h"
+
+#include "dmabuf_import.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#ifdef WITH_KMS
+#include <drm_fourcc.h>
+#include <linux/dma-buf.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#endif
+
+#ifdef WITH_KMS
+
+// A framebuffer that is never flipped away (fbcon, front buffer rendering) is copied again
+// every this many polls, imported ones show such changes by themselves
+#define STATIC_RECOPY_POLLS 6
+
+typedef struct {
+    uint32_t fb_id;         // 0 for a free entry
+    uint64_t last_used;     // poll of the last use, the oldest entry is replaced
+    int width;
+    int height;
+    uint32_t format;
+    DmabufImport import;
+    // Copied frames
+    int dmabuf_fd;
+    unsigned char *map;
+    size_t map_size;
+    uint32_t offset;
+    uint32_t pitch;
+} CachedFb;
+
+static int drm_fd = -1;
+static uint32_t crtc_id = 0;
+static bool use_dmabuf = false;
+static CachedFb cache[KMS_SOURCE_CACHED_FBS];
+static CachedFb *current = NULL;
+// Of the last framebuffer grabbed, kept while current is reset or evicted
+static int frame_width = 0;
+static int frame_height = 0;
+static uint32_t frame_format = 0;
+static uint32_t failed_fb = 0;          // not importable, reported once
+static int static_polls = 0;
+
+static uint64_t polls = 0;
+static uint64_t flips = 0;
+static uint64_t frames = 0;
+static uint64_t imports = 0;
+static uint64_t evictions = 0;
+static StatsHistogram copy_time;
+
+static void release_fb(CachedFb *entry) {
+    dmabuf_import_release(&entry->import);
+    if (entry->map) munmap(entry->map, entry->map_size);
+    if (entry->dmabuf_fd >= 0) close(entry->dmabuf_fd);
+    memset(entry, 0, sizeof(*entry));
+    entry->dmabuf_fd = -1;
+}
+
+// Copied frames are read with the CPU, only linear 8 bit RGB layouts work
+static bool map_fb(CachedFb *entry, const DmabufDesc *desc) {
+    bool linear = desc->modifier == DMABUF_IMPORT_MOD_INVALID || desc->modifier == DRM_FORMAT_MOD_LINEAR;
+    bool rgb = desc->format == DRM_FORMAT_XRGB8888 || desc->format == DRM_FORMAT_ARGB8888 ||
+               desc->format == DRM_FORMAT_XBGR8888 || desc->format == DRM_FORMAT_ABGR8888;
+    if (!linear || !rgb || desc->planes != 1) {
+        fprintf(stderr, "KMS capture: the framebuffer (%.4s, modifier 0x%016llx) can only be imported, "
+                "which needs the GLES build\n", (const char *)&desc->format, (unsigned long long)desc->modifier);
+        return false;
+    }
+    entry->offset = desc->offsets[0];
+    entry->pitch = desc->strides[0];
+    entry->map_size = (size_t)entry->offset + (size_t)entry->pitch * desc->height;
+    entry->map = mmap(NULL, entry->map_size, PROT_READ, MAP_SHARED, desc->fds[0], 0);
+    if (entry->map == MAP_FAILED) {
+        entry->map = NULL;
+        fprintf(stderr, "KMS capture: Could not map the framebuffer: %s\n", strerror(errno));
+        return false;
+    }
+    entry->dmabuf_fd = dup(desc->fds[0]); // For DMA_BUF_IOCTL_SYNC
+    return true;
+}
+
+static bool import_fb(uint32_t fb_id, CachedFb *entry) {
+    drmModeFB2 *fb = drmModeGetFB2(drm_fd, fb_id);
+    if (!fb) {
+        fprintf(stderr, "KMS capture: Could not query framebuffer %u: %s\n", fb_id, strerror(errno));
+        return false;
+    }
+    if (!fb->handles[0]) {
+        // The kernel only hands out the buffers of other clients to root
+        fprintf(stderr, "KMS capture: No access to the contents of framebuffer %u, run as root\n", fb_id);
+        drmModeFreeFB2(fb);
+        return false;
+    }
+
+    DmabufDesc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.width = (int)fb->width;
+    desc.height = (int)fb->height;
+    desc.format = fb->pixel_format;
+    desc.modifier = (fb->flags & DRM_MODE_FB_MODIFIERS) ? fb->modifier : DMABUF_IMPORT_MOD_INVALID;
+    bool ok = true;
+    for (int p = 0; p < DMABUF_IMPORT_MAX_PLANES && fb->handles[p]; p++) {
+        desc.fds[p] = -1;
+        if (drmPrimeHandleToFD(drm_fd, fb->handles[p], DRM_CLOEXEC, &desc.fds[p]) != 0) {
+            fprintf(stderr, "KMS capture: Could not export framebuffer %u: %s\n", fb_id, strerror(errno));
+            ok = false;
+            break;
+        }
+        desc.offsets[p] = fb->offsets[p];
+        desc.strides[p] = fb->pitches[p];
+        desc.planes++;
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->dmabuf_fd = -1;
+    if (ok) {
+        ok = use_dmabuf ? dmabuf_import_create(&desc, &entry->import) : map_fb(entry, &desc);
+    }
+    for (int p = 0; p < desc.planes; p++) {
+        close(desc.fds[p]);
+    }
+    // GETFB2 created a GEM handle per plane, planes of one buffer share it
+    for (int p = 0; p < DMABUF_IMPORT_MAX_PLANES && fb->handles[p]; p++) {
+        bool seen = false;
+        for (int q = 0; q < p; q++) seen |= fb->handles[q] == fb->handles[p];
+        if (!seen) {
+            struct drm_gem_close close_handle = { .handle = fb->handles[p] };
+            drmIoctl(drm_fd, DRM_IOCTL_GEM_CLOSE, &close_handle);
+        }
+    }
+    drmModeFreeFB2(fb);
+    if (!ok) {
+        release_fb(entry);
+        return false;
+    }
+    entry->fb_id = fb_id;
+    entry->width = desc.width;
+    entry->height = desc.height;
+    entry->format = desc.format;
+    imports++;
+    return true;
+}
+
+// The cache entry of the framebuffer, imported if it is new
+static CachedFb *lookup_fb(uint32_t fb_id) {
+    CachedFb *oldest = &cache[0];
+    for (int i = 0; i < KMS_SOURCE_CACHED_FBS; i++) {
+        if (cache[i].fb_id == fb_id) return &cache[i];
+        if (!cache[i].fb_id) {
+            oldest = &cache[i];
+        } else if (oldest->fb_id && cache[i].last_used < oldest->last_used) {
+            oldest = &cache[i];
+        }
+    }
+    if (fb_id == failed_fb) return NULL;
+    if (oldest->fb_id) {
+        // A texture still on screen is deleted by the next dmabuf_import_collect(), the
+        // renderer finds no texture for its framebuffer then and keeps the last one
+        if (oldest == current) current = NULL;
+        release_fb(oldest);
+        evictions++;
+    }
+    if (!import_fb(fb_id, oldest)) {
+        failed_fb = fb_id;
+        return NULL;
+    }
+    return oldest;
+}
+
+// The CRTC with a mode and a framebuffer, i.e. driving a display
+static uint32_t find_active_crtc(void) {
+    drmModeRes *resources = drmModeGetResources(drm_fd);
+    if (!resources) return 0;
+    uint32_t found = 0;
+    for (int i = 0; i < resources->count_crtcs && !found; i++) {
+        drmModeCrtc *crtc = drmModeGetCrtc(drm_fd, resources->crtcs[i]);
+        if (crtc && crtc->mode_valid && crtc->buffer_id) found = crtc->crtc_id;
+        if (crtc) drmModeFreeCrtc(crtc);
+    }
+    drmModeFreeResources(resources);
+    return found;
+}
+
+bool kms_source_init(const char *device, uint32_t crtc) {
+    kms_source_cleanup();
+    drm_fd = open(device, O_RDWR | O_CLOEXEC);
+    if (drm_fd < 0) {
+        fprintf(stderr, "KMS capture: Could not open %s: %s\n", device, strerror(errno));
+        return false;
+    }
+    crtc_id = crtc ? crtc : find_active_crtc();
+    if (!crtc_id) {
+        fprintf(stderr, "KMS capture: No CRTC of %s drives a display\n", device);
+        kms_source_cleanup();
+        return false;
+    }
+    use_dmabuf = dmabuf_import_supported();
+    polls = flips = frames = imports = evictions = 0;
+    memset(&copy_time, 0, sizeof(copy_time));
+
+    // The first framebuffer tells whether its contents are accessible at all
+    if (!kms_source_grab()) {
+        kms_source_cleanup();
+        return false;
+    }
+    printf("KMS capture: CRTC %u of %s, %dx%d %.4s, %s\n", crtc_id, device, frame_width, frame_height,
+           (const char *)&frame_format, use_dmabuf ? "imported as dmabuf" : "mapped and copied");
+    current = NULL; // The next grab publishes it, size and format stay for the setup
+    return true;
+}
+
+void kms_source_cleanup(void) {
+    for (int i = 0; i < KMS_SOURCE_CACHED_FBS; i++) {
+        if (cache[i].fb_id) release_fb(&cache[i]);
+    }
+    current = NULL;
+    frame_width = frame_height = 0;
+    frame_format = 0;
+    failed_fb = 0;
+    static_polls = 0;
+    if (drm_fd >= 0) close(drm_fd);
+    drm_fd = -1;
+    crtc_id = 0;
+}
+
+bool kms_source_active(void) {
+    return drm_fd >= 0;
+}
+
+void kms_source_size(int *width, int *height) {
+    *width = frame_width;
+    *height = frame_height;
+}
+
+GLenum kms_source_gl_format(void) {
+    if (frame_format == DRM_FORMAT_XBGR8888 || frame_format == DRM_FORMAT_ABGR8888) {
+        return GL_RGBA;
+    }
+    return GL_BGRA;
+}
+
+bool kms_source_dmabuf(void) {
+    return use_dmabuf;
+}
+
+bool kms_source_grab(void) {
+    if (drm_fd < 0) return false;
+    polls++;
+    drmModeCrtc *crtc = drmModeGetCrtc(drm_fd, crtc_id);
+    uint32_t fb_id = crtc && crtc->mode_valid ? crtc->buffer_id : 0;
+    if (crtc) drmModeFreeCrtc(crtc);
+    if (!fb_id) return false; // Display off
+
+    if (current && current->fb_id == fb_id) {
+        current->last_used = polls;
+        if (use_dmabuf || ++static_polls < STATIC_RECOPY_POLLS) return false;
+    } else {
+        CachedFb *entry = lookup_fb(fb_id);
+        if (!entry) return false;
+        if (current) flips++;
+        current = entry;
+        current->last_used = polls;
+        frame_width = current->width;
+        frame_height = current->height;
+        frame_format = current->format;
+    }
+    static_polls = 0;
+    frames++;
+    return true;
+}
+
+uint32_t kms_source_frame_fb(void) {
+    return current ? current->fb_id : 0;
+}
+
+GLuint kms_source_texture(uint32_t fb_id) {
+    for (int i = 0; fb_id && i < KMS_SOURCE_CACHED_FBS; i++) {
+        if (cache[i].fb_id == fb_id) return dmabuf_import_texture(&cache[i].import);
+    }
+    return 0;
+}
+
+const unsigned char *kms_source_image(int *stride) {
+    if (!current || !current->map) {
+        *stride = 0;
+        return NULL;
+    }
+    *stride = (int)current->pitch;
+    return current->map + current->offset;
+}
+
+void kms_source_copy(unsigned char *dst, const FrameRect *region) {
+    if (!current || !current->map) return;
+    double start = stats_now_us();
+    struct dma_buf_sync sync = { DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ };
+    ioctl(current->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+    copy_frame_region(current->map + current->offset, (int)current->pitch, dst, 4, region);
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+    ioctl(current->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+    stats_histogram_add(&copy_time, stats_now_us() - start);
+}
+
+void kms_source_print_stats(FILE *out) {
+    if (drm_fd < 0) return;
+    fprintf(out, "KMS capture: %s, %llu polls, %llu flips, %llu frames, %llu framebuffers imported, %llu evicted\n",
+            use_dmabuf ? "dmabuf" : "copy", (unsigned long long)polls, (unsigned long long)flips,
+            (unsigned long long)frames, (unsigned long long)imports, (unsigned long long)evictions);
+    if (!use_dmabuf) stats_histogram_print(&copy_time, "KMS copy", out);
+}
+
+#else // WITH_KMS
+
+bool kms_source_init(const char *device, uint32_t crtc) {
+    (void)device;
+    (void)crtc;
+    fprintf(stderr, "KMS capture: built without libdrm, rebuild with the libdrm development package installed\n");
+    return false;
+}
+
+void kms_source_cleanup(void) {}
+bool kms_source_active(void) { return false; }
+
+void kms_source_size(int *width, int *height) {
+    *width = 0;
+    *height = 0;
+}
+
+GLenum kms_source_gl_format(void) { return GL_BGRA; }
+bool kms_source_dmabuf(void) { return false; }
+bool kms_source_grab(void) { return false; }
+uint32_t kms_source_frame_fb(void) { return 0; }
+GLuint kms_source_texture(uint32_t fb_id) { (void)fb_id; return 0; }
+
+const unsigned char *kms_source_image(int *stride) {
+    *stride = 0;
+    return NULL;
+}
+
+void kms_source_copy(unsigned char *dst, const FrameRect *region) {
+    (void)dst;
+    (void)region;
+}
+
+void kms_source_print_stats(FILE *out) { (void)out; }
+
+#endif // WITH_KMS
@@ -0,0 +1,52 @@
+#ifndef KMS_SOURCE_H
+#define KMS_SOURCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gl_utility.h"
+#include "utility.h"
+
+// Scanout buffers kept imported, enough for a compositor's swapchain
+#define KMS_SOURCE_CACHED_FBS 4
+
+// Opens the KMS device (e.g. /dev/dri/card0) to capture what a CRTC scans out: crtc_id 0
+// takes the first active one. Reading other clients' framebuffers needs root (CAP_SYS_ADMIN).
+// When the renderer imports dmabufs (dmabuf_import_supported()) the framebuffers are sampled
+// where they are, otherwise linear XRGB/XBGR framebuffers are mapped and copied.
+// Needs a build with libdrm (see the Makefile).
+bool kms_source_init(const char *device, uint32_t crtc_id);
+void kms_source_cleanup(void);
+bool kms_source_active(void);
+
+// Size of the scanned out framebuffer in pixels, after kms_source_init() that of the one it probed
+void kms_source_size(int *width, int *height);
+
+// Upload format of copied frames, GL_BGRA or GL_RGBA (4 bytes per pixel)
+GLenum kms_source_gl_format(void);
+
+// True if the frames are imported dmabufs, see kms_source_frame_fb()
+bool kms_source_dmabuf(void);
+
+// Checks which framebuffer the CRTC scans out. Returns true for a new frame, i.e. after a
+// page flip. A framebuffer drawn into directly (fbcon, front buffer rendering) never flips:
+// imported ones show the changes anyway, copied ones are copied again every few calls.
+// The size may have changed afterwards.
+bool kms_source_grab(void);
+
+// dmabuf frames: the framebuffer id of the grabbed frame and the texture sampling it, 0
+// once the framebuffer dropped out of the cache. GL thread only.
+uint32_t kms_source_frame_fb(void);
+GLuint kms_source_texture(uint32_t fb_id);
+
+// Copied frames: the mapped framebuffer (stride bytes per row) for analysis, NULL for dmabufs
+const unsigned char *kms_source_image(int *stride);
+
+// Copied frames: copies region of the grabbed framebuffer into dst, packed with
+// region->width * 4 bytes per row
+void kms_source_copy(unsigned char *dst, const FrameRect *region);
+
+void kms_source_print_stats(FILE *out);
+
+#endif // KMS_SOURCE_H
@@ -0,0 +1,227 @@
+/*  Mip chain of the screen texture, maintained incrementally on the CPU
+
+    glGenerateMipmap rebuilds every level from the whole texture. With the upload
+    scheduler and static desktop content only a few tiles change per frame, so the
+    levels are kept as CPU copies and only the blocks below changed regions are
+    downsampled (2x2 box filter) and uploaded again.
+
+    Every level is split into MIPMAP_BLOCK_SIZE blocks. A dirty block of level k
+    marks the block of level k + 1 it reduces into, so the work per level halves.
+    CPU levels are ceil(size / 2) of the level above (odd edges average the last
+    pixel with itself), the GL levels use the floor(size / 2) sizes GL requires and
+    simply omit the extra column/row.
+
+    The level uploads count against the --upload-budget of the render frame. Blocks
+    left over when it runs out stay dirty and are done first in the next frame,
+    level by level, so a level is never built from a half updated one above it.
+*/
+
+#include "mipmap.h"
+
+#ifdef ARCH_X86_64
+#include "3rdparty/include/SimdLib.h"
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIPMAP_MAX_LEVELS 16
+
+typedef struct {
+    int width, height;          // size of the CPU copy
+    int gl_width, gl_height;    // size of the texture level
+    unsigned char *data;        // NULL for level 0, which is the uploaded frame itself
+    int blocks_x, blocks_y;
+    unsigned char *dirty;       // one flag per block
+} MipLevel;
+
+static MipLevel levels[MIPMAP_MAX_LEVELS];
+static int level_count = 0;     // number of levels including level 0
+static int mip_bpp = 3;
+static GLenum mip_format = GL_RGB;
+static uint16_t *row_sums = NULL;
+static bool dirty_blocks = false; // Cleared by a mipmap_update() that got through every level
+
+bool mipmap_active(void) {
+    return level_count > 1;
+}
+
+void mipmap_cleanup(void) {
+    for (int i = 0; i < level_count; i++) {
+        free(levels[i].data);
+        free(levels[i].dirty);
+    }
+    memset(levels, 0, sizeof(levels));
+    level_count = 0;
+    dirty_blocks = false;
+    free(row_sums);
+    row_sums = NULL;
+}
+
+bool mipmap_init(int width, int height, int bytes_per_pixel, GLenum format) {
+    mipmap_cleanup();
+    // Plain filtering until every level is defined, so a failure leaves a usable texture
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    if (width <= 0 || height <= 0) return false;
+    mip_bpp = bytes_per_pixel;
+    mip_format = format;
+
+    levels[0].width = levels[0].gl_width = width;
+    levels[0].height = levels[0].gl_height = height;
+    level_count = 1;
+    while ((levels[level_count - 1].gl_width > 1 || levels[level_count - 1].gl_height > 1) &&
+           level_count < MIPMAP_MAX_LEVELS) {
+        const MipLevel *up = &levels[level_count - 1];
+        MipLevel *l = &levels[level_count];
+        l->width = (up->width + 1) / 2;
+        l->height = (up->height + 1) / 2;
+        l->gl_width = up->gl_width > 1 ? up->gl_width / 2 : 1;
+        l->gl_height = up->gl_height > 1 ? up->gl_height / 2 : 1;
+        l->blocks_x = (l->width + MIPMAP_BLOCK_SIZE - 1) / MIPMAP_BLOCK_SIZE;
+        l->blocks_y = (l->height + MIPMAP_BLOCK_SIZE - 1) / MIPMAP_BLOCK_SIZE;
+        l->data = malloc((size_t)l->width * l->height * mip_bpp);
+        l->dirty = malloc((size_t)l->blocks_x * l->blocks_y);
+        level_count++;
+        if (!l->data || !l->dirty) {
+            fprintf(stderr, "Mipmap: Failed to allocate level %d (%dx%d)\n", level_count - 1, l->width, l->height);
+            mipmap_cleanup();
+            return false;
+        }
+        memset(l->dirty, 1, (size_t)l->blocks_x * l->blocks_y);
+    }
+    dirty_blocks = true;
+    row_sums = malloc((size_t)width * mip_bpp * sizeof(uint16_t));
+    if (!row_sums) {
+        mipmap_cleanup();
+        return false;
+    }
+
+    for (int i = 1; i < level_count; i++) {
+        glTexImage2D(GL_TEXTURE_2D, i, GL_RGB, levels[i].gl_width, levels[i].gl_height, 0,
+                     mip_format, GL_UNSIGNED_BYTE, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    printf("Mipmap: %d levels for %dx%d\n", level_count, width, height);
+    return true;
+}
+
+void mipmap_mark_dirty(int x, int y, int w, int h) {
+    if (level_count < 2 || w <= 0 || h <= 0) return;
+    MipLevel *l = &levels[1];
+    // Pixels of level 1 that depend on the region, as blocks
+    int bx0 = (x / 2) / MIPMAP_BLOCK_SIZE;
+    int by0 = (y / 2) / MIPMAP_BLOCK_SIZE;
+    int bx1 = ((x + w - 1) / 2) / MIPMAP_BLOCK_SIZE;
+    int by1 = ((y + h - 1) / 2) / MIPMAP_BLOCK_SIZE;
+    if (bx1 >= l->blocks_x) bx1 = l->blocks_x - 1;
+    if (by1 >= l->blocks_y) by1 = l->blocks_y - 1;
+    for (int by = by0; by <= by1; by++) {
+        memset(l->dirty + (size_t)by * l->blocks_x + bx0, 1, (size_t)(bx1 - bx0 + 1));
+    }
+    dirty_blocks = true;
+}
+
+bool mipmap_pending(void) {
+    return dirty_blocks;
+}
+
+// 2x2 box filter of src_w x src_h pixels into ((src_w + 1) / 2) x ((src_h + 1) / 2) pixels
+static void reduce_2x2(const unsigned char *src, int src_w, int src_h, size_t src_stride,
+                       unsigned char *dst, size_t dst_stride) {
+#ifdef ARCH_X86_64
+    SimdReduceColor2x2(src, src_w, src_h, src_stride, dst, (src_w + 1) / 2, (src_h + 1) / 2,
+                       dst_stride, mip_bpp);
+#else
+    // Vertical pair sums first: a plain loop over bytes the compiler turns into NEON/RVV code
+    const int bpp = mip_bpp;
+    const int row_bytes = src_w * bpp;
+    const int pairs = src_w / 2;
+    for (int y = 0; y < (src_h + 1) / 2; y++) {
+        const unsigned char *r0 = src + (size_t)(2 * y) * src_stride;
+        const unsigned char *r1 = 2 * y + 1 < src_h ? r0 + src_stride : r0;
+        unsigned char *d = dst + (size_t)y * dst_stride;
+        for (int i = 0; i < row_bytes; i++) {
+            row_sums[i] = (uint16_t)(r0[i] + r1[i]);
+        }
+        if (bpp == 4) {
+            for (int x = 0; x < pairs; x++) {
+                for (int c = 0; c < 4; c++) {
+                    d[x * 4 + c] = (unsigned char)((row_sums[x * 8 + c] + row_sums[x * 8 + 4 + c] + 2) >> 2);
+                }
+            }
+        } else {
+            for (int x = 0; x < pairs; x++) {
+                for (int c = 0; c < 3; c++) {
+                    d[x * 3 + c] = (unsigned char)((row_sums[x * 6 + c] + row_sums[x * 6 + 3 + c] + 2) >> 2);
+                }
+            }
+        }
+        if (src_w & 1) {
+            for (int c = 0; c < bpp; c++) {
+                d[pairs * bpp + c] = (unsigned char)((row_sums[pairs * 2 * bpp + c] + 1) >> 1);
+            }
+        }
+    }
+#endif
+}
+
+size_t mipmap_update(const unsigned char *frame, size_t budget_bytes) {
+    if (level_count < 2 || !frame || !dirty_blocks) return 0;
+    size_t uploaded = 0;
+    bool out_of_budget = false;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int k = 1; k < level_count; k++) {
+        const MipLevel *up = &levels[k - 1];
+        MipLevel *l = &levels[k];
+        const unsigned char *src = k == 1 ? frame : up->data;
+        size_t src_stride = (size_t)up->width * mip_bpp;
+        size_t dst_stride = (size_t)l->width * mip_bpp;
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, l->width);
+
+        for (int by = 0; by < l->blocks_y && !out_of_budget; by++) {
+            for (int bx = 0; bx < l->blocks_x; bx++) {
+                unsigned char *flag = &l->dirty[(size_t)by * l->blocks_x + bx];
+                if (!*flag) continue;
+                if (uploaded > 0 && uploaded >= budget_bytes) {
+                    out_of_budget = true;
+                    break;
+                }
+                *flag = 0;
+
+                int x = bx * MIPMAP_BLOCK_SIZE;
+                int y = by * MIPMAP_BLOCK_SIZE;
+                int src_w = up->width - 2 * x;
+                int src_h = up->height - 2 * y;
+                if (src_w > 2 * MIPMAP_BLOCK_SIZE) src_w = 2 * MIPMAP_BLOCK_SIZE;
+                if (src_h > 2 * MIPMAP_BLOCK_SIZE) src_h = 2 * MIPMAP_BLOCK_SIZE;
+                unsigned char *dst = l->data + (size_t)y * dst_stride + (size_t)x * mip_bpp;
+                reduce_2x2(src + (size_t)(2 * y) * src_stride + (size_t)(2 * x) * mip_bpp,
+                           src_w, src_h, src_stride, dst, dst_stride);
+
+                int upload_w = l->gl_width - x;
+                int upload_h = l->gl_height - y;
+                if (upload_w > MIPMAP_BLOCK_SIZE) upload_w = MIPMAP_BLOCK_SIZE;
+                if (upload_h > MIPMAP_BLOCK_SIZE) upload_h = MIPMAP_BLOCK_SIZE;
+                if (upload_w > 0 && upload_h > 0) {
+                    glTexSubImage2D(GL_TEXTURE_2D, k, x, y, upload_w, upload_h,
+                                    mip_format, GL_UNSIGNED_BYTE, dst);
+                    uploaded += (size_t)upload_w * upload_h * mip_bpp;
+                }
+
+                if (k + 1 < level_count) {
+                    MipLevel *down = &levels[k + 1];
+                    down->dirty[(size_t)(by / 2) * down->blocks_x + bx / 2] = 1;
+                }
+            }
+        }
+        if (out_of_budget) break;
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    dirty_blocks = out_of_budget;
+    return uploaded;
+}
@@ -0,0 +1,35 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "gl_utility.h"
+
+// Size of one regeneration block in pixels of the level it belongs to
+#define MIPMAP_BLOCK_SIZE 64
+
+// Defines mip levels 1..n of the currently bound texture (level 0 is width x height)
+// and allocates the CPU copies they are computed from. All levels start out dirty.
+// format and bytes_per_pixel describe the frames passed to mipmap_update().
+bool mipmap_init(int width, int height, int bytes_per_pixel, GLenum format);
+
+// Frees the CPU levels.
+void mipmap_cleanup(void);
+
+// Returns true if mipmap_init() succeeded.
+bool mipmap_active(void);
+
+// Marks a region of level 0 as changed. Cheap, call it for every uploaded region.
+void mipmap_mark_dirty(int x, int y, int w, int h);
+
+// Returns true while blocks are waiting for mipmap_update().
+bool mipmap_pending(void);
+
+// Regenerates the blocks of every level below the dirty regions from frame (level 0,
+// tightly packed) and uploads them to the currently bound texture. Stops once
+// budget_bytes are uploaded, but always does at least one block; the rest stays
+// dirty for the next call. Returns the number of bytes uploaded.
+size_t mipmap_update(const unsigned char *frame, size_t budget_bytes);
+
+#endif // MIPMAP_H
@@ -0,0 +1,587 @@
+/*  Hybrid MJPEG decoding: entropy decoding on the CPU, everything after it on the GPU.
+
+    convert_mjpeg_to_rgb() spends most of its time in the IDCT, upsampling and colour
+    conversion, which are perfectly parallel. Here libjpeg only Huffman decodes the frame
+    into DCT coefficient blocks (jpeg_read_coefficients), which go to the GPU as 16 bit
+    integer textures, one per component. Three fragment passes follow:
+
+    1. Column IDCT of the dequantized coefficients into a float workspace
+    2. Row IDCT into 8 bit sample planes
+    3. Upsampling of the chroma planes and YCbCr to RGB into the screen texture
+
+    The passes replicate libjpeg's integer arithmetic (jidctint.c "islow" IDCT, the fancy
+    upsampling of jdsample.c and the tables of jdcolor.c), so the output is the same as
+    libjpeg's default decode, bit for bit. --mjpeg-gpu-verify checks that on live frames.
+    The shaders need GLSL 1.30 (integer textures and arithmetic), which Mesa llvmpipe has.
+*/
+
+#include "mjpeg_gpu.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <jpeglib.h>
+
+#define MJPEG_MAX_COMPONENTS 3
+
+enum ColorTransform {
+    TRANSFORM_YCC,
+    TRANSFORM_RGB,
+    TRANSFORM_GRAY
+};
+
+typedef struct {
+    int h_factor;       // max sampling factor / own, 2 for horizontally halved chroma
+    int v_factor;
+    int width;          // size of the (downsampled) component in samples
+    int height;
+    int blocks_wide;    // DCT blocks stored, each 8x8 texels of the coefficient plane
+    int blocks_high;
+    size_t offset;      // of the coefficient plane from the start of the frame buffer
+    int quant[64];      // natural order
+} ComponentInfo;
+
+// Header at the start of a coefficient frame buffer, the planes follow
+typedef struct {
+    int width;
+    int height;
+    int num_components;
+    int transform;
+    ComponentInfo components[MJPEG_MAX_COMPONENTS];
+} CoefficientFrame;
+
+#define PLANE_ALIGNMENT 64
+
+static const char *mjpeg_vertex_src =
+    "#version 130\n"
+    "void main() {\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+// jidctint.c for one column or row of 8 values, bits is the final descale
+#define IDCT_SRC \
+    "int descale(int x, int n) { return (x + (1 << (n - 1))) >> n; }\n" \
+    "\n" \
+    "void idct8(int d[8], int bits, out int o[8]) {\n" \
+    "    int z1 = (d[2] + d[6]) * 4433;\n" \
+    "    int tmp2 = z1 + d[6] * -15137;\n" \
+    "    int tmp3 = z1 + d[2] * 6270;\n" \
+    "    int tmp0 = (d[0] + d[4]) << 13;\n" \
+    "    int tmp1 = (d[0] - d[4]) << 13;\n" \
+    "    int tmp10 = tmp0 + tmp3;\n" \
+    "    int tmp13 = tmp0 - tmp3;\n" \
+    "    int tmp11 = tmp1 + tmp2;\n" \
+    "    int tmp12 = tmp1 - tmp2;\n" \
+    "\n" \
+    "    tmp0 = d[7];\n" \
+    "    tmp1 = d[5];\n" \
+    "    tmp2 = d[3];\n" \
+    "    tmp3 = d[1];\n" \
+    "    z1 = tmp0 + tmp3;\n" \
+    "    int z2 = tmp1 + tmp2;\n" \
+    "    int z3 = tmp0 + tmp2;\n" \
+    "    int z4 = tmp1 + tmp3;\n" \
+    "    int z5 = (z3 + z4) * 9633;\n" \
+    "    tmp0 *= 2446;\n" \
+    "    tmp1 *= 16819;\n" \
+    "    tmp2 *= 25172;\n" \
+    "    tmp3 *= 12299;\n" \
+    "    z1 *= -7373;\n" \
+    "    z2 *= -20995;\n" \
+    "    z3 = z3 * -16069 + z5;\n" \
+    "    z4 = z4 * -3196 + z5;\n" \
+    "    tmp0 += z1 + z3;\n" \
+    "    tmp1 += z2 + z4;\n" \
+    "    tmp2 += z2 + z3;\n" \
+    "    tmp3 += z1 + z4;\n" \
+    "\n" \
+    "    o[0] = descale(tmp10 + tmp3, bits);\n" \
+    "    o[7] = descale(tmp10 - tmp3, bits);\n" \
+    "    o[1] = descale(tmp11 + tmp2, bits);\n" \
+    "    o[6] = descale(tmp11 - tmp2, bits);\n" \
+    "    o[2] = descale(tmp12 + tmp1, bits);\n" \
+    "    o[5] = descale(tmp12 - tmp1, bits);\n" \
+    "    o[3] = descale(tmp13 + tmp0, bits);\n" \
+    "    o[4] = descale(tmp13 - tmp0, bits);\n" \
+    "}\n"
+
+// Texel (8 * bx + u, 8 * by + v) of the coefficient plane holds coefficient (u, v) of block (bx, by).
+// Writes the workspace value of row y of column u, scaled up by 2^2 like libjpeg's PASS1_BITS.
+static const char *column_fragment_src =
+    "#version 130\n"
+    "uniform isampler2D coefficients;\n"
+    "uniform int quant[64];\n"
+    "\n"
+    IDCT_SRC
+    "\n"
+    "void main() {\n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy);\n"
+    "    int u = p.x & 7;\n"
+    "    int y = p.y & 7;\n"
+    "    int d[8];\n"
+    "    for (int k = 0; k < 8; k++) {\n"
+    "        d[k] = texelFetch(coefficients, ivec2(p.x, p.y - y + k), 0).r * quant[k * 8 + u];\n"
+    "    }\n"
+    "    int o[8];\n"
+    "    idct8(d, 11, o);\n"
+    "    gl_FragColor = vec4(float(o[y]), 0.0, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *row_fragment_src =
+    "#version 130\n"
+    "uniform sampler2D workspace;\n"
+    "\n"
+    IDCT_SRC
+    "\n"
+    "void main() {\n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy);\n"
+    "    int x = p.x & 7;\n"
+    "    int d[8];\n"
+    "    for (int k = 0; k < 8; k++) {\n"
+    "        d[k] = int(texelFetch(workspace, ivec2(p.x - x + k, p.y), 0).r);\n"
+    "    }\n"
+    "    int o[8];\n"
+    "    idct8(d, 18, o);\n"
+    "    gl_FragColor = vec4(float(clamp(o[x] + 128, 0, 255)) / 255.0, 0.0, 0.0, 1.0);\n"
+    "}\n";
+
+// Fancy upsampling as in jdsample.c: triangle filters with libjpeg's rounding, edge samples
+// repeated. Other factors replicate samples.
+static const char *color_fragment_src =
+    "#version 130\n"
+    "uniform sampler2D planes[3];\n"
+    "uniform ivec2 factor[3];\n"
+    "uniform ivec2 size[3];\n"
+    "uniform int components;\n"
+    "uniform int transform;\n"
+    "\n"
+    "int fetch(int c, int x, int y) {\n"
+    "    ivec2 p = clamp(ivec2(x, y), ivec2(0), size[c] - 1);\n"
+    "    float v = c == 0 ? texelFetch(planes[0], p, 0).r : c == 1 ? texelFetch(planes[1], p, 0).r : texelFetch(planes[2], p, 0).r;\n"
+    "    return int(v * 255.0 + 0.5);\n"
+    "}\n"
+    "\n"
+    "int upsample(int c, ivec2 p) {\n"
+    "    ivec2 f = factor[c];\n"
+    "    ivec2 s = p / f;\n"
+    "    if (f == ivec2(2, 1) && size[c].x > 2) {\n"
+    "        int near = fetch(c, s.x, s.y) * 3;\n"
+    "        if ((p.x & 1) == 0) return s.x == 0 ? near / 3 : (near + fetch(c, s.x - 1, s.y) + 1) >> 2;\n"
+    "        return s.x == size[c].x - 1 ? near / 3 : (near + fetch(c, s.x + 1, s.y) + 2) >> 2;\n"
+    "    }\n"
+    "    if (f == ivec2(1, 2)) {\n"
+    "        bool upper = (p.y & 1) == 0;\n"
+    "        return (fetch(c, s.x, s.y) * 3 + fetch(c, s.x, upper ? s.y - 1 : s.y + 1) + (upper ? 1 : 2)) >> 2;\n"
+    "    }\n"
+    "    if (f == ivec2(2, 2) && size[c].x > 2) {\n"
+    "        int far_y = (p.y & 1) == 0 ? s.y - 1 : s.y + 1;\n"
+    "        int this_sum = fetch(c, s.x, s.y) * 3 + fetch(c, s.x, far_y);\n"
+    "        if ((p.x & 1) == 0) {\n"
+    "            if (s.x == 0) return (this_sum * 4 + 8) >> 4;\n"
+    "            return (this_sum * 3 + fetch(c, s.x - 1, s.y) * 3 + fetch(c, s.x - 1, far_y) + 8) >> 4;\n"
+    "        }\n"
+    "        if (s.x == size[c].x - 1) return (this_sum * 4 + 7) >> 4;\n"
+    "        return (this_sum * 3 + fetch(c, s.x + 1, s.y) * 3 + fetch(c, s.x + 1, far_y) + 7) >> 4;\n"
+    "    }\n"
+    "    return fetch(c, s.x, s.y);\n"
+    "}\n"
+    "\n"
+    "void main() {\n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy);\n"
+    "    int y = upsample(0, p);\n"
+    "    ivec3 rgb = ivec3(y);\n"
+    "    if (components == 3) {\n"
+    "        int c1 = upsample(1, p);\n"
+    "        int c2 = upsample(2, p);\n"
+    "        if (transform == 0) {\n"
+    "            int cb = c1 - 128;\n"
+    "            int cr = c2 - 128;\n"
+    "            rgb = ivec3(y + ((91881 * cr + 32768) >> 16),\n"
+    "                        y + ((-22554 * cb - 46802 * cr + 32768) >> 16),\n"
+    "                        y + ((116130 * cb + 32768) >> 16));\n"
+    "        } else {\n"
+    "            rgb = ivec3(y, c1, c2);\n"
+    "        }\n"
+    "    }\n"
+    "    gl_FragColor = vec4(vec3(clamp(rgb, 0, 255)) / 255.0, 1.0);\n"
+    "}\n";
+
+static bool active = false;
+static GLuint column_program = 0;
+static GLuint row_program = 0;
+static GLuint color_program = 0;
+static GLuint fbo = 0;
+static GLuint coefficient_textures[MJPEG_MAX_COMPONENTS] = {0, 0, 0};
+static int coefficient_width[MJPEG_MAX_COMPONENTS] = {0, 0, 0};  // Texels the textures were specified with
+static int coefficient_height[MJPEG_MAX_COMPONENTS] = {0, 0, 0};
+static GLRenderTarget workspace[MJPEG_MAX_COMPONENTS];
+static GLRenderTarget samples[MJPEG_MAX_COMPONENTS];
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long frames_read = 0;
+static unsigned long long frames_rejected = 0;  // Left to libjpeg
+static unsigned long long frames_rendered = 0;
+static StatsHistogram read_time;
+
+// Verify mode, the sample is written by the capture thread while not pending
+static bool verify = false;
+static unsigned char *verify_jpeg = NULL;
+static size_t verify_len = 0;
+static size_t verify_capacity = 0;
+static bool verify_pending = false;
+static unsigned int verify_countdown = 0;
+static unsigned long long verify_runs = 0;
+static int verify_max_diff = 0;
+static unsigned long long verify_diff_pixels = 0;
+
+bool mjpeg_gpu_init(bool enable_verify) {
+    column_program = gl_utility_compile_program("MJPEG column IDCT", mjpeg_vertex_src, column_fragment_src);
+    row_program = gl_utility_compile_program("MJPEG row IDCT", mjpeg_vertex_src, row_fragment_src);
+    color_program = gl_utility_compile_program("MJPEG colour", mjpeg_vertex_src, color_fragment_src);
+    if (!column_program || !row_program || !color_program) {
+        mjpeg_gpu_cleanup();
+        return false;
+    }
+
+    glGenFramebuffers(1, &fbo);
+    glGenTextures(MJPEG_MAX_COMPONENTS, coefficient_textures);
+    for (int c = 0; c < MJPEG_MAX_COMPONENTS; c++) {
+        // Integer textures can't be filtered
+        glBindTexture(GL_TEXTURE_2D, coefficient_textures[c]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        coefficient_width[c] = coefficient_height[c] = 0;
+        memset(&workspace[c], 0, sizeof(workspace[c]));
+        memset(&samples[c], 0, sizeof(samples[c]));
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    pthread_mutex_lock(&stats_lock);
+    frames_read = frames_rejected = frames_rendered = 0;
+    memset(&read_time, 0, sizeof(read_time));
+    pthread_mutex_unlock(&stats_lock);
+    verify = enable_verify;
+    verify_countdown = 0;
+    active = true;
+    printf("MJPEG GPU: IDCT and colour conversion shaders compiled%s.\n", verify ? ", verifying against libjpeg" : "");
+    return true;
+}
+
+void mjpeg_gpu_cleanup(void) {
+    if (column_program) glDeleteProgram(column_program);
+    if (row_program) glDeleteProgram(row_program);
+    if (color_program) glDeleteProgram(color_program);
+    column_program = row_program = color_program = 0;
+    if (fbo) glDeleteFramebuffers(1, &fbo);
+    fbo = 0;
+    if (coefficient_textures[0]) glDeleteTextures(MJPEG_MAX_COMPONENTS, coefficient_textures);
+    for (int c = 0; c < MJPEG_MAX_COMPONENTS; c++) {
+        coefficient_textures[c] = 0;
+        gl_utility_destroy_target(&workspace[c]);
+        gl_utility_destroy_target(&samples[c]);
+    }
+    free(verify_jpeg);
+    verify_jpeg = NULL;
+    verify_capacity = 0;
+    verify_pending = false;
+    active = false;
+}
+
+bool mjpeg_gpu_active(void) {
+    return active;
+}
+
+static size_t align_up(size_t value) {
+    return (value + PLANE_ALIGNMENT - 1) / PLANE_ALIGNMENT * PLANE_ALIGNMENT;
+}
+
+size_t mjpeg_gpu_buffer_size(int width, int height) {
+    // No component has more blocks than a full resolution one
+    size_t plane = (size_t)(width + 7) / 8 * 8 * ((height + 7) / 8 * 8) * sizeof(JCOEF);
+    return align_up(sizeof(CoefficientFrame)) + MJPEG_MAX_COMPONENTS * align_up(plane);
+}
+
+bool mjpeg_gpu_read_coefficients(const unsigned char *jpeg, size_t len, int width, int height,
+                                 unsigned char *buffer, size_t buffer_size) {
+    double start_us = stats_now_us();
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpeg, len);
+
+    bool ok = jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK &&
+              cinfo.image_width == (JDIMENSION)width && cinfo.image_height == (JDIMENSION)height &&
+              !cinfo.progressive_mode &&
+              ((cinfo.num_components == 3 && (cinfo.jpeg_color_space == JCS_YCbCr || cinfo.jpeg_color_space == JCS_RGB)) ||
+               (cinfo.num_components == 1 && cinfo.jpeg_color_space == JCS_GRAYSCALE));
+
+    CoefficientFrame *frame = (CoefficientFrame *)buffer;
+    size_t offset = align_up(sizeof(CoefficientFrame));
+    if (ok) {
+        frame->width = width;
+        frame->height = height;
+        frame->num_components = cinfo.num_components;
+        frame->transform = cinfo.num_components == 1 ? TRANSFORM_GRAY :
+                           cinfo.jpeg_color_space == JCS_RGB ? TRANSFORM_RGB : TRANSFORM_YCC;
+        for (int c = 0; c < cinfo.num_components && ok; c++) {
+            jpeg_component_info *comp = &cinfo.comp_info[c];
+            ComponentInfo *info = &frame->components[c];
+            info->h_factor = cinfo.max_h_samp_factor / comp->h_samp_factor;
+            info->v_factor = cinfo.max_v_samp_factor / comp->v_samp_factor;
+            info->width = (int)comp->downsampled_width;
+            info->height = (int)comp->downsampled_height;
+            info->blocks_wide = (int)comp->width_in_blocks;
+            info->blocks_high = (int)comp->height_in_blocks;
+            info->offset = offset;
+            offset += align_up((size_t)info->blocks_wide * info->blocks_high * 64 * sizeof(JCOEF));
+            ok = offset <= buffer_size &&
+                 info->h_factor * comp->h_samp_factor == cinfo.max_h_samp_factor &&
+                 info->v_factor * comp->v_samp_factor == cinfo.max_v_samp_factor;
+        }
+    }
+    if (!ok) {
+        jpeg_destroy_decompress(&cinfo);
+        pthread_mutex_lock(&stats_lock);
+        frames_rejected++;
+        pthread_mutex_unlock(&stats_lock);
+        return false;
+    }
+
+    jvirt_barray_ptr *coef_arrays = jpeg_read_coefficients(&cinfo);
+    for (int c = 0; c < frame->num_components; c++) {
+        ComponentInfo *info = &frame->components[c];
+        // The quant tables are latched per component once its scan started
+        const JQUANT_TBL *table = cinfo.comp_info[c].quant_table;
+        for (int k = 0; k < 64; k++) {
+            info->quant[k] = table ? table->quantval[k] : 1;
+        }
+
+        JCOEF *plane = (JCOEF *)(buffer + info->offset);
+        size_t texels_wide = (size_t)info->blocks_wide * 8;
+        for (int by = 0; by < info->blocks_high; by++) {
+            JBLOCKARRAY row = (*cinfo.mem->access_virt_barray)((j_common_ptr)&cinfo, coef_arrays[c], by, 1, FALSE);
+            JCOEF *dst = plane + (size_t)by * 8 * texels_wide;
+            for (int bx = 0; bx < info->blocks_wide; bx++) {
+                const JCOEF *block = row[0][bx];
+                for (int v = 0; v < 8; v++) {
+                    memcpy(dst + v * texels_wide + bx * 8, block + v * 8, 8 * sizeof(JCOEF));
+                }
+            }
+        }
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    pthread_mutex_lock(&stats_lock);
+    frames_read++;
+    stats_histogram_add(&read_time, stats_now_us() - start_us);
+    pthread_mutex_unlock(&stats_lock);
+    return true;
+}
+
+static void run_pass(GLRenderTarget *target) {
+    gl_utility_begin_pass(target);
+    gl_utility_draw_fullscreen_quad();
+    gl_utility_end_pass();
+}
+
+bool mjpeg_gpu_render(GLuint texture, const unsigned char *buffer) {
+    if (!active) return false;
+    const CoefficientFrame *frame = (const CoefficientFrame *)buffer;
+
+    glActiveTexture(GL_TEXTURE0);
+    for (int c = 0; c < frame->num_components; c++) {
+        const ComponentInfo *info = &frame->components[c];
+        int texels_wide = info->blocks_wide * 8;
+        int texels_high = info->blocks_high * 8;
+        if (!gl_utility_create_target(&workspace[c], texels_wide, texels_high, GL_R32F) ||
+            !gl_utility_create_target(&samples[c], texels_wide, texels_high, GL_R8)) {
+            return false;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, coefficient_textures[c]);
+        if (coefficient_width[c] != texels_wide || coefficient_height[c] != texels_high) {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R16I, texels_wide, texels_high, 0, GL_RED_INTEGER, GL_SHORT,
+                         buffer + info->offset);
+            coefficient_width[c] = texels_wide;
+            coefficient_height[c] = texels_high;
+        } else {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texels_wide, texels_high, GL_RED_INTEGER, GL_SHORT,
+                            buffer + info->offset);
+        }
+
+        glUseProgram(column_program);
+        glUniform1i(glGetUniformLocation(column_program, "coefficients"), 0);
+        glUniform1iv(glGetUniformLocation(column_program, "quant"), 64, info->quant);
+        run_pass(&workspace[c]);
+
+        glBindTexture(GL_TEXTURE_2D, workspace[c].texture);
+        glUseProgram(row_program);
+        glUniform1i(glGetUniformLocation(row_program, "workspace"), 0);
+        run_pass(&samples[c]);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "MJPEG GPU: Framebuffer %dx%d incomplete (0x%04X)\n", frame->width, frame->height, status);
+        return false;
+    }
+
+    GLint units[MJPEG_MAX_COMPONENTS] = {0, 1, 2};
+    GLint factors[MJPEG_MAX_COMPONENTS * 2];
+    GLint sizes[MJPEG_MAX_COMPONENTS * 2];
+    for (int c = 0; c < MJPEG_MAX_COMPONENTS; c++) {
+        const ComponentInfo *info = &frame->components[c < frame->num_components ? c : 0];
+        factors[c * 2] = info->h_factor;
+        factors[c * 2 + 1] = info->v_factor;
+        sizes[c * 2] = info->width;
+        sizes[c * 2 + 1] = info->height;
+        glActiveTexture(GL_TEXTURE0 + c);
+        glBindTexture(GL_TEXTURE_2D, samples[c < frame->num_components ? c : 0].texture);
+    }
+    glUseProgram(color_program);
+    glUniform1iv(glGetUniformLocation(color_program, "planes"), MJPEG_MAX_COMPONENTS, units);
+    glUniform2iv(glGetUniformLocation(color_program, "factor"), MJPEG_MAX_COMPONENTS, factors);
+    glUniform2iv(glGetUniformLocation(color_program, "size"), MJPEG_MAX_COMPONENTS, sizes);
+    glUniform1i(glGetUniformLocation(color_program, "components"), frame->num_components);
+    glUniform1i(glGetUniformLocation(color_program, "transform"), frame->transform);
+    GLRenderTarget target = {fbo, texture, 0, frame->width, frame->height};
+    run_pass(&target);
+
+    for (int c = MJPEG_MAX_COMPONENTS - 1; c > 0; c--) {
+        glActiveTexture(GL_TEXTURE0 + c);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    pthread_mutex_lock(&stats_lock);
+    frames_rendered++;
+    pthread_mutex_unlock(&stats_lock);
+    return true;
+}
+
+void mjpeg_gpu_verify_submit(const unsigned char *jpeg, size_t len) {
+    if (!verify) return;
+    if (verify_countdown > 0) {
+        verify_countdown--;
+        return;
+    }
+    pthread_mutex_lock(&stats_lock);
+    bool busy = verify_pending;
+    pthread_mutex_unlock(&stats_lock);
+    if (busy) return;
+
+    if (verify_capacity < len) {
+        unsigned char *grown = realloc(verify_jpeg, len);
+        if (!grown) return;
+        verify_jpeg = grown;
+        verify_capacity = len;
+    }
+    memcpy(verify_jpeg, jpeg, len);
+    verify_len = len;
+    verify_countdown = MJPEG_GPU_VERIFY_INTERVAL - 1;
+    pthread_mutex_lock(&stats_lock);
+    verify_pending = true;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+// libjpeg's default decode (islow IDCT, fancy upsampling) to RGB, the reference for the shaders
+static unsigned char *decode_reference(const unsigned char *jpeg, size_t len, int *width, int *height) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpeg, len);
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    *width = (int)cinfo.output_width;
+    *height = (int)cinfo.output_height;
+    unsigned char *rgb = malloc((size_t)*width * *height * 3);
+    while (rgb && cinfo.output_scanline < cinfo.output_height) {
+        unsigned char *row = rgb + (size_t)cinfo.output_scanline * *width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    if (rgb) {
+        jpeg_finish_decompress(&cinfo);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return rgb;
+}
+
+void mjpeg_gpu_verify_run(void) {
+    pthread_mutex_lock(&stats_lock);
+    bool pending = verify_pending;
+    pthread_mutex_unlock(&stats_lock);
+    if (!pending || !active) return;
+
+    int width = 0, height = 0;
+    unsigned char *reference = decode_reference(verify_jpeg, verify_len, &width, &height);
+    size_t buffer_size = mjpeg_gpu_buffer_size(width, height);
+    unsigned char *coefficients = malloc(buffer_size);
+    unsigned char *output = malloc((size_t)width * height * 3);
+    GLRenderTarget target = {0, 0, 0, 0, 0};
+
+    if (reference && coefficients && output &&
+        mjpeg_gpu_read_coefficients(verify_jpeg, verify_len, width, height, coefficients, buffer_size) &&
+        gl_utility_create_target(&target, width, height, GL_RGB8) &&
+        mjpeg_gpu_render(target.texture, coefficients)) {
+        glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, output);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        int max_diff = 0;
+        unsigned long long diff_pixels = 0;
+        for (size_t i = 0; i < (size_t)width * height; i++) {
+            int pixel_diff = 0;
+            for (int k = 0; k < 3; k++) {
+                int d = abs((int)output[i * 3 + k] - (int)reference[i * 3 + k]);
+                if (d > pixel_diff) pixel_diff = d;
+            }
+            if (pixel_diff > 0) diff_pixels++;
+            if (pixel_diff > max_diff) max_diff = pixel_diff;
+        }
+        printf("MJPEG GPU verify: %dx%d frame, max difference %d, %llu of %d pixels differ from libjpeg\n",
+               width, height, max_diff, diff_pixels, width * height);
+        pthread_mutex_lock(&stats_lock);
+        verify_runs++;
+        if (max_diff > verify_max_diff) verify_max_diff = max_diff;
+        verify_diff_pixels += diff_pixels;
+        pthread_mutex_unlock(&stats_lock);
+    } else {
+        fprintf(stderr, "MJPEG GPU verify: Could not decode the sample frame both ways\n");
+    }
+
+    gl_utility_destroy_target(&target);
+    free(reference);
+    free(coefficients);
+    free(output);
+    pthread_mutex_lock(&stats_lock);
+    verify_pending = false;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void mjpeg_gpu_print_stats(FILE *out) {
+    if (!active) return;
+    pthread_mutex_lock(&stats_lock);
+    fprintf(out, "MJPEG GPU: %llu frames entropy decoded, %llu rendered, %llu left to libjpeg\n",
+            frames_read, frames_rendered, frames_rejected);
+    stats_histogram_print(&read_time, "  coefficient decode", out);
+    if (verify) {
+        fprintf(out, "  verify: %llu frames compared, max difference %d, %llu pixels differed\n",
+                verify_runs, verify_max_diff, verify_diff_pixels);
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
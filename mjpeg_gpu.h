@@ -0,0 +1,39 @@
+#ifndef MJPEG_GPU_H
+#define MJPEG_GPU_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "gl_utility.h"
+
+// Every this many frames --mjpeg-gpu-verify compares a frame with the libjpeg output
+#define MJPEG_GPU_VERIFY_INTERVAL 120
+
+// Compiles the IDCT and colour conversion shaders (GLSL 1.30). Must be called with a current
+// GL context. Returns false if integer textures or the shaders are not available.
+bool mjpeg_gpu_init(bool verify);
+void mjpeg_gpu_cleanup(void);
+bool mjpeg_gpu_active(void);
+
+// Size of a coefficient frame buffer for JPEGs of up to width x height pixels
+size_t mjpeg_gpu_buffer_size(int width, int height);
+
+// Entropy decodes a width x height JPEG into DCT coefficient blocks in buffer (header, quant tables
+// and one plane per component). CPU only, called from the capture thread. Returns false for
+// JPEGs the shaders can't convert (other size or colour space), decode those with libjpeg.
+bool mjpeg_gpu_read_coefficients(const unsigned char *jpeg, size_t len, int width, int height,
+                                 unsigned char *buffer, size_t buffer_size);
+
+// Dequantizes, transforms, upsamples and colour converts a coefficient frame into level 0 of
+// texture, which must have the size of the image. Leaves texture bound to unit 0.
+bool mjpeg_gpu_render(GLuint texture, const unsigned char *buffer);
+
+// --mjpeg-gpu-verify: the capture thread hands in the JPEG of every MJPEG_GPU_VERIFY_INTERVAL-th
+// frame, the GL thread decodes it both ways and prints how far the outputs are apart.
+void mjpeg_gpu_verify_submit(const unsigned char *jpeg, size_t len);
+void mjpeg_gpu_verify_run(void);
+
+void mjpeg_gpu_print_stats(FILE *out);
+
+#endif // MJPEG_GPU_H
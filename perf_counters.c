@@ -0,0 +1,296 @@
+/*  Hardware performance counters per pipeline stage
+
+    Wall clock time tells that a converter is slow on a board, not why: cache misses, TLB
+    misses and stalls on uncached reads all just take longer. Here every thread running a
+    stage opens a group of perf_event counters on itself (cycles, instructions, cache
+    references and misses, data TLB read misses). The group is read when a stage begins and
+    ends and the difference is added to the stage. A stage begun inside another one is
+    taken out of the outer one, so the crop analysis doesn't show up as conversion.
+
+    Only user space is counted, which kernel.perf_event_paranoid 2 (the usual default)
+    allows without privileges. Counters the PMU doesn't have are left out of the group.
+    When the kernel multiplexes the group with other events, the counts are scaled by the
+    time it was enabled over the time it ran.
+*/
+
+#include "perf_counters.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef enum {
+    COUNTER_CYCLES,         // the group leader, without it nothing is counted
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_REFERENCES,
+    COUNTER_CACHE_MISSES,
+    COUNTER_DTLB_MISSES,
+    COUNTER_COUNT
+} Counter;
+
+static const char *stage_names[PERF_STAGE_COUNT] = {"buffer read", "crop analysis", "convert", "tile hash", "upload"};
+static const char *counter_names[COUNTER_COUNT] = {"cycles", "instructions", "cache references", "cache misses", "dTLB misses"};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} counter_events[COUNTER_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+typedef struct {
+    double values[COUNTER_COUNT];
+    uint64_t time_enabled;
+    uint64_t time_running;
+} Reading;
+
+typedef struct {
+    PerfStage stage;
+    Reading start;
+    double counted[COUNTER_COUNT]; // before the stages nested in it
+} StageRun;
+
+typedef struct {
+    int fds[COUNTER_COUNT];     // -1 where the PMU lacks the event
+    int group_index[COUNTER_COUNT]; // position of the value in a group read
+    int members;
+    StageRun stack[PERF_COUNTERS_MAX_DEPTH];
+    int depth;
+    int overflow;               // uncounted runs begun (too deep, failed read) and not ended yet
+} ThreadCounters;
+
+typedef struct {
+    uint64_t runs;
+    uint64_t pixels;
+    double counts[COUNTER_COUNT];
+} StageTotals;
+
+static bool active = false;
+static pthread_key_t thread_key;
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+static StageTotals totals[PERF_STAGE_COUNT];
+static bool counter_available[COUNTER_COUNT]; // opened by at least one thread
+static ThreadCounters no_counters; // Threads whose counters could not be opened
+
+static int open_counter(Counter counter, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_events[counter].type;
+    attr.config = counter_events[counter].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // pid 0 and cpu -1: the calling thread on whatever CPU it runs
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void close_thread_counters(void *arg) {
+    ThreadCounters *thread = arg;
+    if (thread == &no_counters) return;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (thread->fds[i] >= 0) close(thread->fds[i]);
+    }
+    free(thread);
+}
+
+static ThreadCounters *open_thread_counters(void) {
+    ThreadCounters *thread = calloc(1, sizeof(ThreadCounters));
+    if (!thread) return NULL;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        thread->fds[i] = -1;
+        thread->group_index[i] = -1;
+    }
+
+    thread->fds[COUNTER_CYCLES] = open_counter(COUNTER_CYCLES, -1);
+    if (thread->fds[COUNTER_CYCLES] < 0) {
+        fprintf(stderr, "Perf counters: cycles counter unavailable: %s\n", strerror(errno));
+        free(thread);
+        return NULL;
+    }
+    thread->group_index[COUNTER_CYCLES] = thread->members++;
+    for (int i = COUNTER_CYCLES + 1; i < COUNTER_COUNT; i++) {
+        thread->fds[i] = open_counter((Counter)i, thread->fds[COUNTER_CYCLES]);
+        if (thread->fds[i] >= 0) thread->group_index[i] = thread->members++;
+    }
+
+    pthread_mutex_lock(&totals_lock);
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (thread->fds[i] >= 0) counter_available[i] = true;
+    }
+    pthread_mutex_unlock(&totals_lock);
+    return thread;
+}
+
+static ThreadCounters *thread_counters(void) {
+    ThreadCounters *thread = pthread_getspecific(thread_key);
+    if (!thread) {
+        thread = open_thread_counters();
+        pthread_setspecific(thread_key, thread ? thread : &no_counters); // Not tried again
+    }
+    return thread != &no_counters ? thread : NULL;
+}
+
+static bool read_counters(const ThreadCounters *thread, Reading *reading) {
+    uint64_t data[3 + COUNTER_COUNT]; // nr, time enabled, time running, the values
+    ssize_t expected = (ssize_t)((3 + thread->members) * sizeof(uint64_t));
+    if (read(thread->fds[COUNTER_CYCLES], data, sizeof(data)) < expected) return false;
+    reading->time_enabled = data[1];
+    reading->time_running = data[2];
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        reading->values[i] = thread->group_index[i] >= 0 ? (double)data[3 + thread->group_index[i]] : 0.0;
+    }
+    return true;
+}
+
+// Adds what was counted between the readings, scaled up if the group was multiplexed
+static void add_difference(double *counts, const Reading *from, const Reading *to) {
+    uint64_t enabled = to->time_enabled - from->time_enabled;
+    uint64_t running = to->time_running - from->time_running;
+    double scale = running > 0 && running < enabled ? (double)enabled / (double)running : 1.0;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        counts[i] += (to->values[i] - from->values[i]) * scale;
+    }
+}
+
+bool perf_counters_init(void) {
+    if (active) return true;
+    if (pthread_key_create(&thread_key, close_thread_counters) != 0) {
+        return false;
+    }
+    memset(totals, 0, sizeof(totals));
+    memset(counter_available, 0, sizeof(counter_available));
+
+    ThreadCounters *thread = open_thread_counters();
+    if (!thread) {
+        FILE *paranoid = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+        int level;
+        if (paranoid && fscanf(paranoid, "%d", &level) == 1 && level > 2) {
+            fprintf(stderr, "Perf counters: kernel.perf_event_paranoid is %d, 2 or lower allows counting user space\n", level);
+        }
+        if (paranoid) fclose(paranoid);
+        pthread_key_delete(thread_key);
+        return false;
+    }
+    pthread_setspecific(thread_key, thread);
+
+    printf("Perf counters: counting");
+    const char *separator = " ";
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (thread->fds[i] < 0) continue;
+        printf("%s%s", separator, counter_names[i]);
+        separator = ", ";
+    }
+    printf(" in user space per stage and thread.\n");
+    active = true;
+    return true;
+}
+
+void perf_counters_cleanup(void) {
+    if (!active) return;
+    active = false;
+    // The calling thread's counters, the other threads closed theirs when they exited
+    ThreadCounters *thread = pthread_getspecific(thread_key);
+    if (thread) {
+        pthread_setspecific(thread_key, NULL);
+        close_thread_counters(thread);
+    }
+    pthread_key_delete(thread_key);
+}
+
+bool perf_counters_active(void) {
+    return active;
+}
+
+void perf_counters_begin(PerfStage stage) {
+    if (!active) return;
+    ThreadCounters *thread = thread_counters();
+    if (!thread) return;
+    // Runs that are not counted, and every stage nested in them, are only matched by end()
+    Reading now;
+    if (thread->overflow > 0 || thread->depth == PERF_COUNTERS_MAX_DEPTH || !read_counters(thread, &now)) {
+        thread->overflow++;
+        return;
+    }
+    if (thread->depth > 0) {
+        StageRun *outer = &thread->stack[thread->depth - 1];
+        add_difference(outer->counted, &outer->start, &now);
+    }
+    StageRun *run = &thread->stack[thread->depth++];
+    run->stage = stage;
+    run->start = now;
+    memset(run->counted, 0, sizeof(run->counted));
+}
+
+void perf_counters_end(uint64_t pixels) {
+    if (!active) return;
+    ThreadCounters *thread = pthread_getspecific(thread_key);
+    if (!thread || thread == &no_counters) return;
+    if (thread->overflow > 0) {
+        thread->overflow--;
+        return;
+    }
+    if (thread->depth == 0) return;
+
+    Reading now;
+    bool have_reading = read_counters(thread, &now);
+    StageRun *run = &thread->stack[--thread->depth];
+    if (have_reading) {
+        add_difference(run->counted, &run->start, &now);
+        pthread_mutex_lock(&totals_lock);
+        StageTotals *stage = &totals[run->stage];
+        stage->runs++;
+        stage->pixels += pixels;
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            stage->counts[i] += run->counted[i];
+        }
+        pthread_mutex_unlock(&totals_lock);
+    }
+    if (thread->depth > 0 && have_reading) {
+        thread->stack[thread->depth - 1].start = now; // The outer stage resumes
+    }
+}
+
+static void print_per_pixel(FILE *out, const StageTotals *stage, Counter counter) {
+    if (!counter_available[counter]) {
+        fprintf(out, ", %s n/a", counter_names[counter]);
+    } else if (stage->pixels > 0) {
+        fprintf(out, ", %.4f %s/px", stage->counts[counter] / (double)stage->pixels, counter_names[counter]);
+    } else {
+        fprintf(out, ", %.0f %s/run", stage->counts[counter] / (double)stage->runs, counter_names[counter]);
+    }
+}
+
+void perf_counters_print_stats(FILE *out) {
+    if (!active) return;
+    pthread_mutex_lock(&totals_lock);
+    for (int s = 0; s < PERF_STAGE_COUNT; s++) {
+        const StageTotals *stage = &totals[s];
+        if (stage->runs == 0) continue;
+        fprintf(out, "Perf %s: %llu runs, %.2f Mpx/run", stage_names[s], (unsigned long long)stage->runs,
+                (double)stage->pixels / (double)stage->runs / 1e6);
+        if (counter_available[COUNTER_INSTRUCTIONS] && stage->counts[COUNTER_CYCLES] > 0.0) {
+            fprintf(out, ", IPC %.2f", stage->counts[COUNTER_INSTRUCTIONS] / stage->counts[COUNTER_CYCLES]);
+        }
+        print_per_pixel(out, stage, COUNTER_CYCLES);
+        print_per_pixel(out, stage, COUNTER_CACHE_MISSES);
+        if (counter_available[COUNTER_CACHE_MISSES] && counter_available[COUNTER_CACHE_REFERENCES] &&
+            stage->counts[COUNTER_CACHE_REFERENCES] > 0.0) {
+            fprintf(out, " (%.1f%% of references)",
+                    100.0 * stage->counts[COUNTER_CACHE_MISSES] / stage->counts[COUNTER_CACHE_REFERENCES]);
+        }
+        print_per_pixel(out, stage, COUNTER_DTLB_MISSES);
+        fprintf(out, "\n");
+    }
+    pthread_mutex_unlock(&totals_lock);
+}
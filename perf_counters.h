@@ -0,0 +1,35 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Stages that can be nested at most this deep in one thread
+#define PERF_COUNTERS_MAX_DEPTH 4
+
+typedef enum {
+    PERF_STAGE_BUFFER_READ, // bounce copy or dmabuf sync of an uncached V4L2 buffer
+    PERF_STAGE_CROP,        // active area analysis
+    PERF_STAGE_CONVERT,     // conversion or copy of the captured frame into the back buffer
+    PERF_STAGE_HASH,        // tile hashes for the upload scheduler
+    PERF_STAGE_UPLOAD,      // CPU side of the texture upload in display()
+    PERF_STAGE_COUNT
+} PerfStage;
+
+// Checks that perf_event counters can be opened for this process. Returns false if not
+// (no PMU, e.g. in many VMs, or kernel.perf_event_paranoid above 2).
+bool perf_counters_init(void);
+void perf_counters_cleanup(void);
+bool perf_counters_active(void);
+
+// Brackets one run of a stage on the calling thread, which gets its own counters the first
+// time. A stage begun inside another one is not counted for the outer one. end() takes the
+// pixels the stage processed, for the per pixel figures. Both do nothing when not active.
+void perf_counters_begin(PerfStage stage);
+void perf_counters_end(uint64_t pixels);
+
+// IPC, cycles and cache, cache miss and dTLB miss counts per pixel of every stage that ran
+void perf_counters_print_stats(FILE *out);
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,219 @@
+/*  Dynamic render resolution
+
+    When drawing the plane at the window resolution takes longer than the budget
+    (software GL, weak SBC drivers), the scene is drawn into an offscreen framebuffer
+    of a fraction of the window size and stretched into the window with one linear
+    filtered blit.
+
+    The scene time is measured with GL_TIME_ELAPSED queries, read back a few frames
+    later from a small ring so the CPU never waits for the GPU. Without timer queries
+    (and on software renderers, whose timer query results are meaningless) the scene is
+    bracketed with glFinish() instead. That costs some parallelism, but software
+    renderers finish the work in glFinish() anyway.
+
+    Hysteresis: the scale is lowered after RENDER_SCALE_DOWN_FRAMES measurements over
+    budget, and only raised after RENDER_SCALE_UP_FRAMES measurements for which the
+    time predicted at the next step (proportional to the pixel count) is still well
+    within budget.
+*/
+
+#include "render_scale.h"
+#include "stats.h"
+
+#include <string.h>
+#include <math.h>
+
+#define QUERY_RING_SIZE 4
+// Weight of a new measurement in the smoothed scene time
+#define SMOOTHING 0.1
+// Fraction of the budget the predicted time at the next step must stay under to raise the scale
+#define UP_HEADROOM 0.8
+
+static bool active = false;
+static double budget_us = 0.0;
+static float scale = 1.0f;
+static GLRenderTarget target = {0, 0, 0, 0, 0};
+static bool rendering_offscreen = false;
+
+static bool use_timer_query = false;
+static GLuint queries[QUERY_RING_SIZE];
+static bool query_pending[QUERY_RING_SIZE];
+static int query_head = 0;      // next query to start
+static int query_tail = 0;      // oldest query that may be pending
+static double cpu_start_us = 0.0;
+
+static double smoothed_us = 0.0;
+static int over_count = 0;
+static int under_count = 0;
+static uint64_t scale_changes = 0;
+static StatsHistogram scene_time;
+
+bool render_scale_init(float budget_ms) {
+    if (budget_ms <= 0.0f) return false;
+    budget_us = budget_ms * 1000.0;
+    scale = 1.0f;
+    smoothed_us = 0.0;
+    over_count = under_count = 0;
+    memset(&scene_time, 0, sizeof(scene_time));
+
+    // Software renderers report timer query results that have nothing to do with the time spent
+    // rasterizing, and they render synchronously anyway
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    const char *renderer = (const char *)glGetString(GL_RENDERER);
+    bool software = renderer && (strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe") || strstr(renderer, "Software"));
+    use_timer_query = !software && extensions &&
+                      (strstr(extensions, "GL_ARB_timer_query") || strstr(extensions, "GL_EXT_timer_query"));
+    if (use_timer_query) {
+        glGenQueries(QUERY_RING_SIZE, queries);
+        memset(query_pending, 0, sizeof(query_pending));
+        query_head = query_tail = 0;
+    }
+    active = true;
+    printf("Render scale: Dynamic resolution with a %.1f ms budget, timing with %s\n",
+           budget_ms, use_timer_query ? "GPU timer queries" : "glFinish");
+    return true;
+}
+
+void render_scale_cleanup(void) {
+    if (!active) return;
+    if (use_timer_query) glDeleteQueries(QUERY_RING_SIZE, queries);
+    gl_utility_destroy_target(&target);
+    active = false;
+}
+
+bool render_scale_active(void) {
+    return active;
+}
+
+float render_scale_current(void) {
+    return scale;
+}
+
+static void set_scale(float new_scale) {
+    new_scale = roundf(new_scale / RENDER_SCALE_STEP) * RENDER_SCALE_STEP;
+    if (new_scale < RENDER_SCALE_MIN) new_scale = RENDER_SCALE_MIN;
+    if (new_scale > 1.0f) new_scale = 1.0f;
+    if (new_scale == scale) return;
+    // Predict the time at the new size so the next decisions don't act on stale measurements
+    smoothed_us *= ((double)new_scale * new_scale) / ((double)scale * scale);
+    scale = new_scale;
+    scale_changes++;
+}
+
+static void record_scene_time(double us) {
+    stats_histogram_add(&scene_time, us);
+    smoothed_us = smoothed_us > 0.0 ? smoothed_us + (us - smoothed_us) * SMOOTHING : us;
+
+    double next = scale + RENDER_SCALE_STEP;
+    double predicted_up = smoothed_us * (next * next) / ((double)scale * scale);
+    if (smoothed_us > budget_us) {
+        over_count++;
+        under_count = 0;
+    } else if (scale < 1.0f && predicted_up < budget_us * UP_HEADROOM) {
+        under_count++;
+        over_count = 0;
+    } else {
+        over_count = 0;
+        under_count = 0;
+    }
+
+    if (over_count >= RENDER_SCALE_DOWN_FRAMES) {
+        set_scale(scale - RENDER_SCALE_STEP);
+        over_count = 0;
+    } else if (under_count >= RENDER_SCALE_UP_FRAMES) {
+        set_scale(scale + RENDER_SCALE_STEP);
+        under_count = 0;
+    }
+}
+
+// Reads every finished query. With wait set the oldest one is read even if the GPU is behind.
+static void collect_queries(bool wait) {
+    while (query_pending[query_tail]) {
+        GLint available = GL_FALSE;
+        if (!wait) {
+            glGetQueryObjectiv(queries[query_tail], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) break;
+        }
+        GLuint64 elapsed_ns = 0;
+        glGetQueryObjectui64v(queries[query_tail], GL_QUERY_RESULT, &elapsed_ns);
+        query_pending[query_tail] = false;
+        query_tail = (query_tail + 1) % QUERY_RING_SIZE;
+        record_scene_time(elapsed_ns / 1000.0);
+        wait = false;
+    }
+}
+
+void render_scale_begin(int window_width, int window_height) {
+    if (!active) return;
+
+    if (use_timer_query) {
+        if (query_pending[query_head]) collect_queries(true); // Ring full, the GPU is far behind
+        glBeginQuery(GL_TIME_ELAPSED, queries[query_head]);
+    } else {
+        glFinish();
+        cpu_start_us = stats_now_us();
+    }
+
+    rendering_offscreen = false;
+    if (scale < 1.0f) {
+        // Creating the target binds its texture, keep the one the scene is drawn with
+        GLint bound_texture = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound_texture);
+        int width = (int)(window_width * scale + 0.5f);
+        int height = (int)(window_height * scale + 0.5f);
+        if (width < 1) width = 1;
+        if (height < 1) height = 1;
+        if (gl_utility_create_target(&target, width, height, GL_RGB8) && gl_utility_attach_depth(&target)) {
+            glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+            glViewport(0, 0, width, height);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            rendering_offscreen = true;
+        }
+        glBindTexture(GL_TEXTURE_2D, (GLuint)bound_texture);
+    } else if (target.fbo) {
+        gl_utility_destroy_target(&target);
+    }
+}
+
+void render_scale_end(int window_width, int window_height) {
+    if (!active) return;
+
+    double cpu_elapsed_us = 0.0;
+    if (use_timer_query) {
+        glEndQuery(GL_TIME_ELAPSED);
+        query_pending[query_head] = true;
+        query_head = (query_head + 1) % QUERY_RING_SIZE;
+    } else {
+        glFinish();
+        cpu_elapsed_us = stats_now_us() - cpu_start_us;
+    }
+
+    if (rendering_offscreen) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, target.width, target.height, 0, 0, window_width, window_height,
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, window_width, window_height);
+        rendering_offscreen = false;
+    }
+
+    // Only after the blit, a scale change resizes the target
+    if (use_timer_query) {
+        collect_queries(false);
+    } else {
+        record_scene_time(cpu_elapsed_us);
+    }
+}
+
+void render_scale_print_stats(FILE *out) {
+    if (!active) return;
+    if (target.fbo) {
+        fprintf(out, "Render scale: %.2f (%dx%d)", scale, target.width, target.height);
+    } else {
+        fprintf(out, "Render scale: %.2f (window resolution)", scale);
+    }
+    fprintf(out, ", scene %.2f ms smoothed, budget %.2f ms, %llu changes\n",
+            smoothed_us / 1000.0, budget_us / 1000.0, (unsigned long long)scale_changes);
+    stats_histogram_print(&scene_time, "  scene time", out);
+}
@@ -0,0 +1,40 @@
+#ifndef RENDER_SCALE_H
+#define RENDER_SCALE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "gl_utility.h"
+
+// Lowest fraction of the window resolution the scene is rendered at
+#define RENDER_SCALE_MIN 0.5f
+// Scale change per adjustment
+#define RENDER_SCALE_STEP 0.1f
+// Consecutive measurements over budget before the scale is lowered
+#define RENDER_SCALE_DOWN_FRAMES 10
+// Consecutive measurements with enough headroom before the scale is raised again
+#define RENDER_SCALE_UP_FRAMES 120
+
+// Enables dynamic render resolution with the given budget for drawing the scene.
+// Must be called with a current GL context.
+bool render_scale_init(float budget_ms);
+
+// Frees the framebuffer and timer queries.
+void render_scale_cleanup(void);
+
+bool render_scale_active(void);
+
+// Starts drawing the scene. Below full scale the scene goes into an offscreen framebuffer
+// of scale * window size, which is bound, cleared and set as viewport.
+void render_scale_begin(int window_width, int window_height);
+
+// Ends the scene, records its render time, upscales the framebuffer into the window and
+// adjusts the scale for the next frames.
+void render_scale_end(int window_width, int window_height);
+
+// Current fraction of the window resolution (RENDER_SCALE_MIN .. 1.0)
+float render_scale_current(void);
+
+void render_scale_print_stats(FILE *out);
+
+#endif // RENDER_SCALE_H
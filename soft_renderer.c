@@ -0,0 +1,890 @@
+/*  Software renderer for boards without a usable GPU driver
+
+    Draws the same flat or curved screen as display() on the CPU, straight into a KMS dumb
+    buffer or an fbdev framebuffer. Every piece of the screen (the flat quad or one segment
+    of the curved one) is planar, so a 3x3 homography maps an output pixel back to its
+    position on the piece, exactly like the perspective correct interpolation of the GL
+    renderers. The texel there is filtered bilinearly with SSE2/NEON integer arithmetic.
+
+    The output is split into SOFT_RENDERER_TILE_SIZE tiles which the worker threads take
+    from a shared counter. A tile is drawn into a small cached buffer and copied out row by
+    row: dumb buffers and framebuffers are write-combined memory, slow to read and slow to
+    write pixel by pixel. The texture holds BGRx texels with one extra column and row, so
+    both texels of a filter row are a single 8 byte load even at the right and bottom edge.
+*/
+
+#include "soft_renderer.h"
+
+#include "gl_utility.h"
+#include "stats.h"
+
+#ifdef ARCH_X86_64
+#include "3rdparty/include/SimdLib.h"
+#include <emmintrin.h>
+#elif defined(ARCH_ARM64)
+#include <arm_neon.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+#ifdef WITH_KMS
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Rows of the texture one upload job converts
+#define UPLOAD_ROWS 32
+// Refresh period assumed when fbdev can neither wait for the vblank nor report its timing
+#define FALLBACK_REFRESH_US (1000000.0 / 60.0)
+
+typedef struct {
+    unsigned char *pixels;  // top left pixel
+    size_t size;            // of the mapping, KMS only
+    uint32_t handle;        // KMS dumb buffer
+    uint32_t fb_id;
+} OutputBuffer;
+
+// A planar piece of the screen
+typedef struct {
+    float g[9];             // output pixel (x, y, 1) to (s, r, 1) / w on the piece, row major
+    float u0, du;           // texture u = u0 + s * du, v = 1 - r
+    int x0, y0, x1, y1;     // output pixels it can cover, end exclusive
+} WarpQuad;
+
+static enum { OUTPUT_NONE, OUTPUT_KMS, OUTPUT_FBDEV } output_type = OUTPUT_NONE;
+static int output_fd = -1;
+static int output_width = 0;
+static int output_height = 0;
+static size_t output_pitch = 0;
+static int output_bytes_per_pixel = 4;
+static bool output_xrgb = true; // XRGB8888, tiles are copied out as they are
+static struct fb_bitfield output_red, output_green, output_blue;
+static OutputBuffer buffers[2];
+static int buffer_count = 0;
+static int back_buffer = 0;
+
+// fbdev
+static unsigned char *fb_map = NULL;
+static size_t fb_map_size = 0;
+static struct fb_var_screeninfo fb_var;
+static bool fb_vsync = true;
+static double fb_refresh_us = FALLBACK_REFRESH_US;
+static double fb_last_present_us = 0.0;
+
+#ifdef WITH_KMS
+static uint32_t kms_connector_id = 0;
+static uint32_t kms_crtc_id = 0;
+static drmModeModeInfo kms_mode;
+static drmModeCrtc *kms_saved_crtc = NULL;
+static bool kms_flip_failed = false;
+#endif
+
+// BGRx, tex_width + 1 texels per row and tex_height + 1 rows
+static uint32_t *texels = NULL;
+static int tex_width = 0;
+static int tex_height = 0;
+static int tex_stride = 0;
+static const unsigned char *upload_src = NULL;
+static int upload_bpp = 3;
+static bool upload_bgr = false;
+
+static WarpQuad quads[SOFT_RENDERER_CURVE_SEGMENTS];
+static int quad_count = 0;
+static bool perspective = false;    // reject pixels outside the clip distances
+static bool depth_test = false;     // curve segments can cover each other from the side
+
+// Worker threads, each batch runs job(0 .. count - 1)
+static pthread_t *workers = NULL;
+static int worker_count = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned int pool_generation = 0;
+static int pool_running = 0;        // workers not done with the current batch
+static bool pool_quit = false;
+static void (*pool_job)(int index) = NULL;
+static int pool_job_count = 0;
+static int pool_next_job = 0;
+
+static StatsHistogram upload_time;
+static StatsHistogram draw_time;
+static StatsHistogram present_time;
+
+// --- Worker pool ---
+
+static void run_jobs(void) {
+    for (;;) {
+        pthread_mutex_lock(&pool_lock);
+        int job = pool_next_job < pool_job_count ? pool_next_job++ : -1;
+        pthread_mutex_unlock(&pool_lock);
+        if (job < 0) return;
+        pool_job(job);
+    }
+}
+
+static void *worker_func(void *arg) {
+    (void)arg;
+    unsigned int seen = 0;
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (pool_generation == seen && !pool_quit) {
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        }
+        if (pool_quit) break;
+        seen = pool_generation;
+        pthread_mutex_unlock(&pool_lock);
+        run_jobs();
+        pthread_mutex_lock(&pool_lock);
+        if (--pool_running == 0) pthread_cond_signal(&pool_done);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+// The calling thread works on the batch too and returns once every job is done
+static void run_parallel(void (*job)(int index), int count) {
+    pthread_mutex_lock(&pool_lock);
+    pool_job = job;
+    pool_job_count = count;
+    pool_next_job = 0;
+    pool_running = worker_count;
+    pool_generation++;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+
+    run_jobs();
+
+    pthread_mutex_lock(&pool_lock);
+    while (pool_running > 0) {
+        pthread_cond_wait(&pool_done, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// --- Outputs ---
+
+static bool fbdev_init(const char *device) {
+    struct fb_fix_screeninfo fix;
+    if (ioctl(output_fd, FBIOGET_FSCREENINFO, &fix) < 0 || ioctl(output_fd, FBIOGET_VSCREENINFO, &fb_var) < 0) {
+        fprintf(stderr, "Software renderer: %s is not a framebuffer device: %s\n", device, strerror(errno));
+        return false;
+    }
+    if (fix.visual != FB_VISUAL_TRUECOLOR || (fb_var.bits_per_pixel != 32 && fb_var.bits_per_pixel != 16) ||
+        fb_var.red.length > 8 || fb_var.green.length > 8 || fb_var.blue.length > 8) {
+        fprintf(stderr, "Software renderer: %s uses an unsupported pixel format (%u bits per pixel)\n",
+                device, fb_var.bits_per_pixel);
+        return false;
+    }
+    output_type = OUTPUT_FBDEV;
+    output_width = (int)fb_var.xres;
+    output_height = (int)fb_var.yres;
+    output_pitch = fix.line_length;
+    output_bytes_per_pixel = (int)fb_var.bits_per_pixel / 8;
+    output_red = fb_var.red;
+    output_green = fb_var.green;
+    output_blue = fb_var.blue;
+    output_xrgb = output_bytes_per_pixel == 4 && output_red.offset == 16 && output_red.length == 8 &&
+                  output_green.offset == 8 && output_green.length == 8 &&
+                  output_blue.offset == 0 && output_blue.length == 8;
+
+    fb_map_size = fix.smem_len;
+    fb_map = mmap(NULL, fb_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, output_fd, 0);
+    if (fb_map == MAP_FAILED) {
+        fb_map = NULL;
+        fprintf(stderr, "Software renderer: Could not map %s: %s\n", device, strerror(errno));
+        return false;
+    }
+
+    // Page flipping by panning when the virtual screen holds two pages
+    buffer_count = 1;
+    buffers[0].pixels = fb_map + (size_t)fb_var.yoffset * output_pitch + (size_t)fb_var.xoffset * output_bytes_per_pixel;
+    if (fb_var.yres_virtual >= 2 * fb_var.yres && 2 * (size_t)fb_var.yres * output_pitch <= fb_map_size) {
+        fb_var.xoffset = 0;
+        fb_var.yoffset = 0;
+        if (ioctl(output_fd, FBIOPAN_DISPLAY, &fb_var) == 0) {
+            buffer_count = 2;
+            buffers[0].pixels = fb_map;
+            buffers[1].pixels = fb_map + (size_t)fb_var.yres * output_pitch;
+        }
+    }
+    back_buffer = buffer_count - 1;
+
+    if (fb_var.pixclock > 0) {
+        double line = fb_var.xres + fb_var.left_margin + fb_var.right_margin + fb_var.hsync_len;
+        double lines = fb_var.yres + fb_var.upper_margin + fb_var.lower_margin + fb_var.vsync_len;
+        fb_refresh_us = fb_var.pixclock * line * lines / 1e6; // pixclock is in ps
+    }
+    for (int i = 0; i < buffer_count; i++) {
+        for (int y = 0; y < output_height; y++) {
+            memset(buffers[i].pixels + (size_t)y * output_pitch, 0, (size_t)output_width * output_bytes_per_pixel);
+        }
+    }
+    return true;
+}
+
+static void fbdev_present(void) {
+    if (buffer_count == 2) {
+        fb_var.yoffset = (unsigned int)back_buffer * fb_var.yres;
+        if (ioctl(output_fd, FBIOPAN_DISPLAY, &fb_var) == 0) {
+            back_buffer ^= 1;
+        } else {
+            fprintf(stderr, "Software renderer: Panning failed (%s), drawing into the visible page.\n", strerror(errno));
+            buffer_count = 1;
+            buffers[0] = buffers[back_buffer ^ 1];
+            back_buffer = 0;
+        }
+    }
+    if (fb_vsync) {
+        __u32 crtc = 0;
+        if (ioctl(output_fd, FBIO_WAITFORVSYNC, &crtc) < 0) {
+            fb_vsync = false;
+        }
+    }
+    if (!fb_vsync) {
+        // Nothing to wait for, keep to the refresh rate instead of drawing as fast as possible
+        double wait_us = fb_last_present_us + fb_refresh_us - stats_now_us();
+        if (wait_us > 0.0) {
+            nanosleep(&(struct timespec){0, (long)(wait_us * 1000.0)}, NULL);
+        }
+    }
+    fb_last_present_us = stats_now_us();
+}
+
+#ifdef WITH_KMS
+static bool kms_create_buffer(OutputBuffer *buffer) {
+    struct drm_mode_create_dumb create;
+    memset(&create, 0, sizeof(create));
+    create.width = output_width;
+    create.height = output_height;
+    create.bpp = 32;
+    if (drmIoctl(output_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
+        fprintf(stderr, "Software renderer: Could not create a %dx%d dumb buffer: %s\n",
+                output_width, output_height, strerror(errno));
+        return false;
+    }
+    buffer->handle = create.handle;
+    buffer->size = create.size;
+    output_pitch = create.pitch;
+    if (drmModeAddFB(output_fd, output_width, output_height, 24, 32, create.pitch, create.handle, &buffer->fb_id) != 0) {
+        fprintf(stderr, "Software renderer: Could not add a framebuffer: %s\n", strerror(errno));
+        return false;
+    }
+
+    struct drm_mode_map_dumb map;
+    memset(&map, 0, sizeof(map));
+    map.handle = create.handle;
+    if (drmIoctl(output_fd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0) {
+        fprintf(stderr, "Software renderer: Could not map a dumb buffer: %s\n", strerror(errno));
+        return false;
+    }
+    buffer->pixels = mmap(NULL, create.size, PROT_READ | PROT_WRITE, MAP_SHARED, output_fd, map.offset);
+    if (buffer->pixels == MAP_FAILED) {
+        buffer->pixels = NULL;
+        fprintf(stderr, "Software renderer: Could not map a dumb buffer: %s\n", strerror(errno));
+        return false;
+    }
+    memset(buffer->pixels, 0, create.size);
+    return true;
+}
+
+static bool kms_init(const char *device) {
+    drmModeRes *resources = drmModeGetResources(output_fd);
+    if (!resources) {
+        fprintf(stderr, "Software renderer: %s is not a KMS device: %s\n", device, strerror(errno));
+        return false;
+    }
+    output_type = OUTPUT_KMS;
+
+    drmModeConnector *connector = NULL;
+    for (int i = 0; i < resources->count_connectors && !connector; i++) {
+        drmModeConnector *candidate = drmModeGetConnector(output_fd, resources->connectors[i]);
+        if (candidate && candidate->connection == DRM_MODE_CONNECTED && candidate->count_modes > 0) {
+            connector = candidate;
+        } else if (candidate) {
+            drmModeFreeConnector(candidate);
+        }
+    }
+    if (!connector) {
+        fprintf(stderr, "Software renderer: No output is connected to %s\n", device);
+        drmModeFreeResources(resources);
+        return false;
+    }
+    kms_connector_id = connector->connector_id;
+    kms_mode = connector->modes[0];
+    for (int i = 0; i < connector->count_modes; i++) {
+        if (connector->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+            kms_mode = connector->modes[i];
+            break;
+        }
+    }
+
+    // The CRTC driving the connector now, otherwise the first one an encoder of it can use
+    kms_crtc_id = 0;
+    drmModeEncoder *encoder = connector->encoder_id ? drmModeGetEncoder(output_fd, connector->encoder_id) : NULL;
+    if (encoder) {
+        kms_crtc_id = encoder->crtc_id;
+        drmModeFreeEncoder(encoder);
+    }
+    for (int i = 0; i < connector->count_encoders && !kms_crtc_id; i++) {
+        encoder = drmModeGetEncoder(output_fd, connector->encoders[i]);
+        if (!encoder) continue;
+        for (int j = 0; j < resources->count_crtcs; j++) {
+            if (encoder->possible_crtcs & (1u << j)) {
+                kms_crtc_id = resources->crtcs[j];
+                break;
+            }
+        }
+        drmModeFreeEncoder(encoder);
+    }
+    drmModeFreeConnector(connector);
+    drmModeFreeResources(resources);
+    if (!kms_crtc_id) {
+        fprintf(stderr, "Software renderer: No CRTC can drive the output of %s\n", device);
+        return false;
+    }
+
+    output_width = kms_mode.hdisplay;
+    output_height = kms_mode.vdisplay;
+    output_bytes_per_pixel = 4;
+    output_xrgb = true;
+    for (buffer_count = 0; buffer_count < 2; buffer_count++) {
+        if (!kms_create_buffer(&buffers[buffer_count])) {
+            buffer_count++; // cleaned up with the others
+            return false;
+        }
+    }
+
+    kms_saved_crtc = drmModeGetCrtc(output_fd, kms_crtc_id);
+    if (drmModeSetCrtc(output_fd, kms_crtc_id, buffers[0].fb_id, 0, 0, &kms_connector_id, 1, &kms_mode) != 0) {
+        fprintf(stderr, "Software renderer: Could not set the mode (%s). A display server may own %s, "
+                "run from a text console.\n", strerror(errno), device);
+        return false;
+    }
+    back_buffer = 1;
+    return true;
+}
+
+static void kms_page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec, void *data) {
+    (void)fd;
+    (void)sequence;
+    (void)tv_sec;
+    (void)tv_usec;
+    *(bool *)data = false;
+}
+
+static void kms_present(void) {
+    const OutputBuffer *buffer = &buffers[back_buffer];
+    back_buffer ^= 1;
+    if (!kms_flip_failed) {
+        bool pending = true;
+        if (drmModePageFlip(output_fd, kms_crtc_id, buffer->fb_id, DRM_MODE_PAGE_FLIP_EVENT, &pending) == 0) {
+            drmEventContext events;
+            memset(&events, 0, sizeof(events));
+            events.version = 2;
+            events.page_flip_handler = kms_page_flip_handler;
+            struct pollfd pfd = {output_fd, POLLIN, 0};
+            while (pending) {
+                int ready = poll(&pfd, 1, 1000);
+                if (ready < 0 && errno == EINTR) continue;
+                if (ready <= 0) {
+                    fprintf(stderr, "Software renderer: Page flip did not complete.\n");
+                    break;
+                }
+                drmHandleEvent(output_fd, &events);
+            }
+            return;
+        }
+        fprintf(stderr, "Software renderer: Page flips failed (%s), setting the CRTC every frame.\n", strerror(errno));
+        kms_flip_failed = true;
+    }
+    drmModeSetCrtc(output_fd, kms_crtc_id, buffer->fb_id, 0, 0, &kms_connector_id, 1, &kms_mode);
+}
+#endif
+
+// --- Texture ---
+
+static void upload_rows(int job) {
+    int y0 = job * UPLOAD_ROWS;
+    int rows = tex_height - y0 < UPLOAD_ROWS ? tex_height - y0 : UPLOAD_ROWS;
+    size_t src_stride = (size_t)tex_width * upload_bpp;
+    const unsigned char *src = upload_src + (size_t)y0 * src_stride;
+    uint32_t *dst = texels + (size_t)y0 * tex_stride;
+
+    if (upload_bpp == 4) {
+        for (int y = 0; y < rows; y++) {
+            memcpy(dst + (size_t)y * tex_stride, src + y * src_stride, src_stride);
+        }
+    } else {
+#ifdef ARCH_X86_64
+        if (upload_bgr) {
+            SimdBgrToBgra(src, tex_width, rows, src_stride, (uint8_t *)dst, (size_t)tex_stride * 4, 0xFF);
+        } else {
+            SimdRgbToBgra(src, tex_width, rows, src_stride, (uint8_t *)dst, (size_t)tex_stride * 4, 0xFF);
+        }
+#else
+        const int red = upload_bgr ? 2 : 0;
+        const int blue = 2 - red;
+        for (int y = 0; y < rows; y++) {
+            const unsigned char *s = src + y * src_stride;
+            uint32_t *d = dst + (size_t)y * tex_stride;
+            for (int x = 0; x < tex_width; x++) {
+                d[x] = 0xFF000000u | (uint32_t)s[x * 3 + red] << 16 | (uint32_t)s[x * 3 + 1] << 8 | s[x * 3 + blue];
+            }
+        }
+#endif
+    }
+    for (int y = 0; y < rows; y++) {
+        dst[(size_t)y * tex_stride + tex_width] = dst[(size_t)y * tex_stride + tex_width - 1];
+    }
+}
+
+void soft_renderer_upload(const unsigned char *frame, int width, int height, int bytes_per_pixel, bool bgr) {
+    if (!frame || width <= 0 || height <= 0) return;
+    double start = stats_now_us();
+    if (width != tex_width || height != tex_height) {
+        free(texels);
+        texels = malloc((size_t)(width + 1) * (height + 1) * sizeof(uint32_t));
+        if (!texels) {
+            fprintf(stderr, "Software renderer: Could not allocate a %dx%d texture.\n", width, height);
+            tex_width = tex_height = 0;
+            return;
+        }
+        tex_width = width;
+        tex_height = height;
+        tex_stride = width + 1;
+    }
+    upload_src = frame;
+    upload_bpp = bytes_per_pixel;
+    upload_bgr = bgr;
+    run_parallel(upload_rows, (height + UPLOAD_ROWS - 1) / UPLOAD_ROWS);
+    memcpy(texels + (size_t)height * tex_stride, texels + (size_t)(height - 1) * tex_stride,
+           (size_t)tex_stride * sizeof(uint32_t));
+    stats_histogram_add(&upload_time, stats_now_us() - start);
+}
+
+// Weights are 8 bit fractions. Texels row0[0..1] and row1[0..1] are the 2x2 footprint.
+static inline uint32_t bilinear(const uint32_t *row0, const uint32_t *row1, unsigned int fx, unsigned int fy) {
+#if defined(ARCH_X86_64)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)row0), zero);
+    __m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)row1), zero);
+    // Both columns at once, then the left half weighted against the right half
+    __m128i column = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(top, _mm_set1_epi16((short)(256 - fy))),
+                                                  _mm_mullo_epi16(bottom, _mm_set1_epi16((short)fy))), 8);
+    __m128i weighted = _mm_mullo_epi16(column, _mm_set_epi16((short)fx, (short)fx, (short)fx, (short)fx,
+                                                             (short)(256 - fx), (short)(256 - fx),
+                                                             (short)(256 - fx), (short)(256 - fx)));
+    __m128i sum = _mm_srli_epi16(_mm_add_epi16(weighted, _mm_srli_si128(weighted, 8)), 8);
+    return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+#elif defined(ARCH_ARM64)
+    uint16x8_t top = vmovl_u8(vld1_u8((const uint8_t *)row0));
+    uint16x8_t bottom = vmovl_u8(vld1_u8((const uint8_t *)row1));
+    uint16x8_t column = vshrq_n_u16(vmlaq_n_u16(vmulq_n_u16(top, (uint16_t)(256 - fy)), bottom, (uint16_t)fy), 8);
+    uint16x4_t sum = vshrn_n_u32(vmlal_n_u16(vmull_n_u16(vget_low_u16(column), (uint16_t)(256 - fx)),
+                                             vget_high_u16(column), (uint16_t)fx), 8);
+    return vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(sum, sum))), 0);
+#else
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        unsigned int left = (((row0[0] >> shift) & 0xFF) * (256 - fy) + ((row1[0] >> shift) & 0xFF) * fy) >> 8;
+        unsigned int right = (((row0[1] >> shift) & 0xFF) * (256 - fy) + ((row1[1] >> shift) & 0xFF) * fy) >> 8;
+        out |= ((left * (256 - fx) + right * fx) >> 8) << shift;
+    }
+    return out;
+#endif
+}
+
+// GL_LINEAR with GL_CLAMP_TO_EDGE, u and v from 0 to 1 across the texture, v = 0 at the top
+static inline uint32_t sample(float u, float v) {
+    float x = u * (float)tex_width - 0.5f;
+    float y = v * (float)tex_height - 0.5f;
+    if (x < 0.0f) x = 0.0f;
+    if (x > (float)(tex_width - 1)) x = (float)(tex_width - 1);
+    if (y < 0.0f) y = 0.0f;
+    if (y > (float)(tex_height - 1)) y = (float)(tex_height - 1);
+    int ix = (int)x;
+    int iy = (int)y;
+    const uint32_t *row0 = texels + (size_t)iy * tex_stride + ix;
+    return bilinear(row0, row0 + tex_stride, (unsigned int)((x - (float)ix) * 256.0f),
+                    (unsigned int)((y - (float)iy) * 256.0f));
+}
+
+// --- Rasterization ---
+
+static bool invert3(const float m[9], float inv[9]) {
+    float c0 = m[4] * m[8] - m[5] * m[7];
+    float c1 = m[5] * m[6] - m[3] * m[8];
+    float c2 = m[3] * m[7] - m[4] * m[6];
+    float det = m[0] * c0 + m[1] * c1 + m[2] * c2;
+    if (fabsf(det) < 1e-12f) return false;
+    float f = 1.0f / det;
+    inv[0] = c0 * f; inv[1] = (m[2] * m[7] - m[1] * m[8]) * f; inv[2] = (m[1] * m[5] - m[2] * m[4]) * f;
+    inv[3] = c1 * f; inv[4] = (m[0] * m[8] - m[2] * m[6]) * f; inv[5] = (m[2] * m[3] - m[0] * m[5]) * f;
+    inv[6] = c2 * f; inv[7] = (m[1] * m[6] - m[0] * m[7]) * f; inv[8] = (m[0] * m[4] - m[1] * m[3]) * f;
+    return true;
+}
+
+// Clip x, y and w of transform * (p, w)
+static void transform_xyw(const float m[16], const float p[3], float w, float out[3]) {
+    out[0] = m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12] * w;
+    out[1] = m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13] * w;
+    out[2] = m[3] * p[0] + m[7] * p[1] + m[11] * p[2] + m[15] * w;
+}
+
+// The piece origin + s * edge_s + r * edge_r (s, r in 0..1) of model space
+static void add_quad(const float transform[16], const float origin[3], const float edge_s[3],
+                     const float edge_r[3], float u0, float du) {
+    float cs[3], cr[3], co[3];
+    transform_xyw(transform, edge_s, 0.0f, cs);
+    transform_xyw(transform, edge_r, 0.0f, cr);
+    transform_xyw(transform, origin, 1.0f, co);
+    // (s, r, 1) to clip (x, y, w), so the inverse takes NDC (x, y, 1) to (s, r, 1) / w
+    const float h[9] = {
+        cs[0], cr[0], co[0],
+        cs[1], cr[1], co[1],
+        cs[2], cr[2], co[2],
+    };
+    float inv[9];
+    if (!invert3(h, inv)) return; // seen edge on
+
+    // Bounds of the projected corners, the whole output if the piece crosses the near plane
+    float min_x = (float)output_width, max_x = 0.0f, min_y = (float)output_height, max_y = 0.0f;
+    int behind = 0;
+    for (int corner = 0; corner < 4; corner++) {
+        float s = (float)(corner & 1);
+        float r = (float)(corner >> 1);
+        float w = cs[2] * s + cr[2] * r + co[2];
+        if (w < SOFT_RENDERER_NEAR) {
+            behind++;
+            continue;
+        }
+        float x = ((cs[0] * s + cr[0] * r + co[0]) / w + 1.0f) * 0.5f * (float)output_width;
+        float y = (1.0f - (cs[1] * s + cr[1] * r + co[1]) / w) * 0.5f * (float)output_height;
+        if (x < min_x) min_x = x;
+        if (x > max_x) max_x = x;
+        if (y < min_y) min_y = y;
+        if (y > max_y) max_y = y;
+    }
+    if (behind == 4) return;
+
+    WarpQuad *q = &quads[quad_count];
+    if (behind > 0) {
+        q->x0 = 0;
+        q->y0 = 0;
+        q->x1 = output_width;
+        q->y1 = output_height;
+    } else {
+        q->x0 = min_x < 0.0f ? 0 : (int)min_x;
+        q->y0 = min_y < 0.0f ? 0 : (int)min_y;
+        q->x1 = max_x >= (float)output_width ? output_width : (int)max_x + 1;
+        q->y1 = max_y >= (float)output_height ? output_height : (int)max_y + 1;
+        if (q->x0 >= q->x1 || q->y0 >= q->y1) return;
+    }
+
+    // Output pixel to NDC: x' = 2x / width - 1, y' = 1 - 2y / height (row 0 is the top)
+    const float sx = 2.0f / (float)output_width;
+    const float sy = -2.0f / (float)output_height;
+    for (int row = 0; row < 3; row++) {
+        const float *i = &inv[row * 3];
+        q->g[row * 3 + 0] = i[0] * sx;
+        q->g[row * 3 + 1] = i[1] * sy;
+        q->g[row * 3 + 2] = i[2] - i[0] + i[1];
+    }
+    q->u0 = u0;
+    q->du = du;
+    quad_count++;
+}
+
+static void shade_span(const WarpQuad *q, int y, int x0, int x1, uint32_t *color, float *depth) {
+    const float *g = q->g;
+    const float px = (float)x0 + 0.5f;
+    const float py = (float)y + 0.5f;
+    float s = g[0] * px + g[1] * py + g[2];
+    float r = g[3] * px + g[4] * py + g[5];
+    float inv_w = g[6] * px + g[7] * py + g[8];
+    for (int i = 0; i < x1 - x0; i++, s += g[0], r += g[3], inv_w += g[6]) {
+        if (perspective) {
+            // Between the clip planes and in front of what the tile already shows there
+            if (inv_w > 1.0f / SOFT_RENDERER_NEAR || inv_w < 1.0f / SOFT_RENDERER_FAR) continue;
+            if (depth_test && inv_w <= depth[i]) continue;
+        }
+        float w = 1.0f / inv_w;
+        float ps = s * w;
+        float pr = r * w;
+        if (ps < 0.0f || ps > 1.0f || pr < 0.0f || pr > 1.0f) continue;
+        color[i] = sample(q->u0 + ps * q->du, 1.0f - pr);
+        if (depth_test) depth[i] = inv_w;
+    }
+}
+
+static void copy_row_out(const uint32_t *src, unsigned char *dst, int count) {
+    if (output_xrgb) {
+        memcpy(dst, src, (size_t)count * 4);
+        return;
+    }
+    for (int x = 0; x < count; x++) {
+        uint32_t p = src[x];
+        uint32_t value = ((p >> 16 & 0xFF) >> (8 - output_red.length)) << output_red.offset |
+                         ((p >> 8 & 0xFF) >> (8 - output_green.length)) << output_green.offset |
+                         ((p & 0xFF) >> (8 - output_blue.length)) << output_blue.offset;
+        if (output_bytes_per_pixel == 4) {
+            ((uint32_t *)dst)[x] = value;
+        } else {
+            ((uint16_t *)dst)[x] = (uint16_t)value;
+        }
+    }
+}
+
+static void draw_tile(int index) {
+    uint32_t color[SOFT_RENDERER_TILE_SIZE * SOFT_RENDERER_TILE_SIZE];
+    float depth[SOFT_RENDERER_TILE_SIZE * SOFT_RENDERER_TILE_SIZE];
+    const int tiles_x = (output_width + SOFT_RENDERER_TILE_SIZE - 1) / SOFT_RENDERER_TILE_SIZE;
+    const int tx = (index % tiles_x) * SOFT_RENDERER_TILE_SIZE;
+    const int ty = (index / tiles_x) * SOFT_RENDERER_TILE_SIZE;
+    const int tw = output_width - tx < SOFT_RENDERER_TILE_SIZE ? output_width - tx : SOFT_RENDERER_TILE_SIZE;
+    const int th = output_height - ty < SOFT_RENDERER_TILE_SIZE ? output_height - ty : SOFT_RENDERER_TILE_SIZE;
+
+    memset(color, 0, sizeof(color));
+    if (depth_test) memset(depth, 0, sizeof(depth));
+    for (int i = 0; i < quad_count; i++) {
+        const WarpQuad *q = &quads[i];
+        int x0 = q->x0 > tx ? q->x0 : tx;
+        int x1 = q->x1 < tx + tw ? q->x1 : tx + tw;
+        int y0 = q->y0 > ty ? q->y0 : ty;
+        int y1 = q->y1 < ty + th ? q->y1 : ty + th;
+        for (int y = y0; y < y1 && x0 < x1; y++) {
+            size_t offset = (size_t)(y - ty) * SOFT_RENDERER_TILE_SIZE + (size_t)(x0 - tx);
+            shade_span(q, y, x0, x1, color + offset, depth + offset);
+        }
+    }
+
+    unsigned char *dst = buffers[back_buffer].pixels + (size_t)ty * output_pitch + (size_t)tx * output_bytes_per_pixel;
+    for (int y = 0; y < th; y++) {
+        copy_row_out(color + (size_t)y * SOFT_RENDERER_TILE_SIZE, dst + (size_t)y * output_pitch, tw);
+    }
+}
+
+static void render(void) {
+    double start = stats_now_us();
+    if (!texels) quad_count = 0;
+    const int tiles_x = (output_width + SOFT_RENDERER_TILE_SIZE - 1) / SOFT_RENDERER_TILE_SIZE;
+    const int tiles_y = (output_height + SOFT_RENDERER_TILE_SIZE - 1) / SOFT_RENDERER_TILE_SIZE;
+    run_parallel(draw_tile, tiles_x * tiles_y);
+    stats_histogram_add(&draw_time, stats_now_us() - start);
+}
+
+void soft_renderer_draw_plane(float aspect, bool curved, const float projection[16], const float modelview[16]) {
+    if (output_type == OUTPUT_NONE) return;
+    float transform[16];
+    memcpy(transform, projection, sizeof(transform));
+    gl_utility_mat4_multiply(transform, modelview);
+    // Built for an aspect ratio of 1 like the GLES geometry, the curve scales with the width
+    gl_utility_mat4_scale(transform, aspect, 1.0f, aspect);
+
+    quad_count = 0;
+    perspective = true;
+    depth_test = curved;
+    const float edge_r[3] = {0.0f, 2.0f, 0.0f};
+    if (curved) {
+        const float radius = 1.0f / sinf(SOFT_RENDERER_CURVE_ANGLE / 2.0f);
+        float prev_x = 0.0f, prev_z = 0.0f;
+        for (int i = 0; i <= SOFT_RENDERER_CURVE_SEGMENTS; ++i) {
+            float t = (float)i / (float)SOFT_RENDERER_CURVE_SEGMENTS;
+            float angle = -SOFT_RENDERER_CURVE_ANGLE / 2.0f + t * SOFT_RENDERER_CURVE_ANGLE;
+            float x = radius * sinf(angle);
+            float z = radius * (cosf(angle) - 1.0f);
+            if (i > 0) {
+                const float origin[3] = {prev_x, -1.0f, prev_z};
+                const float edge_s[3] = {x - prev_x, 0.0f, z - prev_z};
+                add_quad(transform, origin, edge_s, edge_r, (float)(i - 1) / (float)SOFT_RENDERER_CURVE_SEGMENTS,
+                         1.0f / (float)SOFT_RENDERER_CURVE_SEGMENTS);
+            }
+            prev_x = x;
+            prev_z = z;
+        }
+    } else {
+        const float origin[3] = {-1.0f, -1.0f, 0.0f};
+        const float edge_s[3] = {2.0f, 0.0f, 0.0f};
+        add_quad(transform, origin, edge_s, edge_r, 0.0f, 1.0f);
+    }
+    render();
+}
+
+void soft_renderer_draw_passthrough(int x, int y, int width, int height) {
+    if (output_type == OUTPUT_NONE) return;
+    quad_count = 0;
+    perspective = false;
+    depth_test = false;
+    if (width > 0 && height > 0) {
+        WarpQuad *q = &quads[quad_count++];
+        // s across, r up from the bottom edge, w is 1 everywhere
+        const float g[9] = {
+            1.0f / (float)width, 0.0f, -(float)x / (float)width,
+            0.0f, -1.0f / (float)height, (float)(y + height) / (float)height,
+            0.0f, 0.0f, 1.0f,
+        };
+        memcpy(q->g, g, sizeof(g));
+        q->u0 = 0.0f;
+        q->du = 1.0f;
+        q->x0 = x < 0 ? 0 : x;
+        q->y0 = y < 0 ? 0 : y;
+        q->x1 = x + width > output_width ? output_width : x + width;
+        q->y1 = y + height > output_height ? output_height : y + height;
+    }
+    render();
+}
+
+void soft_renderer_clear(void) {
+    if (output_type == OUTPUT_NONE) return;
+    quad_count = 0;
+    render();
+}
+
+void soft_renderer_present(void) {
+    double start = stats_now_us();
+#ifdef WITH_KMS
+    if (output_type == OUTPUT_KMS) {
+        kms_present();
+    }
+#endif
+    if (output_type == OUTPUT_FBDEV) {
+        fbdev_present();
+    }
+    stats_histogram_add(&present_time, stats_now_us() - start);
+}
+
+// --- Setup ---
+
+bool soft_renderer_init(const char *device, int threads) {
+    bool fbdev = strncmp(device, "/dev/fb", 7) == 0;
+#ifndef WITH_KMS
+    if (!fbdev) {
+        fprintf(stderr, "Software renderer: KMS output needs a build with libdrm, use a framebuffer device (/dev/fb0).\n");
+        return false;
+    }
+#endif
+    output_fd = open(device, O_RDWR | O_CLOEXEC);
+    if (output_fd < 0) {
+        fprintf(stderr, "Software renderer: Could not open %s: %s\n", device, strerror(errno));
+        return false;
+    }
+#ifdef WITH_KMS
+    bool ok = fbdev ? fbdev_init(device) : kms_init(device);
+#else
+    bool ok = fbdev_init(device);
+#endif
+    if (!ok) {
+        soft_renderer_cleanup();
+        return false;
+    }
+
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 1) threads = 1;
+    }
+    workers = calloc((size_t)threads, sizeof(pthread_t));
+    for (worker_count = 0; workers && worker_count < threads - 1; worker_count++) {
+        if (pthread_create(&workers[worker_count], NULL, worker_func, NULL) != 0) {
+            perror("Software renderer: Failed to create a worker thread");
+            break;
+        }
+    }
+
+    memset(&upload_time, 0, sizeof(upload_time));
+    memset(&draw_time, 0, sizeof(draw_time));
+    memset(&present_time, 0, sizeof(present_time));
+    printf("Software renderer: %dx%d on %s (%s, %s), %d threads\n", output_width, output_height, device,
+           output_type == OUTPUT_KMS ? "KMS" : "fbdev", buffer_count == 2 ? "page flipping" : "single buffered",
+           worker_count + 1);
+    return true;
+}
+
+void soft_renderer_cleanup(void) {
+    if (workers) {
+        pthread_mutex_lock(&pool_lock);
+        pool_quit = true;
+        pthread_cond_broadcast(&pool_wake);
+        pthread_mutex_unlock(&pool_lock);
+        for (int i = 0; i < worker_count; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        free(workers);
+        workers = NULL;
+        worker_count = 0;
+        pool_quit = false;
+    }
+
+#ifdef WITH_KMS
+    if (output_type == OUTPUT_KMS) {
+        // Give the output back to the console
+        if (kms_saved_crtc) {
+            if (kms_saved_crtc->mode_valid) {
+                drmModeSetCrtc(output_fd, kms_saved_crtc->crtc_id, kms_saved_crtc->buffer_id, kms_saved_crtc->x,
+                               kms_saved_crtc->y, &kms_connector_id, 1, &kms_saved_crtc->mode);
+            }
+            drmModeFreeCrtc(kms_saved_crtc);
+            kms_saved_crtc = NULL;
+        }
+        for (int i = 0; i < buffer_count; i++) {
+            if (buffers[i].pixels) munmap(buffers[i].pixels, buffers[i].size);
+            if (buffers[i].fb_id) drmModeRmFB(output_fd, buffers[i].fb_id);
+            if (buffers[i].handle) {
+                struct drm_mode_destroy_dumb destroy;
+                memset(&destroy, 0, sizeof(destroy));
+                destroy.handle = buffers[i].handle;
+                drmIoctl(output_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+            }
+        }
+        kms_flip_failed = false;
+    }
+#endif
+    if (output_type == OUTPUT_FBDEV && fb_map) {
+        if (buffer_count == 2 && fb_var.yoffset != 0) {
+            fb_var.yoffset = 0;
+            ioctl(output_fd, FBIOPAN_DISPLAY, &fb_var);
+        }
+        munmap(fb_map, fb_map_size);
+        fb_map = NULL;
+    }
+    memset(buffers, 0, sizeof(buffers));
+    buffer_count = 0;
+    if (output_fd >= 0) close(output_fd);
+    output_fd = -1;
+    output_type = OUTPUT_NONE;
+
+    free(texels);
+    texels = NULL;
+    tex_width = tex_height = 0;
+}
+
+bool soft_renderer_active(void) {
+    return output_type != OUTPUT_NONE;
+}
+
+void soft_renderer_size(int *width, int *height) {
+    *width = output_width;
+    *height = output_height;
+}
+
+void soft_renderer_print_stats(FILE *out) {
+    if (output_type == OUTPUT_NONE) return;
+    fprintf(out, "Software renderer: %dx%d %s, %d threads, %s\n", output_width, output_height,
+            output_type == OUTPUT_KMS ? "KMS" : "fbdev", worker_count + 1,
+            buffer_count == 2 ? "page flipping" : "single buffered");
+    stats_histogram_print(&upload_time, "  texture upload", out);
+    stats_histogram_print(&draw_time, "  draw", out);
+    stats_histogram_print(&present_time, "  present", out);
+}
@@ -0,0 +1,46 @@
+#ifndef SOFT_RENDERER_H
+#define SOFT_RENDERER_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Screen tiles the worker threads rasterize, in pixels
+#define SOFT_RENDERER_TILE_SIZE 64
+// Geometry of the curved screen, the same as the GL renderers draw
+#define SOFT_RENDERER_CURVE_SEGMENTS 32
+#define SOFT_RENDERER_CURVE_ANGLE ((float)M_PI / 4.0f)
+// Clip distances of the perspective reshape() sets up
+#define SOFT_RENDERER_NEAR 1.0f
+#define SOFT_RENDERER_FAR 100.0f
+
+// Opens a KMS device (/dev/dri/cardN, needs a build with libdrm) or an fbdev framebuffer
+// (/dev/fbN) and starts threads - 1 workers, 0 uses every online CPU. Sets the mode of the
+// first connected output, the framebuffer keeps its mode.
+bool soft_renderer_init(const char *device, int threads);
+void soft_renderer_cleanup(void);
+bool soft_renderer_active(void);
+
+// Size of the output in pixels
+void soft_renderer_size(int *width, int *height);
+
+// Copies a width x height frame with bytes_per_pixel 3 (RGB, or BGR if bgr is set) or 4
+// (BGRx) into the texture the warp samples from.
+void soft_renderer_upload(const unsigned char *frame, int width, int height, int bytes_per_pixel, bool bgr);
+
+// Draws the screen plane (2 * aspect x 2 units, flat or curved) into the back buffer,
+// transformed by projection * modelview (column major, as display() computes them)
+void soft_renderer_draw_plane(float aspect, bool curved, const float projection[16], const float modelview[16]);
+
+// Draws the texture into the output rectangle (origin top left) with nothing around it
+void soft_renderer_draw_passthrough(int x, int y, int width, int height);
+
+// Clears the back buffer
+void soft_renderer_clear(void);
+
+// Shows the back buffer and returns after the next vblank
+void soft_renderer_present(void);
+
+void soft_renderer_print_stats(FILE *out);
+
+#endif // SOFT_RENDERER_H
@@ -0,0 +1,177 @@
+/*  Counters and log2 histograms for the health of device report streams
+
+    Used for the IMU and MCU reports of the glasses so USB contention (irregular
+    arrival, jitter) can be told apart from device or driver problems (CRC failures,
+    malformed packets, jumps in the device timestamp).
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "stats.h"
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Reports needed to learn the regular device timestamp increment before gaps are counted
+#define DEVICE_DELTA_WARMUP 16
+// An increment this many times larger than the regular one counts as a discontinuity
+#define DEVICE_GAP_FACTOR 3.0
+
+double stats_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static int histogram_bucket(double value_us) {
+    int bucket = 0;
+    double limit = 1.0;
+    while (value_us >= limit && bucket < STATS_HISTOGRAM_BUCKETS - 1) {
+        limit *= 2.0;
+        bucket++;
+    }
+    return bucket;
+}
+
+void stats_histogram_add(StatsHistogram *h, double value_us) {
+    if (h->count == 0 || value_us < h->min) h->min = value_us;
+    if (h->count == 0 || value_us > h->max) h->max = value_us;
+    h->buckets[histogram_bucket(value_us)]++;
+    h->count++;
+    h->sum += value_us;
+}
+
+double stats_histogram_percentile(const StatsHistogram *h, double percentile) {
+    if (h->count == 0) return 0.0;
+    uint64_t target = (uint64_t)ceil(h->count * percentile / 100.0);
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            double upper = ldexp(1.0, i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+static void print_duration(FILE *out, double us) {
+    if (us >= 1000.0) {
+        fprintf(out, "%.1fms", us / 1000.0);
+    } else {
+        fprintf(out, "%.0fus", us);
+    }
+}
+
+void stats_histogram_print(const StatsHistogram *h, const char *label, FILE *out) {
+    fprintf(out, "    %s: n=%llu", label, (unsigned long long)h->count);
+    if (h->count == 0) {
+        fputc('\n', out);
+        return;
+    }
+    fprintf(out, " mean=");
+    print_duration(out, h->sum / h->count);
+    fprintf(out, " p50<=");
+    print_duration(out, stats_histogram_percentile(h, 50.0));
+    fprintf(out, " p99<=");
+    print_duration(out, stats_histogram_percentile(h, 99.0));
+    fprintf(out, " max=");
+    print_duration(out, h->max);
+    fprintf(out, " |");
+    for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        if (!h->buckets[i]) continue;
+        fputc(' ', out);
+        fputc('<', out);
+        print_duration(out, ldexp(1.0, i));
+        fprintf(out, ":%llu", (unsigned long long)h->buckets[i]);
+    }
+    fputc('\n', out);
+}
+
+void stats_stream_init(StreamStats *s, const char *name, bool periodic) {
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->periodic = periodic;
+    pthread_mutex_init(&s->lock, NULL);
+    s->window_start_us = stats_now_us();
+}
+
+void stats_stream_destroy(StreamStats *s) {
+    pthread_mutex_destroy(&s->lock);
+}
+
+void stats_stream_packet(StreamStats *s, double arrival_us, uint32_t device_ts) {
+    pthread_mutex_lock(&s->lock);
+    if (s->packets > 0) {
+        double interval = arrival_us - s->last_arrival_us;
+        stats_histogram_add(&s->interval, interval);
+
+        // Welford's running variance, its square root is the jitter
+        s->interval_count++;
+        double delta = interval - s->interval_mean;
+        s->interval_mean += delta / s->interval_count;
+        s->interval_m2 += delta * (interval - s->interval_mean);
+    }
+    s->last_arrival_us = arrival_us;
+    s->packets++;
+    s->window_packets++;
+
+    if (s->periodic && s->have_device_ts) {
+        uint32_t device_delta = device_ts - s->last_device_ts;
+        bool backwards = device_delta > 0x80000000u;
+        if (backwards ||
+            (s->device_delta_count >= DEVICE_DELTA_WARMUP && device_delta > DEVICE_GAP_FACTOR * s->device_delta_avg)) {
+            s->timestamp_discontinuities++;
+        } else if (s->device_delta_count < DEVICE_DELTA_WARMUP) {
+            s->device_delta_count++;
+            s->device_delta_avg += (device_delta - s->device_delta_avg) / s->device_delta_count;
+        } else {
+            s->device_delta_avg = s->device_delta_avg * 0.95 + device_delta * 0.05;
+        }
+    }
+    s->have_device_ts = true;
+    s->last_device_ts = device_ts;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void stats_stream_crc_failure(StreamStats *s) {
+    pthread_mutex_lock(&s->lock);
+    s->crc_failures++;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void stats_stream_malformed(StreamStats *s) {
+    pthread_mutex_lock(&s->lock);
+    s->malformed++;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void stats_stream_callback(StreamStats *s, double duration_us) {
+    pthread_mutex_lock(&s->lock);
+    stats_histogram_add(&s->callback, duration_us);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void stats_stream_print(StreamStats *s, FILE *out) {
+    pthread_mutex_lock(&s->lock);
+    double now = stats_now_us();
+    double window = now - s->window_start_us;
+    double rate = window > 0.0 ? s->window_packets * 1000000.0 / window : 0.0;
+    double jitter = s->interval_count > 1 ? sqrt(s->interval_m2 / (s->interval_count - 1)) : 0.0;
+
+    fprintf(out, "%s reports: %llu total, %.1f Hz, jitter %.0fus, CRC failures %llu, malformed %llu",
+            s->name, (unsigned long long)s->packets, rate, jitter,
+            (unsigned long long)s->crc_failures, (unsigned long long)s->malformed);
+    if (s->periodic) {
+        fprintf(out, ", timestamp discontinuities %llu (device step %.1f)",
+                (unsigned long long)s->timestamp_discontinuities, s->device_delta_avg);
+    }
+    fputc('\n', out);
+    stats_histogram_print(&s->interval, "interval", out);
+    stats_histogram_print(&s->callback, "callback", out);
+
+    s->window_packets = 0;
+    s->window_start_us = now;
+    pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,72 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Bucket 0 counts values below 1 us, bucket i values in [2^(i-1), 2^i) us, the last one everything above
+#define STATS_HISTOGRAM_BUCKETS 24
+
+typedef struct {
+    uint64_t buckets[STATS_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    double sum;
+    double min;
+    double max;
+} StatsHistogram;
+
+void stats_histogram_add(StatsHistogram *h, double value_us);
+
+// Upper bound (in us) of the bucket holding the given percentile (0..100)
+double stats_histogram_percentile(const StatsHistogram *h, double percentile);
+
+// Prints count, mean, p50/p99/max and the non empty buckets on one line
+void stats_histogram_print(const StatsHistogram *h, const char *label, FILE *out);
+
+// Health of a stream of reports from a device (arrival rate, jitter, errors).
+// Updated from the reader thread, printed from any other thread.
+typedef struct {
+    const char *name;
+    pthread_mutex_t lock;
+
+    uint64_t packets;
+    uint64_t crc_failures;
+    uint64_t malformed;
+    uint64_t timestamp_discontinuities;
+    bool periodic;               // reports are expected at a fixed rate, gaps in the device timestamp count
+
+    double last_arrival_us;
+    double interval_mean;        // running mean and M2 of the inter-arrival time for the jitter
+    double interval_m2;
+    uint64_t interval_count;
+
+    bool have_device_ts;
+    uint32_t last_device_ts;
+    double device_delta_avg;     // smoothed device timestamp increment between reports
+    uint64_t device_delta_count;
+
+    uint64_t window_packets;     // packets since the last report, for the current rate
+    double window_start_us;
+
+    StatsHistogram interval;     // inter-arrival time
+    StatsHistogram callback;     // time the consumer callback took
+} StreamStats;
+
+// Monotonic time in microseconds
+double stats_now_us(void);
+
+void stats_stream_init(StreamStats *s, const char *name, bool periodic);
+void stats_stream_destroy(StreamStats *s);
+
+// A well formed report arrived at arrival_us carrying the device timestamp device_ts
+void stats_stream_packet(StreamStats *s, double arrival_us, uint32_t device_ts);
+void stats_stream_crc_failure(StreamStats *s);
+void stats_stream_malformed(StreamStats *s);
+void stats_stream_callback(StreamStats *s, double duration_us);
+
+// Prints the counters and histograms. The rate is measured since the previous print.
+void stats_stream_print(StreamStats *s, FILE *out);
+
+#endif // STATS_H
@@ -0,0 +1,169 @@
+/*  Colour converter check
+
+    Runs the NV24, YUYV and BGRA converters of utility.c over random frames of odd
+    and even sizes, with padded strides, for every matrix and range, and compares
+    the output byte for byte with a plain multiply-and-clamp reference. Built once
+    per converter path: the lookup tables, and on riscv64 with -march=rv64gcv the
+    RVV kernels (see make check-riscv).
+*/
+
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int y, y_offset, r_cr, g_cb, g_cr, b_cb;
+} Coefficients;
+
+static int fixed_8_8(double value) {
+    return value < 0.0 ? -(int)(-value * 256.0 + 0.5) : (int)(value * 256.0 + 0.5);
+}
+
+static Coefficients coefficients(const YuvFormat *format) {
+    bool bt709 = format && format->bt709;
+    bool full_range = format && format->full_range;
+    double kr = bt709 ? 0.2126 : 0.299;
+    double kb = bt709 ? 0.0722 : 0.114;
+    double kg = 1.0 - kr - kb;
+    double y_scale = full_range ? 1.0 : 255.0 / 219.0;
+    double c_scale = full_range ? 1.0 : 255.0 / 224.0;
+    Coefficients k = {
+        fixed_8_8(y_scale), full_range ? 0 : 16,
+        fixed_8_8(c_scale * 2.0 * (1.0 - kr)),
+        fixed_8_8(-c_scale * 2.0 * kb * (1.0 - kb) / kg),
+        fixed_8_8(-c_scale * 2.0 * kr * (1.0 - kr) / kg),
+        fixed_8_8(c_scale * 2.0 * (1.0 - kb))
+    };
+    return k;
+}
+
+static unsigned char clamp(int value) {
+    return value < 0 ? 0 : (value > 255 ? 255 : (unsigned char)value);
+}
+
+static void reference_pixel(const Coefficients *k, int y, int cb, int cr, unsigned char *r, unsigned char *g,
+                            unsigned char *b) {
+    int luma = k->y * (y - k->y_offset) + 128;
+    *r = clamp((luma + k->r_cr * (cr - 128)) >> 8);
+    *g = clamp((luma + k->g_cb * (cb - 128) + k->g_cr * (cr - 128)) >> 8);
+    *b = clamp((luma + k->b_cb * (cb - 128)) >> 8);
+}
+
+static void fill_random(unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char)(rand() >> 7);
+    }
+}
+
+static int report(const char *name, int width, int height, int format_index,
+                  const unsigned char *out, const unsigned char *expected, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (out[i] != expected[i]) {
+            fprintf(stderr, "%s %dx%d format %d: byte %zu (pixel %zu) is %d, expected %d\n", name, width, height,
+                    format_index, i, i / 3, out[i], expected[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_nv24(int width, int height, const YuvFormat *format, int format_index) {
+    int y_stride = width + 5, uv_stride = width * 2 + 7;
+    unsigned char *y_plane = malloc((size_t)y_stride * height);
+    unsigned char *uv_plane = malloc((size_t)uv_stride * height);
+    unsigned char *out = malloc((size_t)width * height * 3);
+    unsigned char *expected = malloc((size_t)width * height * 3);
+    fill_random(y_plane, (size_t)y_stride * height);
+    fill_random(uv_plane, (size_t)uv_stride * height);
+
+    Coefficients k = coefficients(format);
+    for (int row = 0; row < height; row++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char *p = expected + ((size_t)row * width + x) * 3;
+            reference_pixel(&k, y_plane[row * y_stride + x], uv_plane[row * uv_stride + 2 * x],
+                            uv_plane[row * uv_stride + 2 * x + 1], &p[0], &p[1], &p[2]);
+        }
+    }
+    convert_nv24_to_rgb(y_plane, y_stride, uv_plane, uv_stride, out, width, height, format);
+    int failed = report("NV24", width, height, format_index, out, expected, (size_t)width * height * 3);
+    free(y_plane); free(uv_plane); free(out); free(expected);
+    return failed;
+}
+
+static int check_yuyv(int width, int height, const YuvFormat *format, int format_index) {
+    int stride = ((width + 1) / 2) * 4 + 6;
+    size_t size = (size_t)stride * height;
+    unsigned char *yuyv = malloc(size);
+    unsigned char *out = malloc((size_t)width * height * 3);
+    unsigned char *expected = malloc((size_t)width * height * 3);
+    fill_random(yuyv, size);
+
+    Coefficients k = coefficients(format);
+    for (int row = 0; row < height; row++) {
+        const unsigned char *src = yuyv + (size_t)row * stride;
+        for (int x = 0; x < width; x++) {
+            unsigned char *p = expected + ((size_t)row * width + x) * 3;
+            int pair = x / 2 * 4;
+            reference_pixel(&k, src[x * 2], src[pair + 1], src[pair + 3], &p[2], &p[1], &p[0]);
+        }
+    }
+    convert_yuyv_to_bgr(yuyv, stride, out, width, height, size, format);
+    int failed = report("YUYV", width, height, format_index, out, expected, (size_t)width * height * 3);
+    free(yuyv); free(out); free(expected);
+    return failed;
+}
+
+static int check_bgra(int width, int height) {
+    int stride = width * 4 + 12;
+    unsigned char *bgra = malloc((size_t)stride * height);
+    unsigned char *out = malloc((size_t)width * height * 3);
+    unsigned char *expected = malloc((size_t)width * height * 3);
+    fill_random(bgra, (size_t)stride * height);
+    for (int row = 0; row < height; row++) {
+        for (int x = 0; x < width; x++) {
+            const unsigned char *src = bgra + (size_t)row * stride + x * 4;
+            unsigned char *p = expected + ((size_t)row * width + x) * 3;
+            p[0] = src[2];
+            p[1] = src[1];
+            p[2] = src[0];
+        }
+    }
+    convert_bgra_to_rgb(bgra, stride, out, width, height);
+    int failed = report("BGRA", width, height, 0, out, expected, (size_t)width * height * 3);
+    free(bgra); free(out); free(expected);
+    return failed;
+}
+
+int main(void) {
+    static const int sizes[][2] = {
+        {1, 1}, {2, 1}, {3, 2}, {7, 3}, {16, 4}, {31, 5}, {33, 2}, {64, 3}, {127, 2}, {257, 3}, {1920, 4}
+    };
+    // NULL is what the capture path passes for BT.601 limited range
+    const YuvFormat formats[4] = {
+        {YUV_LAYOUT_NONE, false, true}, {YUV_LAYOUT_NONE, true, false}, {YUV_LAYOUT_NONE, true, true},
+        {YUV_LAYOUT_NONE, false, false}
+    };
+    srand(1);
+    int failed = 0;
+    int checks = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int width = sizes[s][0], height = sizes[s][1];
+        for (int f = 0; f <= 4; f++) {
+            const YuvFormat *format = f == 0 ? NULL : &formats[f - 1];
+            failed += check_nv24(width, height, format, f);
+            failed += check_yuyv(width, height, format, f);
+            checks += 2;
+        }
+        failed += check_bgra(width, height);
+        checks++;
+    }
+#if defined(ARCH_RISCV64) && defined(__riscv_vector)
+    const char *path = "RVV kernels";
+#else
+    const char *path = "lookup tables";
+#endif
+    printf("convert_check (%s): %d of %d checks failed\n", path, failed, checks);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,83 @@
+/*  GLES renderer check
+
+    Draws render_scene.h with gles_renderer.c in an OpenGL ES 3.0 surfaceless EGL
+    pbuffer and compares flat, curved and passthrough output with the desktop GL
+    reference render_reference wrote into the directory given as the first argument.
+*/
+
+#include "render_scene.h"
+#include "gles_renderer.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// Shader and fixed function interpolation round differently by one step at most
+#define GLES_CHECK_TOLERANCE 1
+
+static bool make_context(void) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = get_platform_display ?
+        get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) : EGL_NO_DISPLAY;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_ES_API)) {
+        return false;
+    }
+    const EGLint config_attributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24, EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT, EGL_NONE
+    };
+    const EGLint surface_attributes[] = {EGL_WIDTH, SCENE_WIDTH, EGL_HEIGHT, SCENE_HEIGHT, EGL_NONE};
+    const EGLint context_attributes[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_NONE};
+    EGLConfig config;
+    EGLint count;
+    if (!eglChooseConfig(display, config_attributes, &config, 1, &count) || count == 0) return false;
+    EGLSurface surface = eglCreatePbufferSurface(display, config, surface_attributes);
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+    return surface != EGL_NO_SURFACE && context != EGL_NO_CONTEXT &&
+           eglMakeCurrent(display, surface, surface, context);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : ".";
+    if (!make_context()) {
+        fprintf(stderr, "gles_check: No surfaceless EGL context with OpenGL ES 3.0\n");
+        return EXIT_FAILURE;
+    }
+    printf("gles_check: %s\n", (const char *)glGetString(GL_RENDERER));
+    if (!gles_renderer_init() ||
+        !gles_renderer_set_texture(SCENE_FRAME_WIDTH, SCENE_FRAME_HEIGHT, GL_BGR)) {
+        return EXIT_FAILURE;
+    }
+    unsigned char *frame = scene_frame();
+    gles_renderer_upload(frame);
+    glEnable(GL_DEPTH_TEST);
+    glViewport(0, 0, SCENE_WIDTH, SCENE_HEIGHT);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    float projection[16], modelview[16];
+    scene_matrices(projection, modelview);
+    unsigned char *rgba = malloc(SCENE_BYTES);
+    bool ok = true;
+    for (int view = 0; view < 3; view++) {
+        unsigned char *expected = scene_read(dir, scene_views[view]);
+        if (!expected) return EXIT_FAILURE;
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (view < 2) {
+            gles_renderer_draw_plane(gles_renderer_texture(), scene_aspect(), view == 1, projection, modelview);
+        } else {
+            gles_renderer_draw_passthrough(gles_renderer_texture(), 0, 0, SCENE_WIDTH, SCENE_HEIGHT);
+        }
+        glReadPixels(0, 0, SCENE_WIDTH, SCENE_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+        ok &= glGetError() == GL_NO_ERROR &&
+              scene_compare("gles_check", scene_views[view], expected, rgba, GLES_CHECK_TOLERANCE, 0);
+        free(expected);
+    }
+    gles_renderer_cleanup();
+    free(rgba);
+    free(frame);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
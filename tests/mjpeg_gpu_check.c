@@ -0,0 +1,173 @@
+/*  MJPEG GPU decoder check
+
+    Encodes a test picture with libjpeg (4:2:0, 4:2:2, 4:4:0, 4:4:4 and greyscale, at a size
+    that fills whole MCUs and at one that doesn't), decodes every JPEG with
+    mjpeg_gpu.c in a surfaceless EGL context and with convert_mjpeg_to_rgb(), the
+    libjpeg path the capture thread falls back to, and compares the pixels. The shaders
+    replicate libjpeg's integer arithmetic, so the outputs have to be identical.
+*/
+
+#include "mjpeg_gpu.h"
+#include "utility.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <jpeglib.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+typedef struct {
+    const char *name;
+    int components;
+    int h_sampling;     // of the luma component, chroma has 1x1
+    int v_sampling;
+} Subsampling;
+
+static bool make_context(void) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = get_platform_display ?
+        get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) : EGL_NO_DISPLAY;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_API)) {
+        return false;
+    }
+    const EGLint config_attributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE
+    };
+    const EGLint surface_attributes[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+    EGLConfig config;
+    EGLint count;
+    if (!eglChooseConfig(display, config_attributes, &config, 1, &count) || count == 0) return false;
+    EGLSurface surface = eglCreatePbufferSurface(display, config, surface_attributes);
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+    return surface != EGL_NO_SURFACE && context != EGL_NO_CONTEXT &&
+           eglMakeCurrent(display, surface, surface, context);
+}
+
+// Gradients, a checkerboard and noise, so every coefficient of the blocks is in use
+static unsigned char *test_picture(int width, int height) {
+    unsigned char *rgb = malloc((size_t)width * height * 3);
+    unsigned int seed = 1;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char *p = rgb + ((size_t)y * width + x) * 3;
+            seed = seed * 1103515245u + 12345u;
+            int noise = (int)(seed >> 27) - 16;
+            int check = ((x / 7 + y / 5) & 1) ? 60 : 0;
+            int r = x * 255 / width + noise;
+            int g = y * 255 / height - check + noise;
+            int b = 255 - (x + y) * 255 / (width + height) + check;
+            p[0] = (unsigned char)(r < 0 ? 0 : (r > 255 ? 255 : r));
+            p[1] = (unsigned char)(g < 0 ? 0 : (g > 255 ? 255 : g));
+            p[2] = (unsigned char)(b < 0 ? 0 : (b > 255 ? 255 : b));
+        }
+    }
+    return rgb;
+}
+
+static unsigned char *encode(const unsigned char *rgb, int width, int height, const Subsampling *mode,
+                             unsigned long *size) {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    unsigned char *jpeg = NULL;
+    *size = 0;
+    jpeg_mem_dest(&cinfo, &jpeg, size);
+    cinfo.image_width = (JDIMENSION)width;
+    cinfo.image_height = (JDIMENSION)height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    if (mode->components == 1) jpeg_set_colorspace(&cinfo, JCS_GRAYSCALE);
+    cinfo.comp_info[0].h_samp_factor = mode->h_sampling;
+    cinfo.comp_info[0].v_samp_factor = mode->v_sampling;
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = (JSAMPROW)(rgb + (size_t)cinfo.next_scanline * width * 3);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return jpeg;
+}
+
+static bool check(int width, int height, const Subsampling *mode) {
+    unsigned char *picture = test_picture(width, height);
+    unsigned long jpeg_size;
+    unsigned char *jpeg = encode(picture, width, height, mode, &jpeg_size);
+
+    size_t pixels = (size_t)width * height;
+    unsigned char *expected = malloc(pixels * 3);
+    unsigned char *actual = calloc(1, pixels * 3);
+    convert_mjpeg_to_rgb(jpeg, jpeg_size, expected, width, height);
+
+    size_t buffer_size = mjpeg_gpu_buffer_size(width, height);
+    unsigned char *coefficients = malloc(buffer_size);
+    GLRenderTarget target = {0, 0, 0, 0, 0};
+    bool decoded = mjpeg_gpu_read_coefficients(jpeg, jpeg_size, width, height, coefficients, buffer_size) &&
+                   gl_utility_create_target(&target, width, height, GL_RGB8) &&
+                   mjpeg_gpu_render(target.texture, coefficients);
+    if (decoded) {
+        glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, actual);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        decoded = glGetError() == GL_NO_ERROR;
+    }
+
+    int max_difference = 0;
+    size_t differing = 0;
+    for (size_t i = 0; i < pixels; i++) {
+        int difference = 0;
+        for (int c = 0; c < 3; c++) {
+            int d = abs(expected[i * 3 + c] - actual[i * 3 + c]);
+            if (d > difference) difference = d;
+        }
+        if (difference > 0) differing++;
+        if (difference > max_difference) max_difference = difference;
+    }
+    bool ok = decoded && differing == 0;
+    if (decoded) {
+        printf("mjpeg_gpu_check %dx%d %s: max difference %d, %zu of %zu pixels differ: %s\n", width, height,
+               mode->name, max_difference, differing, pixels, ok ? "ok" : "FAILED");
+    } else {
+        printf("mjpeg_gpu_check %dx%d %s: the GPU decoder did not take the frame: FAILED\n", width, height,
+               mode->name);
+    }
+
+    gl_utility_destroy_target(&target);
+    free(coefficients);
+    free(actual);
+    free(expected);
+    free(jpeg);
+    free(picture);
+    return ok;
+}
+
+int main(void) {
+    if (!make_context()) {
+        fprintf(stderr, "mjpeg_gpu_check: No surfaceless EGL context with desktop OpenGL\n");
+        return EXIT_FAILURE;
+    }
+    printf("mjpeg_gpu_check: %s\n", (const char *)glGetString(GL_RENDERER));
+    if (!mjpeg_gpu_init(false)) return EXIT_FAILURE;
+
+    static const Subsampling modes[] = {
+        {"4:2:0", 3, 2, 2}, {"4:2:2", 3, 2, 1}, {"4:4:0", 3, 1, 2}, {"4:4:4", 3, 1, 1},
+        {"greyscale", 1, 1, 1}
+    };
+    // Whole MCUs, and partial ones at the right and bottom edge
+    static const int sizes[][2] = {{320, 176}, {333, 197}};
+    bool ok = true;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            ok &= check(sizes[s][0], sizes[s][1], &modes[m]);
+        }
+    }
+    mjpeg_gpu_cleanup();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,126 @@
+/*  Desktop GL reference output of the test scene
+
+    Draws render_scene.h with the fixed function code of display() (and the window
+    aligned quad present_passthrough() falls back to) into a surfaceless EGL pbuffer,
+    and writes reference_<view>.raw into the directory given as the first argument.
+*/
+
+#include "render_scene.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <math.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static bool make_context(void) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = get_platform_display ?
+        get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) : EGL_NO_DISPLAY;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_API)) {
+        return false;
+    }
+    const EGLint config_attributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE
+    };
+    const EGLint surface_attributes[] = {EGL_WIDTH, SCENE_WIDTH, EGL_HEIGHT, SCENE_HEIGHT, EGL_NONE};
+    EGLConfig config;
+    EGLint count;
+    if (!eglChooseConfig(display, config_attributes, &config, 1, &count) || count == 0) return false;
+    EGLSurface surface = eglCreatePbufferSurface(display, config, surface_attributes);
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+    return surface != EGL_NO_SURFACE && context != EGL_NO_CONTEXT &&
+           eglMakeCurrent(display, surface, surface, context);
+}
+
+static void draw_plane(bool curved) {
+    float aspect_ratio = scene_aspect();
+    if (curved) {
+        const int segments = 32;
+        const float curve_angle = (float)M_PI / 4.0f;
+        const float width = 2.0f * aspect_ratio;
+        const float radius = width / (2.0f * sinf(curve_angle / 2.0f));
+        glBegin(GL_TRIANGLE_STRIP);
+        for (int i = 0; i <= segments; ++i) {
+            float t = (float)i / (float)segments;
+            float angle = -curve_angle / 2.0f + t * curve_angle;
+            float x = radius * sinf(angle);
+            float z = radius * (cosf(angle) - 1.0f);
+            glTexCoord2f(t, 1.0f); glVertex3f(x, -1.0f, z);
+            glTexCoord2f(t, 0.0f); glVertex3f(x,  1.0f, z);
+        }
+        glEnd();
+    } else {
+        glBegin(GL_QUADS);
+            glTexCoord2f(0.0f, 1.0f); glVertex3f(-aspect_ratio, -1.0f, 0.0f);
+            glTexCoord2f(1.0f, 1.0f); glVertex3f( aspect_ratio, -1.0f, 0.0f);
+            glTexCoord2f(1.0f, 0.0f); glVertex3f( aspect_ratio,  1.0f, 0.0f);
+            glTexCoord2f(0.0f, 0.0f); glVertex3f(-aspect_ratio,  1.0f, 0.0f);
+        glEnd();
+    }
+}
+
+static void draw_passthrough(void) {
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glBegin(GL_QUADS);
+        glTexCoord2f(0.0f, 1.0f); glVertex2f(-1.0f, -1.0f);
+        glTexCoord2f(1.0f, 1.0f); glVertex2f( 1.0f, -1.0f);
+        glTexCoord2f(1.0f, 0.0f); glVertex2f( 1.0f,  1.0f);
+        glTexCoord2f(0.0f, 0.0f); glVertex2f(-1.0f,  1.0f);
+    glEnd();
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : ".";
+    if (!make_context()) {
+        fprintf(stderr, "render_reference: No surfaceless EGL context with desktop OpenGL\n");
+        return EXIT_FAILURE;
+    }
+    printf("render_reference: %s\n", (const char *)glGetString(GL_RENDERER));
+
+    unsigned char *frame = scene_frame();
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, SCENE_FRAME_WIDTH, SCENE_FRAME_HEIGHT, 0, GL_BGR, GL_UNSIGNED_BYTE, frame);
+    glEnable(GL_TEXTURE_2D);
+    glEnable(GL_DEPTH_TEST);
+    glViewport(0, 0, SCENE_WIDTH, SCENE_HEIGHT);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    float projection[16], modelview[16];
+    scene_matrices(projection, modelview);
+    unsigned char *rgba = malloc(SCENE_BYTES);
+    for (int view = 0; view < 3; view++) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (view < 2) {
+            glMatrixMode(GL_PROJECTION);
+            glLoadMatrixf(projection);
+            glMatrixMode(GL_MODELVIEW);
+            glLoadMatrixf(modelview);
+            draw_plane(view == 1);
+        } else {
+            draw_passthrough();
+        }
+        glReadPixels(0, 0, SCENE_WIDTH, SCENE_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+        if (glGetError() != GL_NO_ERROR || !scene_write(dir, scene_views[view], rgba)) {
+            fprintf(stderr, "render_reference: Drawing the %s view failed\n", scene_views[view]);
+            return EXIT_FAILURE;
+        }
+    }
+    free(rgba);
+    free(frame);
+    return EXIT_SUCCESS;
+}
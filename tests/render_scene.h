@@ -0,0 +1,110 @@
+/*  Test scene shared by the renderer checks
+
+    A 320x180 BGR frame (gradients and a checkerboard) on the screen plane, tilted the
+    way display() transforms it, drawn into a 640x360 output. render_reference draws it
+    with the desktop GL fixed function path and writes the output as raw RGBA files,
+    bottom row first as glReadPixels returns it. The other checks draw the same scene
+    with their renderer and compare.
+*/
+
+#ifndef RENDER_SCENE_H
+#define RENDER_SCENE_H
+
+#include "gl_utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SCENE_FRAME_WIDTH 320
+#define SCENE_FRAME_HEIGHT 180
+#define SCENE_WIDTH 640
+#define SCENE_HEIGHT 360
+#define SCENE_BYTES ((size_t)SCENE_WIDTH * SCENE_HEIGHT * 4)
+
+// Flat plane, curved plane, and the frame stretched over the whole output (passthrough)
+static const char *const scene_views[3] = {"flat", "curved", "passthrough"};
+
+static inline unsigned char *scene_frame(void) {
+    unsigned char *bgr = malloc((size_t)SCENE_FRAME_WIDTH * SCENE_FRAME_HEIGHT * 3);
+    for (int y = 0; y < SCENE_FRAME_HEIGHT; y++) {
+        for (int x = 0; x < SCENE_FRAME_WIDTH; x++) {
+            unsigned char *p = bgr + ((size_t)y * SCENE_FRAME_WIDTH + x) * 3;
+            p[0] = (unsigned char)(x * 255 / SCENE_FRAME_WIDTH);
+            p[1] = (unsigned char)(y * 255 / SCENE_FRAME_HEIGHT);
+            p[2] = ((x / 20 + y / 20) & 1) ? 255 : 40;
+        }
+    }
+    return bgr;
+}
+
+static inline float scene_aspect(void) {
+    return (float)SCENE_FRAME_WIDTH / SCENE_FRAME_HEIGHT;
+}
+
+// What reshape() and compute_plane_modelview() set up, with a fixed head pose
+static inline void scene_matrices(float projection[16], float modelview[16]) {
+    gl_utility_mat4_perspective(projection, 45.0f, (float)SCENE_WIDTH / SCENE_HEIGHT, 1.0f, 100.0f);
+    gl_utility_mat4_identity(modelview);
+    gl_utility_mat4_translate(modelview, 0.0f, 0.0f, -2.0f);
+    gl_utility_mat4_rotate(modelview, 20.0f, 0.0f, 1.0f, 0.0f);
+    gl_utility_mat4_rotate(modelview, 10.0f, 1.0f, 0.0f, 0.0f);
+    gl_utility_mat4_rotate(modelview, 5.0f, 0.0f, 0.0f, 1.0f);
+    gl_utility_mat4_translate(modelview, 0.0f, 0.0f, -2.0f);
+    gl_utility_mat4_scale(modelview, 1.2f, 1.2f, 1.0f);
+}
+
+static inline char *scene_path(const char *dir, const char *view) {
+    static char path[512];
+    snprintf(path, sizeof(path), "%s/reference_%s.raw", dir, view);
+    return path;
+}
+
+static inline bool scene_write(const char *dir, const char *view, const unsigned char *rgba) {
+    FILE *f = fopen(scene_path(dir, view), "wb");
+    if (!f) {
+        perror(scene_path(dir, view));
+        return false;
+    }
+    bool ok = fwrite(rgba, 1, SCENE_BYTES, f) == SCENE_BYTES;
+    fclose(f);
+    return ok;
+}
+
+static inline unsigned char *scene_read(const char *dir, const char *view) {
+    FILE *f = fopen(scene_path(dir, view), "rb");
+    if (!f) {
+        fprintf(stderr, "%s: missing, run render_reference first\n", scene_path(dir, view));
+        return NULL;
+    }
+    unsigned char *rgba = malloc(SCENE_BYTES);
+    size_t read = fread(rgba, 1, SCENE_BYTES, f);
+    fclose(f);
+    if (read != SCENE_BYTES) {
+        free(rgba);
+        return NULL;
+    }
+    return rgba;
+}
+
+// Compares the RGB of two outputs in the reference layout. Passes if at most max_outliers
+// pixels differ by more than tolerance in any channel.
+static inline bool scene_compare(const char *renderer, const char *view, const unsigned char *expected,
+                                 const unsigned char *actual, int tolerance, int max_outliers) {
+    int max_difference = 0;
+    int outliers = 0;
+    for (size_t i = 0; i < (size_t)SCENE_WIDTH * SCENE_HEIGHT; i++) {
+        int difference = 0;
+        for (int c = 0; c < 3; c++) {
+            int d = abs(expected[i * 4 + c] - actual[i * 4 + c]);
+            if (d > difference) difference = d;
+        }
+        if (difference > max_difference) max_difference = difference;
+        if (difference > tolerance) outliers++;
+    }
+    bool ok = outliers <= max_outliers;
+    printf("%s %s: max difference %d, %d pixels above %d: %s\n", renderer, view, max_difference, outliers,
+           tolerance, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+#endif // RENDER_SCENE_H
@@ -0,0 +1,106 @@
+/*  Software renderer check
+
+    Includes soft_renderer.c and points its output at a buffer in memory laid out like
+    an fbdev framebuffer, instead of opening a device. Draws render_scene.h into it as
+    XRGB8888 and as RGB565, with one thread and with several, and compares flat, curved
+    and passthrough output with the desktop GL reference render_reference wrote into
+    the directory given as the first argument. Presenting (KMS page flips, fbdev
+    panning) is not covered.
+*/
+
+#include "render_scene.h"
+#include "../soft_renderer.c"
+
+// The bilinear filter works on 8 bit fixed point weights, GL on more
+#define SOFT_CHECK_TOLERANCE 3
+// Pixels on the silhouette of the plane, sampled just inside or outside of it
+#define SOFT_CHECK_OUTLIERS 8
+// Dropped low bits of the 5 and 6 bit channels come on top
+#define SOFT_CHECK_TOLERANCE_565 (SOFT_CHECK_TOLERANCE + 8)
+
+static void memory_output(int bytes_per_pixel) {
+    output_type = OUTPUT_FBDEV;
+    output_width = SCENE_WIDTH;
+    output_height = SCENE_HEIGHT;
+    output_pitch = (size_t)SCENE_WIDTH * bytes_per_pixel;
+    output_bytes_per_pixel = bytes_per_pixel;
+    output_xrgb = bytes_per_pixel == 4;
+    output_red = (struct fb_bitfield){11, 5, 0};
+    output_green = (struct fb_bitfield){5, 6, 0};
+    output_blue = (struct fb_bitfield){0, 5, 0};
+    buffers[0].pixels = calloc(1, output_pitch * SCENE_HEIGHT);
+    buffer_count = 1;
+    back_buffer = 0;
+}
+
+static void start_workers(int threads) {
+    workers = calloc((size_t)threads, sizeof(pthread_t));
+    for (worker_count = 0; worker_count < threads - 1; worker_count++) {
+        pthread_create(&workers[worker_count], NULL, worker_func, NULL);
+    }
+}
+
+// Top down XRGB8888 or RGB565 to the bottom up RGBA of the reference
+static void read_output(unsigned char *rgba) {
+    for (int y = 0; y < SCENE_HEIGHT; y++) {
+        const unsigned char *row = buffers[0].pixels + (size_t)(SCENE_HEIGHT - 1 - y) * output_pitch;
+        for (int x = 0; x < SCENE_WIDTH; x++) {
+            unsigned char *p = rgba + ((size_t)y * SCENE_WIDTH + x) * 4;
+            if (output_bytes_per_pixel == 4) {
+                p[0] = row[x * 4 + 2];
+                p[1] = row[x * 4 + 1];
+                p[2] = row[x * 4 + 0];
+            } else {
+                uint16_t value = ((const uint16_t *)row)[x];
+                p[0] = (unsigned char)((value >> 11 & 0x1F) << 3);
+                p[1] = (unsigned char)((value >> 5 & 0x3F) << 2);
+                p[2] = (unsigned char)((value & 0x1F) << 3);
+            }
+            p[3] = 255;
+        }
+    }
+}
+
+static bool check(const char *dir, const unsigned char *frame, int bytes_per_pixel, int threads) {
+    memory_output(bytes_per_pixel);
+    start_workers(threads);
+    soft_renderer_upload(frame, SCENE_FRAME_WIDTH, SCENE_FRAME_HEIGHT, 3, true);
+
+    char name[64];
+    snprintf(name, sizeof(name), "soft_check (%s, %d threads)", bytes_per_pixel == 4 ? "XRGB8888" : "RGB565",
+             threads);
+    int tolerance = bytes_per_pixel == 4 ? SOFT_CHECK_TOLERANCE : SOFT_CHECK_TOLERANCE_565;
+    float projection[16], modelview[16];
+    scene_matrices(projection, modelview);
+    unsigned char *rgba = malloc(SCENE_BYTES);
+    bool ok = true;
+    for (int view = 0; view < 3 && ok; view++) {
+        unsigned char *expected = scene_read(dir, scene_views[view]);
+        if (!expected) {
+            ok = false;
+            break;
+        }
+        soft_renderer_clear();
+        if (view < 2) {
+            soft_renderer_draw_plane(scene_aspect(), view == 1, projection, modelview);
+        } else {
+            soft_renderer_draw_passthrough(0, 0, SCENE_WIDTH, SCENE_HEIGHT);
+        }
+        read_output(rgba);
+        ok &= scene_compare(name, scene_views[view], expected, rgba, tolerance, SOFT_CHECK_OUTLIERS);
+        free(expected);
+    }
+    free(rgba);
+    unsigned char *pixels = buffers[0].pixels;
+    soft_renderer_cleanup();
+    free(pixels);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : ".";
+    unsigned char *frame = scene_frame();
+    bool ok = check(dir, frame, 4, 1) && check(dir, frame, 4, 4) && check(dir, frame, 2, 4);
+    free(frame);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
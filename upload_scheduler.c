@@ -0,0 +1,340 @@
+/*  Budgeted, priority ordered texture upload scheduler
+
+    The frame is split into tiles of UPLOAD_TILE_WIDTH x UPLOAD_TILE_HEIGHT pixels.
+    Every render frame at most budget_bytes are uploaded so a large (4K) frame can
+    never push the draw of the head tracked plane past the next vblank.
+
+    Pending tiles are uploaded in this order:
+      1. tiles around the point the user is looking at (focus)
+      2. tiles that changed in the most recent frame (dirty)
+      3. everything else that is still waiting from earlier frames (periphery)
+    Within a class closer tiles come first. Tiles that stay pending for more than
+    UPLOAD_MAX_AGE_FRAMES render frames are promoted to the focus class.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "upload_scheduler.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Tiles whose centre is within this distance of the focus point (in tiles) belong to the focus class
+#define FOCUS_RADIUS_TILES 2.5f
+
+enum TileClass {
+    TILE_CLASS_FOCUS = 0,
+    TILE_CLASS_DIRTY = 1,
+    TILE_CLASS_PERIPHERY = 2
+};
+
+typedef struct {
+    int x, y, w, h;
+    bool pending;
+    bool dirty;                 // changed in the most recent frame
+    uint64_t hash;
+    uint64_t pending_since_frame;
+    double pending_since_ms;
+} UploadTile;
+
+typedef struct {
+    int index;
+    int tile_class;
+    float distance;
+} TileOrder;
+
+static UploadTile *tiles = NULL;
+static TileOrder *order = NULL;
+static int tiles_x = 0;
+static int tiles_y = 0;
+static int frame_width = 0;
+static int frame_height = 0;
+static int frame_bpp = 3;
+static size_t budget = 0;
+static float focus_u = 0.5f;
+static float focus_v = 0.5f;
+static uint64_t render_frame = 0;
+static size_t last_frame_bytes = 0;
+static int last_frame_tiles = 0;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void mark_pending(UploadTile *tile, double now) {
+    if (!tile->pending) {
+        tile->pending = true;
+        tile->pending_since_frame = render_frame;
+        tile->pending_since_ms = now;
+    }
+}
+
+size_t upload_scheduler_tile_count(int width, int height) {
+    if (width <= 0 || height <= 0) return 0;
+    size_t tx = (size_t)(width + UPLOAD_TILE_WIDTH - 1) / UPLOAD_TILE_WIDTH;
+    size_t ty = (size_t)(height + UPLOAD_TILE_HEIGHT - 1) / UPLOAD_TILE_HEIGHT;
+    return tx * ty;
+}
+
+bool upload_scheduler_init(int width, int height, int bytes_per_pixel, size_t budget_bytes) {
+    upload_scheduler_shutdown();
+
+    size_t count = upload_scheduler_tile_count(width, height);
+    if (count == 0 || budget_bytes == 0) {
+        return false;
+    }
+
+    tiles = calloc(count, sizeof(*tiles));
+    order = calloc(count, sizeof(*order));
+    if (!tiles || !order) {
+        fprintf(stderr, "upload_scheduler_init: Failed to allocate %zu tiles\n", count);
+        upload_scheduler_shutdown();
+        return false;
+    }
+
+    frame_width = width;
+    frame_height = height;
+    frame_bpp = bytes_per_pixel;
+    budget = budget_bytes;
+    tiles_x = (width + UPLOAD_TILE_WIDTH - 1) / UPLOAD_TILE_WIDTH;
+    tiles_y = (height + UPLOAD_TILE_HEIGHT - 1) / UPLOAD_TILE_HEIGHT;
+
+    double now = now_ms();
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            UploadTile *tile = &tiles[ty * tiles_x + tx];
+            tile->x = tx * UPLOAD_TILE_WIDTH;
+            tile->y = ty * UPLOAD_TILE_HEIGHT;
+            tile->w = (tile->x + UPLOAD_TILE_WIDTH <= width) ? UPLOAD_TILE_WIDTH : width - tile->x;
+            tile->h = (tile->y + UPLOAD_TILE_HEIGHT <= height) ? UPLOAD_TILE_HEIGHT : height - tile->y;
+            mark_pending(tile, now);
+        }
+    }
+
+    printf("Upload scheduler: %dx%d frame, %dx%d tiles, budget %zu bytes per frame\n",
+           width, height, tiles_x, tiles_y, budget);
+    return true;
+}
+
+void upload_scheduler_shutdown(void) {
+    free(tiles);
+    free(order);
+    tiles = NULL;
+    order = NULL;
+    tiles_x = tiles_y = 0;
+    frame_width = frame_height = 0;
+    render_frame = 0;
+    last_frame_bytes = 0;
+    last_frame_tiles = 0;
+}
+
+bool upload_scheduler_active(void) {
+    return tiles != NULL;
+}
+
+// 64 bit multiply/xor-shift hash over the rows of one tile, eight bytes at a time
+static uint64_t hash_tile(const unsigned char *frame, int width, int bpp, int x, int y, int w, int h) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL;
+    size_t row_bytes = (size_t)w * bpp;
+    size_t stride = (size_t)width * bpp;
+
+    for (int row = 0; row < h; row++) {
+        const unsigned char *p = frame + (size_t)(y + row) * stride + (size_t)x * bpp;
+        size_t i = 0;
+        for (; i + 8 <= row_bytes; i += 8) {
+            uint64_t word;
+            memcpy(&word, p + i, sizeof(word));
+            hash = (hash ^ word) * 0x100000001B3ULL;
+            hash ^= hash >> 29;
+        }
+        for (; i < row_bytes; i++) {
+            hash = (hash ^ p[i]) * 0x100000001B3ULL;
+        }
+    }
+    return hash;
+}
+
+void upload_scheduler_hash_tiles(const unsigned char *frame, int width, int height,
+                                 int bytes_per_pixel, uint64_t *hashes) {
+    int tx_count = (width + UPLOAD_TILE_WIDTH - 1) / UPLOAD_TILE_WIDTH;
+    int ty_count = (height + UPLOAD_TILE_HEIGHT - 1) / UPLOAD_TILE_HEIGHT;
+
+    for (int ty = 0; ty < ty_count; ty++) {
+        int y = ty * UPLOAD_TILE_HEIGHT;
+        int h = (y + UPLOAD_TILE_HEIGHT <= height) ? UPLOAD_TILE_HEIGHT : height - y;
+        for (int tx = 0; tx < tx_count; tx++) {
+            int x = tx * UPLOAD_TILE_WIDTH;
+            int w = (x + UPLOAD_TILE_WIDTH <= width) ? UPLOAD_TILE_WIDTH : width - x;
+            hashes[ty * tx_count + tx] = hash_tile(frame, width, bytes_per_pixel, x, y, w, h);
+        }
+    }
+}
+
+void upload_scheduler_new_frame(const uint64_t *hashes) {
+    if (!tiles) return;
+
+    double now = now_ms();
+    int count = tiles_x * tiles_y;
+    for (int i = 0; i < count; i++) {
+        UploadTile *tile = &tiles[i];
+        if (!hashes || hashes[i] != tile->hash) {
+            tile->dirty = true;
+            if (hashes) tile->hash = hashes[i];
+            mark_pending(tile, now);
+        } else {
+            tile->dirty = false;
+        }
+    }
+}
+
+void upload_scheduler_invalidate(void) {
+    if (!tiles) return;
+
+    double now = now_ms();
+    int count = tiles_x * tiles_y;
+    for (int i = 0; i < count; i++) {
+        mark_pending(&tiles[i], now);
+    }
+}
+
+void upload_scheduler_set_focus(float u, float v) {
+    focus_u = u < 0.0f ? 0.0f : (u > 1.0f ? 1.0f : u);
+    focus_v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+static int compare_tile_order(const void *a, const void *b) {
+    const TileOrder *ta = a;
+    const TileOrder *tb = b;
+    if (ta->tile_class != tb->tile_class) return ta->tile_class - tb->tile_class;
+    if (ta->distance < tb->distance) return -1;
+    if (ta->distance > tb->distance) return 1;
+    return ta->index - tb->index;
+}
+
+bool upload_scheduler_pending(void) {
+    int count = tiles ? tiles_x * tiles_y : 0;
+    for (int i = 0; i < count; i++) {
+        if (tiles[i].pending) return true;
+    }
+    return false;
+}
+
+size_t upload_scheduler_run(upload_region_fn upload, void *user) {
+    if (!tiles) return 0;
+
+    render_frame++;
+
+    // Focus point in tile units
+    float fx = focus_u * (float)frame_width / UPLOAD_TILE_WIDTH;
+    float fy = focus_v * (float)frame_height / UPLOAD_TILE_HEIGHT;
+
+    int n_pending = 0;
+    int count = tiles_x * tiles_y;
+    for (int i = 0; i < count; i++) {
+        UploadTile *tile = &tiles[i];
+        if (!tile->pending) continue;
+
+        float cx = ((float)tile->x + tile->w * 0.5f) / UPLOAD_TILE_WIDTH;
+        float cy = ((float)tile->y + tile->h * 0.5f) / UPLOAD_TILE_HEIGHT;
+        float distance = sqrtf((cx - fx) * (cx - fx) + (cy - fy) * (cy - fy));
+
+        int tile_class;
+        if (distance <= FOCUS_RADIUS_TILES ||
+            render_frame - tile->pending_since_frame > UPLOAD_MAX_AGE_FRAMES) {
+            tile_class = TILE_CLASS_FOCUS;
+        } else if (tile->dirty) {
+            tile_class = TILE_CLASS_DIRTY;
+        } else {
+            tile_class = TILE_CLASS_PERIPHERY;
+        }
+
+        order[n_pending].index = i;
+        order[n_pending].tile_class = tile_class;
+        order[n_pending].distance = distance;
+        n_pending++;
+    }
+
+    qsort(order, n_pending, sizeof(*order), compare_tile_order);
+
+    size_t uploaded = 0;
+    int uploaded_tiles = 0;
+    for (int i = 0; i < n_pending; i++) {
+        UploadTile *tile = &tiles[order[i].index];
+        size_t bytes = (size_t)tile->w * tile->h * frame_bpp;
+        if (uploaded_tiles > 0 && uploaded + bytes > budget) {
+            break;
+        }
+        upload(tile->x, tile->y, tile->w, tile->h, user);
+        tile->pending = false;
+        tile->dirty = false;
+        uploaded += bytes;
+        uploaded_tiles++;
+    }
+
+    last_frame_bytes = uploaded;
+    last_frame_tiles = uploaded_tiles;
+    return uploaded;
+}
+
+size_t upload_scheduler_budget_left(void) {
+    return last_frame_bytes < budget ? budget - last_frame_bytes : 0;
+}
+
+void upload_scheduler_charge(size_t bytes) {
+    last_frame_bytes += bytes;
+}
+
+void upload_scheduler_get_stats(UploadSchedulerStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!tiles) return;
+
+    double now = now_ms();
+    stats->frames = render_frame;
+    stats->last_frame_bytes = last_frame_bytes;
+    stats->last_frame_tiles = last_frame_tiles;
+
+    int count = tiles_x * tiles_y;
+    for (int i = 0; i < count; i++) {
+        const UploadTile *tile = &tiles[i];
+        if (!tile->pending) continue;
+        stats->backlog_tiles++;
+        stats->backlog_bytes += (size_t)tile->w * tile->h * frame_bpp;
+        double age = now - tile->pending_since_ms;
+        if (age > stats->max_age_ms) stats->max_age_ms = age;
+    }
+}
+
+void upload_scheduler_print_report(FILE *out) {
+    if (!tiles) {
+        fprintf(out, "Upload scheduler: inactive\n");
+        return;
+    }
+
+    UploadSchedulerStats stats;
+    upload_scheduler_get_stats(&stats);
+
+    fprintf(out, "Upload scheduler: last frame %zu bytes in %d tiles (budget %zu), "
+                 "backlog %d tiles / %zu bytes, oldest %.1f ms, focus (%.2f, %.2f)\n",
+            stats.last_frame_bytes, stats.last_frame_tiles, budget,
+            stats.backlog_tiles, stats.backlog_bytes, stats.max_age_ms, focus_u, focus_v);
+
+    // Age map: '.' uploaded, 0-9 render frames pending, '+' more than 9
+    fprintf(out, "Upload scheduler: region age map (render frames pending)\n");
+    for (int ty = 0; ty < tiles_y; ty++) {
+        fprintf(out, "  ");
+        for (int tx = 0; tx < tiles_x; tx++) {
+            const UploadTile *tile = &tiles[ty * tiles_x + tx];
+            if (!tile->pending) {
+                fputc('.', out);
+            } else {
+                uint64_t age = render_frame - tile->pending_since_frame;
+                fputc(age > 9 ? '+' : (char)('0' + age), out);
+            }
+        }
+        fputc('\n', out);
+    }
+}
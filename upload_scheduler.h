@@ -0,0 +1,80 @@
+#ifndef UPLOAD_SCHEDULER_H
+#define UPLOAD_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Size of one upload region (tile) in pixels
+#define UPLOAD_TILE_WIDTH  128
+#define UPLOAD_TILE_HEIGHT 128
+
+// Tiles that have been waiting longer than this many render frames are
+// promoted to the highest priority so the periphery can never starve.
+#define UPLOAD_MAX_AGE_FRAMES 8
+
+// Called by upload_scheduler_run() for every region that fits into the budget.
+// x, y, w, h are in pixels of the full frame.
+typedef void (*upload_region_fn)(int x, int y, int w, int h, void *user);
+
+typedef struct {
+    uint64_t frames;              // render frames the scheduler ran for
+    size_t   last_frame_bytes;    // bytes uploaded in the most recent render frame
+    int      last_frame_tiles;    // tiles uploaded in the most recent render frame
+    int      backlog_tiles;       // tiles still waiting for upload
+    size_t   backlog_bytes;       // bytes still waiting for upload
+    double   max_age_ms;          // age of the oldest waiting tile
+} UploadSchedulerStats;
+
+// (Re)initializes the scheduler for a frame of the given size.
+// budget_bytes is the number of bytes that may be uploaded per render frame.
+// All tiles start out pending.
+bool upload_scheduler_init(int width, int height, int bytes_per_pixel, size_t budget_bytes);
+
+// Frees the scheduler state.
+void upload_scheduler_shutdown(void);
+
+// Returns true if upload_scheduler_init() succeeded and the scheduler is active.
+bool upload_scheduler_active(void);
+
+// Number of tiles for a frame of the given size. Used to size hash arrays.
+size_t upload_scheduler_tile_count(int width, int height);
+
+// Computes one content hash per tile. Does not touch scheduler state, so it
+// can run on the capture thread right after conversion.
+void upload_scheduler_hash_tiles(const unsigned char *frame, int width, int height,
+                                 int bytes_per_pixel, uint64_t *hashes);
+
+// Hands a new frame to the scheduler. Tiles whose hash changed are marked dirty;
+// tiles still pending from previous frames stay in the backlog.
+// hashes may be NULL, in which case every tile is treated as dirty.
+void upload_scheduler_new_frame(const uint64_t *hashes);
+
+// Marks every tile as pending, e.g. after the texture was re-specified.
+void upload_scheduler_invalidate(void);
+
+// Sets the point the user is looking at in texture coordinates (0..1).
+void upload_scheduler_set_focus(float u, float v);
+
+// True if any tile waits for upload_scheduler_run().
+bool upload_scheduler_pending(void);
+
+// Uploads pending tiles in priority order until the budget is used up.
+// At least one tile is uploaded per call if any are pending.
+// Returns the number of bytes uploaded.
+size_t upload_scheduler_run(upload_region_fn upload, void *user);
+
+// Bytes of the budget upload_scheduler_run() left over in this render frame.
+size_t upload_scheduler_budget_left(void);
+
+// Counts bytes uploaded after upload_scheduler_run() in this render frame (the CPU mip
+// levels) against the budget.
+void upload_scheduler_charge(size_t bytes);
+
+void upload_scheduler_get_stats(UploadSchedulerStats *stats);
+
+// Prints backlog totals and the age of every pending region as a tile map.
+void upload_scheduler_print_report(FILE *out);
+
+#endif // UPLOAD_SCHEDULER_H
@@ -0,0 +1,209 @@
+/*  GPU upscaling of the captured frame so sources can be captured at a reduced resolution.
+
+    Two fragment shader passes modelled after AMD FidelityFX Super Resolution 1:
+
+    EASU  Edge adaptive spatial upsampling. A 12 tap lanczos like kernel whose shape is
+          stretched along the local edge direction, followed by clamping to the 2x2
+          neighbourhood to avoid ringing.
+    RCAS  Robust contrast adaptive sharpening. A 5 tap cross whose negative lobe is limited
+          so it never pushes a pixel outside the range of its neighbours.
+
+    The shaders only use GLSL 1.20 so they run on Mesa llvmpipe as well as on SBC GPUs.
+*/
+
+#include "upscale.h"
+
+#include <stdio.h>
+#include <math.h>
+
+static const char *upscale_vertex_src =
+    "#version 120\n"
+    "void main() {\n"
+    "    gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+static const char *easu_fragment_src =
+    "#version 120\n"
+    "uniform sampler2D source;\n"
+    "uniform vec2 source_size;\n"
+    "\n"
+    "vec3 tap(vec2 p) { return texture2D(source, (p + 0.5) / source_size).rgb; }\n"
+    "float luma(vec3 c) { return dot(c, vec3(0.299, 0.587, 0.114)); }\n"
+    "\n"
+    "// Accumulates direction and edge strength of one of the four inner taps\n"
+    "void edge(inout vec2 dir, inout float len, float w,\n"
+    "          float up, float left, float centre, float right, float down) {\n"
+    "    float dir_x = right - left;\n"
+    "    float len_x = max(abs(right - centre), abs(centre - left));\n"
+    "    len_x = len_x > 0.0 ? clamp(abs(dir_x) / len_x, 0.0, 1.0) : 0.0;\n"
+    "    float dir_y = down - up;\n"
+    "    float len_y = max(abs(down - centre), abs(centre - up));\n"
+    "    len_y = len_y > 0.0 ? clamp(abs(dir_y) / len_y, 0.0, 1.0) : 0.0;\n"
+    "    dir += vec2(dir_x, dir_y) * w;\n"
+    "    len += (len_x * len_x + len_y * len_y) * w;\n"
+    "}\n"
+    "\n"
+    "void accumulate(inout vec3 acc, inout float wsum, vec2 offset, vec2 dir,\n"
+    "                vec2 len2, float lob, float clp, vec3 c) {\n"
+    "    vec2 v = vec2(dot(offset, dir), dot(offset, vec2(-dir.y, dir.x))) * len2;\n"
+    "    float d2 = min(dot(v, v), clp);\n"
+    "    float wb = 0.4 * d2 - 1.0;\n"
+    "    float wa = lob * d2 - 1.0;\n"
+    "    wb *= wb;\n"
+    "    wa *= wa;\n"
+    "    wb = 1.5625 * wb - 0.5625;\n"
+    "    float w = wb * wa;\n"
+    "    acc += c * w;\n"
+    "    wsum += w;\n"
+    "}\n"
+    "\n"
+    "void main() {\n"
+    "    vec2 pp = gl_TexCoord[0].xy * source_size - 0.5;\n"
+    "    vec2 fp = floor(pp);\n"
+    "    pp -= fp;\n"
+    "\n"
+    "    //    b c\n"
+    "    //  e f g h\n"
+    "    //  i j k l\n"
+    "    //    n o\n"
+    "    vec3 b = tap(fp + vec2( 0.0, -1.0));\n"
+    "    vec3 c = tap(fp + vec2( 1.0, -1.0));\n"
+    "    vec3 e = tap(fp + vec2(-1.0,  0.0));\n"
+    "    vec3 f = tap(fp);\n"
+    "    vec3 g = tap(fp + vec2( 1.0,  0.0));\n"
+    "    vec3 h = tap(fp + vec2( 2.0,  0.0));\n"
+    "    vec3 i = tap(fp + vec2(-1.0,  1.0));\n"
+    "    vec3 j = tap(fp + vec2( 0.0,  1.0));\n"
+    "    vec3 k = tap(fp + vec2( 1.0,  1.0));\n"
+    "    vec3 l = tap(fp + vec2( 2.0,  1.0));\n"
+    "    vec3 n = tap(fp + vec2( 0.0,  2.0));\n"
+    "    vec3 o = tap(fp + vec2( 1.0,  2.0));\n"
+    "\n"
+    "    float lb = luma(b), lc = luma(c), le = luma(e), lf = luma(f), lg = luma(g), lh = luma(h);\n"
+    "    float li = luma(i), lj = luma(j), lk = luma(k), ll = luma(l), ln = luma(n), lo = luma(o);\n"
+    "\n"
+    "    vec2 dir = vec2(0.0);\n"
+    "    float len = 0.0;\n"
+    "    edge(dir, len, (1.0 - pp.x) * (1.0 - pp.y), lb, le, lf, lg, lj);\n"
+    "    edge(dir, len, pp.x * (1.0 - pp.y), lc, lf, lg, lh, lk);\n"
+    "    edge(dir, len, (1.0 - pp.x) * pp.y, lf, li, lj, lk, ln);\n"
+    "    edge(dir, len, pp.x * pp.y, lg, lj, lk, ll, lo);\n"
+    "\n"
+    "    float dir_r = dot(dir, dir);\n"
+    "    if (dir_r < 1.0 / 32768.0) {\n"
+    "        dir = vec2(1.0, 0.0);\n"
+    "    } else {\n"
+    "        dir *= inversesqrt(dir_r);\n"
+    "    }\n"
+    "    len *= 0.5;\n"
+    "    len *= len;\n"
+    "    float stretch = dot(dir, dir) / max(abs(dir.x), abs(dir.y));\n"
+    "    vec2 len2 = vec2(1.0 + (stretch - 1.0) * len, 1.0 - 0.5 * len);\n"
+    "    float lob = 0.5 - 0.29 * len;\n"
+    "    float clp = 1.0 / lob;\n"
+    "\n"
+    "    vec3 acc = vec3(0.0);\n"
+    "    float wsum = 0.0;\n"
+    "    accumulate(acc, wsum, vec2( 0.0, -1.0) - pp, dir, len2, lob, clp, b);\n"
+    "    accumulate(acc, wsum, vec2( 1.0, -1.0) - pp, dir, len2, lob, clp, c);\n"
+    "    accumulate(acc, wsum, vec2(-1.0,  1.0) - pp, dir, len2, lob, clp, i);\n"
+    "    accumulate(acc, wsum, vec2( 0.0,  1.0) - pp, dir, len2, lob, clp, j);\n"
+    "    accumulate(acc, wsum, vec2( 0.0,  0.0) - pp, dir, len2, lob, clp, f);\n"
+    "    accumulate(acc, wsum, vec2(-1.0,  0.0) - pp, dir, len2, lob, clp, e);\n"
+    "    accumulate(acc, wsum, vec2( 1.0,  1.0) - pp, dir, len2, lob, clp, k);\n"
+    "    accumulate(acc, wsum, vec2( 2.0,  1.0) - pp, dir, len2, lob, clp, l);\n"
+    "    accumulate(acc, wsum, vec2( 2.0,  0.0) - pp, dir, len2, lob, clp, h);\n"
+    "    accumulate(acc, wsum, vec2( 1.0,  0.0) - pp, dir, len2, lob, clp, g);\n"
+    "    accumulate(acc, wsum, vec2( 1.0,  2.0) - pp, dir, len2, lob, clp, o);\n"
+    "    accumulate(acc, wsum, vec2( 0.0,  2.0) - pp, dir, len2, lob, clp, n);\n"
+    "\n"
+    "    vec3 mn = min(min(f, g), min(j, k));\n"
+    "    vec3 mx = max(max(f, g), max(j, k));\n"
+    "    gl_FragColor = vec4(clamp(acc / wsum, mn, mx), 1.0);\n"
+    "}\n";
+
+static const char *rcas_fragment_src =
+    "#version 120\n"
+    "uniform sampler2D source;\n"
+    "uniform vec2 source_size;\n"
+    "uniform float sharpness;\n"
+    "\n"
+    "void main() {\n"
+    "    vec2 uv = gl_TexCoord[0].xy;\n"
+    "    vec2 px = 1.0 / source_size;\n"
+    "    //   b\n"
+    "    // d e f\n"
+    "    //   h\n"
+    "    vec3 b = texture2D(source, uv + vec2(0.0, -px.y)).rgb;\n"
+    "    vec3 d = texture2D(source, uv + vec2(-px.x, 0.0)).rgb;\n"
+    "    vec3 e = texture2D(source, uv).rgb;\n"
+    "    vec3 f = texture2D(source, uv + vec2(px.x, 0.0)).rgb;\n"
+    "    vec3 h = texture2D(source, uv + vec2(0.0, px.y)).rgb;\n"
+    "\n"
+    "    vec3 mn4 = min(min(b, d), min(f, h));\n"
+    "    vec3 mx4 = max(max(b, d), max(f, h));\n"
+    "    vec3 hit_min = mn4 / (4.0 * mx4 + 1.0 / 4096.0);\n"
+    "    vec3 hit_max = (1.0 - mx4) / (4.0 * mn4 - 4.0 - 1.0 / 4096.0);\n"
+    "    vec3 lobe3 = max(-hit_min, hit_max);\n"
+    "    float lobe = max(lobe3.r, max(lobe3.g, lobe3.b));\n"
+    "    lobe = max(-0.1875, min(lobe, 0.0)) * sharpness;\n"
+    "\n"
+    "    vec3 result = (lobe * (b + d + f + h) + e) / (4.0 * lobe + 1.0);\n"
+    "    gl_FragColor = vec4(clamp(result, 0.0, 1.0), 1.0);\n"
+    "}\n";
+
+static GLuint easu_program = 0;
+static GLuint rcas_program = 0;
+static GLRenderTarget easu_target = {0, 0, 0, 0, 0};
+static GLRenderTarget rcas_target = {0, 0, 0, 0, 0};
+
+bool upscale_init(void) {
+    easu_program = gl_utility_compile_program("EASU", upscale_vertex_src, easu_fragment_src);
+    rcas_program = gl_utility_compile_program("RCAS", upscale_vertex_src, rcas_fragment_src);
+    if (!easu_program || !rcas_program) {
+        upscale_cleanup();
+        return false;
+    }
+    printf("Upscale: EASU/RCAS shaders compiled.\n");
+    return true;
+}
+
+void upscale_cleanup(void) {
+    if (easu_program) glDeleteProgram(easu_program);
+    if (rcas_program) glDeleteProgram(rcas_program);
+    easu_program = 0;
+    rcas_program = 0;
+    gl_utility_destroy_target(&easu_target);
+    gl_utility_destroy_target(&rcas_target);
+}
+
+static void run_pass(GLuint program, GLRenderTarget *target, GLuint source, int src_width, int src_height) {
+    gl_utility_begin_pass(target);
+    glUseProgram(program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source);
+    glUniform1i(glGetUniformLocation(program, "source"), 0);
+    glUniform2f(glGetUniformLocation(program, "source_size"), (float)src_width, (float)src_height);
+    gl_utility_draw_fullscreen_quad();
+    gl_utility_end_pass();
+}
+
+GLuint upscale_apply(GLuint source_texture, int src_width, int src_height,
+                     int dst_width, int dst_height, float sharpness) {
+    if (!easu_program || !rcas_program) return source_texture;
+    if (dst_width <= src_width && dst_height <= src_height) return source_texture;
+
+    if (!gl_utility_create_target(&easu_target, dst_width, dst_height, GL_RGB8) ||
+        !gl_utility_create_target(&rcas_target, dst_width, dst_height, GL_RGB8)) {
+        return source_texture;
+    }
+
+    run_pass(easu_program, &easu_target, source_texture, src_width, src_height);
+
+    glUseProgram(rcas_program);
+    glUniform1f(glGetUniformLocation(rcas_program, "sharpness"), exp2f(-sharpness));
+    run_pass(rcas_program, &rcas_target, easu_target.texture, dst_width, dst_height);
+
+    return rcas_target.texture;
+}
@@ -0,0 +1,22 @@
+#ifndef UPSCALE_H
+#define UPSCALE_H
+
+#include <stdbool.h>
+
+#include "gl_utility.h"
+
+// Compiles the upscale shaders. Must be called with a current GL context.
+// Returns false if shaders or framebuffer objects are not available.
+bool upscale_init(void);
+
+// Frees the programs and intermediate textures.
+void upscale_cleanup(void);
+
+// Upscales source_texture (src_width x src_height) to dst_width x dst_height with an
+// edge adaptive filter (EASU style) followed by a contrast adaptive sharpening pass
+// (RCAS style). sharpness is in stops, 0.0 is the strongest sharpening.
+// Returns the texture holding the result, or source_texture if no upscaling is needed.
+GLuint upscale_apply(GLuint source_texture, int src_width, int src_height,
+                     int dst_width, int dst_height, float sharpness);
+
+#endif // UPSCALE_H
@@ -5,99 +5,275 @@
 #endif
 #include <jpeglib.h>
 
+#include <pthread.h>
+
+// RVV 1.0 kernels when the compiler targets the vector extension (-march=rv64gcv)
+#if defined(ARCH_RISCV64) && defined(__riscv_vector)
+#define USE_RVV
+#include <riscv_vector.h>
+#endif
+
 static inline unsigned char clamp(int val) {
     if (val < 0) return 0;
     if (val > 255) return 255;
     return (unsigned char)val;
 }
 
-void convert_nv24_to_rgb(const unsigned char *y_plane_data, const unsigned char *uv_plane_data, unsigned char *rgb, int width, int height) {
-    const unsigned char *y_plane = y_plane_data;
-    const unsigned char *uv_plane = uv_plane_data;
+// --- Y'CbCr to R'G'B' ---
+// Coefficients in 8.8 fixed point. For BT.601 limited range they are the 298/409/100/208/516
+// the converters always used, the other matrices are derived the same way.
+typedef struct {
+    int y;
+    int y_offset;
+    int r_cr;
+    int g_cb;
+    int g_cr;
+    int b_cb;
+} YuvCoefficients;
+
+// The contribution of every possible 8 bit sample to each output channel, so a pixel costs
+// five loads, four adds and three clamps instead of the multiplies
+typedef struct {
+    YuvCoefficients k;
+    int y[256];     // includes the rounding of the final shift
+    int r_cr[256];
+    int g_cb[256];
+    int g_cr[256];
+    int b_cb[256];
+} YuvLut;
+
+static YuvLut yuv_luts[4]; // [bt709 * 2 + full_range]
+static pthread_once_t yuv_luts_once = PTHREAD_ONCE_INIT;
+
+static int fixed_8_8(double value) {
+    return value < 0.0 ? -(int)(-value * 256.0 + 0.5) : (int)(value * 256.0 + 0.5);
+}
+
+static void init_yuv_luts(void) {
+    for (int i = 0; i < 4; i++) {
+        bool bt709 = i >= 2;
+        bool full_range = i & 1;
+        double kr = bt709 ? 0.2126 : 0.299;
+        double kb = bt709 ? 0.0722 : 0.114;
+        double kg = 1.0 - kr - kb;
+        double y_scale = full_range ? 1.0 : 255.0 / 219.0;
+        double c_scale = full_range ? 1.0 : 255.0 / 224.0;
+
+        YuvLut *lut = &yuv_luts[i];
+        lut->k.y = fixed_8_8(y_scale);
+        lut->k.y_offset = full_range ? 0 : 16;
+        lut->k.r_cr = fixed_8_8(c_scale * 2.0 * (1.0 - kr));
+        lut->k.g_cb = fixed_8_8(-c_scale * 2.0 * kb * (1.0 - kb) / kg);
+        lut->k.g_cr = fixed_8_8(-c_scale * 2.0 * kr * (1.0 - kr) / kg);
+        lut->k.b_cb = fixed_8_8(c_scale * 2.0 * (1.0 - kb));
+        for (int v = 0; v < 256; v++) {
+            lut->y[v] = lut->k.y * (v - lut->k.y_offset) + 128;
+            lut->r_cr[v] = lut->k.r_cr * (v - 128);
+            lut->g_cb[v] = lut->k.g_cb * (v - 128);
+            lut->g_cr[v] = lut->k.g_cr * (v - 128);
+            lut->b_cb[v] = lut->k.b_cb * (v - 128);
+        }
+    }
+}
+
+static const YuvLut *yuv_lut(const YuvFormat *format) {
+    pthread_once(&yuv_luts_once, init_yuv_luts);
+    if (!format) return &yuv_luts[0];
+    return &yuv_luts[(format->bt709 ? 2 : 0) + (format->full_range ? 1 : 0)];
+}
+
+static inline void yuv_lut_pixel(const YuvLut *lut, int y, int cb, int cr,
+                                 unsigned char *r, unsigned char *g, unsigned char *b) {
+    int luma = lut->y[y];
+    *r = clamp((luma + lut->r_cr[cr]) >> 8);
+    *g = clamp((luma + lut->g_cb[cb] + lut->g_cr[cr]) >> 8);
+    *b = clamp((luma + lut->b_cb[cb]) >> 8);
+}
+
+#ifdef USE_RVV
+// Same arithmetic as the tables: 8 bit samples widened to 16 bit, widening multiply-accumulate
+// into 32 bit, shift, clamp and narrow back. Half a vector register of pixels per step keeps
+// the 32 bit intermediates at LMUL 2.
+static inline vint16m1_t rvv_widen_minus(vuint8mf2_t v, int offset, size_t vl) {
+    vint16m1_t w = __riscv_vreinterpret_v_u16m1_i16m1(__riscv_vzext_vf2_u16m1(v, vl));
+    return __riscv_vsub_vx_i16m1(w, (int16_t)offset, vl);
+}
+
+static inline vuint8mf2_t rvv_narrow(vint32m2_t v, size_t vl) {
+    v = __riscv_vsra_vx_i32m2(v, 8, vl);
+    v = __riscv_vmin_vx_i32m2(__riscv_vmax_vx_i32m2(v, 0, vl), 255, vl);
+    vuint16m1_t h = __riscv_vncvt_x_x_w_u16m1(__riscv_vreinterpret_v_i32m2_u32m2(v), vl);
+    return __riscv_vncvt_x_x_w_u8mf2(h, vl);
+}
+
+static inline void rvv_yuv_pixels(const YuvCoefficients *k, vuint8mf2_t y, vint16m1_t cb, vint16m1_t cr, size_t vl,
+                                  vuint8mf2_t *r, vuint8mf2_t *g, vuint8mf2_t *b) {
+    vint32m2_t luma = __riscv_vwmul_vx_i32m2(rvv_widen_minus(y, k->y_offset, vl), (int16_t)k->y, vl);
+    luma = __riscv_vadd_vx_i32m2(luma, 128, vl);
+    *r = rvv_narrow(__riscv_vwmacc_vx_i32m2(luma, (int16_t)k->r_cr, cr, vl), vl);
+    *g = rvv_narrow(__riscv_vwmacc_vx_i32m2(__riscv_vwmacc_vx_i32m2(luma, (int16_t)k->g_cb, cb, vl),
+                                            (int16_t)k->g_cr, cr, vl), vl);
+    *b = rvv_narrow(__riscv_vwmacc_vx_i32m2(luma, (int16_t)k->b_cb, cb, vl), vl);
+}
+
+static void nv24_row_to_rgb_rvv(const YuvCoefficients *k, const unsigned char *y_row, const unsigned char *uv_row,
+                                unsigned char *rgb, int width) {
+    size_t vl;
+    for (size_t x = 0; x < (size_t)width; x += vl) {
+        vl = __riscv_vsetvl_e8mf2((size_t)width - x);
+        vuint8mf2_t y = __riscv_vle8_v_u8mf2(y_row + x, vl);
+        vuint8mf2x2_t uv = __riscv_vlseg2e8_v_u8mf2x2(uv_row + 2 * x, vl);
+        vint16m1_t cb = rvv_widen_minus(__riscv_vget_v_u8mf2x2_u8mf2(uv, 0), 128, vl);
+        vint16m1_t cr = rvv_widen_minus(__riscv_vget_v_u8mf2x2_u8mf2(uv, 1), 128, vl);
+        vuint8mf2_t r, g, b;
+        rvv_yuv_pixels(k, y, cb, cr, vl, &r, &g, &b);
+        vuint8mf2x3_t out = __riscv_vundefined_u8mf2x3();
+        out = __riscv_vset_v_u8mf2_u8mf2x3(out, 0, r);
+        out = __riscv_vset_v_u8mf2_u8mf2x3(out, 1, g);
+        out = __riscv_vset_v_u8mf2_u8mf2x3(out, 2, b);
+        __riscv_vsseg3e8_v_u8mf2x3(rgb + 3 * x, out, vl);
+    }
+}
+
+// Whole Y0 U Y1 V groups only, returns the number of pixels converted
+static int yuyv_row_to_bgr_rvv(const YuvCoefficients *k, const unsigned char *src, unsigned char *bgr, int width) {
+    size_t pairs = (size_t)width / 2;
+    size_t vl;
+    for (size_t p = 0; p < pairs; p += vl) {
+        vl = __riscv_vsetvl_e8mf2(pairs - p);
+        vuint8mf2x4_t yuyv = __riscv_vlseg4e8_v_u8mf2x4(src + 4 * p, vl);
+        vint16m1_t cb = rvv_widen_minus(__riscv_vget_v_u8mf2x4_u8mf2(yuyv, 1), 128, vl);
+        vint16m1_t cr = rvv_widen_minus(__riscv_vget_v_u8mf2x4_u8mf2(yuyv, 3), 128, vl);
+        vuint8mf2_t r0, g0, b0, r1, g1, b1;
+        rvv_yuv_pixels(k, __riscv_vget_v_u8mf2x4_u8mf2(yuyv, 0), cb, cr, vl, &r0, &g0, &b0);
+        rvv_yuv_pixels(k, __riscv_vget_v_u8mf2x4_u8mf2(yuyv, 2), cb, cr, vl, &r1, &g1, &b1);
+        vuint8mf2x6_t out = __riscv_vundefined_u8mf2x6();
+        out = __riscv_vset_v_u8mf2_u8mf2x6(out, 0, b0);
+        out = __riscv_vset_v_u8mf2_u8mf2x6(out, 1, g0);
+        out = __riscv_vset_v_u8mf2_u8mf2x6(out, 2, r0);
+        out = __riscv_vset_v_u8mf2_u8mf2x6(out, 3, b1);
+        out = __riscv_vset_v_u8mf2_u8mf2x6(out, 4, g1);
+        out = __riscv_vset_v_u8mf2_u8mf2x6(out, 5, r1);
+        __riscv_vsseg6e8_v_u8mf2x6(bgr + 6 * p, out, vl);
+    }
+    return (int)(pairs * 2);
+}
+
+static void bgra_row_to_rgb_rvv(const unsigned char *src, unsigned char *rgb, int width) {
+    size_t vl;
+    for (size_t x = 0; x < (size_t)width; x += vl) {
+        vl = __riscv_vsetvl_e8m1((size_t)width - x);
+        vuint8m1x4_t bgra = __riscv_vlseg4e8_v_u8m1x4(src + 4 * x, vl);
+        vuint8m1x3_t out = __riscv_vundefined_u8m1x3();
+        out = __riscv_vset_v_u8m1_u8m1x3(out, 0, __riscv_vget_v_u8m1x4_u8m1(bgra, 2));
+        out = __riscv_vset_v_u8m1_u8m1x3(out, 1, __riscv_vget_v_u8m1x4_u8m1(bgra, 1));
+        out = __riscv_vset_v_u8m1_u8m1x3(out, 2, __riscv_vget_v_u8m1x4_u8m1(bgra, 0));
+        __riscv_vsseg3e8_v_u8m1x3(rgb + 3 * x, out, vl);
+    }
+}
+#endif // USE_RVV
 
+void convert_nv24_to_rgb(const unsigned char *y_plane_data, int y_stride, const unsigned char *uv_plane_data, int uv_stride, unsigned char *rgb, int width, int height, const YuvFormat *format) {
+    const YuvLut *lut = yuv_lut(format);
     for (int y_coord = 0; y_coord < height; y_coord++) {
+        const unsigned char *y_plane = y_plane_data + (size_t)y_coord * y_stride;
+        const unsigned char *uv_plane = uv_plane_data + (size_t)y_coord * uv_stride;
+        unsigned char *rgb_row = rgb + (size_t)y_coord * width * 3;
+#ifdef USE_RVV
+        nv24_row_to_rgb_rvv(&lut->k, y_plane, uv_plane, rgb_row, width);
+#else
         for (int x_coord = 0; x_coord < width; x_coord++) {
-            int i = y_coord * width + x_coord;
-            int uv_idx = i * 2; 
-            
-            int y_val = y_plane[i];
-            int u_val = uv_plane[uv_idx];     
-            int v_val = uv_plane[uv_idx + 1]; 
-
-            int c = y_val - 16;
-            int d = u_val - 128;
-            int e = v_val - 128;
-
-            int r_val = clamp((298 * c + 409 * e + 128) >> 8);
-            int g_val = clamp((298 * c - 100 * d - 208 * e + 128) >> 8);
-            int b_val = clamp((298 * c + 516 * d + 128) >> 8);
-            
-            rgb[i * 3] = r_val;
-            rgb[i * 3 + 1] = g_val;
-            rgb[i * 3 + 2] = b_val;
+            yuv_lut_pixel(lut, y_plane[x_coord], uv_plane[x_coord * 2], uv_plane[x_coord * 2 + 1],
+                          &rgb_row[x_coord * 3], &rgb_row[x_coord * 3 + 1], &rgb_row[x_coord * 3 + 2]);
         }
+#endif
     }
 }
 
-void convert_yuyv_to_bgr(const unsigned char *yuyv_data, unsigned char *bgr, int width, int height, size_t bytesused) {
-    if (bytesused < (size_t)width * height * 2) {
-        fprintf(stderr, "convert_yuyv_to_bgr: Not enough data. Expected %d, got %zu\n", width*height*2, bytesused);
+#ifdef ARCH_X86_64
+// The Simd library has no full range BT.709, that one goes through the tables
+static SimdYuvType simd_yuv_type(const YuvFormat *format) {
+    if (!format || (!format->bt709 && !format->full_range)) return SimdYuvBt601;
+    if (!format->full_range) return SimdYuvBt709;
+    if (!format->bt709) return SimdYuvTrect871;
+    return SimdYuvUnknown;
+}
+#endif
+
+void convert_yuyv_to_bgr(const unsigned char *yuyv_data, int src_stride, unsigned char *bgr, int width, int height, size_t bytesused, const YuvFormat *format) {
+    size_t expected = (size_t)(height - 1) * src_stride + (size_t)width * 2;
+    if (bytesused < expected) {
+        fprintf(stderr, "convert_yuyv_to_bgr: Not enough data. Expected %zu, got %zu\n", expected, bytesused);
         fill_frame_with_pattern(bgr, width, height);
         return;
     }
 #ifdef ARCH_X86_64
-    static unsigned char *uyvy_buf = NULL;
-    static size_t uyvy_buf_size = 0;
-    size_t needed = (size_t)width * height * 2;
-    if (uyvy_buf_size < needed) {
-        unsigned char *new_buf = (unsigned char *)realloc(uyvy_buf, needed);
-        if (!new_buf) {
-            fprintf(stderr, "convert_yuyv_to_bgr: Failed to allocate temp buffer.\n");
-            fill_frame_with_pattern(bgr, width, height);
-            return;
+    SimdYuvType simd_type = simd_yuv_type(format);
+    if (simd_type != SimdYuvUnknown) {
+        static unsigned char *uyvy_buf = NULL;
+        static size_t uyvy_buf_size = 0;
+        size_t needed = (size_t)width * height * 2;
+        if (uyvy_buf_size < needed) {
+            unsigned char *new_buf = (unsigned char *)realloc(uyvy_buf, needed);
+            if (!new_buf) {
+                fprintf(stderr, "convert_yuyv_to_bgr: Failed to allocate temp buffer.\n");
+                fill_frame_with_pattern(bgr, width, height);
+                return;
+            }
+            uyvy_buf = new_buf;
+            uyvy_buf_size = needed;
         }
-        uyvy_buf = new_buf;
-        uyvy_buf_size = needed;
-    }
-    for (size_t i = 0; i < needed; i += 4) {
-        uyvy_buf[i + 0] = yuyv_data[i + 1]; // U
-        uyvy_buf[i + 1] = yuyv_data[i + 0]; // Y0
-        uyvy_buf[i + 2] = yuyv_data[i + 3]; // V
-        uyvy_buf[i + 3] = yuyv_data[i + 2]; // Y1
+        for (int row = 0; row < height; row++) {
+            const unsigned char *src = yuyv_data + (size_t)row * src_stride;
+            unsigned char *dst = uyvy_buf + (size_t)row * width * 2;
+            for (int i = 0; i < width * 2; i += 4) {
+                dst[i + 0] = src[i + 1]; // U
+                dst[i + 1] = src[i + 0]; // Y0
+                dst[i + 2] = src[i + 3]; // V
+                dst[i + 3] = src[i + 2]; // Y1
+            }
+        }
+        SimdUyvy422ToBgr(uyvy_buf, width * 2, width, height, bgr, width * 3, simd_type);
+        return;
     }
-    SimdUyvy422ToBgr(uyvy_buf, width * 2, width, height, bgr, width * 3, SimdYuvBt601);
-#else
+#endif
+    const YuvLut *lut = yuv_lut(format);
     for (int y_coord = 0; y_coord < height; y_coord++) {
-        for (int x_coord = 0; x_coord < width; x_coord += 2) {
-            int yuyv_idx = (y_coord * width + x_coord) * 2;
-            int bgr_idx1 = (y_coord * width + x_coord) * 3;
-            int bgr_idx2 = (y_coord * width + x_coord + 1) * 3;
-
-            if ((size_t)(yuyv_idx + 3) >= bytesused) {
-                fprintf(stderr, "convert_yuyv_to_bgr: YUYV index out of bounds.\n");
-                continue;
-            }
-
-            int y0 = yuyv_data[yuyv_idx + 0];
-            int u  = yuyv_data[yuyv_idx + 1];
-            int y1 = yuyv_data[yuyv_idx + 2];
-            int v  = yuyv_data[yuyv_idx + 3];
-
-            int c1 = y0 - 16;
-            int d1 = u - 128;
-            int e1 = v - 128;
-            bgr[bgr_idx1 + 2] = clamp((298 * c1 + 409 * e1 + 128) >> 8);
-            bgr[bgr_idx1 + 1] = clamp((298 * c1 - 100 * d1 - 208 * e1 + 128) >> 8);
-            bgr[bgr_idx1 + 0] = clamp((298 * c1 + 516 * d1 + 128) >> 8);
-
+        const unsigned char *src = yuyv_data + (size_t)y_coord * src_stride;
+        unsigned char *dst = bgr + (size_t)y_coord * width * 3;
+        int x_coord = 0;
+#ifdef USE_RVV
+        x_coord = yuyv_row_to_bgr_rvv(&lut->k, src, dst, width);
+#endif
+        for (; x_coord < width; x_coord += 2) {
+            int u = src[x_coord * 2 + 1];
+            int v = src[x_coord * 2 + 3];
+            yuv_lut_pixel(lut, src[x_coord * 2], u, v, &dst[x_coord * 3 + 2], &dst[x_coord * 3 + 1], &dst[x_coord * 3]);
             if (x_coord + 1 < width) {
-                int c2 = y1 - 16;
-                bgr[bgr_idx2 + 2] = clamp((298 * c2 + 409 * e1 + 128) >> 8);
-                bgr[bgr_idx2 + 1] = clamp((298 * c2 - 100 * d1 - 208 * e1 + 128) >> 8);
-                bgr[bgr_idx2 + 0] = clamp((298 * c2 + 516 * d1 + 128) >> 8);
+                yuv_lut_pixel(lut, src[x_coord * 2 + 2], u, v,
+                              &dst[x_coord * 3 + 5], &dst[x_coord * 3 + 4], &dst[x_coord * 3 + 3]);
             }
         }
     }
+}
+
+void convert_bgra_to_rgb(const unsigned char *bgra, int src_stride, unsigned char *rgb, int width, int height) {
+#ifdef ARCH_X86_64
+    SimdBgraToRgb(bgra, width, height, src_stride, rgb, width * 3);
+#else
+    for (int y_coord = 0; y_coord < height; y_coord++) {
+        const unsigned char *src = bgra + (size_t)y_coord * src_stride;
+        unsigned char *dst = rgb + (size_t)y_coord * width * 3;
+#ifdef USE_RVV
+        bgra_row_to_rgb_rvv(src, dst, width);
+#else
+        for (int x_coord = 0; x_coord < width; x_coord++) {
+            dst[x_coord * 3 + 0] = src[x_coord * 4 + 2];
+            dst[x_coord * 3 + 1] = src[x_coord * 4 + 1];
+            dst[x_coord * 3 + 2] = src[x_coord * 4 + 0];
+        }
+#endif
+    }
 #endif
 }
 
@@ -112,6 +288,8 @@ void convert_mjpeg_to_rgb(const unsigned char *jpeg_data, size_t len, unsigned c
         fill_frame_with_pattern(rgb, width, height);
         return;
     }
+    // The frames are uploaded as RGB, greyscale ones too
+    cinfo.out_color_space = JCS_RGB;
     jpeg_start_decompress(&cinfo);
     if (cinfo.output_width != (JDIMENSION)width || cinfo.output_height != (JDIMENSION)height) {
         fprintf(stderr, "convert_mjpeg_to_rgb: Dimension mismatch (%ux%u != %dx%d)\n",
@@ -127,6 +305,135 @@ void convert_mjpeg_to_rgb(const unsigned char *jpeg_data, size_t len, unsigned c
     jpeg_destroy_decompress(&cinfo);
 }
 
+void convert_mjpeg_region_to_rgb(const unsigned char *jpeg_data, size_t len, unsigned char *rgb, int width, int height, const FrameRect *region) {
+    static unsigned char *row_buf = NULL;
+    static size_t row_buf_size = 0;
+
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpeg_data, len);
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&cinfo);
+        fill_frame_with_pattern(rgb, region->width, region->height);
+        return;
+    }
+    // The frames are uploaded as RGB, greyscale ones too
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    if (cinfo.output_width != (JDIMENSION)width || cinfo.output_height != (JDIMENSION)height) {
+        fprintf(stderr, "convert_mjpeg_region_to_rgb: Dimension mismatch (%ux%u != %dx%d)\n",
+                cinfo.output_width, cinfo.output_height, width, height);
+    }
+    if ((JDIMENSION)(region->x + region->width) > cinfo.output_width ||
+        (JDIMENSION)(region->y + region->height) > cinfo.output_height) {
+        fprintf(stderr, "convert_mjpeg_region_to_rgb: Region %dx%d+%d+%d outside of the %ux%u image\n",
+                region->width, region->height, region->x, region->y, cinfo.output_width, cinfo.output_height);
+        jpeg_destroy_decompress(&cinfo);
+        fill_frame_with_pattern(rgb, region->width, region->height);
+        return;
+    }
+
+    int skip_x = region->x;
+#ifdef LIBJPEG_TURBO_VERSION
+    // Only decode the iMCU columns covering the region and skip the rows above it
+    JDIMENSION crop_x = region->x;
+    JDIMENSION crop_width = region->width;
+    jpeg_crop_scanline(&cinfo, &crop_x, &crop_width);
+    skip_x = region->x - (int)crop_x;
+    if (region->y > 0) {
+        jpeg_skip_scanlines(&cinfo, region->y);
+    }
+#endif
+
+    size_t row_stride = (size_t)cinfo.output_width * cinfo.output_components;
+    if (row_buf_size < row_stride) {
+        unsigned char *new_buf = (unsigned char *)realloc(row_buf, row_stride);
+        if (!new_buf) {
+            fprintf(stderr, "convert_mjpeg_region_to_rgb: Failed to allocate row buffer.\n");
+            jpeg_destroy_decompress(&cinfo);
+            fill_frame_with_pattern(rgb, region->width, region->height);
+            return;
+        }
+        row_buf = new_buf;
+        row_buf_size = row_stride;
+    }
+
+    unsigned char *buffer_array[1] = { row_buf };
+#ifndef LIBJPEG_TURBO_VERSION
+    while (cinfo.output_scanline < (JDIMENSION)region->y) {
+        jpeg_read_scanlines(&cinfo, buffer_array, 1);
+    }
+#endif
+    for (int row = 0; row < region->height; row++) {
+        jpeg_read_scanlines(&cinfo, buffer_array, 1);
+        memcpy(rgb + (size_t)row * region->width * 3, row_buf + (size_t)skip_x * 3, (size_t)region->width * 3);
+    }
+    // The rows below the region are never decoded, destroying aborts the decompression
+    jpeg_destroy_decompress(&cinfo);
+}
+
+void crop_rgb_frame_in_place(unsigned char *rgb, int width, const FrameRect *region) {
+    for (int row = 0; row < region->height; row++) {
+        memmove(rgb + (size_t)row * region->width * 3,
+                rgb + ((size_t)(region->y + row) * width + region->x) * 3,
+                (size_t)region->width * 3);
+    }
+}
+
+void copy_frame_region(const unsigned char *src, int src_stride, unsigned char *dst, int bytes_per_pixel, const FrameRect *region) {
+    size_t row_bytes = (size_t)region->width * bytes_per_pixel;
+    const unsigned char *src_row = src + (size_t)region->y * src_stride + (size_t)region->x * bytes_per_pixel;
+    if ((size_t)src_stride == row_bytes) {
+        memcpy(dst, src_row, row_bytes * region->height);
+        return;
+    }
+    for (int row = 0; row < region->height; row++) {
+        memcpy(dst + (size_t)row * row_bytes, src_row + (size_t)row * src_stride, row_bytes);
+    }
+}
+
+bool frame_rect_empty(const FrameRect *r) {
+    return r->width <= 0 || r->height <= 0;
+}
+
+FrameRect frame_rect_union(FrameRect a, FrameRect b) {
+    if (frame_rect_empty(&a)) return b;
+    if (frame_rect_empty(&b)) return a;
+    int x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    FrameRect r;
+    r.x = a.x < b.x ? a.x : b.x;
+    r.y = a.y < b.y ? a.y : b.y;
+    r.width = x1 - r.x;
+    r.height = y1 - r.y;
+    return r;
+}
+
+FrameRect frame_rect_intersect(FrameRect a, FrameRect b) {
+    int x0 = a.x > b.x ? a.x : b.x;
+    int y0 = a.y > b.y ? a.y : b.y;
+    int x1 = a.x + a.width < b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y1 = a.y + a.height < b.y + b.height ? a.y + a.height : b.y + b.height;
+    FrameRect r = {x0, y0, x1 - x0, y1 - y0};
+    if (frame_rect_empty(&r)) r.width = r.height = 0;
+    return r;
+}
+
+void pack_yuv420_region(const unsigned char *const planes[3], const int strides[3], YuvLayout layout,
+                        unsigned char *dst, const FrameRect *region) {
+    copy_frame_region(planes[0], strides[0], dst, 1, region);
+    dst += (size_t)region->width * region->height;
+
+    FrameRect chroma = { region->x / 2, region->y / 2, (region->width + 1) / 2, (region->height + 1) / 2 };
+    if (layout == YUV_LAYOUT_NV12) {
+        copy_frame_region(planes[1], strides[1], dst, 2, &chroma);
+    } else {
+        copy_frame_region(planes[1], strides[1], dst, 1, &chroma);
+        copy_frame_region(planes[2], strides[2], dst + (size_t)chroma.width * chroma.height, 1, &chroma);
+    }
+}
 
 void fill_frame_with_pattern( unsigned char *rgb, int width, int height ) {
     for (int y = 0; y < height; y++) {
@@ -11,9 +11,56 @@
 #include <stdbool.h>
 
 
-void convert_nv24_to_rgb(const unsigned char *y_plane_data, const unsigned char *uv_plane_data, unsigned char *rgb, int width, int height);
+// A rectangle inside a frame, in pixels
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} FrameRect;
+
+// A rectangle without pixels is empty. The union of an empty rectangle with another is the other,
+// the intersection of rectangles that don't overlap is {x, y, 0, 0}.
+bool frame_rect_empty(const FrameRect *r);
+FrameRect frame_rect_union(FrameRect a, FrameRect b);
+FrameRect frame_rect_intersect(FrameRect a, FrameRect b);
+
+// Layout of a 4:2:0 frame packed into one buffer: the luma plane (width bytes per row) followed by
+// either two chroma planes of (width + 1) / 2 bytes per row (I420) or one plane of interleaved
+// U/V pairs (NV12), both (height + 1) / 2 rows. YUV_LAYOUT_NONE marks packed RGB frames.
+typedef enum {
+    YUV_LAYOUT_NONE,
+    YUV_LAYOUT_I420,
+    YUV_LAYOUT_NV12,
+    YUV_LAYOUT_JPEG_DCT,    // Not pixels: DCT coefficients of an MJPEG frame, see mjpeg_gpu.h
+    YUV_LAYOUT_DMABUF       // Not pixels: the frame stays in a dmabuf of the capture source, see dmabuf_import.h
+} YuvLayout;
+
+typedef struct {
+    YuvLayout layout;
+    bool bt709;         // BT.709 coefficients, BT.601 otherwise
+    bool full_range;    // 0..255 levels, 16..235 otherwise
+} YuvFormat;
+
+// The source strides are in bytes, so a sub rectangle can be converted by offsetting the plane pointers.
+// The output is always packed (width * 3 bytes per row). Of format only the matrix and the range are
+// used, NULL means BT.601 limited range.
+void convert_nv24_to_rgb(const unsigned char *y_plane_data, int y_stride, const unsigned char *uv_plane_data, int uv_stride, unsigned char *rgb, int width, int height, const YuvFormat *format);
 void fill_frame_with_pattern(unsigned char *rgb, int width, int height);
-void convert_yuyv_to_bgr(const unsigned char *yuyv_data, unsigned char *bgr, int width, int height, size_t bytesused);
+// bytesused counts from yuyv_data
+void convert_yuyv_to_bgr(const unsigned char *yuyv_data, int src_stride, unsigned char *bgr, int width, int height, size_t bytesused, const YuvFormat *format);
+// Drops the alpha channel of a BGRA frame with src_stride bytes per row, the output is packed RGB
+void convert_bgra_to_rgb(const unsigned char *bgra, int src_stride, unsigned char *rgb, int width, int height);
 void convert_mjpeg_to_rgb(const unsigned char *jpeg_data, size_t len, unsigned char *rgb, int width, int height);
+// Decodes only the rows and (iMCU aligned) columns of region, the output is packed region->width * 3 bytes per row
+void convert_mjpeg_region_to_rgb(const unsigned char *jpeg_data, size_t len, unsigned char *rgb, int width, int height, const FrameRect *region);
+// Moves region of a packed RGB frame to the start of the buffer, packed with region->width * 3 bytes per row
+void crop_rgb_frame_in_place(unsigned char *rgb, int width, const FrameRect *region);
+// Copies region of a frame with src_stride bytes per row into dst, packed without padding
+void copy_frame_region(const unsigned char *src, int src_stride, unsigned char *dst, int bytes_per_pixel, const FrameRect *region);
+// Copies region of a decoded 4:2:0 picture (three planes for I420, two for NV12) into dst with the packed
+// layout described at YuvLayout. region->x and region->y must be even.
+void pack_yuv420_region(const unsigned char *const planes[3], const int strides[3], YuvLayout layout,
+                        unsigned char *dst, const FrameRect *region);
 
 #endif
\ No newline at end of file
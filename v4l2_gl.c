@@ -8,10 +8,13 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <pthread.h>
+#include <signal.h>
 
 #include <linux/videodev2.h>
+#include <linux/dma-buf.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <math.h>
 
 #ifndef M_PI
@@ -21,6 +24,8 @@
 #define KGFLAGS_IMPLEMENTATION
 #include "kgflags.h"
 
+// Shader and framebuffer functions (GL 2.0+) are used by the render passes
+#define GL_GLEXT_PROTOTYPES
 // Use GL/glut.h on macOS, GL/freeglut.h on Linux
 #include <GL/freeglut.h> 
 
@@ -32,12 +37,39 @@
 
 #include "utility.h"
 #include "xdg_source.h" // For XDG screen capture
+#include "x11_source.h"
+#include "wayland_source.h"
+#include "kms_source.h"
+#include "dmabuf_import.h"
+#include "upload_scheduler.h"
+#include "upscale.h"
+#include "active_area.h"
+#include "mipmap.h"
+#include "render_scale.h"
+#include "frame_pacing.h"
+#include "capture_throttle.h"
+#include "video_decoder.h"
+#include "yuv_convert.h"
+#include "mjpeg_gpu.h"
+#include "gpu_timer.h"
+#include "perf_counters.h"
+#include "autotune.h"
+#include "capture_memory.h"
+#ifdef USE_GLES
+#include "gles_renderer.h"
+#endif
+#include "soft_renderer.h"
+#include "stats.h"
+#include "control.h"
 
 
 // --- Capture Mode ---
 enum CaptureMode {
     MODE_V4L2,
-    MODE_XDG
+    MODE_XDG,
+    MODE_X11,
+    MODE_WAYLAND,
+    MODE_KMS
 };
 static enum CaptureMode current_capture_mode = MODE_V4L2;
 
@@ -46,7 +78,11 @@ static enum CaptureMode current_capture_mode = MODE_V4L2;
 // #define DEVICE_PATH      "/dev/video0" // Will be replaced by a command line flag
 #define FRAME_WIDTH      1920 // Requested width
 #define FRAME_HEIGHT     1080 // Requested height
-#define BUFFER_COUNT     4
+#define BUFFER_COUNT     4  // V4L2 buffers without --buffers or a machine profile
+
+// Capture size actually requested from the device, FRAME_WIDTH/HEIGHT unless overridden
+static int requested_frame_width = FRAME_WIDTH;
+static int requested_frame_height = FRAME_HEIGHT;
 
 #define SENSITIVITY_ANGLE 2.0f // Sensitivity for head gesture tracking in degrees
 #define HEAD_SHAKE_RESET_TIME 3000 
@@ -57,10 +93,30 @@ static enum v4l2_buf_type active_buffer_type;
 static __u32 active_pixel_format;
 static int actual_frame_width = FRAME_WIDTH;   // Initialize with requested, update with actual
 static int actual_frame_height = FRAME_HEIGHT; // Initialize with requested, update with actual
+static enum v4l2_memory active_memory_type = V4L2_MEMORY_MMAP;
+static bool raw_capture_format = false;      // RGB24/BGR24/BGRx frames are uploaded without conversion
+static unsigned int active_bytesperline = 0; // Row stride of raw capture formats
+static struct v4l2_fract nominal_timeperframe = {0, 0}; // Set if the device supports VIDIOC_S_PARM
+static unsigned int active_sizeimage = 0;
+static bool decoded_capture_format = false;  // H.264/HEVC, decoded to YUV planes converted on the GPU
+static YuvFormat capture_colorimetry = {YUV_LAYOUT_NONE, false, false}; // Matrix and range of NV24/YUYV input
+
+// Formats the renderer can upload as they are, in order of preference
+static const struct {
+    __u32 pixelformat;
+    GLenum gl_format;
+    int bytes_per_pixel;
+} raw_formats[] = {
+    { V4L2_PIX_FMT_RGB24,  GL_RGB,  3 },
+    { V4L2_PIX_FMT_BGR24,  GL_BGR,  3 },
+    { V4L2_PIX_FMT_XBGR32, GL_BGRA, 4 },
+};
 
 struct plane_info {
     void   *start;
     size_t length;
+    void   *dmabuf_start; // Cached mapping of the exported plane with CAPTURE_READ_DMABUF_SYNC
+    int    dmabuf_fd;
 };
 
 struct mplane_buffer {
@@ -73,10 +129,29 @@ static struct mplane_buffer *buffers_mp = NULL;
 static unsigned int n_buffers = 0;
 static unsigned int num_planes_per_buffer = 0;
 
+// USERPTR capture: the driver writes raw frames straight into these page aligned buffers,
+// which are then handed to display() without a copy
+static unsigned char **userptr_pool = NULL;
+static size_t userptr_buffer_size = 0;
+static int userptr_slot_index[2] = {-1, -1}; // Pool buffer held by rgb_frames[0/1], -1 for own memory
+
+// MMAP capture: how the converters get at the frames, measured at init unless --capture-read says
+static const char *capture_read_name = "auto";
+static CaptureReadStrategy requested_capture_read = CAPTURE_READ_AUTO;
+static CaptureReadStrategy capture_read = CAPTURE_READ_DIRECT;
+static unsigned char *bounce_planes[VIDEO_MAX_PLANES];
+static StatsHistogram capture_read_time; // dmabuf syncs or bounce copies per frame
+
 
 // --- Global variables for OpenGL ---
 static GLuint texture_id;
 static unsigned char *rgb_frames[2] = {NULL, NULL};
+static int rgb_frame_width[2] = {0, 0};  // Size of the picture held by rgb_frames[0/1]
+static int rgb_frame_height[2] = {0, 0};
+static YuvFormat rgb_frame_yuv[2];       // Layout of rgb_frames[0/1], YUV_LAYOUT_NONE for RGB
+static int rgb_frame_dmabuf[2] = {-1, -1}; // Wayland buffer or KMS framebuffer of a YUV_LAYOUT_DMABUF frame in slot 0/1
+static const YuvFormat dmabuf_frame_format = {YUV_LAYOUT_DMABUF, false, true};
+static double rgb_frame_capture_us[2];   // CLOCK_MONOTONIC time rgb_frames[0/1] were captured
 static int front_buffer_idx = 0;
 static int back_buffer_idx = 1;
 static volatile bool new_frame_captured = false;
@@ -84,13 +159,27 @@ static pthread_mutex_t frame_mutex;
 static pthread_t capture_thread_id = 0; // Initialize to 0
 static volatile bool stop_capture_thread_flag = false;
 static GLenum gl_upload_format = GL_RGB;
+static int frame_bytes_per_pixel = 3; // Of rgb_frames, 4 only for BGRx capture
+static int texture_width = 0;  // Current storage size of texture_id
+static int texture_height = 0;
 
 // For XDG mode
 static int xdg_prev_frame_width = 0;  // Renamed for clarity
 static int xdg_prev_frame_height = 0; // Renamed for clarity
-static bool texture_needs_respecification = false;
+static bool xdg_session_active = false;
 static size_t current_rgb_buffer_size = 0;
 
+// For X11 mode
+static const char *x11_display_name = ""; // Empty uses $DISPLAY
+static bool x11_draw_cursor = true;
+// For Wayland mode
+static const char *wayland_output_name = ""; // Empty takes the first output
+static bool wayland_dmabuf = true;
+// For KMS mode
+static const char *kms_capture_device = ""; // Empty disables KMS capture at startup
+static char kms_device_buf[256];            // Device selected at runtime
+static int kms_crtc = 0;                    // 0 takes the first active CRTC
+
 
 static bool glut_initialized = false;
 
@@ -99,13 +188,84 @@ static bool display_test_pattern = false;
 static float g_plane_orbit_distance = 1.0f;
 static float g_plane_scale = 1.0f;
 static bool use_curved_screen = false;
+static bool passthrough_mode = false; // Present the frame directly, no 3D transform
+static int window_width = 1280;
+static int window_height = 720;
+static float plane_projection[16];  // 45 degree perspective of the window, set by reshape()
+
+#ifdef USE_GLES
+// The passes of --upscale, --mipmaps, --mjpeg-gpu and --compressed-input use desktop GL shaders
+// and texture storage, the GLES build draws the plane with gles_renderer only
+#define DESKTOP_GL_PASSES false
+#else
+#define DESKTOP_GL_PASSES true
+#endif
+
+// --- Software rendering ---
+static const char *soft_render_device = ""; // KMS or fbdev device, empty draws with OpenGL
+static int soft_render_threads = 0;
+static bool use_soft_render = false;
+static volatile sig_atomic_t quit_requested = 0; // Ends the --soft-render loop
+
+// --- GPU upscaling ---
+static bool use_upscale = false;
+static double upscale_sharpness = 0.2; // In stops, 0 is the strongest sharpening
+
+// --- Texture upload scheduling ---
+static int upload_budget_kb = 0; // 0 uploads the whole frame at once
+// Per-tile content hashes for rgb_frames[0/1]. [2] holds those of a USERPTR frame until it takes a slot.
+static uint64_t *tile_hashes[3] = {NULL, NULL, NULL};
+
+// --- Active area detection ---
+static bool auto_crop = false;
+
+// --- Render quality and pacing ---
+static bool use_mipmaps = false;
+static double render_budget_ms = 0.0; // > 0 enables dynamic render resolution
+static bool use_frame_pacing = false;
+
+// --- Capture pipeline ---
+static bool throttle_static = false;
+static bool compressed_input = false;
+static const char *video_decoder_mode = "auto";
+static bool use_mjpeg_gpu = false;
+static bool mjpeg_gpu_verify = false;
+static bool use_gpu_timing = false;
+static bool use_perf_counters = false;
+static int v4l2_buffer_count = 0;  // 0 until resolved from --buffers, the machine profile or BUFFER_COUNT
+static bool run_autotune = false;
+static unsigned int captured_frame_count = 0; // Frames published since start, paces the analysis
+
+// --- Statistics ---
+#define STATS_INTERVAL_MS 5000
+static bool print_stats = false;
+static volatile sig_atomic_t stats_dump_requested = 0; // Set by SIGUSR1
 
 // --- V4L2 Device Path ---
 static const char *v4l2_device_path_str = "/dev/video0"; // Default value
+static char v4l2_device_path_buf[256]; // Device selected at runtime
+
+// --- Live reconfiguration ---
+#define PLANE_DISTANCE_STEP 0.1f
+#define PLANE_SCALE_STEP 1.1f
+
+// A source switch tears down the old and starts the new source on its own thread,
+// the GL side picks up the result in idle() once it is SOURCE_READY
+enum SourceState {
+    SOURCE_RUNNING,
+    SOURCE_SWITCHING,
+    SOURCE_READY
+};
+static volatile int source_state = SOURCE_RUNNING;
+static enum CaptureMode pending_capture_mode = MODE_V4L2;
+static bool pending_test_pattern = false;
+static pthread_t source_switch_thread_id = 0;
+static const char *control_socket_path = "";
 
 // --- Helper Functions ---
 
 static bool use_viture_imu = false;
+static const char *viture_device_selector = ""; // serial number or HID path, empty takes the first glasses
 static volatile float viture_roll = 0.0f;
 static volatile float viture_pitch = 0.0f;
 static volatile float viture_yaw = 0.0f;
@@ -117,6 +277,12 @@ static float average_yaw = 0.0f; // Used for head gesture tracking
 static int skip_initial_imu_frames = 20;
 
 
+static double get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
 static float makeFloat(uint8_t *data) {
     float value = 0;
     uint8_t tem[4];
@@ -244,7 +410,291 @@ static void app_viture_mcu_event_handler(uint16_t msgid, uint8_t *data, uint16_t
 
 
 // --- V4L2 Initialization ---
-void init_v4l2() {
+static bool device_supports_format(__u32 pixelformat) {
+    struct v4l2_fmtdesc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.type = active_buffer_type;
+    while (ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0) {
+        if (desc.pixelformat == pixelformat) return true;
+        desc.index++;
+    }
+    return false;
+}
+
+static void free_userptr_pool(unsigned int count) {
+    if (!userptr_pool) return;
+    for (unsigned int i = 0; i < count; i++) {
+        free(userptr_pool[i]);
+    }
+    free(userptr_pool);
+    userptr_pool = NULL;
+}
+
+static bool alloc_userptr_pool(unsigned int count) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = active_sizeimage ? active_sizeimage :
+                  (size_t)actual_frame_width * actual_frame_height * frame_bytes_per_pixel;
+    userptr_buffer_size = (size + page - 1) / page * page;
+
+    userptr_pool = calloc(count, sizeof(*userptr_pool));
+    if (!userptr_pool) return false;
+    for (unsigned int i = 0; i < count; i++) {
+        if (posix_memalign((void **)&userptr_pool[i], page, userptr_buffer_size) != 0) {
+            userptr_pool[i] = NULL;
+            free_userptr_pool(count);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool queue_v4l2_buffer(unsigned int index) {
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes_q[VIDEO_MAX_PLANES];
+    memset(&buf, 0, sizeof(buf));
+    buf.type = active_buffer_type;
+    buf.memory = active_memory_type;
+    buf.index = index;
+
+    if (active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        memset(planes_q, 0, sizeof(planes_q));
+        buf.m.planes = planes_q;
+        buf.length = num_planes_per_buffer; 
+    }
+    if (active_memory_type == V4L2_MEMORY_USERPTR) {
+        if (active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+            planes_q[0].m.userptr = (unsigned long)userptr_pool[index];
+            planes_q[0].length = userptr_buffer_size;
+        } else {
+            buf.m.userptr = (unsigned long)userptr_pool[index];
+            buf.length = userptr_buffer_size;
+        }
+    }
+
+    if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) { perror("VIDIOC_QBUF"); return false; }
+    return true;
+}
+
+static void unmap_exported_buffer(struct mplane_buffer *buffer) {
+    for (unsigned int p = 0; p < buffer->num_planes_in_buffer; p++) {
+        struct plane_info *plane = &buffer->planes[p];
+        if (!plane->dmabuf_start) continue;
+        munmap(plane->dmabuf_start, plane->length);
+        close(plane->dmabuf_fd);
+        plane->dmabuf_start = NULL;
+        plane->dmabuf_fd = -1;
+    }
+}
+
+// Exports every plane of the MMAP buffers as a dmabuf and maps that. Drivers with
+// non-coherent buffers map dmabufs cached and keep them coherent with DMA_BUF_IOCTL_SYNC.
+static bool map_exported_buffers(void) {
+    for (unsigned int i = 0; i < n_buffers; i++) {
+        for (unsigned int p = 0; p < buffers_mp[i].num_planes_in_buffer; p++) {
+            struct plane_info *plane = &buffers_mp[i].planes[p];
+            struct v4l2_exportbuffer expbuf;
+            memset(&expbuf, 0, sizeof(expbuf));
+            expbuf.type = active_buffer_type;
+            expbuf.index = i;
+            expbuf.plane = p;
+            expbuf.flags = O_RDONLY | O_CLOEXEC;
+            if (ioctl(fd, VIDIOC_EXPBUF, &expbuf) < 0) return false;
+            void *start = mmap(NULL, plane->length, PROT_READ, MAP_SHARED, expbuf.fd, 0);
+            if (start == MAP_FAILED) {
+                close(expbuf.fd);
+                return false;
+            }
+            plane->dmabuf_start = start;
+            plane->dmabuf_fd = expbuf.fd;
+        }
+    }
+    return true;
+}
+
+static const char *capture_read_description(CaptureReadStrategy strategy) {
+    switch (strategy) {
+        case CAPTURE_READ_DMABUF_SYNC: return "reading frames through synced dmabuf mappings";
+        case CAPTURE_READ_BOUNCE: return "copying frames into a bounce buffer before converting";
+        default: return "reading frames directly";
+    }
+}
+
+// Measures how fast the CPU reads the MMAP buffers and picks how the frames are read
+static void choose_capture_read(void) {
+    struct plane_info *probe = &buffers_mp[0].planes[0];
+    double mapped = capture_memory_read_bandwidth(probe->start, probe->length);
+    double reference = capture_memory_reference_bandwidth(probe->length);
+    double dmabuf_mapped = 0.0;
+    double bounce = 0.0;
+
+    CaptureReadStrategy strategy = requested_capture_read;
+    if (strategy == CAPTURE_READ_AUTO) {
+        if (mapped < reference * CAPTURE_MEMORY_CACHED_RATIO) {
+            if (map_exported_buffers()) {
+                dmabuf_mapped = capture_memory_read_bandwidth(probe->dmabuf_start, probe->length);
+            }
+            bounce = capture_memory_copy_bandwidth(probe->start, probe->length);
+        }
+        strategy = capture_memory_choose(mapped, reference, dmabuf_mapped, bounce);
+    } else if (strategy == CAPTURE_READ_DMABUF_SYNC && !map_exported_buffers()) {
+        fprintf(stderr, "V4L2: The driver cannot export the buffers as dmabufs.\n");
+        strategy = CAPTURE_READ_DIRECT;
+    }
+    if (strategy != CAPTURE_READ_DMABUF_SYNC) {
+        for (unsigned int i = 0; i < n_buffers; i++) unmap_exported_buffer(&buffers_mp[i]);
+    }
+    for (unsigned int p = 0; strategy == CAPTURE_READ_BOUNCE && p < buffers_mp[0].num_planes_in_buffer; p++) {
+        bounce_planes[p] = malloc(buffers_mp[0].planes[p].length);
+        if (!bounce_planes[p]) strategy = CAPTURE_READ_DIRECT; // Freed by shutdown_v4l2()
+    }
+    capture_read = strategy;
+    memset(&capture_read_time, 0, sizeof(capture_read_time));
+
+    printf("V4L2: Buffer reads %.0f MB/s (cached memory %.0f MB/s", mapped, reference);
+    if (dmabuf_mapped > 0.0) printf(", exported dmabuf %.0f MB/s", dmabuf_mapped);
+    if (bounce > 0.0) printf(", bulk copy %.0f MB/s", bounce);
+    printf("), %s.\n", capture_read_description(capture_read));
+}
+
+// The plane data of a dequeued MMAP buffer the CPU reads, valid until end_buffer_read()
+static void begin_buffer_read(const struct v4l2_buffer *buf, const struct v4l2_plane *planes_dq,
+                              const unsigned char **data) {
+    struct mplane_buffer *buffer = &buffers_mp[buf->index];
+    double start = stats_now_us();
+    if (capture_read != CAPTURE_READ_DIRECT) perf_counters_begin(PERF_STAGE_BUFFER_READ);
+    for (unsigned int p = 0; p < buffer->num_planes_in_buffer; p++) {
+        struct plane_info *plane = &buffer->planes[p];
+        if (capture_read == CAPTURE_READ_DMABUF_SYNC) {
+            struct dma_buf_sync sync = { DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ };
+            ioctl(plane->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+            data[p] = plane->dmabuf_start;
+        } else if (capture_read == CAPTURE_READ_BOUNCE) {
+            size_t used = active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? planes_dq[p].bytesused : buf->bytesused;
+            if (used == 0 || used > plane->length) used = plane->length;
+            capture_memory_bulk_copy(bounce_planes[p], plane->start, used);
+            data[p] = bounce_planes[p];
+        } else {
+            data[p] = plane->start;
+        }
+    }
+    if (capture_read != CAPTURE_READ_DIRECT) {
+        perf_counters_end((uint64_t)actual_frame_width * actual_frame_height);
+        stats_histogram_add(&capture_read_time, stats_now_us() - start);
+    }
+}
+
+static void end_buffer_read(unsigned int index) {
+    if (capture_read != CAPTURE_READ_DMABUF_SYNC) return;
+    for (unsigned int p = 0; p < buffers_mp[index].num_planes_in_buffer; p++) {
+        struct dma_buf_sync sync = { DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ };
+        ioctl(buffers_mp[index].planes[p].dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+    }
+}
+
+// Stops streaming and releases the buffers and the device. The capture thread must not
+// be running and no rgb_frames slot may point into the USERPTR pool anymore.
+static void shutdown_v4l2(void) {
+    if (fd != -1) {
+        ioctl(fd, VIDIOC_STREAMOFF, &active_buffer_type);
+        if (buffers_mp) {
+            for (unsigned int i = 0; i < n_buffers; ++i) {
+                for (unsigned int p = 0; p < buffers_mp[i].num_planes_in_buffer; ++p) { 
+                     if (buffers_mp[i].planes[p].start && buffers_mp[i].planes[p].start != MAP_FAILED) {
+                        munmap(buffers_mp[i].planes[p].start, buffers_mp[i].planes[p].length);
+                     }
+                }
+                unmap_exported_buffer(&buffers_mp[i]);
+            }
+        }
+        close(fd);
+        fd = -1;
+    }
+    if (buffers_mp) { free(buffers_mp); buffers_mp = NULL; }
+    free_userptr_pool(n_buffers);
+    n_buffers = 0;
+    video_decoder_shutdown();
+    for (int p = 0; p < VIDEO_MAX_PLANES; p++) {
+        free(bounce_planes[p]);
+        bounce_planes[p] = NULL;
+    }
+    capture_read = CAPTURE_READ_DIRECT;
+
+    active_memory_type = V4L2_MEMORY_MMAP;
+    raw_capture_format = false;
+    decoded_capture_format = false;
+    active_bytesperline = 0;
+    nominal_timeperframe.numerator = 0;
+    nominal_timeperframe.denominator = 0;
+    active_sizeimage = 0;
+    frame_bytes_per_pixel = 3;
+    gl_upload_format = GL_RGB;
+    capture_colorimetry.bt709 = false;
+    capture_colorimetry.full_range = false;
+}
+
+// Drivers that don't say (DEFAULT) get BT.601 limited range, like before the driver was asked
+static void set_capture_colorimetry(__u32 ycbcr_enc, __u32 quantization) {
+    capture_colorimetry.bt709 = ycbcr_enc == V4L2_YCBCR_ENC_709;
+    capture_colorimetry.full_range = quantization == V4L2_QUANTIZATION_FULL_RANGE;
+}
+
+static const char *colorimetry_name(const YuvFormat *format) {
+    if (format->bt709) return format->full_range ? "BT.709 full range" : "BT.709 limited range";
+    return format->full_range ? "BT.601 full range" : "BT.601 limited range";
+}
+
+static bool v4l2_init_failed(void) {
+    shutdown_v4l2();
+    return false;
+}
+
+// Selects H.264 or HEVC and opens a decoder for it
+static bool set_compressed_format(__u32 pixelformat) {
+    if (!device_supports_format(pixelformat)) return false;
+
+    struct v4l2_format fmt;
+    bool mplane = active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = active_buffer_type;
+    if (mplane) {
+        fmt.fmt.pix_mp.width       = requested_frame_width;
+        fmt.fmt.pix_mp.height      = requested_frame_height;
+        fmt.fmt.pix_mp.pixelformat = pixelformat;
+        fmt.fmt.pix_mp.field       = V4L2_FIELD_NONE;
+        fmt.fmt.pix_mp.num_planes  = 1;
+    } else {
+        fmt.fmt.pix.width       = requested_frame_width;
+        fmt.fmt.pix.height      = requested_frame_height;
+        fmt.fmt.pix.pixelformat = pixelformat;
+        fmt.fmt.pix.field       = V4L2_FIELD_NONE;
+    }
+    if (ioctl(fd, VIDIOC_S_FMT, &fmt) < 0) {
+        perror("VIDIOC_S_FMT (H.264/HEVC) failed");
+        return false;
+    }
+    if ((mplane ? fmt.fmt.pix_mp.pixelformat : fmt.fmt.pix.pixelformat) != pixelformat ||
+        (mplane && fmt.fmt.pix_mp.num_planes != 1)) {
+        return false;
+    }
+
+    int width = mplane ? (int)fmt.fmt.pix_mp.width : (int)fmt.fmt.pix.width;
+    int height = mplane ? (int)fmt.fmt.pix_mp.height : (int)fmt.fmt.pix.height;
+    if (!video_decoder_init(pixelformat, width, height, video_decoder_mode)) {
+        return false;
+    }
+    active_pixel_format = pixelformat;
+    num_planes_per_buffer = 1;
+    actual_frame_width = width;
+    actual_frame_height = height;
+    gl_upload_format = GL_RGB;
+    decoded_capture_format = true;
+    printf("V4L2: Format set to %dx%d, pixelformat %s (decoded, converted on the GPU)\n",
+           actual_frame_width, actual_frame_height, pixelformat == V4L2_PIX_FMT_H264 ? "H.264" : "HEVC");
+    return true;
+}
+
+// Opens v4l2_device_path_str and starts streaming. Returns false (with the device closed) on failure.
+bool init_v4l2() {
     struct v4l2_capability cap;
     struct v4l2_format fmt;
     struct v4l2_requestbuffers req;
@@ -253,10 +703,10 @@ void init_v4l2() {
     fd = open(v4l2_device_path_str, O_RDWR | O_NONBLOCK, 0);
     if (fd < 0) { 
         fprintf(stderr, "Cannot open device %s: %s\n", v4l2_device_path_str, strerror(errno)); 
-        exit(EXIT_FAILURE); 
+        return v4l2_init_failed(); 
     }
 
-    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) < 0) { perror("VIDIOC_QUERYCAP"); exit(EXIT_FAILURE); }
+    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) < 0) { perror("VIDIOC_QUERYCAP"); return v4l2_init_failed(); }
 
     if (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
         active_buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
@@ -265,21 +715,69 @@ void init_v4l2() {
         active_buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         printf("V4L2: Device supports single-planar video capture.\n");
     } else {
-        fprintf(stderr, "Device does not support video capture (single or multi-planar)\n"); exit(EXIT_FAILURE);
+        fprintf(stderr, "Device does not support video capture (single or multi-planar)\n"); return v4l2_init_failed();
     }
 
     if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
-        fprintf(stderr, "Device does not support streaming\n"); exit(EXIT_FAILURE);
+        fprintf(stderr, "Device does not support streaming\n"); return v4l2_init_failed();
     }
     printf("V4L2: Device supports streaming.\n");
 
+    bool format_set = false;
+    bool mplane = active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+    // Formats that need no conversion come first, they can be captured into memory the renderer uploads from
+    for (size_t i = 0; i < sizeof(raw_formats) / sizeof(raw_formats[0]) && !format_set; i++) {
+        if (!device_supports_format(raw_formats[i].pixelformat)) continue;
+
+        memset(&fmt, 0, sizeof(fmt));
+        fmt.type = active_buffer_type;
+        if (mplane) {
+            fmt.fmt.pix_mp.width       = requested_frame_width;
+            fmt.fmt.pix_mp.height      = requested_frame_height;
+            fmt.fmt.pix_mp.pixelformat = raw_formats[i].pixelformat;
+            fmt.fmt.pix_mp.field       = V4L2_FIELD_NONE;
+            fmt.fmt.pix_mp.num_planes  = 1;
+        } else {
+            fmt.fmt.pix.width       = requested_frame_width;
+            fmt.fmt.pix.height      = requested_frame_height;
+            fmt.fmt.pix.pixelformat = raw_formats[i].pixelformat;
+            fmt.fmt.pix.field       = V4L2_FIELD_NONE;
+        }
+        if (ioctl(fd, VIDIOC_S_FMT, &fmt) < 0) {
+            perror("VIDIOC_S_FMT (raw RGB) failed");
+            continue;
+        }
+        if ((mplane ? fmt.fmt.pix_mp.pixelformat : fmt.fmt.pix.pixelformat) != raw_formats[i].pixelformat ||
+            (mplane && fmt.fmt.pix_mp.num_planes != 1)) {
+            continue;
+        }
+
+        active_pixel_format = raw_formats[i].pixelformat;
+        num_planes_per_buffer = 1;
+        actual_frame_width = mplane ? (int)fmt.fmt.pix_mp.width : (int)fmt.fmt.pix.width;
+        actual_frame_height = mplane ? (int)fmt.fmt.pix_mp.height : (int)fmt.fmt.pix.height;
+        active_bytesperline = mplane ? fmt.fmt.pix_mp.plane_fmt[0].bytesperline : fmt.fmt.pix.bytesperline;
+        active_sizeimage = mplane ? fmt.fmt.pix_mp.plane_fmt[0].sizeimage : fmt.fmt.pix.sizeimage;
+        gl_upload_format = raw_formats[i].gl_format;
+        frame_bytes_per_pixel = raw_formats[i].bytes_per_pixel;
+        if (active_bytesperline == 0) {
+            active_bytesperline = (unsigned int)actual_frame_width * frame_bytes_per_pixel;
+        }
+        raw_capture_format = true;
+        printf("V4L2: Format set to %dx%d, pixelformat %c%c%c%c (no conversion needed)\n",
+               actual_frame_width, actual_frame_height,
+               (active_pixel_format)&0xFF, (active_pixel_format>>8)&0xFF,
+               (active_pixel_format>>16)&0xFF, (active_pixel_format>>24)&0xFF);
+        format_set = true;
+    }
+
     memset(&fmt, 0, sizeof(fmt));
     fmt.type = active_buffer_type;
-    bool format_set = false;
 
-    if (active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
-        fmt.fmt.pix_mp.width       = FRAME_WIDTH;
-        fmt.fmt.pix_mp.height      = FRAME_HEIGHT;
+    if (!format_set && active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        fmt.fmt.pix_mp.width       = requested_frame_width;
+        fmt.fmt.pix_mp.height      = requested_frame_height;
         fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV24; 
         fmt.fmt.pix_mp.field       = V4L2_FIELD_NONE;
         fmt.fmt.pix_mp.num_planes  = 2; 
@@ -291,8 +789,9 @@ void init_v4l2() {
                 actual_frame_width = fmt.fmt.pix_mp.width;
                 actual_frame_height = fmt.fmt.pix_mp.height;
                 gl_upload_format = GL_RGB;
-                printf("V4L2: Format set to %dx%d, pixelformat NV24, %u planes (MPLANE)\n",
-                       actual_frame_width, actual_frame_height, num_planes_per_buffer);
+                set_capture_colorimetry(fmt.fmt.pix_mp.ycbcr_enc, fmt.fmt.pix_mp.quantization);
+                printf("V4L2: Format set to %dx%d, pixelformat NV24, %u planes (MPLANE), %s\n",
+                       actual_frame_width, actual_frame_height, num_planes_per_buffer, colorimetry_name(&capture_colorimetry));
                 format_set = true;
             } else {
                  fprintf(stderr, "V4L2: Device did not accept NV24 with 1 or 2 planes as expected. Planes: %u, Format: %c%c%c%c\n",
@@ -304,12 +803,21 @@ void init_v4l2() {
         }
     }
     
+    // Only on request, decoding adds more latency than MJPEG. H.264 decodes faster than HEVC.
+    if (!format_set && compressed_input) {
+        if (!video_decoder_available()) {
+            fprintf(stderr, "V4L2: Built without libavcodec, --compressed-input is ignored.\n");
+        } else {
+            format_set = set_compressed_format(V4L2_PIX_FMT_H264) || set_compressed_format(V4L2_PIX_FMT_HEVC);
+        }
+    }
+
     if (!format_set) {
         printf("V4L2: Attempting single-plane MJPEG format.\n");
         active_buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         fmt.type = active_buffer_type;
-        fmt.fmt.pix.width       = FRAME_WIDTH;
-        fmt.fmt.pix.height      = FRAME_HEIGHT;
+        fmt.fmt.pix.width       = requested_frame_width;
+        fmt.fmt.pix.height      = requested_frame_height;
         fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
         fmt.fmt.pix.field       = V4L2_FIELD_NONE;
         if (ioctl(fd, VIDIOC_S_FMT, &fmt) == 0) {
@@ -330,8 +838,8 @@ void init_v4l2() {
         printf("V4L2: Attempting single-plane YUYV format.\n");
         active_buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         fmt.type = active_buffer_type;
-        fmt.fmt.pix.width       = FRAME_WIDTH;
-        fmt.fmt.pix.height      = FRAME_HEIGHT;
+        fmt.fmt.pix.width       = requested_frame_width;
+        fmt.fmt.pix.height      = requested_frame_height;
         fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
         fmt.fmt.pix.field       = V4L2_FIELD_NONE;
         if (ioctl(fd, VIDIOC_S_FMT, &fmt) == 0) {
@@ -340,29 +848,52 @@ void init_v4l2() {
             actual_frame_width = fmt.fmt.pix.width;
             actual_frame_height = fmt.fmt.pix.height;
             gl_upload_format = GL_BGR;
-            printf("V4L2: Format set to %dx%d, pixelformat YUYV (SINGLE-PLANE)\n",
-                   actual_frame_width, actual_frame_height);
+            set_capture_colorimetry(fmt.fmt.pix.ycbcr_enc, fmt.fmt.pix.quantization);
+            printf("V4L2: Format set to %dx%d, pixelformat YUYV (SINGLE-PLANE), %s\n",
+                   actual_frame_width, actual_frame_height, colorimetry_name(&capture_colorimetry));
             format_set = true;
         } else {
             perror("VIDIOC_S_FMT (SINGLE-PLANE YUYV) also failed.");
-            exit(EXIT_FAILURE);
+            return v4l2_init_failed();
         }
     }
     if (!format_set) { 
         fprintf(stderr, "V4L2: Failed to set any video format.\n");
-        exit(EXIT_FAILURE);
+        return v4l2_init_failed();
+    }
+
+    // Raw frames without row padding can be captured into our own memory and uploaded from there.
+    // --auto-crop needs the copy, the cropped picture is packed into a frame buffer of its own.
+    active_memory_type = V4L2_MEMORY_MMAP;
+    if (raw_capture_format && auto_crop) {
+        printf("V4L2: --auto-crop copies the frames, USERPTR capture is not used.\n");
+    } else if (raw_capture_format && active_bytesperline == (unsigned int)actual_frame_width * frame_bytes_per_pixel) {
+        memset(&req, 0, sizeof(req));
+        req.count = v4l2_buffer_count;
+        req.type = active_buffer_type;
+        req.memory = V4L2_MEMORY_USERPTR;
+        if (ioctl(fd, VIDIOC_REQBUFS, &req) == 0 && req.count >= 3 && alloc_userptr_pool(req.count)) {
+            active_memory_type = V4L2_MEMORY_USERPTR;
+            n_buffers = req.count;
+            printf("V4L2: %d USERPTR buffers of %zu bytes, frames are uploaded without copy.\n",
+                   n_buffers, userptr_buffer_size);
+        } else {
+            printf("V4L2: USERPTR capture not available, using MMAP and a copy.\n");
+        }
     }
 
-    memset(&req, 0, sizeof(req));
-    req.count = BUFFER_COUNT;
-    req.type = active_buffer_type;
-    req.memory = V4L2_MEMORY_MMAP;
-    if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0) { perror("VIDIOC_REQBUFS"); exit(EXIT_FAILURE); }
-    n_buffers = req.count;
-    printf("V4L2: %d buffers requested.\n", n_buffers);
+    if (active_memory_type == V4L2_MEMORY_MMAP) {
+        memset(&req, 0, sizeof(req));
+        req.count = v4l2_buffer_count;
+        req.type = active_buffer_type;
+        req.memory = V4L2_MEMORY_MMAP;
+        if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0) { perror("VIDIOC_REQBUFS"); return v4l2_init_failed(); }
+        n_buffers = req.count;
+        printf("V4L2: %d buffers requested.\n", n_buffers);
+    }
 
     buffers_mp = calloc(n_buffers, sizeof(*buffers_mp)); 
-    for (unsigned int i = 0; i < n_buffers; ++i) {
+    for (unsigned int i = 0; i < n_buffers && active_memory_type == V4L2_MEMORY_MMAP; ++i) {
         struct v4l2_buffer buf;
         memset(&buf, 0, sizeof(buf));
         buf.type   = active_buffer_type;
@@ -376,7 +907,7 @@ void init_v4l2() {
             buf.length = num_planes_per_buffer; 
         }
 
-        if (ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) { perror("VIDIOC_QUERYBUF"); exit(EXIT_FAILURE); }
+        if (ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) { perror("VIDIOC_QUERYBUF"); return v4l2_init_failed(); }
 
         if (active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
             buffers_mp[i].num_planes_in_buffer = num_planes_per_buffer;
@@ -385,7 +916,7 @@ void init_v4l2() {
                 buffers_mp[i].planes[p].start = mmap(NULL, buf.m.planes[p].length,
                                                      PROT_READ | PROT_WRITE, MAP_SHARED,
                                                      fd, buf.m.planes[p].m.mem_offset);
-                if (buffers_mp[i].planes[p].start == MAP_FAILED) { perror("mmap mplane"); exit(EXIT_FAILURE); }
+                if (buffers_mp[i].planes[p].start == MAP_FAILED) { perror("mmap mplane"); return v4l2_init_failed(); }
             }
         } else { 
             buffers_mp[i].num_planes_in_buffer = 1;
@@ -393,31 +924,213 @@ void init_v4l2() {
             buffers_mp[i].planes[0].start = mmap(NULL, buf.length,
                                                  PROT_READ | PROT_WRITE, MAP_SHARED,
                                                  fd, buf.m.offset); 
-            if (buffers_mp[i].planes[0].start == MAP_FAILED) { perror("mmap splane"); exit(EXIT_FAILURE); }
+            if (buffers_mp[i].planes[0].start == MAP_FAILED) { perror("mmap splane"); return v4l2_init_failed(); }
         }
     }
-    printf("V4L2: Buffers and planes mapped.\n");
+    if (active_memory_type == V4L2_MEMORY_MMAP) {
+        printf("V4L2: Buffers and planes mapped.\n");
+        choose_capture_read();
+    }
 
     for (unsigned int i = 0; i < n_buffers; ++i) {
-        struct v4l2_buffer buf;
-        memset(&buf, 0, sizeof(buf));
-        buf.type = active_buffer_type;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
+        if (!queue_v4l2_buffer(i)) return v4l2_init_failed();
+    }
+    printf("V4L2: Buffers queued.\n");
 
-        if (active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
-            struct v4l2_plane planes_q[VIDEO_MAX_PLANES]; 
-            memset(planes_q, 0, sizeof(planes_q));
-            buf.m.planes = planes_q;
-            buf.length = num_planes_per_buffer; 
+    // The frame interval is only needed to throttle static content through the device
+    struct v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = active_buffer_type;
+    if (ioctl(fd, VIDIOC_G_PARM, &parm) == 0 && (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME) &&
+        parm.parm.capture.timeperframe.denominator != 0) {
+        nominal_timeperframe = parm.parm.capture.timeperframe;
+    }
+
+    if (ioctl(fd, VIDIOC_STREAMON, &active_buffer_type) < 0) { perror("VIDIOC_STREAMON"); return v4l2_init_failed(); }
+    printf("V4L2: Streaming started.\n");
+    return true;
+}
+
+// Divides the device frame rate by divisor (1 restores it). Many drivers only accept this
+// while not streaming, false means the rate stayed as it was.
+static bool set_capture_rate_divisor(unsigned int divisor) {
+    if (nominal_timeperframe.denominator == 0) return false;
+    struct v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = active_buffer_type;
+    parm.parm.capture.timeperframe.numerator = nominal_timeperframe.numerator * divisor;
+    parm.parm.capture.timeperframe.denominator = nominal_timeperframe.denominator;
+    if (ioctl(fd, VIDIOC_S_PARM, &parm) < 0) {
+        return false;
+    }
+    // Drivers round to the closest interval they support
+    return (uint64_t)parm.parm.capture.timeperframe.numerator * nominal_timeperframe.denominator ==
+           (uint64_t)nominal_timeperframe.numerator * divisor * parm.parm.capture.timeperframe.denominator;
+}
+
+// --- Frame Handoff ---
+
+// (Re)allocates the per-tile hashes the upload scheduler uses for dirty detection
+static void alloc_tile_hashes(void) {
+    if (upload_budget_kb <= 0) return;
+    size_t count = upload_scheduler_tile_count(actual_frame_width, actual_frame_height);
+    for (int i = 0; i < 3; i++) {
+        free(tile_hashes[i]);
+        tile_hashes[i] = calloc(count, sizeof(uint64_t));
+    }
+}
+
+// (Re)allocates both frame buffers, cleared, for the current source size and format
+static bool alloc_frame_buffers(void) {
+    current_rgb_buffer_size = (size_t)actual_frame_width * actual_frame_height * frame_bytes_per_pixel;
+    if (current_rgb_buffer_size == 0) { // Safety if dimensions were somehow zero
+        fprintf(stderr, "Warning: Frame dimensions are zero. Defaulting to 1x1.\n");
+        actual_frame_width = 1; actual_frame_height = 1;
+        current_rgb_buffer_size = frame_bytes_per_pixel;
+    }
+    // MJPEG decoded on the GPU passes 16 bit coefficients through the frame buffers
+    if (mjpeg_gpu_active() && fd != -1 && active_pixel_format == V4L2_PIX_FMT_MJPEG) {
+        size_t coefficient_size = mjpeg_gpu_buffer_size(actual_frame_width, actual_frame_height);
+        if (coefficient_size > current_rgb_buffer_size) current_rgb_buffer_size = coefficient_size;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        free(rgb_frames[i]);
+        rgb_frames[i] = calloc(1, current_rgb_buffer_size);
+    }
+    if (!rgb_frames[0] || !rgb_frames[1]) {
+        fprintf(stderr, "Failed to allocate memory for RGB frames (%dx%d)\n", actual_frame_width, actual_frame_height);
+        return false;
+    }
+    return true;
+}
+
+// Marks rgb_frames[back_buffer_idx] (width x height pixels) as complete so display() picks it up.
+// The tile hashes are computed here so the capture thread pays for them, not the render loop.
+// capture_us is the CLOCK_MONOTONIC time the frame was captured, used for frame pacing.
+// yuv describes frames holding decoded 4:2:0 planes, NULL for RGB.
+static void hash_frame_tiles(const unsigned char *frame, int width, int height, uint64_t *hashes) {
+    if (!hashes) return;
+    perf_counters_begin(PERF_STAGE_HASH);
+    upload_scheduler_hash_tiles(frame, width, height, frame_bytes_per_pixel, hashes);
+    perf_counters_end((uint64_t)width * height);
+}
+
+// With --frame-pacing at matched rates the V4L2 capture thread holds the frame back until its
+// publish time. Returns when the frame was ready.
+static double wait_for_publish_time(double capture_us) {
+    double ready_us = stats_now_us();
+    if (use_frame_pacing && current_capture_mode == MODE_V4L2 && !display_test_pattern) {
+        // Only the V4L2 capture thread can wait, the other sources publish from the render loop
+        double publish_us = frame_pacing_publish_time(capture_us);
+        if (publish_us > ready_us) {
+            struct timespec until = { (time_t)(publish_us / 1e6), (long)(fmod(publish_us, 1e6) * 1000.0) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
         }
+    }
+    return ready_us;
+}
 
-        if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) { perror("VIDIOC_QBUF"); exit(EXIT_FAILURE); }
+// Fills in the back slot's metadata and hands it to display(), frame_mutex held
+static void mark_back_frame_ready(int width, int height, double capture_us, double ready_us, const YuvFormat *yuv) {
+    rgb_frame_width[back_buffer_idx] = width;
+    rgb_frame_height[back_buffer_idx] = height;
+    rgb_frame_capture_us[back_buffer_idx] = capture_us;
+    if (yuv) {
+        rgb_frame_yuv[back_buffer_idx] = *yuv;
+    } else {
+        rgb_frame_yuv[back_buffer_idx].layout = YUV_LAYOUT_NONE;
     }
-    printf("V4L2: Buffers queued.\n");
+    frame_pacing_frame_arrived(capture_us, ready_us, new_frame_captured);
+    new_frame_captured = true;
+}
 
-    if (ioctl(fd, VIDIOC_STREAMON, &active_buffer_type) < 0) { perror("VIDIOC_STREAMON"); exit(EXIT_FAILURE); }
-    printf("V4L2: Streaming started.\n");
+static void publish_frame_with_format(int width, int height, double capture_us, const YuvFormat *yuv) {
+    if (!yuv) hash_frame_tiles(rgb_frames[back_buffer_idx], width, height, tile_hashes[back_buffer_idx]);
+    double ready_us = wait_for_publish_time(capture_us);
+    pthread_mutex_lock(&frame_mutex);
+    mark_back_frame_ready(width, height, capture_us, ready_us, yuv);
+    pthread_mutex_unlock(&frame_mutex);
+    captured_frame_count++;
+}
+
+static void publish_frame(int width, int height, double capture_us) {
+    publish_frame_with_format(width, height, capture_us, NULL);
+}
+
+// USERPTR capture: the dequeued buffer itself becomes the back frame.
+// Returns the pool buffer it replaced, which display() no longer uses, or -1.
+// The buffer is hashed and paced before it takes the slot, and the slot, its metadata and
+// new_frame_captured change together: display() may swap whenever frame_mutex is free,
+// and would otherwise show this buffer with the previous frame's metadata and then the
+// previous frame once more.
+static int publish_userptr_frame(unsigned int index, double capture_us) {
+    hash_frame_tiles(userptr_pool[index], actual_frame_width, actual_frame_height, tile_hashes[2]);
+    double ready_us = wait_for_publish_time(capture_us);
+
+    pthread_mutex_lock(&frame_mutex);
+    int released = userptr_slot_index[back_buffer_idx];
+    if (released < 0) {
+        free(rgb_frames[back_buffer_idx]); // First pool buffer in this slot, drop the initial frame
+    }
+    userptr_slot_index[back_buffer_idx] = (int)index;
+    rgb_frames[back_buffer_idx] = userptr_pool[index];
+    uint64_t *hashes = tile_hashes[back_buffer_idx];
+    tile_hashes[back_buffer_idx] = tile_hashes[2];
+    tile_hashes[2] = hashes;
+    mark_back_frame_ready(actual_frame_width, actual_frame_height, capture_us, ready_us, NULL);
+    pthread_mutex_unlock(&frame_mutex);
+    captured_frame_count++;
+    return released;
+}
+
+static bool is_full_frame(const FrameRect *rect) {
+    return rect->x == 0 && rect->y == 0 &&
+           rect->width == actual_frame_width && rect->height == actual_frame_height;
+}
+
+// Returns the part of the source frame that has to be converted and uploaded.
+// With --auto-crop the luma (pixel_step bytes between samples, stride bytes between rows)
+// is analyzed every ACTIVE_AREA_INTERVAL_FRAMES frames, pass NULL to skip the analysis.
+static void get_crop_rect(const unsigned char *luma, int pixel_step, int stride, FrameRect *crop) {
+    if (!auto_crop) {
+        crop->x = 0;
+        crop->y = 0;
+        crop->width = actual_frame_width;
+        crop->height = actual_frame_height;
+        return;
+    }
+    if (luma && active_area_due(captured_frame_count)) {
+        perf_counters_begin(PERF_STAGE_CROP);
+        active_area_analyze(luma, pixel_step, stride);
+        perf_counters_end((uint64_t)actual_frame_width * actual_frame_height);
+    }
+    active_area_get(crop);
+}
+
+void *capture_thread_func(void *arg);
+
+static bool start_v4l2_capture_thread(void) {
+    printf("V4L2_GL: Creating V4L2 capture thread...\n");
+    stop_capture_thread_flag = false;
+    if (pthread_create(&capture_thread_id, NULL, capture_thread_func, NULL) != 0) {
+        perror("Failed to create V4L2 capture thread");
+        capture_thread_id = 0;
+        return false;
+    }
+    printf("V4L2_GL: V4L2 capture thread created.\n");
+    return true;
+}
+
+static void stop_v4l2_capture_thread(void) {
+    if (capture_thread_id == 0) return;
+    printf("V4L2_GL: Signaling V4L2 capture thread to stop...\n");
+    stop_capture_thread_flag = true;
+    printf("V4L2_GL: Joining V4L2 capture thread...\n");
+    pthread_join(capture_thread_id, NULL);
+    capture_thread_id = 0; // Reset after joining
+    stop_capture_thread_flag = false;
+    printf("V4L2_GL: V4L2 capture thread joined.\n");
 }
 
 // --- OpenGL/GLUT Functions ---
@@ -432,101 +1145,412 @@ void cleanup() {
         deinit();       
 #else
         set_imu(false); 
+        viture_print_stats(stdout); // The statistics go away with the driver
         viture_driver_close(); 
 #endif
     }
 
-    if (fd != -1) {
-        ioctl(fd, VIDIOC_STREAMOFF, &active_buffer_type);
-        if (buffers_mp) {
-            for (unsigned int i = 0; i < n_buffers; ++i) {
-                for (unsigned int p = 0; p < buffers_mp[i].num_planes_in_buffer; ++p) { 
-                     if (buffers_mp[i].planes[p].start && buffers_mp[i].planes[p].start != MAP_FAILED) {
-                        munmap(buffers_mp[i].planes[p].start, buffers_mp[i].planes[p].length);
-                     }
-                }
-            }
-        }
-        close(fd);
-        fd = -1;
+    control_shutdown();
+
+    // A source switch in progress finishes first, then the capture thread stops before its buffers go away
+    if (source_switch_thread_id != 0) {
+        pthread_join(source_switch_thread_id, NULL);
+        source_switch_thread_id = 0;
     }
-    if (buffers_mp) { free(buffers_mp); buffers_mp = NULL; }
-    if (rgb_frames[0]) { free(rgb_frames[0]); rgb_frames[0] = NULL; }
-    if (rgb_frames[1]) { free(rgb_frames[1]); rgb_frames[1] = NULL; }
-    
-    // Signal capture thread to stop and wait for it (only if it was started for V4L2)
-    if (current_capture_mode == MODE_V4L2 && capture_thread_id != 0) {
-        printf("V4L2_GL: Signaling V4L2 capture thread to stop...\n");
-        stop_capture_thread_flag = true;
-        printf("V4L2_GL: Joining V4L2 capture thread...\n");
-        pthread_join(capture_thread_id, NULL);
-        capture_thread_id = 0; // Reset after joining
-        printf("V4L2_GL: V4L2 capture thread joined.\n");
+    stop_v4l2_capture_thread();
+
+    // Slots holding a USERPTR pool buffer are freed with the pool
+    for (int i = 0; i < 2; i++) {
+        if (userptr_slot_index[i] < 0) free(rgb_frames[i]);
+        rgb_frames[i] = NULL;
+        userptr_slot_index[i] = -1;
     }
+    shutdown_v4l2();
     
     // Clean up XDG screencast session if it was used
-    if (current_capture_mode == MODE_XDG) {
+    if (xdg_session_active) {
+        xdg_session_active = false;
         printf("V4L2_GL: Cleaning up XDG screencast session...\n");
         cleanup_screencast_session();
     }
+    x11_source_cleanup();
+    wayland_source_cleanup();
+    kms_source_cleanup();
+    perf_counters_cleanup(); // The threads counting stages are gone, the report with them
+
+    // The capture thread is gone now, nothing hashes into these anymore
+    free(tile_hashes[0]); tile_hashes[0] = NULL;
+    free(tile_hashes[1]); tile_hashes[1] = NULL;
+    free(tile_hashes[2]); tile_hashes[2] = NULL;
+    upload_scheduler_shutdown();
 
     pthread_mutex_destroy(&frame_mutex); 
-    if (texture_id != 0) glDeleteTextures(1, &texture_id);
+    frame_pacing_shutdown();
+    if (use_soft_render) {
+        // Gives the display back to the console, there is no GL state to free
+        soft_renderer_cleanup();
+    } else {
+        if (use_upscale) upscale_cleanup();
+        yuv_convert_cleanup();
+        mjpeg_gpu_cleanup();
+        gpu_timer_cleanup();
+        mipmap_cleanup();
+        render_scale_cleanup();
+        gl_utility_cleanup();
+#ifdef USE_GLES
+        gles_renderer_cleanup();
+#else
+        if (texture_id != 0) glDeleteTextures(1, &texture_id);
+#endif
+    }
     printf("Cleanup complete.\n");
 }
 
-void display() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+/* Finds the texture coordinate the centre of view falls on so the upload scheduler
+   can send that part of the screen first. Inverts the modelview rotation of display()
+   and intersects the view ray with the (flat) plane. */
+static void compute_view_focus(float *u, float *v) {
+    *u = 0.5f;
+    *v = 0.5f;
+    if (!use_viture_imu || !initial_offsets_set || passthrough_mode) return;
+
+    float yaw = (viture_yaw - initial_yaw_offset) * (float)M_PI / 180.0f;
+    float pitch = (viture_pitch - initial_pitch_offset) * (float)M_PI / 180.0f;
+    float roll = (viture_roll - initial_roll_offset) * (float)M_PI / 180.0f;
+
+    // Eye position and view direction, rotated into the plane's frame (inverse of Ry * Rx * Rz)
+    float e[3] = {0.0f, 0.0f, 2.0f};
+    float d[3] = {0.0f, 0.0f, -1.0f};
+    float *vecs[2] = {e, d};
+    for (int i = 0; i < 2; i++) {
+        float *p = vecs[i];
+        float x = p[0] * cosf(yaw) - p[2] * sinf(yaw);
+        float z = p[0] * sinf(yaw) + p[2] * cosf(yaw);
+        p[0] = x; p[2] = z;
+        float y = p[1] * cosf(pitch) + p[2] * sinf(pitch);
+        z = -p[1] * sinf(pitch) + p[2] * cosf(pitch);
+        p[1] = y; p[2] = z;
+        x = p[0] * cosf(roll) + p[1] * sinf(roll);
+        y = -p[0] * sinf(roll) + p[1] * cosf(roll);
+        p[0] = x; p[1] = y;
+    }
+
+    if (d[2] >= -1e-4f) return; // Looking away from the plane
+    float t = (-g_plane_orbit_distance - e[2]) / d[2];
+    float aspect_ratio = (float)texture_width / (float)texture_height;
+    float px = (e[0] + t * d[0]) / g_plane_scale;
+    float py = (e[1] + t * d[1]) / g_plane_scale;
+    *u = (px / aspect_ratio + 1.0f) * 0.5f;
+    *v = (1.0f - py) * 0.5f;
+}
+
+/* Largest rectangle with the aspect ratio of the frame that fits into the window, centred.
+   With a frame the size of the window this is the 1:1 copy. */
+static void compute_passthrough_rect(int src_width, int src_height, int *x, int *y, int *w, int *h) {
+    if ((long)window_width * src_height <= (long)window_height * src_width) {
+        *w = window_width;
+        *h = (int)((long)window_width * src_height / src_width);
+    } else {
+        *w = (int)((long)window_height * src_width / src_height);
+        *h = window_height;
+    }
+    *x = (window_width - *w) / 2;
+    *y = (window_height - *h) / 2;
+}
+
+/* The upscaled texture should match the number of panel pixels the plane covers.
+   Projects the plane height at its distance through the 45 degree field of view of reshape(). */
+static void compute_upscale_output_size(int *w, int *h) {
+    if (passthrough_mode) {
+        int x, y;
+        compute_passthrough_rect(texture_width, texture_height, &x, &y, w, h);
+        return;
+    }
+    float view_distance = 2.0f + g_plane_orbit_distance;
+    float covered = (2.0f * g_plane_scale) / (2.0f * view_distance * tanf(22.5f * (float)M_PI / 180.0f));
+    int out_h = (int)(window_height * covered);
+    if (out_h > 2 * window_height) out_h = 2 * window_height;
+    *h = out_h;
+    *w = (int)((float)out_h * texture_width / texture_height);
+}
+
+static void upload_texture_region(int x, int y, int w, int h, void *user) {
+    const unsigned char *frame = user;
+#ifdef USE_GLES
+    gles_renderer_upload_region(frame, x, y, w, h);
+#else
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, gl_upload_format, GL_UNSIGNED_BYTE,
+                    frame + ((size_t)y * texture_width + x) * frame_bytes_per_pixel);
+    mipmap_mark_dirty(x, y, w, h);
+#endif
+}
+
+// Starts PERF_STAGE_UPLOAD once per render frame, at the first upload work
+static void begin_upload_stage(bool *counting) {
+    if (*counting) return;
+    perf_counters_begin(PERF_STAGE_UPLOAD);
+    *counting = true;
+}
+
+/* Head-locked presentation: the frame is copied into the window with a framebuffer blit,
+   no depth test, no projection and no texture sampling. Falls back to a window aligned
+   quad if the texture can not be used as a blit source. */
+static void present_passthrough(GLuint texture, int src_width, int src_height) {
+    int x, y, w, h;
+    compute_passthrough_rect(src_width, src_height, &x, &y, &w, &h);
+#ifdef USE_GLES
+    // A blit would ignore the red/blue swizzle of BGR textures
+    gles_renderer_draw_passthrough(texture, x, y, w, h);
+#else
+    if (gl_utility_blit_texture(texture, src_width, src_height, x, y, w, h)) {
+        return;
+    }
 
+    glPushAttrib(GL_VIEWPORT_BIT);
+    glViewport(x, y, w, h);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
-    gluLookAt(0.0, 0.0, 2.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0); 
+    glBegin(GL_QUADS);
+        glTexCoord2f(0.0f, 1.0f); glVertex2f(-1.0f, -1.0f);
+        glTexCoord2f(1.0f, 1.0f); glVertex2f( 1.0f, -1.0f);
+        glTexCoord2f(1.0f, 0.0f); glVertex2f( 1.0f,  1.0f);
+        glTexCoord2f(0.0f, 0.0f); glVertex2f(-1.0f,  1.0f);
+    glEnd();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
+#endif
+}
+
+// Camera at z = 2 looking at the origin, turned by the head rotation (or the idle animation
+// without IMU), then the plane at its orbit distance and scale
+static void compute_plane_modelview(float m[16]) {
+    gl_utility_mat4_identity(m);
+    gl_utility_mat4_translate(m, 0.0f, 0.0f, -2.0f);
 
     if (use_viture_imu) {
-        glRotatef(viture_yaw - initial_yaw_offset, 0.0f, 1.0f, 0.0f);   
-        glRotatef(viture_pitch - initial_pitch_offset, 1.0f, 0.0f, 0.0f); 
-        glRotatef(viture_roll - initial_roll_offset, 0.0f, 0.0f, 1.0f);  
+        gl_utility_mat4_rotate(m, viture_yaw - initial_yaw_offset, 0.0f, 1.0f, 0.0f);
+        gl_utility_mat4_rotate(m, viture_pitch - initial_pitch_offset, 1.0f, 0.0f, 0.0f);
+        gl_utility_mat4_rotate(m, viture_roll - initial_roll_offset, 0.0f, 0.0f, 1.0f);
     } else {
         static float angle = 0.0f;
         angle += 0.2f;
         if (angle > 360.0f) angle -= 360.0f;
-        glRotatef(15.0f, 1.0f, 0.0f, 0.0f); 
-        glRotatef(angle, 0.0f, 1.0f, 0.0f); 
+        gl_utility_mat4_rotate(m, 15.0f, 1.0f, 0.0f, 0.0f);
+        gl_utility_mat4_rotate(m, angle, 0.0f, 1.0f, 0.0f);
     }
 
-    glTranslatef(0.0f, 0.0f, -g_plane_orbit_distance);
-    glScalef(g_plane_scale, g_plane_scale, 1.0f);
+    gl_utility_mat4_translate(m, 0.0f, 0.0f, -g_plane_orbit_distance);
+    gl_utility_mat4_scale(m, g_plane_scale, g_plane_scale, 1.0f);
+}
+
+static void swap_buffers(void) {
+    glutSwapBuffers();
+    frame_pacing_vblank(stats_now_us());
+}
 
-    bool generate_texture = false;
+// Makes the newest captured frame the front buffer. Returns true if there was a new one.
+static bool swap_in_captured_frame(int *width, int *height, YuvFormat *yuv) {
+    bool swapped = false;
     pthread_mutex_lock(&frame_mutex);
-    if (new_frame_captured) {
+    // With frame pacing a frame waits until the vblank its capture time maps to
+    if (new_frame_captured && (!use_frame_pacing || frame_pacing_frame_due(stats_now_us()))) {
         int temp = front_buffer_idx;
         front_buffer_idx = back_buffer_idx;
         back_buffer_idx = temp;
         new_frame_captured = false;
-        generate_texture = true; 
+        swapped = true;
+        if (use_frame_pacing) frame_pacing_frame_presented();
     }
+    *width = rgb_frame_width[front_buffer_idx];
+    *height = rgb_frame_height[front_buffer_idx];
+    *yuv = rgb_frame_yuv[front_buffer_idx];
     pthread_mutex_unlock(&frame_mutex);
+    return swapped;
+}
 
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-
-    if (texture_needs_respecification && glut_initialized) { // Ensure GL context is active
-        printf("V4L2_GL: Re-specifying texture to %dx%d\n", actual_frame_width, actual_frame_height);
-        // Update texture storage with new dimensions
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, actual_frame_width, actual_frame_height, 0,
-                     gl_upload_format, GL_UNSIGNED_BYTE, NULL); // Data can be NULL if immediately followed by glTexSubImage2D
-        texture_needs_respecification = false;
-        generate_texture = true; // Force update with new data even if new_frame_captured was false before this
+// The texture of the YUV_LAYOUT_DMABUF frame in slot, 0 once its buffer is gone
+static GLuint dmabuf_frame_texture(int slot) {
+    if (current_capture_mode == MODE_KMS) {
+        return kms_source_texture((uint32_t)rgb_frame_dmabuf[slot]);
     }
+    return wayland_source_texture(rgb_frame_dmabuf[slot]);
+}
 
-    if ( generate_texture ) {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, actual_frame_width, actual_frame_height, gl_upload_format, GL_UNSIGNED_BYTE, rgb_frames[front_buffer_idx]);
-    }
+// The V4L2 view stays empty with the IMU until its first report centred the view
+static bool plane_visible(void) {
+    return (use_viture_imu && initial_offsets_set) || current_capture_mode == MODE_XDG ||
+           current_capture_mode == MODE_X11 || current_capture_mode == MODE_WAYLAND ||
+           current_capture_mode == MODE_KMS || display_test_pattern;
+}
 
-    if ((use_viture_imu && initial_offsets_set) || current_capture_mode == MODE_XDG || display_test_pattern) {
-        float aspect_ratio = (float)actual_frame_width / (float)actual_frame_height;
-        if (use_curved_screen) {
-            const int segments = 32;
+void display() {
+    gpu_timer_frame_begin();
+    glClear(passthrough_mode ? GL_COLOR_BUFFER_BIT : GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    gpu_timer_mark(GPU_STAGE_DRAW);
+
+    bool texture_updated = false;
+    int front_width, front_height;
+    YuvFormat front_yuv;
+    bool generate_texture = swap_in_captured_frame(&front_width, &front_height, &front_yuv);
+
+    if (mjpeg_gpu_active()) {
+        mjpeg_gpu_verify_run();
+    }
+    dmabuf_import_collect();
+
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+
+    // The source resolution or the active area changed. Not while a source switch may be
+    // rewriting the capture format.
+    if (source_state == SOURCE_RUNNING && front_width > 0 &&
+        (front_width != texture_width || front_height != texture_height) && glut_initialized) {
+        printf("V4L2_GL: Re-specifying texture to %dx%d\n", front_width, front_height);
+        texture_width = front_width;
+        texture_height = front_height;
+#ifdef USE_GLES
+        // Immutable storage, a new size is a new texture
+        gles_renderer_set_texture(texture_width, texture_height, gl_upload_format);
+        texture_id = gles_renderer_texture();
+#else
+        // Update texture storage with new dimensions
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texture_width, texture_height, 0,
+                     gl_upload_format, GL_UNSIGNED_BYTE, NULL); // Data can be NULL if immediately followed by glTexSubImage2D
+#endif
+        generate_texture = true; // Force update with new data even if new_frame_captured was false before this
+        if (upload_scheduler_active()) {
+            upload_scheduler_init(texture_width, texture_height, frame_bytes_per_pixel, (size_t)upload_budget_kb * 1024);
+        }
+        if (use_mipmaps) {
+            mipmap_init(texture_width, texture_height, frame_bytes_per_pixel, gl_upload_format);
+        }
+    }
+
+    // CPU side only: the copy into the driver or the pixel buffer, mip levels on the CPU.
+    // Counted from the first piece of work on, render frames without one are left out.
+    bool counting_upload = false;
+    GLuint source_texture = texture_id;
+    if (source_state != SOURCE_RUNNING) {
+        // A source switch may change the capture format under us, keep showing the last texture
+    } else if (front_yuv.layout == YUV_LAYOUT_DMABUF) {
+        // The compositor or the display controller's buffer is sampled as it is, nothing to upload
+        GLuint dmabuf_texture = dmabuf_frame_texture(front_buffer_idx);
+        if (dmabuf_texture) {
+            source_texture = dmabuf_texture;
+            texture_updated = generate_texture;
+        }
+    } else if (front_yuv.layout == YUV_LAYOUT_JPEG_DCT) {
+        // MJPEG entropy decoded by the capture thread, the rest of the decode runs in shader passes
+        if (generate_texture) {
+            begin_upload_stage(&counting_upload);
+            texture_updated = mjpeg_gpu_render(texture_id, rgb_frames[front_buffer_idx]);
+        }
+    } else if (front_yuv.layout != YUV_LAYOUT_NONE) {
+        // Decoded H.264/HEVC: the planes go up as they are and a shader pass writes the RGB texture
+        if (generate_texture) {
+            begin_upload_stage(&counting_upload);
+            texture_updated = yuv_convert_to_texture(texture_id, rgb_frames[front_buffer_idx],
+                                                     texture_width, texture_height, &front_yuv);
+        }
+    } else if (upload_scheduler_active()) {
+        // Budgeted upload: only part of the frame goes up this render frame, the rest carries over
+        if (generate_texture) {
+            upload_scheduler_new_frame(tile_hashes[front_buffer_idx]);
+        }
+        float focus_u, focus_v;
+        compute_view_focus(&focus_u, &focus_v);
+        upload_scheduler_set_focus(focus_u, focus_v);
+        if (upload_scheduler_pending()) begin_upload_stage(&counting_upload);
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, texture_width);
+        texture_updated = upload_scheduler_run(upload_texture_region, rgb_frames[front_buffer_idx]) > 0;
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    } else if ( generate_texture ) {
+        begin_upload_stage(&counting_upload);
+#ifdef USE_GLES
+        gles_renderer_upload(rgb_frames[front_buffer_idx]);
+#else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture_width, texture_height, gl_upload_format, GL_UNSIGNED_BYTE, rgb_frames[front_buffer_idx]);
+        mipmap_mark_dirty(0, 0, texture_width, texture_height);
+#endif
+        texture_updated = true;
+    }
+    if (mipmap_active() && source_texture == texture_id) {
+        if (front_yuv.layout != YUV_LAYOUT_NONE) {
+            // There is no RGB copy on the CPU to downsample, the GPU builds the whole chain
+            if (texture_updated) glGenerateMipmap(GL_TEXTURE_2D);
+        } else if (mipmap_pending()) {
+            // Only the levels below the regions uploaded above are regenerated, with what is
+            // left of the upload budget. Leftover blocks carry over like the tiles.
+            begin_upload_stage(&counting_upload);
+            if (upload_scheduler_active()) {
+                upload_scheduler_charge(mipmap_update(rgb_frames[front_buffer_idx], upload_scheduler_budget_left()));
+            } else {
+                mipmap_update(rgb_frames[front_buffer_idx], SIZE_MAX);
+            }
+        }
+    }
+    if (counting_upload) perf_counters_end(texture_updated ? (uint64_t)texture_width * texture_height : 0);
+    // The capture thread only writes the back slot, the front one is stable here
+    if (generate_texture && texture_updated && autotune_measuring()) {
+        autotune_frame_shown(stats_now_us() - rgb_frame_capture_us[front_buffer_idx]);
+    }
+    gpu_timer_mark(GPU_STAGE_UPLOAD);
+
+    GLuint shown_texture = source_texture;
+    int shown_width = texture_width;
+    int shown_height = texture_height;
+    if (use_upscale) {
+        // Only re-run the passes when the source or the on-screen size changed
+        static GLuint upscaled_texture = 0;
+        static int upscaled_width = 0, upscaled_height = 0;
+        int out_w, out_h;
+        compute_upscale_output_size(&out_w, &out_h);
+        if (texture_updated || upscaled_texture == 0 || out_w != upscaled_width || out_h != upscaled_height) {
+            upscaled_texture = upscale_apply(source_texture, texture_width, texture_height,
+                                             out_w, out_h, (float)upscale_sharpness);
+            upscaled_width = out_w;
+            upscaled_height = out_h;
+        }
+        if (upscaled_texture != source_texture) {
+            shown_texture = upscaled_texture;
+            shown_width = upscaled_width;
+            shown_height = upscaled_height;
+        }
+        glBindTexture(GL_TEXTURE_2D, shown_texture);
+        gpu_timer_mark(GPU_STAGE_POST);
+    }
+
+    if (passthrough_mode) {
+        present_passthrough(shown_texture, shown_width, shown_height);
+        gpu_timer_mark(GPU_STAGE_DRAW);
+        gpu_timer_frame_end();
+        swap_buffers();
+        return;
+    }
+
+    render_scale_begin(window_width, window_height);
+
+    float modelview[16];
+    compute_plane_modelview(modelview);
+#ifndef USE_GLES
+    glMatrixMode(GL_MODELVIEW);
+    glLoadMatrixf(modelview);
+#endif
+
+    if (plane_visible()) {
+        float aspect_ratio = (float)texture_width / (float)texture_height;
+#ifdef USE_GLES
+        gles_renderer_draw_plane(shown_texture, aspect_ratio, use_curved_screen, plane_projection, modelview);
+#else
+        if (use_curved_screen) {
+            const int segments = 32;
             const float curve_angle = (float)M_PI / 4.0f; // 45 degrees of curvature
             const float width = 2.0f * aspect_ratio;
             const float radius = width / (2.0f * sinf(curve_angle / 2.0f));
@@ -548,24 +1572,160 @@ void display() {
                 glTexCoord2f(0.0f, 0.0f); glVertex3f(-aspect_ratio,  1.0f, 0.0f);
             glEnd();
         }
+#endif
     }
-    glutSwapBuffers();
+    gpu_timer_mark(GPU_STAGE_DRAW);
+    render_scale_end(window_width, window_height);
+    if (render_scale_active()) gpu_timer_mark(GPU_STAGE_POST);
+    gpu_timer_frame_end();
+    swap_buffers();
+}
+
+static void upload_front_frame_soft(void) {
+    soft_renderer_upload(rgb_frames[front_buffer_idx], texture_width, texture_height, frame_bytes_per_pixel,
+                         gl_upload_format == GL_BGR || gl_upload_format == GL_BGRA);
+}
+
+// --soft-render: the frame handoff and head pose of display(), drawn by the CPU renderer
+static void display_software(void) {
+    int front_width, front_height;
+    YuvFormat front_yuv;
+    bool new_frame = swap_in_captured_frame(&front_width, &front_height, &front_yuv);
+    if (source_state == SOURCE_RUNNING && front_width > 0 &&
+        (new_frame || front_width != texture_width || front_height != texture_height)) {
+        texture_width = front_width;
+        texture_height = front_height;
+        upload_front_frame_soft();
+        if (new_frame && autotune_measuring()) {
+            autotune_frame_shown(stats_now_us() - rgb_frame_capture_us[front_buffer_idx]);
+        }
+    }
+
+    if (passthrough_mode) {
+        int x, y, w, h;
+        compute_passthrough_rect(texture_width, texture_height, &x, &y, &w, &h);
+        soft_renderer_draw_passthrough(x, window_height - y - h, w, h);
+    } else {
+        float modelview[16];
+        compute_plane_modelview(modelview);
+        if (plane_visible()) {
+            soft_renderer_draw_plane((float)texture_width / (float)texture_height, use_curved_screen,
+                                     plane_projection, modelview);
+        } else {
+            soft_renderer_clear();
+        }
+    }
+    soft_renderer_present();
+    frame_pacing_vblank(stats_now_us());
+}
+
+static void set_view_size(int w, int h) {
+    window_width = w;
+    window_height = h;
+    gl_utility_mat4_perspective(plane_projection, 45.0f, (float)w / (float)h, 1.0f, 100.0f);
 }
 
 void reshape(int w, int h) {
+    set_view_size(w, h);
     glViewport(0, 0, w, h);
+#ifndef USE_GLES
     glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(45.0, (double)w / (double)h, 1.0, 100.0);
+    glLoadMatrixf(plane_projection);
+#endif
+}
+
+// Capture time of a dequeued buffer. Drivers with monotonic timestamps take them at the
+// start or end of the frame, which is steadier than the time the thread woke up.
+static double v4l2_buffer_time_us(const struct v4l2_buffer *buf) {
+    if ((buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC &&
+        (buf->timestamp.tv_sec != 0 || buf->timestamp.tv_usec != 0)) {
+        return buf->timestamp.tv_sec * 1000000.0 + buf->timestamp.tv_usec;
+    }
+    return stats_now_us();
 }
 
-void capture_and_update() {
+// Hashes the raw buffer for --throttle-static. Returns false if the buffer can go straight
+// back to the driver. Entering and leaving the throttled state also changes the device rate
+// where the driver allows it.
+static bool throttle_allows_buffer(const struct v4l2_buffer *buf, const struct v4l2_plane *planes_dq,
+                                   const unsigned char **data) {
+    ThrottlePlane planes[VIDEO_MAX_PLANES];
+    int num_planes = 1;
+    if (active_memory_type == V4L2_MEMORY_USERPTR) {
+        // Raw formats have a single plane in our own pool
+        planes[0].data = userptr_pool[buf->index];
+        planes[0].length = active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ?
+                           planes_dq[0].bytesused : buf->bytesused;
+    } else if (active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        num_planes = (int)num_planes_per_buffer;
+        for (int p = 0; p < num_planes; p++) {
+            planes[p].data = data[p];
+            planes[p].length = planes_dq[p].bytesused;
+        }
+    } else {
+        planes[0].data = data[0];
+        planes[0].length = buf->bytesused;
+    }
+    for (int p = 0; p < num_planes; p++) {
+        // Compressed data has no rows, any chunk size works as long as it stays the same
+        planes[p].stride = active_pixel_format == V4L2_PIX_FMT_MJPEG ? 4096 :
+                           planes[p].length / (actual_frame_height > 0 ? actual_frame_height : 1);
+    }
+
+    bool was_throttled = capture_throttle_throttled();
+    bool process = capture_throttle_check(planes, num_planes);
+    bool throttled = capture_throttle_throttled();
+    if (nominal_timeperframe.denominator == 0) {
+        // The driver has no frame interval, throttling skips buffers
+    } else if (throttled && !was_throttled) {
+        // Lowering is tried once per throttled period, skipping buffers works as well. A rate
+        // that was never restored is still lowered.
+        capture_throttle_set_device_rate(capture_throttle_device_rate_lowered() ||
+                                         set_capture_rate_divisor(CAPTURE_THROTTLE_DIVISOR));
+    } else if (!throttled && capture_throttle_device_rate_lowered()) {
+        // Retried with every buffer until the full rate is back
+        capture_throttle_set_device_rate(!set_capture_rate_divisor(1));
+    }
+    return process;
+}
+
+// Decodes one H.264/HEVC buffer and publishes the picture as packed 4:2:0 planes,
+// display() converts them to RGB on the GPU
+static void decode_and_publish(const unsigned char *data, size_t size, double capture_us) {
+    DecodedFrame decoded;
+    if (video_decoder_decode(data, size, capture_us, &decoded) != 1) {
+        return;
+    }
+    // The frame buffers and the active area detection are sized for the negotiated format
+    if (decoded.width < actual_frame_width || decoded.height < actual_frame_height) {
+        static bool warned = false;
+        if (!warned) {
+            fprintf(stderr, "V4L2_GL: Decoded picture %dx%d is smaller than the negotiated %dx%d, dropping it\n",
+                    decoded.width, decoded.height, actual_frame_width, actual_frame_height);
+            warned = true;
+        }
+        return;
+    }
+
+    FrameRect crop;
+    get_crop_rect(decoded.planes[0], 1, decoded.strides[0], &crop);
+    // Chroma covers 2x2 pixels, the crop has to start on a chroma sample
+    crop.width += crop.x & 1;
+    crop.height += crop.y & 1;
+    crop.x &= ~1;
+    crop.y &= ~1;
+    pack_yuv420_region(decoded.planes, decoded.strides, decoded.format.layout, rgb_frames[back_buffer_idx], &crop);
+    publish_frame_with_format(crop.width, crop.height, decoded.capture_us, &decoded.format);
+}
+
+// Returns false if no buffer was ready
+bool capture_and_update() {
     struct v4l2_buffer buf;
     struct v4l2_plane planes_dq[VIDEO_MAX_PLANES]; 
     memset(&buf, 0, sizeof(buf));
     
     buf.type = active_buffer_type;
-    buf.memory = V4L2_MEMORY_MMAP;
+    buf.memory = active_memory_type;
 
     if (active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
         memset(planes_dq, 0, sizeof(planes_dq));
@@ -575,54 +1735,135 @@ void capture_and_update() {
 
     if (ioctl(fd, VIDIOC_DQBUF, &buf) == -1) {
         if (errno == EAGAIN) {
-            return;
+            return false;
         }
         perror("VIDIOC_DQBUF");
         exit(EXIT_FAILURE);
     }
+    double capture_us = v4l2_buffer_time_us(&buf);
+    const unsigned char *data[VIDEO_MAX_PLANES];
+    if (active_memory_type == V4L2_MEMORY_MMAP) {
+        // The throttle hashes the mapping itself, only buffers it keeps pay for the bounce copy or the sync
+        for (unsigned int p = 0; p < buffers_mp[buf.index].num_planes_in_buffer; p++) {
+            data[p] = buffers_mp[buf.index].planes[p].start;
+        }
+    }
+
+    // Every H.264/HEVC buffer is needed as a reference for the next one, none can be skipped
+    if (capture_throttle_active() && !decoded_capture_format && !throttle_allows_buffer(&buf, planes_dq, data)) {
+        // Same content as the frame on screen, hand the buffer back untouched
+        if (!queue_v4l2_buffer(buf.index)) {
+            exit(EXIT_FAILURE);
+        }
+        return true;
+    }
+    if (active_memory_type == V4L2_MEMORY_MMAP) {
+        begin_buffer_read(&buf, planes_dq, data);
+    }
     
-    if (active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
-        if (active_pixel_format == V4L2_PIX_FMT_NV24 && num_planes_per_buffer >= 2) {
-            convert_nv24_to_rgb(
-                (const unsigned char *)buffers_mp[buf.index].planes[0].start,
-                (const unsigned char *)buffers_mp[buf.index].planes[1].start,
-                rgb_frames[back_buffer_idx], actual_frame_width, actual_frame_height);
-        } else if (active_pixel_format == V4L2_PIX_FMT_NV24 && num_planes_per_buffer == 1) {
+    if (active_memory_type == V4L2_MEMORY_USERPTR) {
+        // The driver wrote the frame into memory display() uploads from, nothing to convert.
+        // The buffer stays with the renderer until a newer frame replaces it.
+        int released = publish_userptr_frame(buf.index, capture_us);
+        if (released >= 0 && !queue_v4l2_buffer((unsigned int)released)) {
+            exit(EXIT_FAILURE);
+        }
+        return true;
+    }
+
+    if (decoded_capture_format) {
+        size_t size = active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? planes_dq[0].bytesused : buf.bytesused;
+        decode_and_publish(data[0], size, capture_us);
+        end_buffer_read(buf.index);
+        if (!queue_v4l2_buffer(buf.index)) {
+            exit(EXIT_FAILURE);
+        }
+        return true;
+    }
+
+    if (use_mjpeg_gpu && active_pixel_format == V4L2_PIX_FMT_MJPEG &&
+        active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        mjpeg_gpu_verify_submit(data[0], buf.bytesused);
+        // Frames the shaders can't take (other size, colour space) fall through to libjpeg
+        if (mjpeg_gpu_read_coefficients(data[0], buf.bytesused, actual_frame_width, actual_frame_height,
+                                        rgb_frames[back_buffer_idx], current_rgb_buffer_size)) {
+            static const YuvFormat jpeg_dct = {YUV_LAYOUT_JPEG_DCT, false, true};
+            publish_frame_with_format(actual_frame_width, actual_frame_height, capture_us, &jpeg_dct);
+            end_buffer_read(buf.index);
+            if (!queue_v4l2_buffer(buf.index)) {
+                exit(EXIT_FAILURE);
+            }
+            return true;
+        }
+    }
+
+    // The crop analysis inside is counted as a stage of its own
+    perf_counters_begin(PERF_STAGE_CONVERT);
+    FrameRect crop;
+    if (raw_capture_format) {
+        get_crop_rect(data[0] + 1, frame_bytes_per_pixel, active_bytesperline, &crop);
+        copy_frame_region(data[0], active_bytesperline, rgb_frames[back_buffer_idx], frame_bytes_per_pixel, &crop);
+    } else if (active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        if (active_pixel_format == V4L2_PIX_FMT_NV24 && num_planes_per_buffer >= 1) {
+            const unsigned char *y_plane = data[0];
+            const unsigned char *uv_plane = num_planes_per_buffer >= 2 ? data[1] :
+                y_plane + actual_frame_width * actual_frame_height;
+            get_crop_rect(y_plane, 1, actual_frame_width, &crop);
             convert_nv24_to_rgb(
-                (const unsigned char *)buffers_mp[buf.index].planes[0].start,
-                (const unsigned char *)buffers_mp[buf.index].planes[0].start + actual_frame_width * actual_frame_height,
-                rgb_frames[back_buffer_idx], actual_frame_width, actual_frame_height);
+                y_plane + (size_t)crop.y * actual_frame_width + crop.x, actual_frame_width,
+                uv_plane + ((size_t)crop.y * actual_frame_width + crop.x) * 2, actual_frame_width * 2,
+                rgb_frames[back_buffer_idx], crop.width, crop.height, &capture_colorimetry);
         } else {
              fprintf(stderr, "Error: Unsupported MPLANE pixel format %c%c%c%c or plane count %u\n",
                     (active_pixel_format)&0xFF, (active_pixel_format>>8)&0xFF,
                     (active_pixel_format>>16)&0xFF, (active_pixel_format>>24)&0xFF,
                     num_planes_per_buffer);
-            fill_frame_with_pattern(rgb_frames[back_buffer_idx], actual_frame_width, actual_frame_height);
+            get_crop_rect(NULL, 0, 0, &crop);
+            fill_frame_with_pattern(rgb_frames[back_buffer_idx], crop.width, crop.height);
         }
     } else { // Single-plane
+        const unsigned char *frame = data[0];
         if (active_pixel_format == V4L2_PIX_FMT_YUYV) {
-            convert_yuyv_to_bgr((const unsigned char *)buffers_mp[buf.index].planes[0].start,
-                                 rgb_frames[back_buffer_idx], actual_frame_width, actual_frame_height, buf.bytesused);
+            get_crop_rect(frame, 2, actual_frame_width * 2, &crop);
+            size_t offset = ((size_t)crop.y * actual_frame_width + crop.x) * 2;
+            convert_yuyv_to_bgr(frame + offset, actual_frame_width * 2,
+                                rgb_frames[back_buffer_idx], crop.width, crop.height,
+                                buf.bytesused > offset ? buf.bytesused - offset : 0, &capture_colorimetry);
         } else if (active_pixel_format == V4L2_PIX_FMT_MJPEG) {
-            convert_mjpeg_to_rgb((const unsigned char *)buffers_mp[buf.index].planes[0].start,
-                                 buf.bytesused, rgb_frames[back_buffer_idx], actual_frame_width, actual_frame_height);
+            if (auto_crop && active_area_due(captured_frame_count)) {
+                // Analysis frames are decoded completely and cropped afterwards
+                convert_mjpeg_to_rgb(frame, buf.bytesused, rgb_frames[back_buffer_idx], actual_frame_width, actual_frame_height);
+                get_crop_rect(rgb_frames[back_buffer_idx] + 1, 3, actual_frame_width * 3, &crop);
+                if (!is_full_frame(&crop)) {
+                    crop_rgb_frame_in_place(rgb_frames[back_buffer_idx], actual_frame_width, &crop);
+                }
+            } else {
+                get_crop_rect(NULL, 0, 0, &crop);
+                if (is_full_frame(&crop)) {
+                    convert_mjpeg_to_rgb(frame, buf.bytesused, rgb_frames[back_buffer_idx], actual_frame_width, actual_frame_height);
+                } else {
+                    convert_mjpeg_region_to_rgb(frame, buf.bytesused, rgb_frames[back_buffer_idx],
+                                                actual_frame_width, actual_frame_height, &crop);
+                }
+            }
         } else {
              fprintf(stderr, "Error: Unsupported SINGLE-PLANE pixel format %c%c%c%c\n",
                     (active_pixel_format)&0xFF, (active_pixel_format>>8)&0xFF,
                     (active_pixel_format>>16)&0xFF, (active_pixel_format>>24)&0xFF);
-            fill_frame_with_pattern(rgb_frames[back_buffer_idx], actual_frame_width, actual_frame_height);
+            get_crop_rect(NULL, 0, 0, &crop);
+            fill_frame_with_pattern(rgb_frames[back_buffer_idx], crop.width, crop.height);
         }
     }
+    perf_counters_end((uint64_t)crop.width * crop.height);
 
-    pthread_mutex_lock(&frame_mutex);
-    new_frame_captured = true;
-    pthread_mutex_unlock(&frame_mutex);
+    publish_frame(crop.width, crop.height, capture_us);
 
+    end_buffer_read(buf.index);
     if (ioctl(fd, VIDIOC_QBUF, &buf) == -1) {
         perror("VIDIOC_QBUF");
         exit(EXIT_FAILURE);
     }
-
+    return true;
 }
 
 #define TARGET_FPS 30 // This can still be used for display refresh rate
@@ -640,7 +1881,7 @@ void *capture_thread_func(void *arg) {
         struct v4l2_buffer buf_check; // For checking DQBUF result
         memset(&buf_check, 0, sizeof(buf_check));
         buf_check.type = active_buffer_type;
-        buf_check.memory = V4L2_MEMORY_MMAP;
+        buf_check.memory = active_memory_type;
         if (active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
             struct v4l2_plane planes_temp[VIDEO_MAX_PLANES];
             memset(planes_temp, 0, sizeof(planes_temp));
@@ -656,14 +1897,9 @@ void *capture_thread_func(void *arg) {
         // A more robust way might be to use select() or poll() on the fd.
         // For now, we'll call capture_and_update and let it handle EAGAIN.
 
-        capture_and_update(); // This function now handles its own EAGAIN
-
-        // If capture_and_update returned due to EAGAIN, we can sleep a bit
-        // This check is a bit indirect. A better way would be for capture_and_update to return a status.
-        // For now, we assume if new_frame_captured is false after a call, it might have been EAGAIN.
-        pthread_mutex_lock(&frame_mutex);
-        bool frame_was_newly_captured = new_frame_captured; // Check if capture_and_update set it
-        pthread_mutex_unlock(&frame_mutex);
+        // A frame still waiting for presentation must not keep this loop from sleeping,
+        // so only the result of this call counts
+        bool frame_was_newly_captured = capture_and_update(); // This function now handles its own EAGAIN
 
         if (!frame_was_newly_captured) { // If no new frame was processed (e.g. EAGAIN)
              nanosleep(&ts, NULL); // Sleep briefly to avoid busy-waiting
@@ -674,6 +1910,511 @@ void *capture_thread_func(void *arg) {
     return NULL;
 }
 
+// --- Statistics ---
+static void request_stats_dump(int sig) {
+    (void)sig;
+    stats_dump_requested = 1;
+}
+
+static void request_quit(int sig) {
+    (void)sig;
+    quit_requested = 1;
+}
+
+static void print_pipeline_stats(void) {
+    upload_scheduler_print_report(stdout);
+    render_scale_print_stats(stdout);
+    frame_pacing_print_stats(stdout);
+    capture_throttle_print_stats(stdout);
+    video_decoder_print_stats(stdout);
+    mjpeg_gpu_print_stats(stdout);
+    gpu_timer_print_stats(stdout);
+    perf_counters_print_stats(stdout);
+    soft_renderer_print_stats(stdout);
+    x11_source_print_stats(stdout);
+    wayland_source_print_stats(stdout);
+    kms_source_print_stats(stdout);
+#ifndef USE_VITURE
+    if (use_viture_imu && viture_driver_device()) {
+        viture_device_print_stats(viture_driver_device(), stdout);
+    }
+#endif
+    if (capture_read != CAPTURE_READ_DIRECT) {
+        stats_histogram_print(&capture_read_time, capture_read == CAPTURE_READ_BOUNCE ? "V4L2 bounce copy" : "V4L2 dmabuf sync", stdout);
+    }
+    fflush(stdout);
+}
+
+// --- Live reconfiguration ---
+static void set_plane_distance(float distance) {
+    g_plane_orbit_distance = distance;
+    printf("V4L2_GL: Plane distance %.2f\n", g_plane_orbit_distance);
+}
+
+static bool set_plane_scale(float scale) {
+    if (scale <= 0.0f) return false;
+    g_plane_scale = scale;
+    printf("V4L2_GL: Plane scale %.2f\n", g_plane_scale);
+    return true;
+}
+
+static void set_curved_screen(bool enable) {
+    use_curved_screen = enable;
+    printf("V4L2_GL: Curved screen %s\n", enable ? "enabled" : "disabled");
+}
+
+static void set_passthrough(bool enable) {
+    passthrough_mode = enable;
+    if (use_soft_render) {
+        // No GL state to change
+    } else if (enable) {
+        glDisable(GL_DEPTH_TEST);
+    } else {
+        glEnable(GL_DEPTH_TEST);
+    }
+    printf("V4L2_GL: Passthrough %s\n", enable ? "enabled" : "disabled");
+}
+
+// The next IMU report becomes the new centre of the view
+static void recenter_view(void) {
+    initial_offsets_set = false;
+    printf("V4L2_GL: Recentering view\n");
+}
+
+// Gives rgb_frames slots that point into the USERPTR pool their own copy so the pool can go away
+static void detach_userptr_frames(void) {
+    for (int i = 0; i < 2; i++) {
+        if (userptr_slot_index[i] < 0) continue;
+        unsigned char *own = malloc(current_rgb_buffer_size);
+        if (own) memcpy(own, rgb_frames[i], current_rgb_buffer_size);
+        rgb_frames[i] = own;
+        userptr_slot_index[i] = -1;
+    }
+}
+
+// The X11 frames are the BGRx pixels of the shared memory image, uploaded as they are
+static bool init_x11_capture(void) {
+    if (!x11_source_init(x11_display_name, x11_draw_cursor)) {
+        return false;
+    }
+    x11_source_size(&actual_frame_width, &actual_frame_height);
+    frame_bytes_per_pixel = 4;
+    gl_upload_format = GL_BGRA;
+    return true;
+}
+
+// Polled from idle(). Only the damaged rows are fetched, an unchanged screen publishes nothing.
+static void capture_x11_frame(void) {
+    double capture_us = stats_now_us();
+    if (!x11_source_grab()) return;
+
+    int width, height;
+    x11_source_size(&width, &height);
+    if (width != actual_frame_width || height != actual_frame_height) {
+        printf("V4L2_GL: X11 screen size changed to %dx%d (from %dx%d)\n",
+               width, height, actual_frame_width, actual_frame_height);
+        actual_frame_width = width;
+        actual_frame_height = height;
+        if (!alloc_frame_buffers()) {
+            exit(EXIT_FAILURE);
+        }
+        x11_source_invalidate();
+        alloc_tile_hashes();
+        if (auto_crop) active_area_init(actual_frame_width, actual_frame_height);
+    }
+
+    int stride;
+    const unsigned char *image = x11_source_image(&stride);
+    FrameRect crop;
+    get_crop_rect(image + 1, 4, stride, &crop);
+    perf_counters_begin(PERF_STAGE_CONVERT);
+    x11_source_copy(rgb_frames[back_buffer_idx], back_buffer_idx, &crop);
+    perf_counters_end((uint64_t)crop.width * crop.height);
+    publish_frame(crop.width, crop.height, capture_us);
+}
+
+// Shared memory frames are BGRx or RGBx, copied like the X11 ones. dmabuf frames stay where the
+// compositor rendered them: the slot only names the buffer and display() samples it.
+static bool init_wayland_capture(void) {
+    if (!wayland_source_init(wayland_output_name, wayland_dmabuf)) {
+        return false;
+    }
+    wayland_source_size(&actual_frame_width, &actual_frame_height);
+    frame_bytes_per_pixel = 4;
+    gl_upload_format = wayland_source_gl_format();
+    return true;
+}
+
+// Polled from idle(). The compositor only completes a capture for a damaged output.
+static void capture_wayland_frame(void) {
+    double capture_us = stats_now_us();
+    if (!wayland_source_poll()) return;
+
+    int width, height;
+    wayland_source_size(&width, &height);
+    if (width != actual_frame_width || height != actual_frame_height) {
+        printf("V4L2_GL: Wayland output size changed to %dx%d (from %dx%d)\n",
+               width, height, actual_frame_width, actual_frame_height);
+        actual_frame_width = width;
+        actual_frame_height = height;
+        if (!alloc_frame_buffers()) {
+            exit(EXIT_FAILURE);
+        }
+        wayland_source_invalidate();
+        alloc_tile_hashes();
+        if (auto_crop) active_area_init(actual_frame_width, actual_frame_height);
+    }
+    if (wayland_source_gl_format() != gl_upload_format) {
+        gl_upload_format = wayland_source_gl_format();
+        texture_width = 0; // Re-specified with the new format by display()
+    }
+
+    if (wayland_source_dmabuf()) {
+        // The buffer published before and never shown goes back to the compositor
+        wayland_source_release(rgb_frame_dmabuf[back_buffer_idx]);
+        rgb_frame_dmabuf[back_buffer_idx] = wayland_source_frame_buffer();
+        publish_frame_with_format(width, height, capture_us, &dmabuf_frame_format);
+        return;
+    }
+    int stride;
+    const unsigned char *image = wayland_source_image(&stride);
+    FrameRect crop;
+    get_crop_rect(image + 1, 4, stride, &crop);
+    perf_counters_begin(PERF_STAGE_CONVERT);
+    wayland_source_copy(rgb_frames[back_buffer_idx], back_buffer_idx, &crop);
+    perf_counters_end((uint64_t)crop.width * crop.height);
+    publish_frame(crop.width, crop.height, capture_us);
+}
+
+// The scanout framebuffer is imported and sampled in place, or mapped and copied like an X11 frame
+static bool init_kms_capture(void) {
+    const char *device = kms_capture_device[0] ? kms_capture_device : "/dev/dri/card0";
+    if (!kms_source_init(device, (uint32_t)kms_crtc)) {
+        return false;
+    }
+    kms_source_size(&actual_frame_width, &actual_frame_height);
+    frame_bytes_per_pixel = 4;
+    gl_upload_format = kms_source_gl_format();
+    return true;
+}
+
+// Polled from idle(). A new frame is a page flip, the compositor's frame rate is the capture rate.
+static void capture_kms_frame(void) {
+    double capture_us = stats_now_us();
+    if (!kms_source_grab()) return;
+
+    int width, height;
+    kms_source_size(&width, &height);
+    if (width != actual_frame_width || height != actual_frame_height) {
+        printf("V4L2_GL: KMS framebuffer size changed to %dx%d (from %dx%d)\n",
+               width, height, actual_frame_width, actual_frame_height);
+        actual_frame_width = width;
+        actual_frame_height = height;
+        if (!alloc_frame_buffers()) {
+            exit(EXIT_FAILURE);
+        }
+        alloc_tile_hashes();
+        if (auto_crop) active_area_init(actual_frame_width, actual_frame_height);
+    }
+    if (kms_source_gl_format() != gl_upload_format) {
+        gl_upload_format = kms_source_gl_format();
+        texture_width = 0; // Re-specified with the new format by display()
+    }
+
+    if (kms_source_dmabuf()) {
+        rgb_frame_dmabuf[back_buffer_idx] = (int)kms_source_frame_fb();
+        publish_frame_with_format(width, height, capture_us, &dmabuf_frame_format);
+        return;
+    }
+    int stride;
+    const unsigned char *image = kms_source_image(&stride);
+    FrameRect crop;
+    get_crop_rect(image + 1, 4, stride, &crop);
+    perf_counters_begin(PERF_STAGE_CONVERT);
+    kms_source_copy(rgb_frames[back_buffer_idx], &crop);
+    perf_counters_end((uint64_t)crop.width * crop.height);
+    publish_frame(crop.width, crop.height, capture_us);
+}
+
+// Runs the slow part of a source switch (V4L2 probing, display connections) off the render loop.
+// It sets the capture geometry (actual_frame_*, gl_upload_format, frame_bytes_per_pixel), which
+// display() only reads while the source runs: finish_source_switch() joins this thread first.
+static void *source_switch_thread_func(void *arg) {
+    (void)arg;
+    shutdown_v4l2();
+    x11_source_cleanup();
+    wayland_source_cleanup();
+    kms_source_cleanup();
+
+    actual_frame_width = requested_frame_width;
+    actual_frame_height = requested_frame_height;
+
+    bool ok = true;
+    if (!pending_test_pattern) {
+        if (pending_capture_mode == MODE_V4L2) {
+            ok = init_v4l2();
+        } else if (pending_capture_mode == MODE_X11) {
+            ok = init_x11_capture();
+        } else if (pending_capture_mode == MODE_WAYLAND) {
+            ok = init_wayland_capture();
+        } else if (pending_capture_mode == MODE_KMS) {
+            ok = init_kms_capture();
+        }
+        // The XDG portal session is started by finish_source_switch()
+    }
+    if (!ok) {
+        fprintf(stderr, "V4L2_GL: Could not start the new source, showing the test pattern.\n");
+        actual_frame_width = requested_frame_width;
+        actual_frame_height = requested_frame_height;
+        pending_test_pattern = true;
+    }
+
+    source_state = SOURCE_READY;
+    return NULL;
+}
+
+// Switches to another capture source while IMU, GL context and window keep running.
+// device is only used for V4L2 and KMS, NULL keeps the current one.
+static bool request_source_switch(enum CaptureMode mode, bool test_pattern, const char *device) {
+    if (source_state != SOURCE_RUNNING) {
+        return false;
+    }
+    if (device && mode == MODE_KMS) {
+        snprintf(kms_device_buf, sizeof(kms_device_buf), "%s", device);
+        kms_capture_device = kms_device_buf;
+    } else if (device) {
+        snprintf(v4l2_device_path_buf, sizeof(v4l2_device_path_buf), "%s", device);
+        v4l2_device_path_str = v4l2_device_path_buf;
+    }
+    printf("V4L2_GL: Switching source to %s\n",
+           test_pattern ? "test pattern" : (mode == MODE_XDG ? "XDG screen capture" :
+                                            mode == MODE_X11 ? "X11 screen capture" :
+                                            mode == MODE_WAYLAND ? "Wayland screen capture" :
+                                            mode == MODE_KMS ? "KMS scanout capture" : v4l2_device_path_str));
+
+    stop_v4l2_capture_thread();
+    detach_userptr_frames();
+    if (xdg_session_active) {
+        // The portal session runs on the GLib default context of this thread
+        cleanup_screencast_session();
+        xdg_session_active = false;
+    }
+    pending_capture_mode = mode;
+    pending_test_pattern = test_pattern;
+    source_state = SOURCE_SWITCHING;
+    if (pthread_create(&source_switch_thread_id, NULL, source_switch_thread_func, NULL) != 0) {
+        perror("Failed to create source switch thread");
+        source_switch_thread_id = 0;
+        source_switch_thread_func(NULL);
+    }
+    return true;
+}
+
+// Called from idle() once the switch thread is done. Buffers are resized here, on the GL thread.
+static void finish_source_switch(void) {
+    if (source_switch_thread_id != 0) {
+        pthread_join(source_switch_thread_id, NULL);
+        source_switch_thread_id = 0;
+    }
+    current_capture_mode = pending_capture_mode;
+    display_test_pattern = pending_test_pattern;
+    xdg_prev_frame_width = 0;
+    xdg_prev_frame_height = 0;
+    if (current_capture_mode == MODE_XDG && !display_test_pattern) {
+        // Blocks the render loop while the portal negotiates, like at startup
+        xdg_set_preferred_size(requested_frame_width, requested_frame_height);
+        xdg_session_active = init_screencast_session() != NULL;
+        if (!xdg_session_active) {
+            fprintf(stderr, "V4L2_GL: Could not start the new source, showing the test pattern.\n");
+            display_test_pattern = true;
+        }
+    }
+
+    if (!alloc_frame_buffers()) {
+        exit(EXIT_FAILURE);
+    }
+    // Let display() re-specify the texture for the new source right away, even if only
+    // the pixel format changed
+    for (int i = 0; i < 2; i++) {
+        rgb_frame_width[i] = actual_frame_width;
+        rgb_frame_height[i] = actual_frame_height;
+        rgb_frame_yuv[i].layout = YUV_LAYOUT_NONE;
+        rgb_frame_dmabuf[i] = -1; // The old source took its buffers along
+    }
+    texture_width = 0;
+    texture_height = 0;
+    if (upload_scheduler_active()) alloc_tile_hashes();
+    if (auto_crop) active_area_init(actual_frame_width, actual_frame_height);
+    if (capture_throttle_active()) capture_throttle_reset();
+
+    source_state = SOURCE_RUNNING;
+    if (current_capture_mode == MODE_V4L2 && !display_test_pattern) {
+        start_v4l2_capture_thread();
+    }
+    printf("V4L2_GL: Source switch complete (%dx%d)\n", actual_frame_width, actual_frame_height);
+
+    if (autotune_active()) {
+        // What the device and the decoders made of the requested configuration
+        PipelineConfig effective = {
+            decoded_capture_format,
+            use_mjpeg_gpu && mjpeg_gpu_active() && active_pixel_format == V4L2_PIX_FMT_MJPEG &&
+                active_buffer_type == V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            (int)n_buffers
+        };
+        char format[5];
+        snprintf(format, sizeof(format), "%c%c%c%c", active_pixel_format & 0xFF, (active_pixel_format >> 8) & 0xFF,
+                 (active_pixel_format >> 16) & 0xFF, (active_pixel_format >> 24) & 0xFF);
+        autotune_measure(&effective, display_test_pattern ? NULL : format, captured_frame_count, stats_now_us());
+    }
+}
+
+static void apply_pipeline_config(const PipelineConfig *config) {
+    compressed_input = config->compressed_input;
+    use_mjpeg_gpu = config->mjpeg_gpu;
+    if (config->buffer_count > 0) {
+        v4l2_buffer_count = config->buffer_count;
+    }
+}
+
+// --autotune: runs the V4L2 source with every candidate configuration in turn, then saves
+// the fastest one as the machine profile and switches to it
+static void autotune_step(void) {
+    if (source_state != SOURCE_RUNNING || !autotune_update(captured_frame_count, stats_now_us())) {
+        return;
+    }
+    PipelineConfig config;
+    if (autotune_next(&config)) {
+        apply_pipeline_config(&config);
+        request_source_switch(MODE_V4L2, false, NULL);
+        return;
+    }
+
+    PipelineConfig best;
+    AutotuneResult result;
+    if (!autotune_finish(&best, &result)) {
+        return;
+    }
+    char path[512];
+    if (autotune_profile_path(v4l2_device_path_str, requested_frame_width, requested_frame_height, path, sizeof(path))) {
+        autotune_profile_save(path, v4l2_device_path_str, requested_frame_width, requested_frame_height, &best, &result);
+    }
+    printf("Autotune: Using %s capture, %s MJPEG decoding, %d buffers "
+           "(%.1f fps, latency p50 %.1f ms, CPU %.0f%%)\n\n",
+           result.format, best.mjpeg_gpu ? "GPU" : "CPU", best.buffer_count, result.frames_per_second,
+           result.latency_p50_us / 1000.0, result.cpu_percent);
+    apply_pipeline_config(&best);
+    request_source_switch(MODE_V4L2, false, NULL);
+}
+
+static bool parse_switch(const char *value, bool current, bool *result) {
+    if (strcmp(value, "on") == 0 || strcmp(value, "1") == 0 || strcmp(value, "true") == 0) {
+        *result = true;
+    } else if (strcmp(value, "off") == 0 || strcmp(value, "0") == 0 || strcmp(value, "false") == 0) {
+        *result = false;
+    } else if (strcmp(value, "toggle") == 0) {
+        *result = !current;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_number(const char *value, float *result) {
+    char *end;
+    *result = strtof(value, &end);
+    return end != value && *end == '\0' && isfinite(*result);
+}
+
+static void handle_control_command(const char *line, char *reply, size_t reply_size) {
+    char name[64] = "";
+    char value[192] = "";
+    char extra[192] = "";
+    int n = sscanf(line, "%63s %191s %191s", name, value, extra);
+    bool flag;
+
+    if (n < 1) {
+        snprintf(reply, reply_size, "error empty command");
+    } else if (strcmp(name, "plane-distance") == 0 && n >= 2) {
+        float distance;
+        if (parse_number(value, &distance)) {
+            set_plane_distance(distance);
+            snprintf(reply, reply_size, "ok plane-distance %.3f", g_plane_orbit_distance);
+        } else {
+            snprintf(reply, reply_size, "error plane-distance must be a number");
+        }
+    } else if (strcmp(name, "plane-scale") == 0 && n >= 2) {
+        float scale;
+        if (parse_number(value, &scale) && set_plane_scale(scale)) {
+            snprintf(reply, reply_size, "ok plane-scale %.3f", g_plane_scale);
+        } else {
+            snprintf(reply, reply_size, "error plane-scale must be positive");
+        }
+    } else if (strcmp(name, "curved-screen") == 0 && n >= 2 && parse_switch(value, use_curved_screen, &flag)) {
+        set_curved_screen(flag);
+        snprintf(reply, reply_size, "ok curved-screen %s", flag ? "on" : "off");
+    } else if (strcmp(name, "passthrough") == 0 && n >= 2 && parse_switch(value, passthrough_mode, &flag)) {
+        set_passthrough(flag);
+        snprintf(reply, reply_size, "ok passthrough %s", flag ? "on" : "off");
+    } else if (strcmp(name, "recenter") == 0) {
+        recenter_view();
+        snprintf(reply, reply_size, "ok");
+    } else if (strcmp(name, "source") == 0 && n >= 2) {
+        bool accepted;
+        if (strcmp(value, "v4l2") == 0) {
+            accepted = request_source_switch(MODE_V4L2, false, n >= 3 ? extra : NULL);
+        } else if (strcmp(value, "xdg") == 0) {
+            accepted = request_source_switch(MODE_XDG, false, NULL);
+        } else if (strcmp(value, "x11") == 0) {
+            accepted = request_source_switch(MODE_X11, false, NULL);
+        } else if (strcmp(value, "wayland") == 0) {
+            accepted = request_source_switch(MODE_WAYLAND, false, NULL);
+        } else if (strcmp(value, "kms") == 0) {
+            accepted = request_source_switch(MODE_KMS, false, n >= 3 ? extra : NULL);
+        } else if (strcmp(value, "test-pattern") == 0) {
+            accepted = request_source_switch(current_capture_mode, true, NULL);
+        } else {
+            snprintf(reply, reply_size, "error unknown source %s (v4l2 [device], xdg, x11, wayland, kms [device], test-pattern)", value);
+            return;
+        }
+        snprintf(reply, reply_size, accepted ? "ok switching" : "error a source switch is already running");
+    } else if (strcmp(name, "stats") == 0) {
+        print_pipeline_stats();
+        snprintf(reply, reply_size, "ok printed to stdout");
+    } else if (strcmp(name, "status") == 0) {
+        snprintf(reply, reply_size,
+                 "plane-distance %.3f plane-scale %.3f curved-screen %s passthrough %s source %s %dx%d%s",
+                 g_plane_orbit_distance, g_plane_scale, use_curved_screen ? "on" : "off",
+                 passthrough_mode ? "on" : "off",
+                 display_test_pattern ? "test-pattern" : (current_capture_mode == MODE_XDG ? "xdg" :
+                                                          current_capture_mode == MODE_X11 ? "x11" :
+                                                          current_capture_mode == MODE_WAYLAND ? "wayland" :
+                                                          current_capture_mode == MODE_KMS ? "kms" : v4l2_device_path_str),
+                 texture_width, texture_height, source_state != SOURCE_RUNNING ? " (switching)" : "");
+    } else {
+        snprintf(reply, reply_size, "error unknown command, use plane-distance <d>, plane-scale <s>, "
+                 "curved-screen on|off|toggle, passthrough on|off|toggle, recenter, "
+                 "source v4l2 [device]|xdg|x11|wayland|kms [device]|test-pattern, stats or status");
+    }
+}
+
+void keyboard(unsigned char key, int x, int y) {
+    (void)x;
+    (void)y;
+    switch (key) {
+        case '+': case '=': set_plane_distance(g_plane_orbit_distance + PLANE_DISTANCE_STEP); break;
+        case '-':           set_plane_distance(g_plane_orbit_distance - PLANE_DISTANCE_STEP); break;
+        case ']':           set_plane_scale(g_plane_scale * PLANE_SCALE_STEP); break;
+        case '[':           set_plane_scale(g_plane_scale / PLANE_SCALE_STEP); break;
+        case 'c':           set_curved_screen(!use_curved_screen); break;
+        case 'p':           set_passthrough(!passthrough_mode); break;
+        case 'r':           recenter_view(); break;
+        case 'v':           request_source_switch(MODE_V4L2, false, NULL); break;
+        case 'x':           request_source_switch(MODE_XDG, false, NULL); break;
+        case 't':           request_source_switch(current_capture_mode, true, NULL); break;
+        default: break;
+    }
+}
+
 // static clock_t last_redisplay_time = 0; // Moved TARGET_FPS definition earlier
 static clock_t last_redisplay_time = 0;
 void idle()
@@ -684,12 +2425,20 @@ void idle()
     // Let's try capturing XDG frames here to decouple from display's GL context needs.
 
     clock_t current_time = clock();
+
+    control_poll(handle_control_command);
+    if (source_state == SOURCE_READY) {
+        finish_source_switch();
+    }
+    if (autotune_active()) {
+        autotune_step();
+    }
     
-    if (display_test_pattern) {
+    if (source_state != SOURCE_RUNNING) {
+        // The previous frame stays on screen until the new source is up
+    } else if (display_test_pattern) {
         fill_frame_with_pattern(rgb_frames[back_buffer_idx], actual_frame_width, actual_frame_height);
-        pthread_mutex_lock(&frame_mutex);
-        new_frame_captured = true;
-        pthread_mutex_unlock(&frame_mutex);
+        publish_frame(actual_frame_width, actual_frame_height, stats_now_us());
     } else if (current_capture_mode == MODE_XDG) {
         //if ( (current_time - last_redisplay_time) * 1000 / CLOCKS_PER_SEC >= (1000 / TARGET_FPS) ) {
             XDGFrameRequest *xdg_frame = get_xdg_root_window_frame_sync();
@@ -702,7 +2451,7 @@ void idle()
                     actual_frame_height = xdg_frame->height;
                     xdg_prev_frame_width = actual_frame_width;
                     xdg_prev_frame_height = actual_frame_height;
-                    texture_needs_respecification = true;
+                    if (auto_crop) active_area_init(actual_frame_width, actual_frame_height);
 
                     // Reallocate rgb_frames if necessary
                     size_t new_size = (size_t)actual_frame_width * actual_frame_height * 3;
@@ -725,13 +2474,16 @@ void idle()
                         memset(rgb_frames[1], 0, new_size);
                         current_rgb_buffer_size = new_size;
                     }
+                    alloc_tile_hashes();
                 }
 
                 if (rgb_frames[back_buffer_idx]) { // Check if buffer is allocated
-                    memcpy(rgb_frames[back_buffer_idx], xdg_frame->data, (size_t)actual_frame_width * actual_frame_height * 3);
-                    pthread_mutex_lock(&frame_mutex);
-                    new_frame_captured = true;
-                    pthread_mutex_unlock(&frame_mutex);
+                    FrameRect crop;
+                    get_crop_rect(xdg_frame->data + 1, 3, actual_frame_width * 3, &crop);
+                    perf_counters_begin(PERF_STAGE_CONVERT);
+                    copy_frame_region(xdg_frame->data, actual_frame_width * 3, rgb_frames[back_buffer_idx], 3, &crop);
+                    perf_counters_end((uint64_t)crop.width * crop.height);
+                    publish_frame(crop.width, crop.height, stats_now_us());
                 } else {
                     fprintf(stderr, "V4L2_GL: rgb_frames not allocated, cannot copy XDG frame.\n");
                 }
@@ -742,44 +2494,67 @@ void idle()
             }
         //}  /* end of FPS conditional */ 
 
+    } else if (current_capture_mode == MODE_X11) {
+        capture_x11_frame();
+    } else if (current_capture_mode == MODE_WAYLAND) {
+        capture_wayland_frame();
+    } else if (current_capture_mode == MODE_KMS) {
+        capture_kms_frame();
     }
 
 skip_xdg_frame_processing:; // Label for goto
+    if (print_stats || stats_dump_requested) {
+        static double last_stats_time = 0.0;
+        double now = get_time_ms();
+        if (stats_dump_requested || now - last_stats_time >= STATS_INTERVAL_MS) {
+            stats_dump_requested = 0;
+            last_stats_time = now;
+            print_pipeline_stats();
+        }
+    }
+
     //if ( (current_time - last_redisplay_time) * 1000 / CLOCKS_PER_SEC >= (1000 / TARGET_FPS) ) {
         last_redisplay_time = current_time;
 
+    if (use_soft_render) {
+        // Presenting waits for the vblank, which paces the loop instead of the sleep
+        display_software();
+        return;
+    }
     glutPostRedisplay();
     nanosleep(&(struct timespec){0, 1000000000L / TARGET_FPS}, NULL); // Sleep for FPS interval, this means the exact FPS will not be reached due to processing time
 
     //}
 }
 
-void init_gl() {
-    if (pthread_mutex_init(&frame_mutex, NULL) != 0) {
-        perror("Mutex init failed");
-        exit(EXIT_FAILURE);
+// With a V4L2 device the candidates are measured from idle(), otherwise only the MJPEG
+// decoder can be chosen and is timed right here
+static void start_autotune(void) {
+    if (current_capture_mode == MODE_V4L2 && !display_test_pattern) {
+        autotune_start(compressed_input, use_mjpeg_gpu);
+        return;
     }
-
-    // Allocate RGB frames based on actual dimensions.
-    // actual_frame_width/height are set by init_v4l2() or by initial XDG frame check.
-    current_rgb_buffer_size = (size_t)actual_frame_width * actual_frame_height * 3;
-    if (current_rgb_buffer_size == 0) { // Safety if dimensions were somehow zero
-        fprintf(stderr, "Warning: Frame dimensions are zero in init_gl. Defaulting to 1x1.\n");
-        actual_frame_width = 1; actual_frame_height = 1;
-        current_rgb_buffer_size = 3;
+    PipelineConfig best;
+    AutotuneResult result;
+    if (autotune_synthetic(requested_frame_width, requested_frame_height, use_mjpeg_gpu, &best, &result)) {
+        char path[512];
+        if (autotune_profile_path(v4l2_device_path_str, requested_frame_width, requested_frame_height, path, sizeof(path))) {
+            autotune_profile_save(path, v4l2_device_path_str, requested_frame_width, requested_frame_height, &best, &result);
+        }
+        use_mjpeg_gpu = best.mjpeg_gpu;
     }
+    if (!use_soft_render) glBindTexture(GL_TEXTURE_2D, texture_id);
+}
 
-    rgb_frames[0] = malloc(current_rgb_buffer_size);
-    rgb_frames[1] = malloc(current_rgb_buffer_size);
-
-    if (!rgb_frames[0] || !rgb_frames[1]) {
-        fprintf(stderr, "Failed to allocate memory for RGB frames (%dx%d)\n", actual_frame_width, actual_frame_height);
+static void create_screen_texture(void) {
+#ifdef USE_GLES
+    if (!gles_renderer_init() || !gles_renderer_set_texture(texture_width, texture_height, gl_upload_format)) {
+        fprintf(stderr, "V4L2_GL: The GLES renderer needs OpenGL ES 3.0.\n");
         exit(EXIT_FAILURE);
     }
-    memset(rgb_frames[0], 0, current_rgb_buffer_size);
-    memset(rgb_frames[1], 0, current_rgb_buffer_size);
-
-    glEnable(GL_DEPTH_TEST);
+    texture_id = gles_renderer_texture();
+    gles_renderer_upload(rgb_frames[front_buffer_idx]);
+#else
     glEnable(GL_TEXTURE_2D);
 
     glGenTextures(1, &texture_id);
@@ -789,9 +2564,98 @@ void init_gl() {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, actual_frame_width, actual_frame_height, 0,
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texture_width, texture_height, 0,
                  gl_upload_format, GL_UNSIGNED_BYTE, rgb_frames[front_buffer_idx]);
+#endif
+}
+
+void init_gl() {
+    if (pthread_mutex_init(&frame_mutex, NULL) != 0) {
+        perror("Mutex init failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // --autotune tries every decoder, the candidates turn them on and off
+    if (run_autotune) {
+        use_mjpeg_gpu = DESKTOP_GL_PASSES && !use_soft_render && !auto_crop;
+        compressed_input = DESKTOP_GL_PASSES && !use_soft_render && video_decoder_available();
+    }
+
+    // Before the frame buffers are sized, they hold coefficients when this works
+    if (use_mjpeg_gpu && !mjpeg_gpu_init(mjpeg_gpu_verify)) {
+        fprintf(stderr, "Warning: GPU MJPEG decoding is not available (needs GLSL 1.30), using libjpeg.\n");
+        use_mjpeg_gpu = false;
+    }
+
+    // Allocate RGB frames based on actual dimensions.
+    // actual_frame_width/height are set by init_v4l2() or by initial XDG frame check.
+    if (!alloc_frame_buffers()) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (!passthrough_mode && !use_soft_render) {
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    texture_width = actual_frame_width;
+    texture_height = actual_frame_height;
+    if (use_soft_render) {
+        upload_front_frame_soft();
+    } else {
+        create_screen_texture();
+    }
+    if (use_mipmaps) {
+        if (mipmap_init(texture_width, texture_height, frame_bytes_per_pixel, gl_upload_format)) {
+            mipmap_update(rgb_frames[front_buffer_idx], SIZE_MAX);
+        } else {
+            fprintf(stderr, "Warning: Mipmaps could not be allocated, using plain linear filtering.\n");
+            use_mipmaps = false;
+        }
+    }
+
+    if (auto_crop) {
+        active_area_init(actual_frame_width, actual_frame_height);
+    }
+
+    if (upload_budget_kb > 0) {
+        if (upload_scheduler_init(actual_frame_width, actual_frame_height, frame_bytes_per_pixel, (size_t)upload_budget_kb * 1024)) {
+            alloc_tile_hashes();
+        } else {
+            fprintf(stderr, "Warning: Upload scheduler could not be initialized, uploading whole frames.\n");
+        }
+    }
+
+    if (use_frame_pacing) {
+        frame_pacing_init();
+    }
+
+    if (throttle_static) {
+        capture_throttle_init();
+    }
+
+    if (render_budget_ms > 0.0) {
+        render_scale_init((float)render_budget_ms);
+    }
+
+    if (compressed_input && video_decoder_available() && !yuv_convert_init()) {
+        fprintf(stderr, "Warning: The YUV conversion shader is not available, decoded H.264/HEVC frames can not be shown.\n");
+        if (run_autotune) compressed_input = false;
+    }
+
+    if (use_gpu_timing && !gpu_timer_init()) {
+        fprintf(stderr, "Warning: GPU timer queries are not available, --gpu-timing is ignored.\n");
+        use_gpu_timing = false;
+    }
+
+    if (use_upscale && !upscale_init()) {
+        fprintf(stderr, "Warning: GPU upscaling is not available, showing the captured resolution.\n");
+        use_upscale = false;
+    }
+
+    if (run_autotune) {
+        start_autotune();
+    }
 
     glut_initialized = true; 
 }
@@ -801,10 +2665,48 @@ int main(int argc, char **argv) {
     kgflags_string("device", "/dev/video0", "V4L2 device path (e.g., /dev/video0).", false, &v4l2_device_path_str);
     kgflags_bool("fullscreen", false, "Enable fullscreen mode.", false, &fullscreen_mode);
     kgflags_bool("viture", false, "Enable Viture IMU.", false, &use_viture_imu);
+    kgflags_string("viture-device", "", "Serial number or HID path of the Viture glasses to use (custom driver).", false, &viture_device_selector);
     kgflags_bool("test-pattern", false, "Display test pattern instead of V4L2.", false, &display_test_pattern);
     kgflags_bool("curved-screen", false, "Render the screen with a horizontal curvature.", false, &use_curved_screen);
+    kgflags_bool("passthrough", false, "Show the frame head-locked and unscaled, bypassing the 3D view (lowest latency).", false, &passthrough_mode);
     bool use_xdg_mode = false;
     kgflags_bool("xdg", false, "Use XDG portal for screen capture instead of V4L2.", false, &use_xdg_mode);
+    bool use_x11_mode = false;
+    kgflags_bool("x11", false, "Capture the X11 screen through MIT-SHM instead of V4L2.", false, &use_x11_mode);
+    kgflags_string("x11-display", "", "X display to capture with --x11 (default $DISPLAY).", false, &x11_display_name);
+    kgflags_bool("x11-cursor", true, "Draw the pointer into the --x11 frames.", false, &x11_draw_cursor);
+    bool use_wayland_mode = false;
+    kgflags_bool("wayland-capture", false, "Capture a Wayland output through ext-image-copy-capture-v1 instead of V4L2.", false, &use_wayland_mode);
+    kgflags_string("wayland-output", "", "Output to capture with --wayland-capture, e.g. HDMI-A-1 (default the first one).", false, &wayland_output_name);
+    kgflags_string("kms-capture", "", "Capture what a KMS device (e.g. /dev/dri/card0) scans out instead of V4L2, needs root.", false, &kms_capture_device);
+    kgflags_int("kms-crtc", 0, "CRTC id to capture with --kms-capture (0 = the first active one).", false, &kms_crtc);
+    kgflags_bool("wayland-dmabuf", true, "Let the compositor render --wayland-capture frames into dmabufs the GLES renderer samples directly.", false, &wayland_dmabuf);
+
+    kgflags_int("upload-budget", 0, "Texture upload budget per rendered frame in KiB (0 = upload whole frames).", false, &upload_budget_kb);
+    kgflags_int("capture-width", FRAME_WIDTH, "Width requested from the capture device.", false, &requested_frame_width);
+    kgflags_int("capture-height", FRAME_HEIGHT, "Height requested from the capture device.", false, &requested_frame_height);
+    kgflags_bool("upscale", false, "Upscale the captured frame on the GPU (EASU/RCAS) to the size the plane covers.", false, &use_upscale);
+    kgflags_double("upscale-sharpness", 0.2, "Sharpening in stops for --upscale, 0 is the strongest.", false, &upscale_sharpness);
+    kgflags_bool("mipmaps", false, "Sample the screen from a mip chain with trilinear filtering; only changed regions are regenerated.", false, &use_mipmaps);
+    kgflags_double("render-budget-ms", 0.0, "Lower the render resolution when drawing the scene takes longer than this (ms). 0 disables.", false, &render_budget_ms);
+    kgflags_bool("frame-pacing", false, "Show captured frames at an even cadence, delayed by the measured arrival jitter.", false, &use_frame_pacing);
+    kgflags_bool("throttle-static", false, "Skip capture buffers and lower the capture rate while the V4L2 source shows static content.", false, &throttle_static);
+    kgflags_bool("compressed-input", false, "Prefer H.264/HEVC from the capture device over MJPEG (needs a build with libavcodec).", false, &compressed_input);
+    kgflags_string("video-decoder", "auto", "Decoder for --compressed-input: auto, v4l2m2m, slice or frame.", false, &video_decoder_mode);
+    kgflags_bool("mjpeg-gpu", false, "Decode MJPEG on the GPU: only the entropy decoding runs on the CPU.", false, &use_mjpeg_gpu);
+    kgflags_bool("mjpeg-gpu-verify", false, "With --mjpeg-gpu, compare a frame with libjpeg every few seconds and print the difference.", false, &mjpeg_gpu_verify);
+    kgflags_bool("auto-crop", false, "Detect letterbox/pillarbox borders and only convert and show the active picture.", false, &auto_crop);
+    kgflags_string("control-socket", "", "Unix socket for changing settings and the source while running.", false, &control_socket_path);
+    kgflags_string("capture-read", "auto", "How frames are read from V4L2 MMAP buffers: auto (measured), direct, dmabuf or bounce.", false, &capture_read_name);
+    kgflags_int("buffers", 0, "Number of V4L2 capture buffers (0 = machine profile or 4).", false, &v4l2_buffer_count);
+    kgflags_bool("autotune", false, "Benchmark the available pipeline configurations and save the fastest as the machine profile.", false, &run_autotune);
+    bool use_profile = true;
+    kgflags_bool("profile", true, "Load the machine profile written by --autotune for the device and capture size.", false, &use_profile);
+    kgflags_string("soft-render", "", "Draw on the CPU into a KMS device (/dev/dri/card0) or framebuffer (/dev/fb0) instead of OpenGL.", false, &soft_render_device);
+    kgflags_int("soft-render-threads", 0, "Threads drawing with --soft-render (0 = one per CPU).", false, &soft_render_threads);
+    kgflags_bool("gpu-timing", false, "Measure the GPU time of upload, draw and post-processing with timer queries (printed with --stats).", false, &use_gpu_timing);
+    kgflags_bool("perf-counters", false, "Count cycles, instructions, cache and dTLB misses of the CPU pipeline stages with perf_event (printed with --stats).", false, &use_perf_counters);
+    kgflags_bool("stats", false, "Print pipeline statistics every few seconds.", false, &print_stats);
 
     double plane_distance_double = (double)g_plane_orbit_distance;
     kgflags_double("plane-distance", plane_distance_double, "Set plane orbit distance (float).", false, &plane_distance_double);
@@ -823,6 +2725,56 @@ int main(int argc, char **argv) {
 
     g_plane_orbit_distance = (float)plane_distance_double;
     g_plane_scale = (float)plane_scale_double;
+    use_soft_render = soft_render_device[0] != '\0';
+
+    if (requested_frame_width <= 0 || requested_frame_height <= 0) {
+        fprintf(stderr, "Warning: Capture size must be positive. Resetting to %dx%d.\n", FRAME_WIDTH, FRAME_HEIGHT);
+        requested_frame_width = FRAME_WIDTH;
+        requested_frame_height = FRAME_HEIGHT;
+    }
+    // Test pattern and the initial XDG buffers use the requested size until a source reports its own
+    actual_frame_width = requested_frame_width;
+    actual_frame_height = requested_frame_height;
+
+    // A profile only turns options on, flags given on the command line keep their effect
+    char profile_path[512];
+    PipelineConfig profile;
+    if (use_profile && !run_autotune &&
+        autotune_profile_path(v4l2_device_path_str, requested_frame_width, requested_frame_height, profile_path, sizeof(profile_path)) &&
+        autotune_profile_load(profile_path, &profile)) {
+        printf("V4L2_GL: Loaded machine profile %s\n", profile_path);
+        compressed_input = compressed_input || profile.compressed_input;
+        use_mjpeg_gpu = use_mjpeg_gpu || profile.mjpeg_gpu;
+        if (v4l2_buffer_count <= 0) v4l2_buffer_count = profile.buffer_count;
+    }
+    if (v4l2_buffer_count <= 0) {
+        v4l2_buffer_count = BUFFER_COUNT;
+    }
+    if (!capture_memory_parse(capture_read_name, &requested_capture_read)) {
+        fprintf(stderr, "Warning: --capture-read must be auto, direct, dmabuf or bounce. Measuring instead.\n");
+        requested_capture_read = CAPTURE_READ_AUTO;
+    }
+
+    if (!DESKTOP_GL_PASSES && (use_upscale || use_mipmaps || use_mjpeg_gpu || compressed_input)) {
+        fprintf(stderr, "Warning: --upscale, --mipmaps, --mjpeg-gpu and --compressed-input are not available in the GLES build.\n");
+        use_upscale = use_mipmaps = use_mjpeg_gpu = compressed_input = false;
+    }
+    if (use_soft_render && (use_upscale || use_mipmaps || use_mjpeg_gpu || compressed_input ||
+                            upload_budget_kb > 0 || render_budget_ms > 0.0 || use_gpu_timing)) {
+        fprintf(stderr, "Warning: --upscale, --mipmaps, --mjpeg-gpu, --compressed-input, --upload-budget, "
+                "--render-budget-ms and --gpu-timing need OpenGL and are ignored with --soft-render.\n");
+        use_upscale = use_mipmaps = use_mjpeg_gpu = compressed_input = use_gpu_timing = false;
+        upload_budget_kb = 0;
+        render_budget_ms = 0.0;
+    }
+    if (use_mjpeg_gpu && auto_crop) {
+        fprintf(stderr, "Warning: --mjpeg-gpu does not work with --auto-crop, decoding MJPEG with libjpeg.\n");
+        use_mjpeg_gpu = false;
+    }
+    if (use_perf_counters && !perf_counters_init()) {
+        fprintf(stderr, "Warning: perf_event hardware counters are not available, --perf-counters is ignored.\n");
+        use_perf_counters = false;
+    }
 
     // Validate plane_scale after parsing
     if (g_plane_scale <= 0.0f) {
@@ -836,12 +2788,39 @@ int main(int argc, char **argv) {
     printf("  Test Pattern: %s\n", display_test_pattern ? "enabled" : "disabled");
     printf("  V4L2 Device: %s\n", v4l2_device_path_str);
     printf("  XDG Mode: %s\n", use_xdg_mode ? "enabled" : "disabled");
+    printf("  X11 Mode: %s\n", use_x11_mode ? "enabled" : "disabled");
+    printf("  Wayland Mode: %s\n", use_wayland_mode ? "enabled" : "disabled");
+    printf("  KMS Capture: %s\n", kms_capture_device[0] ? kms_capture_device : "disabled");
     printf("  Curved Screen: %s\n", use_curved_screen ? "enabled" : "disabled");
+    printf("  Passthrough: %s\n", passthrough_mode ? "enabled" : "disabled");
     printf("  Plane Orbit Distance: %f\n", g_plane_orbit_distance);
     printf("  Plane Scale: %f\n", g_plane_scale);
+    printf("  Capture Size: %dx%d\n", requested_frame_width, requested_frame_height);
+    printf("  GPU Upscale: %s\n", use_upscale ? "enabled" : "disabled");
+    printf("  Auto Crop: %s\n", auto_crop ? "enabled" : "disabled");
+    printf("  V4L2 Buffers: %d\n", v4l2_buffer_count);
+    printf("  Autotune: %s\n", run_autotune ? "enabled" : "disabled");
+    printf("  Software Rendering: %s\n", use_soft_render ? soft_render_device : "disabled");
+    if (upload_budget_kb > 0) {
+        printf("  Upload Budget: %d KiB per frame\n", upload_budget_kb);
+    } else {
+        printf("  Upload Budget: unlimited\n");
+    }
     printf("\n");
 
-    if (use_xdg_mode) {
+    if (kms_capture_device[0]) {
+        if (use_xdg_mode || use_x11_mode || use_wayland_mode) fprintf(stderr, "V4L2_GL: More than one screen capture given, using --kms-capture.\n");
+        current_capture_mode = MODE_KMS;
+        printf("V4L2_GL: KMS scanout capture mode selected.\n");
+    } else if (use_wayland_mode) {
+        if (use_xdg_mode || use_x11_mode) fprintf(stderr, "V4L2_GL: More than one screen capture given, using --wayland-capture.\n");
+        current_capture_mode = MODE_WAYLAND;
+        printf("V4L2_GL: Wayland screen capture mode selected.\n");
+    } else if (use_x11_mode) {
+        if (use_xdg_mode) fprintf(stderr, "V4L2_GL: --x11 and --xdg given, using --x11.\n");
+        current_capture_mode = MODE_X11;
+        printf("V4L2_GL: X11 screen capture mode selected.\n");
+    } else if (use_xdg_mode) {
         current_capture_mode = MODE_XDG;
         printf("V4L2_GL: XDG screen capture mode selected.\n");
     } else {
@@ -858,7 +2837,7 @@ if (use_viture_imu) {
     printf("Viture: IMU stream enabled via official SDK.\n");
 #else
     printf("Viture: Initializing with custom driver...\n");
-    if (!viture_driver_init()) { 
+    if (!viture_driver_open(viture_device_selector)) { 
         fprintf(stderr, "V4L2_GL: Failed to initialize custom Viture driver.\n");
         use_viture_imu = false; 
     } else {
@@ -876,50 +2855,99 @@ if (use_viture_imu) {
 #endif
 }
 
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
-
-    if (fullscreen_mode) {
-        printf("Mode: Fullscreen\n");
-        glutCreateWindow("V4L2 Real-time Display");
-        glutFullScreen();
+    if (use_soft_render) {
+        // The whole output, there is no window
+        if (!soft_renderer_init(soft_render_device, soft_render_threads)) {
+            exit(EXIT_FAILURE);
+        }
+        int output_width, output_height;
+        soft_renderer_size(&output_width, &output_height);
+        set_view_size(output_width, output_height);
     } else {
-        printf("Mode: Windowed\n");
-        glutInitWindowSize(1280, 720); 
-        glutCreateWindow("V4L2 Real-time Display");
+        glutInit(&argc, argv);
+#ifdef USE_GLES
+        glutInitContextVersion(3, 0);
+#endif
+        // Passthrough never depth tests, skip the depth buffer
+        glutInitDisplayMode(passthrough_mode ? GLUT_DOUBLE | GLUT_RGB : GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+
+        if (fullscreen_mode) {
+            printf("Mode: Fullscreen\n");
+            glutCreateWindow("V4L2 Real-time Display");
+            glutFullScreen();
+        } else {
+            printf("Mode: Windowed\n");
+            glutInitWindowSize(1280, 720); 
+            glutCreateWindow("V4L2 Real-time Display");
+        }
+        // Before any source starts, the Wayland and KMS sources ask it which buffers the renderer can sample
+        dmabuf_import_init();
     }
     
     if (current_capture_mode == MODE_V4L2 && !display_test_pattern) {
-        init_v4l2(); 
+        if (!init_v4l2()) {
+            exit(EXIT_FAILURE);
+        }
     } else if (current_capture_mode == MODE_XDG) { // MODE_XDG
         printf("V4L2_GL: Initializing XDG screen capture session...\n");
+        xdg_set_preferred_size(requested_frame_width, requested_frame_height);
         if (!init_screencast_session()) {
             fprintf(stderr, "V4L2_GL: Failed to initialize XDG screencast session. Exiting.\n");
             exit(EXIT_FAILURE);
         }
+        xdg_session_active = true;
+    } else if (current_capture_mode == MODE_X11) {
+        if (!init_x11_capture()) {
+            fprintf(stderr, "V4L2_GL: Failed to start X11 screen capture. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    } else if (current_capture_mode == MODE_WAYLAND) {
+        if (!init_wayland_capture()) {
+            fprintf(stderr, "V4L2_GL: Failed to start Wayland screen capture. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    } else if (current_capture_mode == MODE_KMS) {
+        if (!init_kms_capture()) {
+            fprintf(stderr, "V4L2_GL: Failed to start KMS scanout capture. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
     init_gl();   
 
-    glutDisplayFunc(display);
-    glutReshapeFunc(reshape);
-    glutIdleFunc(idle);
+    if (!use_soft_render) {
+        glutDisplayFunc(display);
+        glutReshapeFunc(reshape);
+        glutIdleFunc(idle);
+        glutKeyboardFunc(keyboard);
+    }
     atexit(cleanup);
+    signal(SIGUSR1, request_stats_dump); // kill -USR1 <pid> prints the statistics once
+
+    if (control_socket_path[0] != '\0' && !control_init(control_socket_path)) {
+        fprintf(stderr, "V4L2_GL: Continuing without control socket.\n");
+    }
 
     // Create and start the capture thread only for V4L2 mode
     if (current_capture_mode == MODE_V4L2 && !display_test_pattern) {
-        printf("V4L2_GL: Creating V4L2 capture thread...\n");
-        if (pthread_create(&capture_thread_id, NULL, capture_thread_func, NULL) != 0) {
-            perror("Failed to create V4L2 capture thread");
+        if (!start_v4l2_capture_thread()) {
             cleanup(); 
             exit(EXIT_FAILURE);
         }
-        printf("V4L2_GL: V4L2 capture thread created.\n");
     } else {
         printf("V4L2_GL: XDG mode, no separate capture thread needed.\n");
     }
 
     printf("\n--- Starting main loop ---\n");
+    if (use_soft_render) {
+        // Without a window system Ctrl+C ends the loop, so cleanup() can give the display back
+        signal(SIGINT, request_quit);
+        signal(SIGTERM, request_quit);
+        while (!quit_requested) {
+            idle();
+        }
+        return 0;
+    }
     glutMainLoop();
     return 0;
 }
@@ -0,0 +1,271 @@
+/*  H.264/HEVC decoding of compressed capture input with libavcodec.
+
+    Some USB capture devices deliver H.264 or HEVC, which fits 4K60 into USB 2.0 where
+    MJPEG can not. The decoder is set up for latency rather than throughput:
+
+    v4l2m2m  A V4L2 memory-to-memory (stateful hardware) decoder, used by "auto" when
+             the kernel has one (Raspberry Pi, Rockchip, ...). Outputs NV12.
+    slice    Software decoding with AV_CODEC_FLAG_LOW_DELAY and slice threads. Adds no
+             delay, but only runs in parallel when the encoder splits frames into slices.
+    frame    Software decoding with frame threads. Always parallel, but every thread
+             holds back one frame (libavcodec turns frame threads off with LOW_DELAY).
+
+    The decoded planes are handed out as they are, the colour conversion happens on the
+    GPU (yuv_convert.c). Without WITH_FFMPEG only stubs are built.
+
+    Decoding runs on the capture thread, the statistics are printed from the GL thread.
+*/
+
+#include "video_decoder.h"
+#include "stats.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <linux/videodev2.h>
+
+#ifdef WITH_FFMPEG
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixdesc.h>
+
+static AVCodecContext *codec_ctx = NULL;
+static AVPacket *packet = NULL;
+static AVFrame *frame = NULL;          // picture handed out by the last decode call
+static AVFrame *next_frame = NULL;
+static char decoder_description[64] = "";
+static bool warned_pixel_format = false;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long packets = 0;
+static unsigned long long pictures = 0;
+static unsigned long long errors = 0;
+static unsigned long long dropped = 0;  // pictures replaced by a newer one from the same packet
+static StatsHistogram decode_time;
+
+bool video_decoder_available(void) {
+    return true;
+}
+
+static AVCodecContext *open_decoder(const AVCodec *codec, int width, int height, int thread_type) {
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    if (!ctx) return NULL;
+    ctx->width = width;
+    ctx->height = height;
+    ctx->pkt_timebase = (AVRational){1, 1000000};
+    if (thread_type == FF_THREAD_FRAME) {
+        ctx->thread_type = FF_THREAD_FRAME;
+        ctx->thread_count = 0;
+    } else {
+        ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        ctx->thread_type = thread_type;
+        ctx->thread_count = thread_type ? 0 : 1;
+    }
+    if (avcodec_open2(ctx, codec, NULL) < 0) {
+        avcodec_free_context(&ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+bool video_decoder_init(uint32_t v4l2_pixelformat, int width, int height, const char *mode) {
+    video_decoder_shutdown();
+
+    enum AVCodecID codec_id;
+    const char *m2m_name;
+    if (v4l2_pixelformat == V4L2_PIX_FMT_H264) {
+        codec_id = AV_CODEC_ID_H264;
+        m2m_name = "h264_v4l2m2m";
+    } else if (v4l2_pixelformat == V4L2_PIX_FMT_HEVC) {
+        codec_id = AV_CODEC_ID_HEVC;
+        m2m_name = "hevc_v4l2m2m";
+    } else {
+        fprintf(stderr, "Video decoder: Unsupported pixel format %c%c%c%c\n",
+                v4l2_pixelformat & 0xFF, (v4l2_pixelformat >> 8) & 0xFF,
+                (v4l2_pixelformat >> 16) & 0xFF, (v4l2_pixelformat >> 24) & 0xFF);
+        return false;
+    }
+
+    bool try_m2m = strcmp(mode, "auto") == 0 || strcmp(mode, "v4l2m2m") == 0;
+    int thread_type;
+    if (strcmp(mode, "frame") == 0) {
+        thread_type = FF_THREAD_FRAME;
+    } else if (strcmp(mode, "slice") == 0 || strcmp(mode, "auto") == 0) {
+        thread_type = FF_THREAD_SLICE;
+    } else if (strcmp(mode, "v4l2m2m") == 0) {
+        thread_type = 0;
+    } else {
+        fprintf(stderr, "Video decoder: Unknown mode '%s' (auto, v4l2m2m, slice or frame)\n", mode);
+        return false;
+    }
+
+    if (try_m2m) {
+        const AVCodec *m2m = avcodec_find_decoder_by_name(m2m_name);
+        if (m2m) codec_ctx = open_decoder(m2m, width, height, 0);
+        if (codec_ctx) {
+            snprintf(decoder_description, sizeof(decoder_description), "%s (V4L2 memory-to-memory)", m2m_name);
+        } else if (!thread_type) {
+            fprintf(stderr, "Video decoder: No V4L2 memory-to-memory decoder (%s) available\n", m2m_name);
+            return false;
+        }
+    }
+    if (!codec_ctx) {
+        const AVCodec *codec = avcodec_find_decoder(codec_id);
+        if (codec) codec_ctx = open_decoder(codec, width, height, thread_type);
+        if (!codec_ctx) {
+            fprintf(stderr, "Video decoder: Could not open the %s decoder\n", codec_id == AV_CODEC_ID_H264 ? "H.264" : "HEVC");
+            return false;
+        }
+        snprintf(decoder_description, sizeof(decoder_description), "%s (software, %d %s threads)",
+                 codec->name, codec_ctx->thread_count,
+                 codec_ctx->active_thread_type == FF_THREAD_FRAME ? "frame" :
+                 codec_ctx->active_thread_type == FF_THREAD_SLICE ? "slice" : "no");
+    }
+
+    packet = av_packet_alloc();
+    frame = av_frame_alloc();
+    next_frame = av_frame_alloc();
+    if (!packet || !frame || !next_frame) {
+        fprintf(stderr, "Video decoder: Out of memory\n");
+        video_decoder_shutdown();
+        return false;
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    packets = pictures = errors = dropped = 0;
+    memset(&decode_time, 0, sizeof(decode_time));
+    pthread_mutex_unlock(&stats_lock);
+    warned_pixel_format = false;
+    printf("Video decoder: Using %s\n", decoder_description);
+    return true;
+}
+
+void video_decoder_shutdown(void) {
+    if (codec_ctx) avcodec_free_context(&codec_ctx);
+    if (packet) av_packet_free(&packet);
+    if (frame) av_frame_free(&frame);
+    if (next_frame) av_frame_free(&next_frame);
+}
+
+// Describes the picture in frame, false for pixel formats the GPU conversion can't take
+static bool describe_frame(double capture_us, DecodedFrame *out) {
+    switch (frame->format) {
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUVJ420P:
+            out->format.layout = YUV_LAYOUT_I420;
+            break;
+        case AV_PIX_FMT_NV12:
+            out->format.layout = YUV_LAYOUT_NV12;
+            break;
+        default:
+            if (!warned_pixel_format) {
+                fprintf(stderr, "Video decoder: Decoded pixel format %s is not supported (8 bit 4:2:0 only)\n",
+                        av_get_pix_fmt_name((enum AVPixelFormat)frame->format));
+                warned_pixel_format = true;
+            }
+            return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        out->planes[i] = frame->data[i];
+        out->strides[i] = frame->linesize[i];
+    }
+    out->width = frame->width;
+    out->height = frame->height;
+    // Streams that don't say are BT.709 from HD up, like most players assume
+    out->format.bt709 = frame->colorspace == AVCOL_SPC_BT709 ||
+                        (frame->colorspace == AVCOL_SPC_UNSPECIFIED && frame->height > 576);
+    out->format.full_range = frame->color_range == AVCOL_RANGE_JPEG || frame->format == AV_PIX_FMT_YUVJ420P;
+    // With frame threads the picture belongs to an earlier packet
+    out->capture_us = frame->pts != AV_NOPTS_VALUE ? (double)frame->pts : capture_us;
+    return true;
+}
+
+int video_decoder_decode(const unsigned char *data, size_t size, double capture_us, DecodedFrame *out) {
+    if (!codec_ctx) return -1;
+    double start_us = stats_now_us();
+
+    // libavcodec reads a little past the end of the data, the packet buffer is padded for that
+    av_packet_unref(packet);
+    if (av_new_packet(packet, (int)size) < 0) return -1;
+    memcpy(packet->data, data, size);
+    packet->pts = (int64_t)capture_us;
+
+    int got = 0;
+    int replaced = 0;
+    int ret = 0;
+    // A full output queue makes send_packet fail with EAGAIN until a picture was taken out
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int sent = avcodec_send_packet(codec_ctx, packet);
+        if (sent < 0 && sent != AVERROR(EAGAIN)) {
+            ret = -1;
+            break;
+        }
+        int received;
+        while ((received = avcodec_receive_frame(codec_ctx, next_frame)) == 0) {
+            // Only the newest picture is shown
+            if (got) replaced++;
+            av_frame_unref(frame);
+            av_frame_move_ref(frame, next_frame);
+            got = 1;
+        }
+        if (received != AVERROR(EAGAIN) && received != AVERROR_EOF) {
+            ret = -1;
+            break;
+        }
+        if (sent == 0) break;
+    }
+
+    if (got && !describe_frame(capture_us, out)) {
+        got = 0;
+        ret = -1;
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    packets++;
+    if (ret < 0) errors++;
+    if (got) pictures++;
+    dropped += replaced;
+    stats_histogram_add(&decode_time, stats_now_us() - start_us);
+    pthread_mutex_unlock(&stats_lock);
+    return got ? 1 : ret;
+}
+
+void video_decoder_print_stats(FILE *out) {
+    if (!codec_ctx) return;
+    pthread_mutex_lock(&stats_lock);
+    fprintf(out, "Video decoder: %s, %llu packets, %llu pictures, %llu errors, %llu dropped\n",
+            decoder_description, packets, pictures, errors, dropped);
+    stats_histogram_print(&decode_time, "  decode time", out);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+#else // WITH_FFMPEG
+
+bool video_decoder_available(void) {
+    return false;
+}
+
+bool video_decoder_init(uint32_t v4l2_pixelformat, int width, int height, const char *mode) {
+    (void)v4l2_pixelformat;
+    (void)width;
+    (void)height;
+    (void)mode;
+    fprintf(stderr, "Video decoder: Built without libavcodec (WITH_FFMPEG), H.264/HEVC input is not available\n");
+    return false;
+}
+
+void video_decoder_shutdown(void) {
+}
+
+int video_decoder_decode(const unsigned char *data, size_t size, double capture_us, DecodedFrame *frame) {
+    (void)data;
+    (void)size;
+    (void)capture_us;
+    (void)frame;
+    return -1;
+}
+
+void video_decoder_print_stats(FILE *out) {
+    (void)out;
+}
+
+#endif // WITH_FFMPEG
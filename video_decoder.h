@@ -0,0 +1,39 @@
+#ifndef VIDEO_DECODER_H
+#define VIDEO_DECODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "utility.h"
+
+// A decoded 4:2:0 picture. The planes belong to the decoder and stay valid until the next
+// video_decoder_decode() call.
+typedef struct {
+    const unsigned char *planes[3];
+    int strides[3];
+    int width;
+    int height;
+    YuvFormat format;
+    double capture_us;  // capture time passed with the packet the picture came from
+} DecodedFrame;
+
+// False if the build has no libavcodec (WITH_FFMPEG not defined)
+bool video_decoder_available(void);
+
+// Opens a decoder for V4L2_PIX_FMT_H264 or V4L2_PIX_FMT_HEVC in a low latency configuration.
+// mode is "auto" (a V4L2 memory-to-memory decoder if there is one, otherwise "slice"),
+// "v4l2m2m", "slice" (software, slice threads) or "frame" (software, frame threads).
+// Called while the capture thread is not running.
+bool video_decoder_init(uint32_t v4l2_pixelformat, int width, int height, const char *mode);
+void video_decoder_shutdown(void);
+
+// Feeds one access unit captured at capture_us. Returns 1 and fills frame when a picture is
+// ready, 0 if the decoder needs more data and -1 if the data could not be decoded (decoding
+// goes on with the next buffer).
+int video_decoder_decode(const unsigned char *data, size_t size, double capture_us, DecodedFrame *frame);
+
+void video_decoder_print_stats(FILE *out);
+
+#endif // VIDEO_DECODER_H
@@ -10,6 +10,16 @@
 
     MCU is used for sending commands to the glasses and receiving events
     IMU is used for receiving the IMU data
+
+    Each pair of glasses is a VitureDevice with its own HID handles, reader threads,
+    command channel and callbacks, so several can be driven from one process. The two
+    interfaces of one pair are matched by their USB device (from the hidapi-libusb path or
+    the hidraw node in sysfs) or serial number.
+
+    When the USB connection drops the reader threads stop and a hotplug thread per device
+    waits for the glasses to come back: udev events tell when they reappear (built with
+    libudev), otherwise the bus is enumerated a few times a second. The interfaces are
+    reopened and the IMU stream is enabled again if it was on, the callbacks stay in place.
 */
 
 #define _GNU_SOURCE // For strdup and other POSIX extensions
@@ -21,15 +31,25 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
 #include <pthread.h>
 #include <stdint.h> // For uint8_t, uint16_t, uint32_t
 #include <stdbool.h>
+#include <wchar.h>
 
 #include <hidapi/hidapi.h>
 #include <sys/time.h> // For gettimeofday
+#ifdef WITH_UDEV
+#include <libudev.h>
+#endif
+
+#include "stats.h"
+#include "viture_connection.h"
 
 typedef unsigned char uchar;
 typedef unsigned short ushort;
@@ -40,6 +60,15 @@ typedef unsigned int uint;
 #define MCU_INTERFACE_NUMBER 1 // Common for Viture One
 #define IMU_INTERFACE_NUMBER 0 // Common for Viture One
 
+// Reconnecting after the glasses were unplugged
+#define RECONNECT_SETTLE_MS 2000   // retry this long after the glasses reappeared, until both interfaces enumerate
+#define RECONNECT_RETRY_MS 50
+#define RECONNECT_POLL_MS 250      // enumeration interval without udev events
+#define RECONNECT_IDLE_POLL_MS 1000 // with udev, in case an event was missed
+#define RECONNECT_TARGET_MS 500.0   // from reappearing to the first IMU report, slower ones are warned about
+
+#define MAX_LISTED_DEVICES 16
+
 
 // --- CRC Calculation ---
 static unsigned short aus_CrcTable[256];
@@ -78,56 +107,185 @@ static ushort cmd_crc(uchar *data, ushort len) {
     return crc;
 }
 
-// --- Global Variables ---
-static hid_device *g_mcu_dev = NULL;
-static hid_device *g_imu_dev = NULL;
+// --- Device State ---
+struct VitureDevice {
+    VitureDevice *next_open;    // in open_devices
+    char serial[64];
+    char *mcu_hid_path;         // under open_lock
+    char *imu_hid_path;
+
+    hid_device *mcu_dev;
+    hid_device *imu_dev;
+
+    // MCU command handling
+    pthread_mutex_t lock_cmd;
+    pthread_cond_t signal_cond_cmd;
+    bool rsp_ready;     // set by mcu_thread when mcu_rsp holds a response, under lock_cmd
+    uchar mcu_rsp[0x100]; // Buffer for MCU responses (size from mcu_thread)
+
+    // Threads
+    pthread_t mcu_read_tid;
+    pthread_t imu_read_tid;
+    volatile bool mcu_thread_flag;
+    volatile bool imu_thread_flag;
+
+    // Barriers for thread startup synchronization
+    pthread_barrier_t barrier_mcu;
+    pthread_barrier_t barrier_imu;
+
+    // Callbacks
+    viture_device_mcu_callback_t mcu_callback;
+    void *mcu_user;
+    viture_device_imu_callback_t imu_callback;
+    void *imu_user;
+
+    // Stream health, see viture_device_print_stats()
+    char imu_stats_name[80];
+    char mcu_stats_name[80];
+    StreamStats imu_stats;
+    StreamStats mcu_stats;
+
+    // Hot-plug. connection_lock is held by commands and while the hotplug thread replaces the
+    // HID handles, reconnect_lock guards the connection state and the reconnect statistics.
+    pthread_mutex_t connection_lock;
+    pthread_mutex_t reconnect_lock;
+    pthread_t hotplug_tid;
+    volatile bool hotplug_flag;
+    int wake_fd;                // eventfd waking the hotplug thread
+    bool connected;
+    bool imu_enabled;           // last set_imu() request, repeated after a reconnect, under reconnect_lock
+    bool awaiting_first_report; // reconnected, the next IMU report ends the reconnect, under reconnect_lock
+    double lost_us;             // when a reader thread lost the connection
+    double appeared_us;         // when the glasses were seen again, 0 before
+    uint64_t reconnects;
+    double last_reconnect_ms;   // from reappearing to the first IMU report
+    double worst_reconnect_ms;
+};
+
+// hid_init()/hid_exit() are process wide, the devices share them
+static pthread_mutex_t hid_lock = PTHREAD_MUTEX_INITIALIZER;
+static int hid_users = 0;
+
+// Every open device, so that glasses without a serial number are not claimed by two devices.
+// open_lock also guards the HID paths of the devices.
+static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+static VitureDevice *open_devices = NULL;
+
+// Default device of the viture_driver_*() API and its callbacks
+static VitureDevice *default_device = NULL;
+static viture_mcu_event_callback_t ext_mcu_event_callback = NULL;
+static viture_imu_data_callback_t ext_imu_data_callback = NULL;
+
 
-static char *mcu_hid_path = NULL;
-static char *imu_hid_path = NULL;
+static void native_imu_deinit(VitureDevice *device);
+static void native_mcu_deinit(VitureDevice *device);
+static void connection_lost(VitureDevice *device);
+static void first_report_after_reconnect(VitureDevice *device);
 
-// MCU command handling
-static pthread_mutex_t lock_cmd;
-static pthread_cond_t signal_cond_cmd;
-static uchar g_mcu_rsp[0x100]; // Buffer for MCU responses (size from mcu_thread)
+static bool hid_acquire(void) {
+    bool ok = true;
+    pthread_mutex_lock(&hid_lock);
+    if (hid_users == 0) {
+        if (hid_init() != 0) {
+            fprintf(stderr, "Failed to initialize HIDAPI.\n");
+            ok = false;
+        } else {
+            init_crc_table();
+        }
+    }
+    if (ok) hid_users++;
+    pthread_mutex_unlock(&hid_lock);
+    return ok;
+}
 
-// Threads
-static pthread_t mcu_read_tid;
-static pthread_t imu_read_tid;
-static volatile bool mcu_thread_flag = false;
-static volatile bool imu_thread_flag = false;
+static void hid_release(void) {
+    pthread_mutex_lock(&hid_lock);
+    if (hid_users > 0 && --hid_users == 0) {
+        hid_exit();
+    }
+    pthread_mutex_unlock(&hid_lock);
+}
 
-// Barriers for thread startup synchronization
-static pthread_barrier_t barrier_mcu;
-static pthread_barrier_t barrier_imu;
+// --- HID Device Handling ---
+// hidapi-libusb paths are "bus:address:interface", the part before the last ':' names the
+// USB device. hidraw paths (/dev/hidrawN) name the USB device through sysfs: the hidraw
+// node's device is the HID device, its parent the USB interface and the one above that
+// the USB device. Failing both the serial number has to tell the devices apart.
+static size_t usb_device_prefix_len(const char *path) {
+    const char *colon = strrchr(path, ':');
+    if (!colon || strchr(path, '/')) return 0;
+    return (size_t)(colon - path);
+}
 
-// Callbacks
-typedef void (*viture_mcu_event_callback_t)(ushort event_id, uchar *data, ushort len, uint timestamp);
-static viture_mcu_event_callback_t ext_mcu_event_callback = NULL;
+static bool hidraw_usb_device(const char *path, char usb_device[PATH_MAX]) {
+    const char *name = strrchr(path, '/');
+    if (!name || strncmp(name + 1, "hidraw", 6) != 0) return false;
+    char link[PATH_MAX];
+    snprintf(link, sizeof(link), "/sys/class/hidraw/%s/device/../..", name + 1);
+    return realpath(link, usb_device) != NULL;
+}
 
-// IMU Data callback
-#include "viture_connection.h" // For viture_imu_data_callback_t
-static viture_imu_data_callback_t ext_imu_data_callback = NULL;
+static bool same_usb_device(const struct hid_device_info *a, const struct hid_device_info *b) {
+    size_t len = usb_device_prefix_len(a->path);
+    if (len > 0 && len == usb_device_prefix_len(b->path)) {
+        return strncmp(a->path, b->path, len) == 0;
+    }
+    char a_device[PATH_MAX], b_device[PATH_MAX];
+    if (hidraw_usb_device(a->path, a_device) && hidraw_usb_device(b->path, b_device)) {
+        return strcmp(a_device, b_device) == 0;
+    }
+    if (a->serial_number && b->serial_number && a->serial_number[0]) {
+        return wcscmp(a->serial_number, b->serial_number) == 0;
+    }
+    // Neither tells them apart, assume a single pair of glasses
+    return true;
+}
 
+// Pairs every MCU interface with the IMU interface of the same glasses
+static int find_devices(VitureDeviceInfo *devices, int max_devices) {
+    struct hid_device_info *devs = hid_enumerate(VITURE_VENDOR_ID, 0); // PID 0 to match any
+    int count = 0;
 
-static void native_imu_deinit(void);
-static void native_mcu_deinit(void);
+    for (struct hid_device_info *mcu = devs; mcu; mcu = mcu->next) {
+        if (mcu->interface_number != MCU_INTERFACE_NUMBER) continue;
 
-// --- HID Device Handling ---
-static char* find_hid_device_path(int vid, int pid, int interface_number) {
-    struct hid_device_info *devs, *cur_dev;
-    char *path = NULL;
-
-    devs = hid_enumerate(vid, pid);
-    cur_dev = devs;
-    while (cur_dev) {
-        if (cur_dev->interface_number == interface_number) {
-            path = strdup(cur_dev->path);
-            break;
+        struct hid_device_info *imu = devs;
+        while (imu && (imu->interface_number != IMU_INTERFACE_NUMBER || !same_usb_device(mcu, imu))) {
+            imu = imu->next;
+        }
+        if (!imu) {
+            fprintf(stderr, "Viture: no IMU interface (%d) for MCU interface %s, skipping\n", IMU_INTERFACE_NUMBER, mcu->path);
+            continue;
+        }
+
+        if (count < max_devices) {
+            VitureDeviceInfo *info = &devices[count];
+            snprintf(info->serial, sizeof(info->serial), "%ls", mcu->serial_number ? mcu->serial_number : L"");
+            snprintf(info->mcu_path, sizeof(info->mcu_path), "%s", mcu->path);
+            snprintf(info->imu_path, sizeof(info->imu_path), "%s", imu->path);
         }
-        cur_dev = cur_dev->next;
+        count++;
     }
     hid_free_enumeration(devs);
-    return path;
+    return count;
+}
+
+// True if another open device uses either interface of the glasses, open_lock held
+static bool claimed_by_other(const VitureDeviceInfo *info, const VitureDevice *self) {
+    for (const VitureDevice *d = open_devices; d; d = d->next_open) {
+        if (d == self) continue;
+        if ((d->mcu_hid_path && (strcmp(d->mcu_hid_path, info->mcu_path) == 0 || strcmp(d->mcu_hid_path, info->imu_path) == 0)) ||
+            (d->imu_hid_path && (strcmp(d->imu_hid_path, info->mcu_path) == 0 || strcmp(d->imu_hid_path, info->imu_path) == 0))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool device_matches(const VitureDeviceInfo *info, const char *selector) {
+    if (!selector || !selector[0]) return true;
+    if (info->serial[0] && strcmp(info->serial, selector) == 0) return true;
+    return strcmp(info->mcu_path, selector) == 0 || strcmp(info->imu_path, selector) == 0;
 }
 
 static hid_device* open_hid_interface(const char* path) {
@@ -144,6 +302,12 @@ static hid_device* open_hid_interface(const char* path) {
 
 // --- Command Building and Parsing ---
 
+enum ParseResult {
+    PARSE_OK = 0,
+    PARSE_CRC_MISMATCH, // Data was extracted but may be corrupt
+    PARSE_MALFORMED     // Nothing usable in the packet
+};
+
 static void cmd_build(ushort cmd_id, uchar *data, ushort data_len, uchar *out_buf, ushort *out_total_len) {
     memset(out_buf, 0, 0x40); // Max packet size is 64 bytes for HID
 
@@ -178,12 +342,12 @@ static void cmd_build(ushort cmd_id, uchar *data, ushort data_len, uchar *out_bu
     *out_total_len = 0x40; // Always send 64 bytes for HID report
 }
 
-static void parse_rsp(uchar *rsp_buf, ushort total_rsp_len, uchar *out_data, ushort *out_data_len, ushort *out_cmd_id) {
+static enum ParseResult parse_rsp(uchar *rsp_buf, ushort total_rsp_len, uchar *out_data, ushort *out_data_len, ushort *out_cmd_id) {
     if (total_rsp_len == 0) {
         fprintf(stderr, "parse_rsp: invalid response (length 0)\n");
         *out_data_len = 0;
         *out_cmd_id = 0xFFFF; // Indicate error
-        return;
+        return PARSE_MALFORMED;
     }
 
     // Assuming rsp_buf points to the start of the 64-byte HID report
@@ -202,12 +366,14 @@ static void parse_rsp(uchar *rsp_buf, ushort total_rsp_len, uchar *out_data, ush
     if (payload_len_field < 0x0c) { // Minimum length: 8 (zeros) + 2 (cmd_id) + 2 (zeros)
         fprintf(stderr, "parse_rsp: payload_len_field %d too small\n", payload_len_field);
         *out_data_len = 0;
-        return;
+        return PARSE_MALFORMED;
     }
     
     // Check CRC
+    enum ParseResult result = PARSE_OK;
     ushort calculated_crc = cmd_crc(rsp_buf + 4, payload_len_field + 2);
     if (calculated_crc != actual_crc_val) {
+        result = PARSE_CRC_MISMATCH;
         fprintf(stderr, "parse_rsp: CRC mismatch. Expected %04X, Got %04X for CmdID %04X\n",
                 calculated_crc, actual_crc_val, *out_cmd_id);
         // Continue parsing for debugging, but data might be corrupt
@@ -219,51 +385,70 @@ static void parse_rsp(uchar *rsp_buf, ushort total_rsp_len, uchar *out_data, ush
         if (0x12 + *out_data_len > total_rsp_len || 0x12 + *out_data_len > 0x40) {
              fprintf(stderr, "parse_rsp: out_data_len %d inconsistent with total_rsp_len %d or packet size\n", *out_data_len, total_rsp_len);
              *out_data_len = 0; // or clamp
-             return;
+             return PARSE_MALFORMED;
         }
         memcpy(out_data, rsp_buf + 0x12, *out_data_len);
     } else {
         *out_data_len = 0; // Ensure it's zero if no data
     }
+    return result;
+}
+
+static void count_parse_result(StreamStats *stats, enum ParseResult result) {
+    if (result == PARSE_CRC_MISMATCH) {
+        stats_stream_crc_failure(stats);
+    } else if (result == PARSE_MALFORMED) {
+        stats_stream_malformed(stats);
+    }
 }
 
 // --- Command Synchronization ---
-static int cmd_wait(int timeout_sec) {
+static int cmd_wait(VitureDevice *device, int timeout_sec) {
     struct timespec ts;
     struct timeval tv;
-    int ret;
+    int ret = 0;
 
     gettimeofday(&tv, NULL);
     ts.tv_sec = tv.tv_sec + timeout_sec;
     ts.tv_nsec = tv.tv_usec * 1000;
 
-    pthread_mutex_lock(&lock_cmd);
-    ret = pthread_cond_timedwait(&signal_cond_cmd, &lock_cmd, &ts);
-    pthread_mutex_unlock(&lock_cmd);
+    pthread_mutex_lock(&device->lock_cmd);
+    while (!device->rsp_ready && ret == 0) {
+        ret = pthread_cond_timedwait(&device->signal_cond_cmd, &device->lock_cmd, &ts);
+    }
+    if (device->rsp_ready) ret = 0;
+    device->rsp_ready = false;
+    pthread_mutex_unlock(&device->lock_cmd);
 
     return ret; // 0 if signaled, ETIMEDOUT if timeout
 }
 
-static void cmd_release(void) {
-    pthread_mutex_lock(&lock_cmd);
-    pthread_cond_signal(&signal_cond_cmd);
-    pthread_mutex_unlock(&lock_cmd);
+static void cmd_release(VitureDevice *device, const uchar *rsp, size_t len) {
+    pthread_mutex_lock(&device->lock_cmd);
+    memcpy(device->mcu_rsp, rsp, len);
+    device->rsp_ready = true;
+    pthread_cond_signal(&device->signal_cond_cmd);
+    pthread_mutex_unlock(&device->lock_cmd);
 }
 
 
 // --- Thread Functions ---
-static void event_update(ushort event_id, uchar *data, ushort len, uint timestamp) {
+static void event_update(VitureDevice *device, ushort event_id, uchar *data, ushort len, uint timestamp) {
     // This function is called from mcu_thread for asynchronous events
     // fprintf(stderr, "MCU Event: ID=0x%04X, Len=%d, TS=%u\n", event_id, len, timestamp);
-    if (ext_mcu_event_callback) {
-        ext_mcu_event_callback(event_id, data, len, timestamp);
+    if (device->mcu_callback) {
+        double start = stats_now_us();
+        device->mcu_callback(device, event_id, data, len, timestamp, device->mcu_user);
+        stats_stream_callback(&device->mcu_stats, stats_now_us() - start);
     }
 }
 
-static void imu_update(uchar *data, ushort len, uint timestamp) {
+static void imu_update(VitureDevice *device, uchar *data, ushort len, uint timestamp) {
     // This function is called from imu_thread
-    if (ext_imu_data_callback) {
-        ext_imu_data_callback(data, len, timestamp);
+    if (device->imu_callback) {
+        double start = stats_now_us();
+        device->imu_callback(device, data, len, timestamp, device->imu_user);
+        stats_stream_callback(&device->imu_stats, stats_now_us() - start);
     }
 }
 
@@ -272,20 +457,22 @@ static void* mcu_thread(void *arg) {
     // uchar read_buf[0x100]; // Unused
     // int bytes_read_total = 0; // Unused
 
-    (void)arg; // Unused
+    VitureDevice *device = arg;
 
-    pthread_barrier_wait(&barrier_mcu);
+    pthread_barrier_wait(&device->barrier_mcu);
     fprintf(stderr, "MCU thread started\n");
 
-    while (mcu_thread_flag) {
+    while (device->mcu_thread_flag) {
         uchar hid_packet[0x40]; // Standard HID packet size
-        int res = hid_read_timeout(g_mcu_dev, hid_packet, sizeof(hid_packet), 1000); // 1 sec timeout
+        int res = hid_read_timeout(device->mcu_dev, hid_packet, sizeof(hid_packet), 1000); // 1 sec timeout
+        double arrival_us = stats_now_us();
 
         if (res < 0) {
-            fprintf(stderr, "MCU HID read error. Stopping thread.\n");
-            const wchar_t *err = hid_error(g_mcu_dev); // Add const
+            fprintf(stderr, "MCU HID read error. Stopping thread until the glasses reconnect.\n");
+            const wchar_t *err = hid_error(device->mcu_dev); // Add const
             if (err) fprintf(stderr, "HID Error: %ls\n", err);
-            mcu_thread_flag = false; // Signal to stop
+            device->mcu_thread_flag = false; // Signal to stop
+            connection_lost(device);
             break;
         }
         if (res == 0) { // Timeout
@@ -333,17 +520,22 @@ static void* mcu_thread(void *arg) {
             // Otherwise, it's an asynchronous event.
             ushort raw_cmd_id_in_header = *(ushort*)(hid_packet + 0xE);
 
+            // Only intact packets count for rate, jitter and the device timestamps, a corrupted
+            // timestamp would show up as a discontinuity. Responses are parsed again by cmd_exec.
+            enum ParseResult result = parse_rsp(hid_packet, res, parsed_data, &parsed_data_len, &parsed_cmd_id);
+            count_parse_result(&device->mcu_stats, result);
+            if (result == PARSE_OK) stats_stream_packet(&device->mcu_stats, arrival_us, timestamp_from_packet);
+
             if (raw_cmd_id_in_header == 0) { // Synchronous response for cmd_exec
-                size_t copy_len = (res > 0 && (size_t)res < sizeof(g_mcu_rsp)) ? (size_t)res : sizeof(g_mcu_rsp);
-                memcpy(g_mcu_rsp, hid_packet, copy_len);
-                cmd_release();
+                size_t copy_len = (res > 0 && (size_t)res < sizeof(device->mcu_rsp)) ? (size_t)res : sizeof(device->mcu_rsp);
+                cmd_release(device, hid_packet, copy_len);
             } else { // Asynchronous event
-                parse_rsp(hid_packet, res, parsed_data, &parsed_data_len, &parsed_cmd_id);
                  if (parsed_cmd_id != 0xFFFF) { // Check if parse_rsp had an error
-                    event_update(parsed_cmd_id, parsed_data, parsed_data_len, timestamp_from_packet);
+                    event_update(device, parsed_cmd_id, parsed_data, parsed_data_len, timestamp_from_packet);
                 }
             }
         } else {
+            count_parse_result(&device->mcu_stats, PARSE_MALFORMED);
             fprintf(stderr, "MCU Read: Invalid packet header\n");
         }
     }
@@ -352,20 +544,22 @@ static void* mcu_thread(void *arg) {
 }
 
 static void* imu_thread(void *arg) {
-    (void)arg; // Unused
+    VitureDevice *device = arg;
 
-    pthread_barrier_wait(&barrier_imu);
+    pthread_barrier_wait(&device->barrier_imu);
     fprintf(stderr, "IMU thread started\n");
 
-    while (imu_thread_flag) {
+    while (device->imu_thread_flag) {
         uchar hid_packet[0x40]; // Standard HID packet size
-        int res = hid_read_timeout(g_imu_dev, hid_packet, sizeof(hid_packet), 1000); // 1 sec timeout
+        int res = hid_read_timeout(device->imu_dev, hid_packet, sizeof(hid_packet), 1000); // 1 sec timeout
+        double arrival_us = stats_now_us();
 
         if (res < 0) {
-            fprintf(stderr, "IMU HID read error. Stopping thread.\n");
-            const wchar_t *err = hid_error(g_imu_dev); // Add const
+            fprintf(stderr, "IMU HID read error. Stopping thread until the glasses reconnect.\n");
+            const wchar_t *err = hid_error(device->imu_dev); // Add const
             if (err) fprintf(stderr, "HID Error: %ls\n", err);
-            imu_thread_flag = false; // Signal to stop
+            device->imu_thread_flag = false; // Signal to stop
+            connection_lost(device);
             break;
         }
         if (res == 0) { // Timeout
@@ -381,13 +575,18 @@ static void* imu_thread(void *arg) {
             uint timestamp_from_packet = 0;
             memcpy(&timestamp_from_packet, hid_packet + 6, sizeof(uint));
 
-            parse_rsp(hid_packet, res, imu_data_payload, &imu_data_len, &imu_cmd_id);
+            enum ParseResult result = parse_rsp(hid_packet, res, imu_data_payload, &imu_data_len, &imu_cmd_id);
+            count_parse_result(&device->imu_stats, result);
+            // Intact reports only, as on the MCU thread. One with a bad CRC still shows the stream is back.
+            if (result == PARSE_OK) stats_stream_packet(&device->imu_stats, arrival_us, timestamp_from_packet);
+            if (result != PARSE_MALFORMED) first_report_after_reconnect(device);
             if (imu_cmd_id != 0xFFFF) { // Check if parse_rsp had an error
                  // The cmd_id for IMU data is typically a fixed value indicating IMU report.
                  // e.g. if (imu_cmd_id == EXPECTED_IMU_DATA_CMD_ID)
-                imu_update(imu_data_payload, imu_data_len, timestamp_from_packet);
+                imu_update(device, imu_data_payload, imu_data_len, timestamp_from_packet);
             }
         } else {
+             count_parse_result(&device->imu_stats, PARSE_MALFORMED);
              fprintf(stderr, "IMU Read: Invalid packet header %02X %02X (expected FF FC)\n", hid_packet[0], hid_packet[1]);
         }
     }
@@ -396,9 +595,10 @@ static void* imu_thread(void *arg) {
 }
 
 // --- Core Command Execution ---
-// This function sends a command and waits for a response via g_mcu_rsp, filled by mcu_thread.
+// This function sends a command and waits for a response via mcu_rsp, filled by mcu_thread.
 // Returns status code from response payload (byte 0).
-static uint cmd_exec(hid_device *dev, ushort cmd_id, uchar *data, ushort data_len, uchar **rsp_data, ushort *rsp_data_len) {
+static uint cmd_exec(VitureDevice *device, ushort cmd_id, uchar *data, ushort data_len, uchar **rsp_data, ushort *rsp_data_len) {
+    hid_device *dev = device ? device->mcu_dev : NULL;
     if (dev == NULL) {
         fprintf(stderr, "cmd_exec: device is null for cmd 0x%04X\n", cmd_id);
         return 0xFFFFFFFD; // Error code like in decompiled SDK
@@ -416,6 +616,11 @@ static uint cmd_exec(hid_device *dev, ushort cmd_id, uchar *data, ushort data_le
     // This is a bit confusing. Let's assume cmd_build puts the correct cmd_id.
     // And mcu_thread's logic for distinguishing sync/async is correct.
 
+    // A response that arrived after an earlier command timed out must not answer this one
+    pthread_mutex_lock(&device->lock_cmd);
+    device->rsp_ready = false;
+    pthread_mutex_unlock(&device->lock_cmd);
+
     int bytes_written = hid_write(dev, cmd_buf, cmd_total_len);
     if (bytes_written < 0 || (ushort)bytes_written != cmd_total_len) { // Check for error (-1) and partial write
         fprintf(stderr, "cmd_exec: HID write failed for cmd 0x%04X. Wrote %d, expected %d\n", cmd_id, bytes_written, cmd_total_len);
@@ -424,20 +629,21 @@ static uint cmd_exec(hid_device *dev, ushort cmd_id, uchar *data, ushort data_le
         return 0xFFFFFFFF; // Error code
     }
 
-    if (cmd_wait(2) == ETIMEDOUT) { // 2 second timeout
+    if (cmd_wait(device, 2) == ETIMEDOUT) { // 2 second timeout
         fprintf(stderr, "cmd_exec: Timeout waiting for response for cmd 0x%04X\n", cmd_id);
-        // Check g_mcu_rsp anyway, as per decompiled code
-        // This part is tricky, as g_mcu_rsp might contain stale data or data for a different command
+        // Check mcu_rsp anyway, as per decompiled code
+        // This part is tricky, as mcu_rsp might contain stale data or data for a different command
         // For now, let's assume timeout means failure.
         return 0xFFFFFFFE; // Error code for timeout
     }
 
-    // Response is now in g_mcu_rsp
+    // Response is now in mcu_rsp
     uchar parsed_rsp_payload[0x40];
     ushort parsed_rsp_payload_len;
     ushort parsed_cmd_id; // This should be 0 if mcu_thread logic is right for sync responses
 
-    parse_rsp(g_mcu_rsp, sizeof(g_mcu_rsp), parsed_rsp_payload, &parsed_rsp_payload_len, &parsed_cmd_id);
+    // Counted in the statistics by mcu_thread already
+    parse_rsp(device->mcu_rsp, sizeof(device->mcu_rsp), parsed_rsp_payload, &parsed_rsp_payload_len, &parsed_cmd_id);
 
     // The decompiled cmd_exec checks if the *original* cmd_id matches the cmd_id in the response *payload*.
     // This is not standard. parse_rsp gets cmd_id from header (offset 0xE).
@@ -445,7 +651,7 @@ static uint cmd_exec(hid_device *dev, ushort cmd_id, uchar *data, ushort data_le
     // Then cmd_exec checks `if (param_2 == local_e8)`, where param_2 is original cmd_id, local_e8 is parsed_cmd_id.
     // This implies that responses to commands also carry the original command's ID in their header.
     // This contradicts the mcu_thread logic that cmd_id 0 in header means sync response.
-    // Let's stick to: mcu_thread puts response in g_mcu_rsp if header cmd_id is 0.
+    // Let's stick to: mcu_thread puts response in mcu_rsp if header cmd_id is 0.
     // Then parse_rsp will report cmd_id as 0.
     // The actual status of the command (e.g. success/failure of *set_imu*) is in the payload.
 
@@ -479,143 +685,507 @@ static uint cmd_exec(hid_device *dev, ushort cmd_id, uchar *data, ushort data_le
 
 
 // --- Start/Stop Threads ---
-static bool startReadMcu(void) {
-    if (g_mcu_dev == NULL) return false;
-    if (mcu_thread_flag) return true; // Already running
+static bool startReadMcu(VitureDevice *device) {
+    if (device->mcu_dev == NULL) return false;
+    if (device->mcu_thread_flag) return true; // Already running
 
-    pthread_barrier_init(&barrier_mcu, NULL, 2);
-    mcu_thread_flag = true;
-    if (pthread_create(&mcu_read_tid, NULL, mcu_thread, NULL) != 0) {
+    pthread_barrier_init(&device->barrier_mcu, NULL, 2);
+    device->mcu_thread_flag = true;
+    if (pthread_create(&device->mcu_read_tid, NULL, mcu_thread, device) != 0) {
         fprintf(stderr, "Error creating MCU monitor thread.\n");
-        mcu_thread_flag = false;
-        pthread_barrier_destroy(&barrier_mcu);
+        device->mcu_thread_flag = false;
+        pthread_barrier_destroy(&device->barrier_mcu);
         return false;
     }
-    pthread_barrier_wait(&barrier_mcu); // Wait for thread to start
+    pthread_barrier_wait(&device->barrier_mcu); // Wait for thread to start
     fprintf(stderr, "MCU monitor thread created successfully.\n");
     return true;
 }
 
-static void stopReadMcu(void) {
-    if (mcu_thread_flag) {
-        mcu_thread_flag = false;
-        if (mcu_read_tid != 0) { // Check if thread was actually created
-             pthread_join(mcu_read_tid, NULL);
-        }
-        mcu_read_tid = 0; // Reset thread ID
+static void stopReadMcu(VitureDevice *device) {
+    // The thread may have stopped on its own after a read error, it still has to be joined
+    device->mcu_thread_flag = false;
+    if (device->mcu_read_tid != 0) { // Check if thread was actually created
+        pthread_join(device->mcu_read_tid, NULL);
+        device->mcu_read_tid = 0; // Reset thread ID
         fprintf(stderr, "MCU Read thread stopped.\n");
     }
-    pthread_barrier_destroy(&barrier_mcu);
+    pthread_barrier_destroy(&device->barrier_mcu);
 }
 
-static bool startReadImu(void) {
-    if (g_imu_dev == NULL) return false;
-    if (imu_thread_flag) return true;
+static bool startReadImu(VitureDevice *device) {
+    if (device->imu_dev == NULL) return false;
+    if (device->imu_thread_flag) return true;
 
-    pthread_barrier_init(&barrier_imu, NULL, 2);
-    imu_thread_flag = true;
-    if (pthread_create(&imu_read_tid, NULL, imu_thread, NULL) != 0) {
+    pthread_barrier_init(&device->barrier_imu, NULL, 2);
+    device->imu_thread_flag = true;
+    if (pthread_create(&device->imu_read_tid, NULL, imu_thread, device) != 0) {
         fprintf(stderr, "Error creating IMU monitor thread.\n");
-        imu_thread_flag = false;
-        pthread_barrier_destroy(&barrier_imu);
+        device->imu_thread_flag = false;
+        pthread_barrier_destroy(&device->barrier_imu);
         return false;
     }
-    pthread_barrier_wait(&barrier_imu);
+    pthread_barrier_wait(&device->barrier_imu);
     fprintf(stderr, "IMU monitor thread created successfully.\n");
     return true;
 }
 
-static void stopReadImu(void) {
-    if (imu_thread_flag) {
-        imu_thread_flag = false;
-        if (imu_read_tid != 0) {
-            pthread_join(imu_read_tid, NULL);
-        }
-        imu_read_tid = 0;
+static void stopReadImu(VitureDevice *device) {
+    device->imu_thread_flag = false;
+    if (device->imu_read_tid != 0) {
+        pthread_join(device->imu_read_tid, NULL);
+        device->imu_read_tid = 0;
         fprintf(stderr, "IMU Read thread stopped.\n");
     }
-    pthread_barrier_destroy(&barrier_imu);
+    pthread_barrier_destroy(&device->barrier_imu);
 }
 
 // --- Native Init/Deinit ---
-bool native_mcu_init(void) {
-    if (g_mcu_dev) return true; // Already initialized
+static bool native_mcu_init(VitureDevice *device) {
+    if (device->mcu_dev) return true; // Already initialized
 
-    g_mcu_dev = open_hid_interface(mcu_hid_path);
-    if (g_mcu_dev == NULL) {
+    device->mcu_dev = open_hid_interface(device->mcu_hid_path);
+    if (device->mcu_dev == NULL) {
         fprintf(stderr, "native_mcu_init: Failed to open MCU HID device.\n");
         return false;
     }
 
-    pthread_mutex_init(&lock_cmd, NULL);
-    pthread_cond_init(&signal_cond_cmd, NULL);
+    pthread_mutex_init(&device->lock_cmd, NULL);
+    pthread_cond_init(&device->signal_cond_cmd, NULL);
 
-    if (!startReadMcu()) {
+    if (!startReadMcu(device)) {
         fprintf(stderr, "native_mcu_init: Failed to start MCU read thread.\n");
-        hid_close(g_mcu_dev);
-        g_mcu_dev = NULL;
-        pthread_mutex_destroy(&lock_cmd);
-        pthread_cond_destroy(&signal_cond_cmd);
+        hid_close(device->mcu_dev);
+        device->mcu_dev = NULL;
+        pthread_mutex_destroy(&device->lock_cmd);
+        pthread_cond_destroy(&device->signal_cond_cmd);
         return false;
     }
     fprintf(stderr, "Native MCU initialized.\n");
     return true;
 }
 
-void native_mcu_deinit(void) {
-    if (g_mcu_dev != NULL) {
-        stopReadMcu();
-        hid_close(g_mcu_dev);
-        g_mcu_dev = NULL;
-        pthread_mutex_destroy(&lock_cmd);
-        pthread_cond_destroy(&signal_cond_cmd);
+static void native_mcu_deinit(VitureDevice *device) {
+    if (device->mcu_dev != NULL) {
+        stopReadMcu(device);
+        hid_close(device->mcu_dev);
+        device->mcu_dev = NULL;
+        pthread_mutex_destroy(&device->lock_cmd);
+        pthread_cond_destroy(&device->signal_cond_cmd);
         fprintf(stderr, "Native MCU deinitialized.\n");
     }
 }
 
-bool native_imu_init(void) {
-    if (g_imu_dev) return true;
+static bool native_imu_init(VitureDevice *device) {
+    if (device->imu_dev) return true;
 
-    g_imu_dev = open_hid_interface(imu_hid_path);
-    if (g_imu_dev == NULL) {
+    device->imu_dev = open_hid_interface(device->imu_hid_path);
+    if (device->imu_dev == NULL) {
         fprintf(stderr, "native_imu_init: Failed to open IMU HID device.\n");
         return false;
     }
 
-    if (!startReadImu()) {
+    if (!startReadImu(device)) {
         fprintf(stderr, "native_imu_init: Failed to start IMU read thread.\n");
-        hid_close(g_imu_dev);
-        g_imu_dev = NULL;
+        hid_close(device->imu_dev);
+        device->imu_dev = NULL;
         return false;
     }
     fprintf(stderr, "Native IMU initialized.\n");
     return true;
 }
 
-void native_imu_deinit(void) {
-    if (g_imu_dev != NULL) {
-        stopReadImu();
-        hid_close(g_imu_dev);
-        g_imu_dev = NULL;
+static void native_imu_deinit(VitureDevice *device) {
+    if (device->imu_dev != NULL) {
+        stopReadImu(device);
+        hid_close(device->imu_dev);
+        device->imu_dev = NULL;
         fprintf(stderr, "Native IMU deinitialized.\n");
     }
 }
 
-// --- Public API ---
+// --- Hot-plug ---
+static void wake_hotplug(VitureDevice *device) {
+    uint64_t one = 1;
+    if (device->wake_fd >= 0 && write(device->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "Viture: failed to wake the hotplug thread: %s\n", strerror(errno));
+    }
+}
+
+// Called by a reader thread whose HID read failed, the thread stops afterwards
+static void connection_lost(VitureDevice *device) {
+    pthread_mutex_lock(&device->reconnect_lock);
+    if (device->connected) {
+        device->connected = false;
+        device->awaiting_first_report = false;
+        device->lost_us = stats_now_us();
+        device->appeared_us = 0.0;
+        fprintf(stderr, "Viture %s: connection lost, waiting for the glasses to reappear\n", device->serial);
+    }
+    pthread_mutex_unlock(&device->reconnect_lock);
+    wake_hotplug(device);
+}
+
+// Called for every IMU report, ends a pending reconnect
+static void first_report_after_reconnect(VitureDevice *device) {
+    pthread_mutex_lock(&device->reconnect_lock);
+    if (device->awaiting_first_report) {
+        device->awaiting_first_report = false;
+        double now = stats_now_us();
+        double reconnect_ms = (now - device->appeared_us) / 1000.0;
+        device->reconnects++;
+        device->last_reconnect_ms = reconnect_ms;
+        if (reconnect_ms > device->worst_reconnect_ms) device->worst_reconnect_ms = reconnect_ms;
+        fprintf(stderr, "Viture %s: IMU reports resumed %.1f ms after the glasses reappeared (%.1f s without a connection)\n",
+                device->serial, reconnect_ms, (now - device->lost_us) / 1000000.0);
+        if (reconnect_ms > RECONNECT_TARGET_MS) {
+            fprintf(stderr, "Viture %s: warning, the reconnect took longer than the %.0f ms target\n",
+                    device->serial, RECONNECT_TARGET_MS);
+        }
+    }
+    pthread_mutex_unlock(&device->reconnect_lock);
+}
+
+// Reopens the interfaces of the glasses if they are enumerated again: by serial number, the
+// HID paths change with the USB address. Glasses without a serial number take the first pair
+// no other open device uses.
+static bool reconnect(VitureDevice *device) {
+    VitureDeviceInfo infos[MAX_LISTED_DEVICES];
+    int count = find_devices(infos, MAX_LISTED_DEVICES);
+    if (count > MAX_LISTED_DEVICES) count = MAX_LISTED_DEVICES;
+
+    // Chosen and claimed in one go, two devices reconnecting at once can't pick the same pair
+    pthread_mutex_lock(&open_lock);
+    const VitureDeviceInfo *info = NULL;
+    for (int i = 0; i < count && !info; i++) {
+        if ((!device->serial[0] || strcmp(infos[i].serial, device->serial) == 0) &&
+            !claimed_by_other(&infos[i], device)) {
+            info = &infos[i];
+        }
+    }
+    if (info) {
+        free(device->mcu_hid_path);
+        free(device->imu_hid_path);
+        device->mcu_hid_path = strdup(info->mcu_path);
+        device->imu_hid_path = strdup(info->imu_path);
+    }
+    pthread_mutex_unlock(&open_lock);
+    if (!info) return false;
+
+    pthread_mutex_lock(&device->connection_lock);
+    native_imu_deinit(device); // Joins the reader threads that stopped
+    native_mcu_deinit(device);
+
+    // Without a udev event the glasses count as reappeared when they enumerate, unless
+    // they turn out not to be usable yet
+    pthread_mutex_lock(&device->reconnect_lock);
+    bool appeared_now = device->appeared_us == 0.0;
+    if (appeared_now) device->appeared_us = stats_now_us();
+    device->connected = true; // A read error from here on counts as a new loss
+    bool imu_enabled = device->imu_enabled;
+    device->awaiting_first_report = imu_enabled;
+    pthread_mutex_unlock(&device->reconnect_lock);
+
+    bool ok = native_mcu_init(device) && native_imu_init(device);
+    if (ok && imu_enabled) {
+        uchar enable = 1;
+        uint status = cmd_exec(device, 0x15, &enable, 1, NULL, NULL);
+        if (status != 0) {
+            fprintf(stderr, "Viture %s: enabling the IMU after reconnecting failed with code %u\n", device->serial, status);
+            ok = false;
+        }
+    }
+    if (!ok) {
+        native_imu_deinit(device);
+        native_mcu_deinit(device);
+        pthread_mutex_lock(&device->reconnect_lock);
+        device->connected = false;
+        device->awaiting_first_report = false;
+        if (appeared_now) device->appeared_us = 0.0;
+        pthread_mutex_unlock(&device->reconnect_lock);
+    }
+    pthread_mutex_unlock(&device->connection_lock);
+
+    if (ok) fprintf(stderr, "Viture %s: reconnected (MCU %s, IMU %s)\n", device->serial, device->mcu_hid_path, device->imu_hid_path);
+    return ok;
+}
+
+#ifdef WITH_UDEV
+// USB devices and hidraw nodes of any Viture glasses being added. The hidraw nodes appear
+// once the kernel bound the HID interfaces, which is when hidapi can open them.
+static struct udev_monitor *open_udev_monitor(struct udev *udev) {
+    struct udev_monitor *monitor = udev_monitor_new_from_netlink(udev, "udev");
+    if (!monitor) return NULL;
+    if (udev_monitor_filter_add_match_subsystem_devtype(monitor, "usb", "usb_device") < 0 ||
+        udev_monitor_filter_add_match_subsystem_devtype(monitor, "hidraw", NULL) < 0 ||
+        udev_monitor_enable_receiving(monitor) < 0) {
+        udev_monitor_unref(monitor);
+        return NULL;
+    }
+    return monitor;
+}
+
+static bool is_viture_added(struct udev_device *dev) {
+    const char *action = udev_device_get_action(dev);
+    if (!action || strcmp(action, "add") != 0) return false;
+
+    const char *devtype = udev_device_get_devtype(dev);
+    struct udev_device *usb = devtype && strcmp(devtype, "usb_device") == 0
+        ? dev : udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
+    const char *vendor = usb ? udev_device_get_sysattr_value(usb, "idVendor") : NULL;
+    return vendor && strtol(vendor, NULL, 16) == VITURE_VENDOR_ID;
+}
+
+// The reconnect time counts from the first event
+static void note_appeared(VitureDevice *device) {
+    pthread_mutex_lock(&device->reconnect_lock);
+    if (!device->connected && device->appeared_us == 0.0) {
+        device->appeared_us = stats_now_us();
+    }
+    pthread_mutex_unlock(&device->reconnect_lock);
+}
+
+// Returns true if any of the pending events announced Viture glasses
+static bool receive_udev_events(struct udev_monitor *monitor) {
+    bool appeared = false;
+    struct udev_device *dev;
+    while ((dev = udev_monitor_receive_device(monitor)) != NULL) {
+        if (is_viture_added(dev)) appeared = true;
+        udev_device_unref(dev);
+    }
+    return appeared;
+}
+#endif
+
+static void *hotplug_thread(void *arg) {
+    VitureDevice *device = arg;
+    struct pollfd fds[2] = {
+        { .fd = device->wake_fd, .events = POLLIN },
+        { .fd = -1, .events = POLLIN } // poll() skips negative descriptors
+    };
+#ifdef WITH_UDEV
+    struct udev *udev = udev_new();
+    struct udev_monitor *monitor = udev ? open_udev_monitor(udev) : NULL;
+    if (monitor) {
+        fds[1].fd = udev_monitor_get_fd(monitor);
+    } else {
+        fprintf(stderr, "Viture: no udev monitor, polling for reconnected glasses\n");
+    }
+#endif
+
+    double settle_until_us = 0.0;
+    while (device->hotplug_flag) {
+        pthread_mutex_lock(&device->reconnect_lock);
+        bool connected = device->connected;
+        pthread_mutex_unlock(&device->reconnect_lock);
+
+        int timeout = -1;
+        if (!connected) {
+            if (fds[1].fd < 0) {
+                timeout = RECONNECT_POLL_MS;
+            } else if (stats_now_us() < settle_until_us) {
+                timeout = RECONNECT_RETRY_MS;
+            } else {
+                timeout = RECONNECT_IDLE_POLL_MS;
+            }
+        }
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            fprintf(stderr, "Viture: hotplug poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(device->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) break;
+        }
+#ifdef WITH_UDEV
+        if (monitor && (fds[1].revents & POLLIN) && receive_udev_events(monitor)) {
+            note_appeared(device);
+            settle_until_us = stats_now_us() + RECONNECT_SETTLE_MS * 1000.0;
+        }
+#endif
+        if (!device->hotplug_flag) break;
+
+        pthread_mutex_lock(&device->reconnect_lock);
+        connected = device->connected;
+        pthread_mutex_unlock(&device->reconnect_lock);
+        if (!connected && reconnect(device)) settle_until_us = 0.0;
+    }
+
+#ifdef WITH_UDEV
+    if (monitor) udev_monitor_unref(monitor);
+    if (udev) udev_unref(udev);
+#endif
+    return NULL;
+}
+
+static bool start_hotplug(VitureDevice *device) {
+    device->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (device->wake_fd < 0) {
+        fprintf(stderr, "Viture: eventfd failed: %s\n", strerror(errno));
+        return false;
+    }
+    device->hotplug_flag = true;
+    if (pthread_create(&device->hotplug_tid, NULL, hotplug_thread, device) != 0) {
+        fprintf(stderr, "Error creating Viture hotplug thread.\n");
+        device->hotplug_flag = false;
+        device->hotplug_tid = 0;
+        return false;
+    }
+    return true;
+}
+
+static void stop_hotplug(VitureDevice *device) {
+    device->hotplug_flag = false;
+    if (device->hotplug_tid != 0) {
+        wake_hotplug(device);
+        pthread_join(device->hotplug_tid, NULL);
+        device->hotplug_tid = 0;
+    }
+    if (device->wake_fd >= 0) close(device->wake_fd);
+    device->wake_fd = -1;
+}
+
+// --- Per-device API ---
+int viture_enumerate(VitureDeviceInfo *devices, int max_devices) {
+    if (!hid_acquire()) return -1;
+    int count = find_devices(devices, devices ? max_devices : 0);
+    hid_release();
+    return count;
+}
+
+VitureDevice *viture_open(const char *selector) {
+    if (!hid_acquire()) return NULL;
+
+    VitureDeviceInfo infos[MAX_LISTED_DEVICES];
+    int count = find_devices(infos, MAX_LISTED_DEVICES);
+    if (count > MAX_LISTED_DEVICES) count = MAX_LISTED_DEVICES;
+
+    pthread_mutex_lock(&open_lock);
+    const VitureDeviceInfo *info = NULL;
+    for (int i = 0; i < count && !info; i++) {
+        if (device_matches(&infos[i], selector) && !claimed_by_other(&infos[i], NULL)) info = &infos[i];
+    }
+    if (!info) {
+        pthread_mutex_unlock(&open_lock);
+        if (count == 0) {
+            fprintf(stderr, "Viture glasses (VID: %04X, Interfaces: %d/%d) not found.\n", VITURE_VENDOR_ID, MCU_INTERFACE_NUMBER, IMU_INTERFACE_NUMBER);
+        } else {
+            fprintf(stderr, "Viture glasses '%s' not found, connected are:\n", selector);
+            for (int i = 0; i < count; i++) {
+                fprintf(stderr, "  serial '%s', MCU %s, IMU %s\n", infos[i].serial, infos[i].mcu_path, infos[i].imu_path);
+            }
+        }
+        hid_release();
+        return NULL;
+    }
+
+    VitureDevice *device = calloc(1, sizeof(VitureDevice));
+    if (!device) {
+        pthread_mutex_unlock(&open_lock);
+        hid_release();
+        return NULL;
+    }
+    pthread_mutex_init(&device->connection_lock, NULL);
+    pthread_mutex_init(&device->reconnect_lock, NULL);
+    device->wake_fd = -1;
+    snprintf(device->serial, sizeof(device->serial), "%s", info->serial);
+    device->mcu_hid_path = strdup(info->mcu_path);
+    device->imu_hid_path = strdup(info->imu_path);
+    device->next_open = open_devices;
+    open_devices = device;
+    pthread_mutex_unlock(&open_lock);
+    fprintf(stderr, "Found MCU HID device path: %s\n", device->mcu_hid_path);
+    fprintf(stderr, "Found IMU HID device path: %s\n", device->imu_hid_path);
+
+    // Tell the streams of several glasses apart in the statistics
+    if (device->serial[0]) {
+        snprintf(device->imu_stats_name, sizeof(device->imu_stats_name), "IMU %s", device->serial);
+        snprintf(device->mcu_stats_name, sizeof(device->mcu_stats_name), "MCU %s", device->serial);
+    } else {
+        snprintf(device->imu_stats_name, sizeof(device->imu_stats_name), "IMU");
+        snprintf(device->mcu_stats_name, sizeof(device->mcu_stats_name), "MCU");
+    }
+    stats_stream_init(&device->imu_stats, device->imu_stats_name, true);
+    stats_stream_init(&device->mcu_stats, device->mcu_stats_name, false);
+
+    if (!native_mcu_init(device)) {
+        fprintf(stderr, "Failed to initialize native MCU.\n");
+        viture_close(device);
+        return NULL;
+    }
+    if (!native_imu_init(device)) {
+        fprintf(stderr, "Failed to initialize native IMU.\n");
+        viture_close(device); // Cleans up the MCU as well
+        return NULL;
+    }
+    device->connected = true;
+    if (!start_hotplug(device)) {
+        fprintf(stderr, "Viture: the glasses will not be reconnected if they are unplugged.\n");
+    }
+    return device;
+}
+
+void viture_close(VitureDevice *device) {
+    if (!device) return;
+
+    stop_hotplug(device); // No reconnect can replace the handles from here on
+    native_imu_deinit(device);
+    native_mcu_deinit(device);
+    pthread_mutex_lock(&open_lock);
+    for (VitureDevice **d = &open_devices; *d; d = &(*d)->next_open) {
+        if (*d == device) {
+            *d = device->next_open;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&open_lock);
+    pthread_mutex_destroy(&device->connection_lock);
+    pthread_mutex_destroy(&device->reconnect_lock);
+
+    stats_stream_destroy(&device->imu_stats);
+    stats_stream_destroy(&device->mcu_stats);
+    free(device->mcu_hid_path);
+    free(device->imu_hid_path);
+    free(device);
+
+    hid_release();
+}
+
+const char *viture_device_serial(const VitureDevice *device) {
+    return device ? device->serial : "";
+}
+
+void viture_device_set_mcu_callback(VitureDevice *device, viture_device_mcu_callback_t callback, void *user) {
+    device->mcu_user = user;
+    device->mcu_callback = callback;
+}
+
+void viture_device_set_imu_callback(VitureDevice *device, viture_device_imu_callback_t callback, void *user) {
+    device->imu_user = user;
+    device->imu_callback = callback;
+}
+
 // Sends a command with a single byte of data.
-uint native_mcu_exec(ushort cmd_id, uchar data_byte) {
-    return cmd_exec(g_mcu_dev, cmd_id, &data_byte, 1, NULL, NULL);
+uint viture_device_mcu_exec(VitureDevice *device, ushort cmd_id, uchar data_byte) {
+    if (!device) return cmd_exec(NULL, cmd_id, &data_byte, 1, NULL, NULL);
+    pthread_mutex_lock(&device->connection_lock); // The handles stay while a reconnect is in progress
+    uint result = cmd_exec(device, cmd_id, &data_byte, 1, NULL, NULL);
+    pthread_mutex_unlock(&device->connection_lock);
+    return result;
 }
 
 // Command ID for set_imu is 0x15 from decompiled SDK
 // Data: 0 for off, 1 for on.
-uint set_imu(bool enable) {
-    if (!g_mcu_dev) {
+uint viture_device_set_imu(VitureDevice *device, bool enable) {
+    if (!device) {
         fprintf(stderr, "set_imu: MCU not initialized.\n");
         return 0xFFFFFFFD;
     }
+    pthread_mutex_lock(&device->reconnect_lock);
+    device->imu_enabled = enable; // Also while disconnected, for the reconnect
+    pthread_mutex_unlock(&device->reconnect_lock);
     fprintf(stderr, "Setting IMU to: %s\n", enable ? "ON" : "OFF");
-    uint result = native_mcu_exec(0x15, enable ? 1 : 0);
+    uint result = viture_device_mcu_exec(device, 0x15, enable ? 1 : 0);
     if (result == 0) { // Assuming 0 means success from command payload
         fprintf(stderr, "Set IMU %s successful.\n", enable ? "ON" : "OFF");
     } else {
@@ -624,87 +1194,89 @@ uint set_imu(bool enable) {
     return result;
 }
 
-void viture_set_mcu_event_callback(viture_mcu_event_callback_t callback) {
-    ext_mcu_event_callback = callback;
-}
+void viture_device_print_stats(VitureDevice *device, FILE *out) {
+    stats_stream_print(&device->imu_stats, out);
+    stats_stream_print(&device->mcu_stats, out);
 
-void viture_set_imu_data_callback(viture_imu_data_callback_t callback) {
-    ext_imu_data_callback = callback;
+    pthread_mutex_lock(&device->reconnect_lock);
+    if (!device->connected) {
+        fprintf(out, "Viture %s: disconnected for %.1f s\n", device->serial, (stats_now_us() - device->lost_us) / 1000000.0);
+    }
+    if (device->reconnects > 0) {
+        fprintf(out, "Viture %s: %llu reconnects, last %.1f ms, worst %.1f ms from reappearing to the first IMU report (target %.0f ms%s)\n",
+                device->serial, (unsigned long long)device->reconnects, device->last_reconnect_ms, device->worst_reconnect_ms,
+                RECONNECT_TARGET_MS, device->worst_reconnect_ms > RECONNECT_TARGET_MS ? ", exceeded" : "");
+    }
+    pthread_mutex_unlock(&device->reconnect_lock);
 }
 
-// Main Init/Deinit for the driver
-bool viture_driver_init(void) {
-    fprintf(stderr, "Initializing Viture driver...\n");
+// --- Default device API ---
+static void default_mcu_callback(VitureDevice *device, ushort event_id, uchar *data, ushort len, uint timestamp, void *user) {
+    (void)device; (void)user;
+    ext_mcu_event_callback(event_id, data, len, timestamp);
+}
 
-    if (hid_init() != 0) {
-        fprintf(stderr, "Failed to initialize HIDAPI.\n");
-        return false;
-    }
+static void default_imu_callback(VitureDevice *device, uchar *data, ushort len, uint timestamp, void *user) {
+    (void)device; (void)user;
+    ext_imu_data_callback(data, len, timestamp);
+}
 
-    fprintf(stderr, "HIDAPI initialized successfully.\n");
+uint native_mcu_exec(ushort cmd_id, uchar data_byte) {
+    return viture_device_mcu_exec(default_device, cmd_id, data_byte);
+}
 
-    init_crc_table();
+uint set_imu(bool enable) {
+    return viture_device_set_imu(default_device, enable);
+}
 
-    fprintf(stderr, "CRC table initialized.\n");
-    // Find HID device paths
-    // Free these paths in viture_driver_close
-    if (mcu_hid_path) free(mcu_hid_path);
-    if (imu_hid_path) free(imu_hid_path);
-    mcu_hid_path = find_hid_device_path(VITURE_VENDOR_ID, 0, MCU_INTERFACE_NUMBER); // PID 0 to match any
-    imu_hid_path = find_hid_device_path(VITURE_VENDOR_ID, 0, IMU_INTERFACE_NUMBER);
+void viture_set_mcu_event_callback(viture_mcu_event_callback_t callback) {
+    ext_mcu_event_callback = callback;
+    if (default_device) {
+        viture_device_set_mcu_callback(default_device, callback ? default_mcu_callback : NULL, NULL);
+    }
+}
 
-    if (!mcu_hid_path) {
-        fprintf(stderr, "MCU HID device (VID: %04X, Interface: %d) not found.\n", VITURE_VENDOR_ID, MCU_INTERFACE_NUMBER);
-        hid_exit();
-        return false;
+void viture_set_imu_data_callback(viture_imu_data_callback_t callback) {
+    ext_imu_data_callback = callback;
+    if (default_device) {
+        viture_device_set_imu_callback(default_device, callback ? default_imu_callback : NULL, NULL);
     }
-     fprintf(stderr, "Found MCU HID device path: %s\n", mcu_hid_path);
+}
 
-    if (!imu_hid_path) {
-        fprintf(stderr, "IMU HID device (VID: %04X, Interface: %d) not found.\n", VITURE_VENDOR_ID, IMU_INTERFACE_NUMBER);
-        if (mcu_hid_path) free(mcu_hid_path);
-        mcu_hid_path = NULL;
-        hid_exit();
-        return false;
+void viture_print_stats(FILE *out) {
+    if (!default_device) {
+        fprintf(out, "Viture: driver not initialized, no report statistics\n");
+        return;
     }
-    fprintf(stderr, "Found IMU HID device path: %s\n", imu_hid_path);
+    viture_device_print_stats(default_device, out);
+}
 
+// Main Init/Deinit for the driver
+bool viture_driver_open(const char *selector) {
+    fprintf(stderr, "Initializing Viture driver...\n");
 
-    if (!native_mcu_init()) {
-        fprintf(stderr, "Failed to initialize native MCU.\n");
-        if (mcu_hid_path) free(mcu_hid_path);
-        if (imu_hid_path) free(imu_hid_path);
-        mcu_hid_path = NULL; imu_hid_path = NULL;
-        hid_exit();
-        return false;
-    }
-    if (!native_imu_init()) {
-        fprintf(stderr, "Failed to initialize native IMU.\n");
-        native_mcu_deinit(); // Clean up MCU if IMU fails
-        if (mcu_hid_path) free(mcu_hid_path);
-        if (imu_hid_path) free(imu_hid_path);
-        mcu_hid_path = NULL; imu_hid_path = NULL;
-        hid_exit();
-        return false;
-    }
+    if (default_device) viture_driver_close();
+
+    default_device = viture_open(selector);
+    if (!default_device) return false;
+
+    viture_set_mcu_event_callback(ext_mcu_event_callback);
+    viture_set_imu_data_callback(ext_imu_data_callback);
 
     fprintf(stderr, "Viture driver initialized successfully.\n");
     return true;
 }
 
-void viture_driver_close(void) {
-    native_imu_deinit();
-    native_mcu_deinit();
+bool viture_driver_init(void) {
+    return viture_driver_open(NULL);
+}
 
-    if (mcu_hid_path) {
-        free(mcu_hid_path);
-        mcu_hid_path = NULL;
-    }
-    if (imu_hid_path) {
-        free(imu_hid_path);
-        imu_hid_path = NULL;
-    }
+VitureDevice *viture_driver_device(void) {
+    return default_device;
+}
 
-    hid_exit();
+void viture_driver_close(void) {
+    viture_close(default_device);
+    default_device = NULL;
     fprintf(stderr, "Viture driver closed.\n");
 }
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stdint.h> // For uint types used in callback
+#include <stdio.h>
 
 
 // Forward declare uchar, ushort, uint if they are not standard types in this header's context
@@ -17,13 +18,62 @@ typedef void (*viture_mcu_event_callback_t)(uint16_t event_id, unsigned char *da
 // Callback type for IMU data
 typedef void (*viture_imu_data_callback_t)(uint8_t *data, uint16_t len, uint32_t timestamp);
 
+// --- Per-device API ---
+// Every VitureDevice has its own HID handles, MCU and IMU reader threads, command channel,
+// callbacks and stream statistics, so one process can drive several glasses at once
+// without them contending for anything.
+// A device whose USB connection drops is reopened when it is plugged in again, matched by
+// serial number, or without one to the first glasses no other open device uses. The
+// callbacks stay registered and an enabled IMU stream is enabled again.
+typedef struct VitureDevice VitureDevice;
+
+typedef struct {
+    char serial[64];     // USB serial number, empty if the device reports none
+    char mcu_path[256];  // HID path of the MCU (command/event) interface
+    char imu_path[256];  // HID path of the IMU interface
+} VitureDeviceInfo;
+
+typedef void (*viture_device_mcu_callback_t)(VitureDevice *device, uint16_t event_id, uint8_t *data, uint16_t len, uint32_t timestamp, void *user);
+typedef void (*viture_device_imu_callback_t)(VitureDevice *device, uint8_t *data, uint16_t len, uint32_t timestamp, void *user);
+
+// Fills up to max_devices entries with the connected glasses. Returns how many were found,
+// which can be more than max_devices, or -1 if HIDAPI could not be initialized.
+int viture_enumerate(VitureDeviceInfo *devices, int max_devices);
+
+// Opens the glasses whose serial number or HID path (of either interface) is selector,
+// the first ones found if selector is NULL or empty. Glasses another VitureDevice has open
+// are skipped. Returns NULL on failure.
+VitureDevice *viture_open(const char *selector);
+void viture_close(VitureDevice *device);
+
+const char *viture_device_serial(const VitureDevice *device);
+
+// Callbacks run on the reader threads of the device. Set them before enabling the IMU.
+void viture_device_set_mcu_callback(VitureDevice *device, viture_device_mcu_callback_t callback, void *user);
+void viture_device_set_imu_callback(VitureDevice *device, viture_device_imu_callback_t callback, void *user);
+
+// Same as set_imu() and native_mcu_exec() below, for one device
+uint32_t viture_device_set_imu(VitureDevice *device, bool enable);
+uint32_t viture_device_mcu_exec(VitureDevice *device, uint16_t cmd_id, uint8_t data_byte);
+
+void viture_device_print_stats(VitureDevice *device, FILE *out);
+
+// --- Default device API ---
+// The functions below drive a single default device opened by viture_driver_init().
+
 // Initializes the Viture driver (HID communication, threads, etc.)
 // Returns true on success, false on failure.
 bool viture_driver_init(void);
 
+// Like viture_driver_init(), selecting the glasses as viture_open() does
+bool viture_driver_open(const char *selector);
+
 // Closes the Viture driver, cleans up resources.
 void viture_driver_close(void);
 
+// The default device, for the per-device API. NULL while the driver is closed.
+VitureDevice *viture_driver_device(void);
+
 // Enables or disables the IMU data stream.
 // Returns a status code from the device (0 typically means success).
 uint32_t set_imu(bool enable);
@@ -38,6 +88,11 @@ void viture_set_mcu_event_callback(viture_mcu_event_callback_t callback);
 // Registers a callback function to receive IMU data.
 void viture_set_imu_data_callback(viture_imu_data_callback_t callback);
 
+// Prints rate, jitter, CRC failures, malformed packets, device timestamp discontinuities
+// and callback duration of the IMU and MCU report streams. Safe to call while the driver runs,
+// the statistics are gone after viture_driver_close().
+void viture_print_stats(FILE *out);
+
 // Default IMU data handler that processes raw data into roll, pitch, yaw global variables.
 // This can be passed to viture_set_imu_data_callback if default processing is desired.
 void default_viture_imu_data_handler(uint8_t *data, uint16_t len, uint32_t timestamp);
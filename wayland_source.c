@@ -0,0 +1,784 @@
+/*  Wayland screen capture through ext-image-copy-capture-v1
+
+    Captures an output straight from the compositor (sway, Hyprland, any compositor with
+    ext-image-copy-capture-v1), without the portal and PipeWire in between. The session
+    tells which buffers it can write: with a renderer that imports dmabufs (the GLES build)
+    the compositor renders into GBM buffers that become textures once and are sampled as
+    they are, otherwise it copies into shared memory and the damaged area is copied on.
+
+    The compositor completes a capture only once the output was damaged and reports the
+    damage with the frame. Every buffer remembers what changed since it was last captured
+    into and passes that as damage_buffer, so the compositor only updates that part.
+    dmabufs rotate through WAYLAND_SOURCE_DMABUF_BUFFERS buffers: the renderer owns the
+    shown and the published one until it hands them back, the third is captured into.
+*/
+
+#define _GNU_SOURCE // For memfd_create
+
+#include "wayland_source.h"
+
+#include "dmabuf_import.h"
+#include "stats.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef WITH_WAYLAND
+#include <gbm.h>
+#include <wayland-client.h>
+#include "ext-image-capture-source-v1-client-protocol.h"
+#include "ext-image-copy-capture-v1-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#endif
+
+#ifdef WITH_WAYLAND
+
+#define MAX_OUTPUTS 8
+#define MAX_MODIFIERS 64
+// Roundtrips to wait for the first buffer constraints of a session
+#define CONSTRAINT_ROUNDTRIPS 10
+
+#define FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define DRM_FORMAT_XRGB8888 FOURCC('X', 'R', '2', '4')
+#define DRM_FORMAT_ARGB8888 FOURCC('A', 'R', '2', '4')
+#define DRM_FORMAT_XBGR8888 FOURCC('X', 'B', '2', '4')
+#define DRM_FORMAT_ABGR8888 FOURCC('A', 'B', '2', '4')
+
+typedef struct {
+    struct wl_buffer *wl_buffer;
+    bool busy;              // captured into, or owned by the renderer or the caller
+    FrameRect damage;       // changed on the output since it was last captured into
+    // Shared memory
+    unsigned char *data;
+    size_t size;
+    // dmabuf
+    struct gbm_bo *bo;
+    DmabufImport import;
+} CaptureBuffer;
+
+typedef struct {
+    struct wl_output *output;
+    char name[64];
+} OutputInfo;
+
+// One set of buffer constraints, sent by the session up to its done event
+typedef struct {
+    int width;
+    int height;
+    uint32_t shm_format;
+    int shm_rank;           // of the preferred format seen, 0 for none usable
+    dev_t dmabuf_device;
+    bool have_dmabuf_device;
+    uint32_t dmabuf_format;
+    int dmabuf_rank;
+    uint64_t modifiers[MAX_MODIFIERS];
+    int modifier_count;
+} Constraints;
+
+static struct wl_display *display = NULL;
+static struct wl_registry *registry = NULL;
+static struct wl_shm *shm = NULL;
+static struct zwp_linux_dmabuf_v1 *linux_dmabuf = NULL;
+static struct ext_output_image_capture_source_manager_v1 *source_manager = NULL;
+static struct ext_image_copy_capture_manager_v1 *copy_manager = NULL;
+static OutputInfo outputs[MAX_OUTPUTS];
+static int output_count = 0;
+
+static struct ext_image_capture_source_v1 *capture_source = NULL;
+static struct ext_image_copy_capture_session_v1 *session = NULL;
+static bool session_stopped = false;
+static bool connection_lost = false;
+
+static Constraints offered;             // being received
+static Constraints constraints;         // of the last done event
+static bool constraints_done = false;
+static bool constraints_changed = false;
+
+static bool dmabuf_requested = false;
+static bool use_dmabuf = false;         // of the current buffers
+static int drm_fd = -1;
+static struct gbm_device *gbm = NULL;
+
+static CaptureBuffer buffers[WAYLAND_SOURCE_DMABUF_BUFFERS];
+static int buffer_count = 0;
+static int buffer_generation = 0;       // in the handles the renderer holds, see buffer_handle()
+static int width = 0;
+static int height = 0;
+static GLenum gl_format = GL_BGRA;
+
+// The capture in flight
+static struct ext_image_copy_capture_frame_v1 *frame = NULL;
+static int frame_buffer = -1;
+static FrameRect frame_damage;
+static double frame_start_us = 0.0;
+static bool transform_warned = false;
+
+// The last completed capture
+static bool frame_ready = false;
+static int ready_buffer = -1;
+
+// Shared memory frames: what differs between the buffer and frame buffer slot 0/1
+static FrameRect slot_dirty[2];
+
+static uint64_t polls = 0;
+static uint64_t frames = 0;
+static uint64_t failed_frames = 0;
+static double damaged_pixels = 0.0;
+static StatsHistogram capture_time;
+
+static FrameRect output_rect(void) {
+    FrameRect r = {0, 0, width, height};
+    return r;
+}
+
+// The renderer holds buffers by handle, a handle of buffers freed since means nothing
+static int buffer_handle(int index) {
+    return buffer_generation * WAYLAND_SOURCE_DMABUF_BUFFERS + index;
+}
+
+static int buffer_from_handle(int handle) {
+    if (handle < 0 || handle / WAYLAND_SOURCE_DMABUF_BUFFERS != buffer_generation) return -1;
+    int index = handle % WAYLAND_SOURCE_DMABUF_BUFFERS;
+    return index < buffer_count ? index : -1;
+}
+
+// --- Protocol events ---
+
+static void output_geometry(void *data, struct wl_output *output, int32_t x, int32_t y, int32_t physical_width,
+                            int32_t physical_height, int32_t subpixel, const char *make, const char *model,
+                            int32_t transform) {
+    (void)data; (void)output; (void)x; (void)y; (void)physical_width; (void)physical_height;
+    (void)subpixel; (void)make; (void)model; (void)transform;
+}
+
+static void output_mode(void *data, struct wl_output *output, uint32_t flags, int32_t w, int32_t h, int32_t refresh) {
+    (void)data; (void)output; (void)flags; (void)w; (void)h; (void)refresh;
+}
+
+static void output_done(void *data, struct wl_output *output) {
+    (void)data; (void)output;
+}
+
+static void output_scale(void *data, struct wl_output *output, int32_t factor) {
+    (void)data; (void)output; (void)factor;
+}
+
+static void output_name(void *data, struct wl_output *output, const char *name) {
+    (void)output;
+    OutputInfo *info = data;
+    snprintf(info->name, sizeof(info->name), "%s", name);
+}
+
+static void output_description(void *data, struct wl_output *output, const char *description) {
+    (void)data; (void)output; (void)description;
+}
+
+static const struct wl_output_listener output_listener = {
+    .geometry = output_geometry,
+    .mode = output_mode,
+    .done = output_done,
+    .scale = output_scale,
+    .name = output_name,
+    .description = output_description,
+};
+
+static void registry_global(void *data, struct wl_registry *reg, uint32_t name, const char *interface, uint32_t version) {
+    (void)data;
+    if (strcmp(interface, wl_shm_interface.name) == 0) {
+        shm = wl_registry_bind(reg, name, &wl_shm_interface, 1);
+    } else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0 && version >= 2) {
+        linux_dmabuf = wl_registry_bind(reg, name, &zwp_linux_dmabuf_v1_interface, 3 < version ? 3 : version);
+    } else if (strcmp(interface, ext_output_image_capture_source_manager_v1_interface.name) == 0) {
+        source_manager = wl_registry_bind(reg, name, &ext_output_image_capture_source_manager_v1_interface, 1);
+    } else if (strcmp(interface, ext_image_copy_capture_manager_v1_interface.name) == 0) {
+        copy_manager = wl_registry_bind(reg, name, &ext_image_copy_capture_manager_v1_interface, 1);
+    } else if (strcmp(interface, wl_output_interface.name) == 0 && output_count < MAX_OUTPUTS) {
+        OutputInfo *info = &outputs[output_count++];
+        info->name[0] = '\0';
+        info->output = wl_registry_bind(reg, name, &wl_output_interface, 4 < version ? 4 : version);
+        wl_output_add_listener(info->output, &output_listener, info);
+    }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *reg, uint32_t name) {
+    (void)data; (void)reg; (void)name;
+}
+
+static const struct wl_registry_listener registry_listener = {
+    .global = registry_global,
+    .global_remove = registry_global_remove,
+};
+
+// Formats in order of preference, all 4 bytes per pixel. Returns 0 for the others.
+static int format_rank(uint32_t drm_format) {
+    switch (drm_format) {
+        case DRM_FORMAT_XRGB8888: return 4;
+        case DRM_FORMAT_ARGB8888: return 3;
+        case DRM_FORMAT_XBGR8888: return 2;
+        case DRM_FORMAT_ABGR8888: return 1;
+        default: return 0;
+    }
+}
+
+static void session_buffer_size(void *data, struct ext_image_copy_capture_session_v1 *s, uint32_t w, uint32_t h) {
+    (void)data; (void)s;
+    offered.width = (int)w;
+    offered.height = (int)h;
+}
+
+static void session_shm_format(void *data, struct ext_image_copy_capture_session_v1 *s, uint32_t format) {
+    (void)data; (void)s;
+    // wl_shm has its own codes for the two formats every compositor supports
+    uint32_t drm_format = format == WL_SHM_FORMAT_ARGB8888 ? DRM_FORMAT_ARGB8888 :
+                          format == WL_SHM_FORMAT_XRGB8888 ? DRM_FORMAT_XRGB8888 : format;
+    int rank = format_rank(drm_format);
+    if (rank > offered.shm_rank) {
+        offered.shm_rank = rank;
+        offered.shm_format = format;
+    }
+}
+
+static void session_dmabuf_device(void *data, struct ext_image_copy_capture_session_v1 *s, struct wl_array *device) {
+    (void)data; (void)s;
+    if (device->size == sizeof(dev_t)) {
+        memcpy(&offered.dmabuf_device, device->data, sizeof(dev_t));
+        offered.have_dmabuf_device = true;
+    }
+}
+
+static void session_dmabuf_format(void *data, struct ext_image_copy_capture_session_v1 *s, uint32_t format,
+                                  struct wl_array *modifiers) {
+    (void)data; (void)s;
+    int rank = format_rank(format);
+    if (rank <= offered.dmabuf_rank) return;
+    offered.dmabuf_rank = rank;
+    offered.dmabuf_format = format;
+    offered.modifier_count = 0;
+    const uint64_t *modifier;
+    wl_array_for_each(modifier, modifiers) {
+        if (offered.modifier_count < MAX_MODIFIERS) offered.modifiers[offered.modifier_count++] = *modifier;
+    }
+}
+
+static void session_done(void *data, struct ext_image_copy_capture_session_v1 *s) {
+    (void)data; (void)s;
+    constraints = offered;
+    memset(&offered, 0, sizeof(offered));
+    constraints_done = true;
+    constraints_changed = true;
+}
+
+static void session_stopped_event(void *data, struct ext_image_copy_capture_session_v1 *s) {
+    (void)data; (void)s;
+    fprintf(stderr, "Wayland capture: the compositor stopped the session (output gone?)\n");
+    session_stopped = true;
+}
+
+static const struct ext_image_copy_capture_session_v1_listener session_listener = {
+    .buffer_size = session_buffer_size,
+    .shm_format = session_shm_format,
+    .dmabuf_device = session_dmabuf_device,
+    .dmabuf_format = session_dmabuf_format,
+    .done = session_done,
+    .stopped = session_stopped_event,
+};
+
+static void frame_transform(void *data, struct ext_image_copy_capture_frame_v1 *f, uint32_t transform) {
+    (void)data; (void)f;
+    if (transform != WL_OUTPUT_TRANSFORM_NORMAL && !transform_warned) {
+        fprintf(stderr, "Wayland capture: the output is transformed (%u), frames are shown untransformed\n", transform);
+        transform_warned = true;
+    }
+}
+
+static void frame_damage_event(void *data, struct ext_image_copy_capture_frame_v1 *f,
+                               int32_t x, int32_t y, int32_t w, int32_t h) {
+    (void)data; (void)f;
+    FrameRect r = {x, y, w, h};
+    frame_damage = frame_rect_union(frame_damage, frame_rect_intersect(r, output_rect()));
+}
+
+static void frame_presentation_time(void *data, struct ext_image_copy_capture_frame_v1 *f,
+                                    uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec) {
+    (void)data; (void)f; (void)tv_sec_hi; (void)tv_sec_lo; (void)tv_nsec;
+}
+
+static void frame_ready_event(void *data, struct ext_image_copy_capture_frame_v1 *f) {
+    (void)data;
+    ext_image_copy_capture_frame_v1_destroy(f);
+    frame = NULL;
+    stats_histogram_add(&capture_time, stats_now_us() - frame_start_us);
+
+    for (int i = 0; i < buffer_count; i++) {
+        buffers[i].damage = i == frame_buffer ? (FrameRect){0, 0, 0, 0} : frame_rect_union(buffers[i].damage, frame_damage);
+    }
+    for (int i = 0; i < 2; i++) {
+        slot_dirty[i] = frame_rect_union(slot_dirty[i], frame_damage);
+    }
+    damaged_pixels += (double)frame_damage.width * frame_damage.height;
+    ready_buffer = frame_buffer; // Stays busy until released or copied
+    frame_buffer = -1;
+    frame_ready = true;
+    frames++;
+}
+
+static void frame_failed(void *data, struct ext_image_copy_capture_frame_v1 *f, uint32_t reason) {
+    (void)data;
+    ext_image_copy_capture_frame_v1_destroy(f);
+    frame = NULL;
+    if (frame_buffer >= 0) buffers[frame_buffer].busy = false;
+    frame_buffer = -1;
+    failed_frames++;
+    if (reason == EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED) {
+        session_stopped = true;
+    }
+    // With BUFFER_CONSTRAINTS new constraints follow, the buffers are replaced on their done
+}
+
+static const struct ext_image_copy_capture_frame_v1_listener frame_listener = {
+    .transform = frame_transform,
+    .damage = frame_damage_event,
+    .presentation_time = frame_presentation_time,
+    .ready = frame_ready_event,
+    .failed = frame_failed,
+};
+
+// --- Buffers ---
+
+static void destroy_buffers(void) {
+    for (int i = 0; i < buffer_count; i++) {
+        CaptureBuffer *b = &buffers[i];
+        if (b->wl_buffer) wl_buffer_destroy(b->wl_buffer);
+        if (b->data) munmap(b->data, b->size);
+        dmabuf_import_release(&b->import);
+        if (b->bo) gbm_bo_destroy(b->bo);
+        memset(b, 0, sizeof(*b));
+    }
+    buffer_count = 0;
+    buffer_generation++;
+    ready_buffer = -1;
+}
+
+// The DRM node the compositor allocates on, which is where the buffers have to come from
+static int open_drm_node(dev_t device) {
+    DIR *dir = opendir("/dev/dri");
+    if (!dir) return -1;
+    int fd = -1;
+    struct dirent *entry;
+    while (fd < 0 && (entry = readdir(dir)) != NULL) {
+        char path[300];
+        struct stat st;
+        snprintf(path, sizeof(path), "/dev/dri/%s", entry->d_name);
+        if (stat(path, &st) == 0 && S_ISCHR(st.st_mode) && st.st_rdev == device) {
+            fd = open(path, O_RDWR | O_CLOEXEC);
+        }
+    }
+    closedir(dir);
+    return fd;
+}
+
+static bool create_shm_buffer(CaptureBuffer *b) {
+    b->size = (size_t)width * height * 4;
+    int fd = memfd_create("wayland-capture", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, (off_t)b->size) != 0) {
+        perror("Wayland capture: memfd");
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    b->data = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (b->data == MAP_FAILED) {
+        b->data = NULL;
+        close(fd);
+        return false;
+    }
+    struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, (int32_t)b->size);
+    b->wl_buffer = wl_shm_pool_create_buffer(pool, 0, width, height, width * 4, constraints.shm_format);
+    wl_shm_pool_destroy(pool);
+    close(fd); // The request carries a duplicate
+    return b->wl_buffer != NULL;
+}
+
+static bool create_dmabuf_buffer(CaptureBuffer *b) {
+    // Layouts both the compositor can write and the renderer can sample
+    uint64_t importable[MAX_MODIFIERS];
+    int importable_count = dmabuf_import_modifiers(constraints.dmabuf_format, importable, MAX_MODIFIERS);
+    uint64_t usable[MAX_MODIFIERS];
+    int usable_count = 0;
+    bool implicit = false;
+    for (int i = 0; i < constraints.modifier_count; i++) {
+        if (constraints.modifiers[i] == DMABUF_IMPORT_MOD_INVALID) implicit = true;
+        for (int j = 0; j < importable_count; j++) {
+            if (constraints.modifiers[i] == importable[j]) usable[usable_count++] = importable[j];
+        }
+    }
+
+    uint64_t modifier = DMABUF_IMPORT_MOD_INVALID;
+    if (usable_count > 0) {
+        b->bo = gbm_bo_create_with_modifiers(gbm, width, height, constraints.dmabuf_format, usable, usable_count);
+        if (b->bo) modifier = gbm_bo_get_modifier(b->bo);
+    } else if (implicit) {
+        b->bo = gbm_bo_create(gbm, width, height, constraints.dmabuf_format, GBM_BO_USE_RENDERING);
+    }
+    if (!b->bo) return false;
+
+    int fd = gbm_bo_get_fd(b->bo);
+    if (fd < 0) return false;
+    DmabufDesc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.width = width;
+    desc.height = height;
+    desc.format = constraints.dmabuf_format;
+    desc.modifier = modifier;
+    desc.planes = gbm_bo_get_plane_count(b->bo);
+    if (desc.planes < 1 || desc.planes > DMABUF_IMPORT_MAX_PLANES) {
+        close(fd);
+        return false;
+    }
+
+    struct zwp_linux_buffer_params_v1 *params = zwp_linux_dmabuf_v1_create_params(linux_dmabuf);
+    for (int p = 0; p < desc.planes; p++) {
+        desc.fds[p] = fd;
+        desc.offsets[p] = gbm_bo_get_offset(b->bo, p);
+        desc.strides[p] = gbm_bo_get_stride_for_plane(b->bo, p);
+        zwp_linux_buffer_params_v1_add(params, fd, (uint32_t)p, desc.offsets[p], desc.strides[p],
+                                       (uint32_t)(modifier >> 32), (uint32_t)(modifier & 0xffffffff));
+    }
+    b->wl_buffer = zwp_linux_buffer_params_v1_create_immed(params, width, height, constraints.dmabuf_format, 0);
+    zwp_linux_buffer_params_v1_destroy(params);
+    bool imported = dmabuf_import_create(&desc, &b->import);
+    close(fd); // The request and the EGLImage hold their own references
+    return b->wl_buffer != NULL && imported;
+}
+
+static bool open_gbm(void) {
+    if (gbm) return true;
+    drm_fd = open_drm_node(constraints.dmabuf_device);
+    if (drm_fd < 0) {
+        fprintf(stderr, "Wayland capture: no DRM node for the compositor's dmabuf device\n");
+        return false;
+    }
+    gbm = gbm_create_device(drm_fd);
+    if (!gbm) {
+        close(drm_fd);
+        drm_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// (Re)creates the buffers for the current constraints, dmabufs if possible
+static bool allocate_buffers(void) {
+    destroy_buffers();
+    constraints_changed = false;
+    width = constraints.width;
+    height = constraints.height;
+    if (width <= 0 || height <= 0) return false;
+
+    use_dmabuf = dmabuf_requested && dmabuf_import_supported() && linux_dmabuf &&
+                 constraints.have_dmabuf_device && constraints.dmabuf_rank > 0 && open_gbm();
+    if (use_dmabuf) {
+        for (buffer_count = 0; buffer_count < WAYLAND_SOURCE_DMABUF_BUFFERS; buffer_count++) {
+            if (!create_dmabuf_buffer(&buffers[buffer_count])) break;
+        }
+        if (buffer_count < WAYLAND_SOURCE_DMABUF_BUFFERS) {
+            buffer_count++; // Free the half created one too
+            destroy_buffers();
+            fprintf(stderr, "Wayland capture: could not create importable dmabufs, using shared memory\n");
+            use_dmabuf = false;
+        }
+    }
+    if (!use_dmabuf) {
+        if (!shm || constraints.shm_rank == 0) {
+            fprintf(stderr, "Wayland capture: the compositor offers no usable buffer format\n");
+            return false;
+        }
+        buffer_count = 1;
+        if (!create_shm_buffer(&buffers[0])) {
+            destroy_buffers();
+            return false;
+        }
+    }
+    for (int i = 0; i < buffer_count; i++) {
+        buffers[i].damage = output_rect();
+    }
+    wayland_source_invalidate();
+
+    uint32_t format = use_dmabuf ? constraints.dmabuf_format : constraints.shm_format;
+    gl_format = format == DRM_FORMAT_XBGR8888 || format == DRM_FORMAT_ABGR8888 ? GL_RGBA : GL_BGRA;
+    printf("Wayland capture: %dx%d into %d %s buffer%s\n", width, height, buffer_count,
+           use_dmabuf ? "dmabuf" : "shared memory", buffer_count > 1 ? "s" : "");
+    return true;
+}
+
+static void start_capture(void) {
+    int index = -1;
+    for (int i = 0; i < buffer_count && index < 0; i++) {
+        if (!buffers[i].busy) index = i;
+    }
+    if (index < 0) return;
+
+    CaptureBuffer *b = &buffers[index];
+    b->busy = true;
+    frame_buffer = index;
+    frame_damage.width = frame_damage.height = 0;
+    frame = ext_image_copy_capture_session_v1_create_frame(session);
+    ext_image_copy_capture_frame_v1_add_listener(frame, &frame_listener, NULL);
+    ext_image_copy_capture_frame_v1_attach_buffer(frame, b->wl_buffer);
+    if (!frame_rect_empty(&b->damage)) {
+        ext_image_copy_capture_frame_v1_damage_buffer(frame, b->damage.x, b->damage.y, b->damage.width, b->damage.height);
+    }
+    ext_image_copy_capture_frame_v1_capture(frame);
+    frame_start_us = stats_now_us();
+}
+
+// Reads and dispatches whatever arrived, never blocks
+static void dispatch_events(void) {
+    while (wl_display_prepare_read(display) != 0) {
+        wl_display_dispatch_pending(display);
+    }
+    wl_display_flush(display);
+    struct pollfd pfd = { wl_display_get_fd(display), POLLIN, 0 };
+    if (poll(&pfd, 1, 0) > 0) {
+        wl_display_read_events(display);
+    } else {
+        wl_display_cancel_read(display);
+    }
+    wl_display_dispatch_pending(display);
+}
+
+bool wayland_source_init(const char *output_name, bool dmabuf) {
+    wayland_source_cleanup();
+
+    display = wl_display_connect(NULL);
+    if (!display) {
+        fprintf(stderr, "Wayland capture: cannot connect to the compositor (WAYLAND_DISPLAY not set?)\n");
+        return false;
+    }
+    registry = wl_display_get_registry(display);
+    wl_registry_add_listener(registry, &registry_listener, NULL);
+    wl_display_roundtrip(display); // Globals
+    wl_display_roundtrip(display); // Output names
+    if (!source_manager || !copy_manager) {
+        fprintf(stderr, "Wayland capture: the compositor lacks ext-image-copy-capture-v1\n");
+        wayland_source_cleanup();
+        return false;
+    }
+
+    OutputInfo *output = NULL;
+    for (int i = 0; i < output_count && !output; i++) {
+        if (!output_name || !output_name[0] || strcmp(outputs[i].name, output_name) == 0) output = &outputs[i];
+    }
+    if (!output) {
+        fprintf(stderr, "Wayland capture: output '%s' not found, outputs are:", output_name ? output_name : "");
+        for (int i = 0; i < output_count; i++) fprintf(stderr, " %s", outputs[i].name);
+        fprintf(stderr, "\n");
+        wayland_source_cleanup();
+        return false;
+    }
+
+    dmabuf_requested = dmabuf;
+    memset(&offered, 0, sizeof(offered));
+    capture_source = ext_output_image_capture_source_manager_v1_create_source(source_manager, output->output);
+    session = ext_image_copy_capture_manager_v1_create_session(copy_manager, capture_source,
+                                                               EXT_IMAGE_COPY_CAPTURE_MANAGER_V1_OPTIONS_PAINT_CURSORS);
+    ext_image_copy_capture_session_v1_add_listener(session, &session_listener, NULL);
+    for (int i = 0; i < CONSTRAINT_ROUNDTRIPS && !constraints_done && !session_stopped; i++) {
+        wl_display_roundtrip(display);
+    }
+    if (!constraints_done || !allocate_buffers()) {
+        fprintf(stderr, "Wayland capture: could not set up the capture session\n");
+        wayland_source_cleanup();
+        return false;
+    }
+
+    polls = frames = failed_frames = 0;
+    damaged_pixels = 0.0;
+    memset(&capture_time, 0, sizeof(capture_time));
+    printf("Wayland capture: Capturing output %s\n", output->name[0] ? output->name : "(unnamed)");
+    start_capture();
+    wl_display_flush(display);
+    return true;
+}
+
+void wayland_source_cleanup(void) {
+    if (!display) return;
+    if (frame) ext_image_copy_capture_frame_v1_destroy(frame);
+    frame = NULL;
+    frame_buffer = -1;
+    destroy_buffers();
+    if (session) ext_image_copy_capture_session_v1_destroy(session);
+    if (capture_source) ext_image_capture_source_v1_destroy(capture_source);
+    if (copy_manager) ext_image_copy_capture_manager_v1_destroy(copy_manager);
+    if (source_manager) ext_output_image_capture_source_manager_v1_destroy(source_manager);
+    if (linux_dmabuf) zwp_linux_dmabuf_v1_destroy(linux_dmabuf);
+    if (shm) wl_shm_destroy(shm);
+    for (int i = 0; i < output_count; i++) wl_output_destroy(outputs[i].output);
+    if (registry) wl_registry_destroy(registry);
+    wl_display_disconnect(display);
+    if (gbm) gbm_device_destroy(gbm);
+    if (drm_fd >= 0) close(drm_fd);
+
+    display = NULL;
+    registry = NULL;
+    shm = NULL;
+    linux_dmabuf = NULL;
+    source_manager = NULL;
+    copy_manager = NULL;
+    output_count = 0;
+    capture_source = NULL;
+    session = NULL;
+    gbm = NULL;
+    drm_fd = -1;
+    session_stopped = false;
+    connection_lost = false;
+    constraints_done = false;
+    constraints_changed = false;
+    frame_ready = false;
+    width = height = 0;
+}
+
+bool wayland_source_active(void) {
+    return display != NULL && !session_stopped && !connection_lost;
+}
+
+void wayland_source_size(int *w, int *h) {
+    *w = width;
+    *h = height;
+}
+
+GLenum wayland_source_gl_format(void) {
+    return gl_format;
+}
+
+bool wayland_source_dmabuf(void) {
+    return use_dmabuf;
+}
+
+bool wayland_source_poll(void) {
+    if (!display || connection_lost || session_stopped) return false;
+    polls++;
+    dispatch_events();
+    if (wl_display_get_error(display)) {
+        fprintf(stderr, "Wayland capture: lost the connection to the compositor\n");
+        connection_lost = true;
+        return false;
+    }
+    if (constraints_changed && !frame && !frame_ready) {
+        if (!allocate_buffers()) {
+            session_stopped = true;
+            return false;
+        }
+    }
+    // A dmabuf capture can go on right away, the single shared memory buffer is busy until copied
+    if (!frame && !constraints_changed) {
+        start_capture();
+        wl_display_flush(display);
+    }
+    if (frame_ready) {
+        frame_ready = false;
+        return true;
+    }
+    return false;
+}
+
+int wayland_source_frame_buffer(void) {
+    return ready_buffer >= 0 ? buffer_handle(ready_buffer) : -1;
+}
+
+void wayland_source_release(int handle) {
+    int index = buffer_from_handle(handle);
+    if (index >= 0) buffers[index].busy = false;
+}
+
+GLuint wayland_source_texture(int handle) {
+    int index = buffer_from_handle(handle);
+    return index >= 0 ? dmabuf_import_texture(&buffers[index].import) : 0;
+}
+
+const unsigned char *wayland_source_image(int *stride) {
+    if (use_dmabuf || ready_buffer < 0) {
+        *stride = 0;
+        return NULL;
+    }
+    *stride = width * 4;
+    return buffers[ready_buffer].data;
+}
+
+void wayland_source_copy(unsigned char *dst, int slot, const FrameRect *region) {
+    if (use_dmabuf || ready_buffer < 0) return;
+    const unsigned char *src = buffers[ready_buffer].data;
+    int stride = width * 4;
+    if (region->x == 0 && region->y == 0 && region->width == width && region->height == height) {
+        FrameRect dirty = frame_rect_intersect(slot_dirty[slot], output_rect());
+        for (int y = dirty.y; y < dirty.y + dirty.height; y++) {
+            size_t offset = (size_t)y * stride + (size_t)dirty.x * 4;
+            memcpy(dst + offset, src + offset, (size_t)dirty.width * 4);
+        }
+        slot_dirty[slot].width = slot_dirty[slot].height = 0;
+    } else {
+        // A cropped frame has another layout, the next full frame rewrites everything
+        copy_frame_region(src, stride, dst, 4, region);
+        slot_dirty[slot] = output_rect();
+    }
+    buffers[ready_buffer].busy = false;
+    ready_buffer = -1;
+}
+
+void wayland_source_invalidate(void) {
+    slot_dirty[0] = slot_dirty[1] = output_rect();
+}
+
+void wayland_source_print_stats(FILE *out) {
+    if (!display) return;
+    fprintf(out, "Wayland capture: %s, %llu polls, %llu frames, %llu failed, %.1f%% of the output damaged per frame\n",
+            use_dmabuf ? "dmabuf" : "shared memory", (unsigned long long)polls, (unsigned long long)frames,
+            (unsigned long long)failed_frames,
+            frames && width && height ? 100.0 * damaged_pixels / ((double)frames * width * height) : 0.0);
+    stats_histogram_print(&capture_time, "Wayland capture request to ready", out);
+}
+
+#else // WITH_WAYLAND
+
+bool wayland_source_init(const char *output_name, bool use_dmabuf) {
+    (void)output_name;
+    (void)use_dmabuf;
+    fprintf(stderr, "Wayland capture: built without Wayland, rebuild with the wayland-client, wayland-protocols and gbm development packages installed\n");
+    return false;
+}
+
+void wayland_source_cleanup(void) {}
+bool wayland_source_active(void) { return false; }
+
+void wayland_source_size(int *width, int *height) {
+    *width = 0;
+    *height = 0;
+}
+
+GLenum wayland_source_gl_format(void) { return GL_BGRA; }
+bool wayland_source_dmabuf(void) { return false; }
+bool wayland_source_poll(void) { return false; }
+int wayland_source_frame_buffer(void) { return -1; }
+void wayland_source_release(int buffer) { (void)buffer; }
+GLuint wayland_source_texture(int buffer) { (void)buffer; return 0; }
+
+const unsigned char *wayland_source_image(int *stride) {
+    *stride = 0;
+    return NULL;
+}
+
+void wayland_source_copy(unsigned char *dst, int slot, const FrameRect *region) {
+    (void)dst;
+    (void)slot;
+    (void)region;
+}
+
+void wayland_source_invalidate(void) {}
+void wayland_source_print_stats(FILE *out) { (void)out; }
+
+#endif // WITH_WAYLAND
@@ -0,0 +1,59 @@
+#ifndef WAYLAND_SOURCE_H
+#define WAYLAND_SOURCE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "gl_utility.h"
+#include "utility.h"
+
+// Buffers the compositor captures into when they are dmabufs: one on screen, one
+// published and waiting for the renderer, one being captured
+#define WAYLAND_SOURCE_DMABUF_BUFFERS 3
+
+// Connects to the Wayland compositor ($WAYLAND_DISPLAY) and starts an
+// ext-image-copy-capture-v1 session of the output with the given name (NULL or "" takes the
+// first one). With use_dmabuf the compositor writes into GBM buffers the renderer samples
+// directly (needs dmabuf_import_supported()), otherwise into shared memory that is copied.
+// Needs a build with Wayland (see the Makefile).
+bool wayland_source_init(const char *output_name, bool use_dmabuf);
+void wayland_source_cleanup(void);
+bool wayland_source_active(void);
+
+// Size of the output in pixels
+void wayland_source_size(int *width, int *height);
+
+// Upload format of the shared memory frames, GL_BGRA or GL_RGBA (4 bytes per pixel)
+GLenum wayland_source_gl_format(void);
+
+// True if the frames are dmabufs, see wayland_source_frame_buffer()
+bool wayland_source_dmabuf(void);
+
+// Dispatches the compositor's events without blocking and starts the next capture when a
+// buffer is free. Returns true when a new frame is ready. The compositor only finishes a
+// capture once the output was damaged, an unchanged screen produces no frames.
+bool wayland_source_poll(void);
+
+// dmabuf frames: the buffer of the frame wayland_source_poll() reported. It belongs to the
+// renderer until handed back with wayland_source_release().
+int wayland_source_frame_buffer(void);
+void wayland_source_release(int buffer);
+
+// The texture sampling a dmabuf buffer, 0 if it can't be imported. GL thread only.
+GLuint wayland_source_texture(int buffer);
+
+// Shared memory frames: copies region of the ready frame into dst, packed with
+// region->width * 4 bytes per row, and frees the buffer for the next capture. slot (0 or 1)
+// names the destination buffer, for a full frame region only the area damaged since the
+// last copy into that slot is copied.
+void wayland_source_copy(unsigned char *dst, int slot, const FrameRect *region);
+
+// The ready shared memory frame (stride bytes per row) for analysis, NULL for dmabufs
+const unsigned char *wayland_source_image(int *stride);
+
+// The next copy into each slot copies the whole region, e.g. after the buffers were reallocated
+void wayland_source_invalidate(void);
+
+void wayland_source_print_stats(FILE *out);
+
+#endif // WAYLAND_SOURCE_H
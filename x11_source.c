@@ -0,0 +1,475 @@
+/*  X11 screen capture through MIT-SHM
+
+    The root window is read with XShmGetImage into a shared memory image that lives as long
+    as the screen size does, so a frame costs no allocation and no copy through the socket.
+    With the DAMAGE extension only the rows of the damaged rectangles are fetched, and a
+    poll without damage (and without pointer movement) produces no frame at all.
+
+    X leaves the pointer out of the image. XFixes reports when its shape changes, the
+    position is queried on every poll, and the pointer is blended into the frame buffers
+    only, the shared memory image stays a clean copy of the screen. Every frame buffer slot
+    remembers what changed since it was last written, so a copy into it only touches the
+    damaged area and the previous pointer position.
+*/
+
+#include "x11_source.h"
+
+#include "stats.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WITH_X11
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#endif
+
+#ifdef WITH_X11
+
+static Display *display = NULL;
+static Window root;
+static XImage *image = NULL;
+static XShmSegmentInfo shm_info;
+static int width = 0;
+static int height = 0;
+static bool resize_pending = false;
+static bool full_grab_pending = true;
+
+// DAMAGE tracking, needs XFixes for the region too
+static bool have_damage = false;
+static int damage_event_base;
+static Damage damage = None;
+static XserverRegion damage_region = None;
+static bool damage_pending = false;
+
+// The pointer
+static bool have_fixes = false;
+static int fixes_event_base;
+static bool draw_cursor = false;
+static bool cursor_changed = false;
+static uint32_t *cursor_pixels = NULL;  // premultiplied ARGB
+static int cursor_width = 0;
+static int cursor_height = 0;
+static int cursor_xhot = 0;
+static int cursor_yhot = 0;
+static int cursor_x = -1;               // root coordinates of the hotspot, -1 off this screen
+static int cursor_y = -1;
+
+// What differs between the image and frame buffer slot 0/1
+static FrameRect slot_dirty[2];
+
+// Errors of the requests made while grabbing, the default handler would exit
+static bool x_error = false;
+
+static uint64_t polls = 0;
+static uint64_t frames = 0;
+static uint64_t pointer_only_frames = 0;
+static double fetched_rows = 0.0;
+static StatsHistogram fetch_time;
+
+static FrameRect screen_rect(void) {
+    FrameRect r = {0, 0, width, height};
+    return r;
+}
+
+static int record_x_error(Display *dpy, XErrorEvent *event) {
+    (void)dpy;
+    (void)event;
+    x_error = true;
+    return 0;
+}
+
+static void destroy_image(void) {
+    if (!image) return;
+    XShmDetach(display, &shm_info);
+    XSync(display, False);
+    XDestroyImage(image); // The data is the segment, it is not freed here
+    shmdt(shm_info.shmaddr);
+    image = NULL;
+}
+
+static bool create_image(void) {
+    XWindowAttributes attr;
+    if (!XGetWindowAttributes(display, root, &attr)) {
+        fprintf(stderr, "X11: cannot query the root window\n");
+        return false;
+    }
+    width = attr.width;
+    height = attr.height;
+
+    image = XShmCreateImage(display, attr.visual, attr.depth, ZPixmap, NULL, &shm_info, width, height);
+    if (!image) {
+        fprintf(stderr, "X11: XShmCreateImage failed for %dx%d\n", width, height);
+        return false;
+    }
+    if (image->bits_per_pixel != 32 || image->byte_order != LSBFirst ||
+        image->red_mask != 0xff0000 || image->green_mask != 0xff00 || image->blue_mask != 0xff) {
+        fprintf(stderr, "X11: unsupported root window format (depth %d, %d bpp), only 24 bit BGRx is handled\n",
+                attr.depth, image->bits_per_pixel);
+        XDestroyImage(image);
+        image = NULL;
+        return false;
+    }
+
+    shm_info.shmid = shmget(IPC_PRIVATE, (size_t)image->bytes_per_line * height, IPC_CREAT | 0600);
+    if (shm_info.shmid < 0) {
+        perror("X11: shmget");
+        XDestroyImage(image);
+        image = NULL;
+        return false;
+    }
+    shm_info.shmaddr = image->data = shmat(shm_info.shmid, NULL, 0);
+    shm_info.readOnly = False;
+    if (shm_info.shmaddr == (char *)-1) {
+        perror("X11: shmat");
+        shmctl(shm_info.shmid, IPC_RMID, NULL);
+        XDestroyImage(image);
+        image = NULL;
+        return false;
+    }
+
+    // A remote server can't attach the segment, that only shows up as an error
+    x_error = false;
+    XErrorHandler previous = XSetErrorHandler(record_x_error);
+    Status attached = XShmAttach(display, &shm_info);
+    XSync(display, False);
+    XSetErrorHandler(previous);
+    // Marked for removal now, it goes away once both sides detached
+    shmctl(shm_info.shmid, IPC_RMID, NULL);
+    if (!attached || x_error) {
+        fprintf(stderr, "X11: the server cannot attach the shared memory segment (remote display?)\n");
+        XDestroyImage(image);
+        shmdt(shm_info.shmaddr);
+        image = NULL;
+        return false;
+    }
+    return true;
+}
+
+static void fetch_cursor_image(void) {
+    XFixesCursorImage *cursor = XFixesGetCursorImage(display);
+    if (!cursor) return;
+    size_t count = (size_t)cursor->width * cursor->height;
+    uint32_t *pixels = realloc(cursor_pixels, count * sizeof(uint32_t));
+    if (pixels) {
+        // XFixes hands out one pixel per unsigned long, 64 bit on most hosts
+        for (size_t i = 0; i < count; i++) pixels[i] = (uint32_t)cursor->pixels[i];
+        cursor_pixels = pixels;
+        cursor_width = cursor->width;
+        cursor_height = cursor->height;
+        cursor_xhot = cursor->xhot;
+        cursor_yhot = cursor->yhot;
+    }
+    XFree(cursor);
+}
+
+static void process_events(void) {
+    while (XPending(display)) {
+        XEvent event;
+        XNextEvent(display, &event);
+        if (have_damage && event.type == damage_event_base + XDamageNotify) {
+            damage_pending = true;
+        } else if (have_fixes && event.type == fixes_event_base + XFixesCursorNotify) {
+            cursor_changed = true;
+        } else if (event.type == ConfigureNotify && event.xconfigure.window == root &&
+                   (event.xconfigure.width != width || event.xconfigure.height != height)) {
+            resize_pending = true;
+        }
+    }
+}
+
+// Returns true if the pointer moved or changed its shape
+static bool update_pointer(void) {
+    bool changed = false;
+    if (cursor_changed) {
+        fetch_cursor_image();
+        cursor_changed = false;
+        changed = true;
+    }
+    Window root_return, child;
+    int x, y, win_x, win_y;
+    unsigned int mask;
+    if (!XQueryPointer(display, root, &root_return, &child, &x, &y, &win_x, &win_y, &mask)) {
+        x = y = -1; // On another screen
+    }
+    if (x != cursor_x || y != cursor_y) {
+        cursor_x = x;
+        cursor_y = y;
+        changed = true;
+    }
+    return changed;
+}
+
+// Reads rows y .. y + rows - 1 into the same rows of the image
+static void fetch_rows(int y, int rows) {
+    XImage band = *image;
+    band.height = rows;
+    band.data = image->data + (size_t)y * image->bytes_per_line;
+    if (!XShmGetImage(display, root, &band, 0, y, AllPlanes)) {
+        x_error = true;
+    }
+    fetched_rows += rows;
+}
+
+// Fetches the damaged rows, merging rectangles that share rows into one request.
+// Returns the bounding box of the damage.
+static FrameRect fetch_damage(void) {
+    FrameRect damaged = {0, 0, 0, 0};
+    XDamageSubtract(display, damage, None, damage_region);
+
+    int count = 0;
+    XRectangle bounds;
+    XRectangle *rects = XFixesFetchRegionAndBounds(display, damage_region, &count, &bounds);
+    int band_y = 0;
+    int band_end = -1;
+    for (int i = 0; i < count; i++) {
+        FrameRect r = {rects[i].x, rects[i].y, rects[i].width, rects[i].height};
+        r = frame_rect_intersect(r, screen_rect());
+        if (frame_rect_empty(&r)) continue;
+        damaged = frame_rect_union(damaged, r);
+        if (band_end >= 0 && r.y <= band_end) {
+            if (r.y + r.height > band_end) band_end = r.y + r.height;
+            continue;
+        }
+        if (band_end >= 0) fetch_rows(band_y, band_end - band_y);
+        band_y = r.y;
+        band_end = r.y + r.height;
+    }
+    if (band_end >= 0) fetch_rows(band_y, band_end - band_y);
+    if (rects) XFree(rects);
+    return damaged;
+}
+
+bool x11_source_init(const char *display_name, bool with_cursor) {
+    x11_source_cleanup();
+
+    display = XOpenDisplay(display_name && display_name[0] ? display_name : NULL);
+    if (!display) {
+        fprintf(stderr, "X11: cannot open display %s\n", XDisplayName(display_name && display_name[0] ? display_name : NULL));
+        return false;
+    }
+    if (!XShmQueryExtension(display)) {
+        fprintf(stderr, "X11: display %s has no MIT-SHM extension\n", DisplayString(display));
+        x11_source_cleanup();
+        return false;
+    }
+    root = DefaultRootWindow(display);
+    if (!create_image()) {
+        x11_source_cleanup();
+        return false;
+    }
+    XSelectInput(display, root, StructureNotifyMask);
+
+    int error_base, major, minor;
+    have_fixes = XFixesQueryExtension(display, &fixes_event_base, &error_base) &&
+                 XFixesQueryVersion(display, &major, &minor) && major >= 2;
+    have_damage = have_fixes && XDamageQueryExtension(display, &damage_event_base, &error_base) &&
+                  XDamageQueryVersion(display, &major, &minor);
+    if (have_damage) {
+        damage = XDamageCreate(display, root, XDamageReportNonEmpty);
+        damage_region = XFixesCreateRegion(display, NULL, 0);
+    }
+    draw_cursor = with_cursor && have_fixes;
+    if (draw_cursor) {
+        XFixesSelectCursorInput(display, root, XFixesDisplayCursorNotifyMask);
+        cursor_changed = true;
+    }
+
+    full_grab_pending = true;
+    damage_pending = false;
+    resize_pending = false;
+    cursor_x = cursor_y = -1;
+    x11_source_invalidate();
+    polls = frames = pointer_only_frames = 0;
+    fetched_rows = 0.0;
+    memset(&fetch_time, 0, sizeof(fetch_time));
+
+    printf("X11: Capturing %dx%d from %s through MIT-SHM, %s, %s\n", width, height, DisplayString(display),
+           have_damage ? "fetching damaged rows" : "fetching every frame (no DAMAGE extension)",
+           draw_cursor ? "with the pointer" : "without the pointer");
+    return true;
+}
+
+void x11_source_cleanup(void) {
+    if (!display) return;
+    if (damage != None) XDamageDestroy(display, damage);
+    if (damage_region != None) XFixesDestroyRegion(display, damage_region);
+    damage = None;
+    damage_region = None;
+    destroy_image();
+    XCloseDisplay(display);
+    display = NULL;
+    free(cursor_pixels);
+    cursor_pixels = NULL;
+    cursor_width = cursor_height = 0;
+}
+
+bool x11_source_active(void) {
+    return display != NULL && image != NULL;
+}
+
+void x11_source_size(int *w, int *h) {
+    *w = width;
+    *h = height;
+}
+
+bool x11_source_grab(void) {
+    if (!display) return false;
+    polls++;
+    process_events();
+
+    if (resize_pending) {
+        resize_pending = false;
+        destroy_image();
+        if (!create_image()) {
+            fprintf(stderr, "X11: cannot capture the resized screen\n");
+            return false;
+        }
+        printf("X11: Screen resized to %dx%d\n", width, height);
+        full_grab_pending = true;
+        x11_source_invalidate();
+    }
+    if (!image) return false;
+
+    bool pointer_changed = draw_cursor && update_pointer();
+
+    double start = stats_now_us();
+    FrameRect damaged = {0, 0, 0, 0};
+    x_error = false;
+    XErrorHandler previous = XSetErrorHandler(record_x_error);
+    if (full_grab_pending || !have_damage) {
+        // Whatever was damaged so far is part of this grab
+        if (have_damage) XDamageSubtract(display, damage, None, None);
+        damage_pending = false;
+        fetch_rows(0, height);
+        damaged = screen_rect();
+        full_grab_pending = false;
+    } else if (damage_pending) {
+        damage_pending = false;
+        damaged = fetch_damage();
+    }
+    XSync(display, False);
+    XSetErrorHandler(previous);
+    if (!frame_rect_empty(&damaged)) stats_histogram_add(&fetch_time, stats_now_us() - start);
+
+    if (x_error) {
+        // Most likely the screen shrank under the request, the ConfigureNotify follows
+        full_grab_pending = true;
+        resize_pending = true;
+        return false;
+    }
+    if (frame_rect_empty(&damaged) && !pointer_changed) return false;
+
+    for (int i = 0; i < 2; i++) {
+        slot_dirty[i] = frame_rect_union(slot_dirty[i], damaged);
+    }
+    frames++;
+    if (frame_rect_empty(&damaged)) pointer_only_frames++;
+    return true;
+}
+
+const unsigned char *x11_source_image(int *stride) {
+    *stride = image ? image->bytes_per_line : 0;
+    return image ? (const unsigned char *)image->data : NULL;
+}
+
+// Blends the pointer into dst, which holds region of the screen packed. Returns the
+// part of the screen it covered.
+static FrameRect blend_pointer(unsigned char *dst, const FrameRect *region) {
+    FrameRect covered = {0, 0, 0, 0};
+    if (!cursor_pixels || cursor_x < 0) return covered;
+    FrameRect pointer = {cursor_x - cursor_xhot, cursor_y - cursor_yhot, cursor_width, cursor_height};
+    covered = frame_rect_intersect(pointer, *region);
+    for (int y = covered.y; y < covered.y + covered.height; y++) {
+        const uint32_t *src = cursor_pixels + (size_t)(y - pointer.y) * cursor_width + (covered.x - pointer.x);
+        unsigned char *out = dst + ((size_t)(y - region->y) * region->width + (covered.x - region->x)) * 4;
+        for (int x = 0; x < covered.width; x++, out += 4) {
+            uint32_t p = src[x];
+            unsigned int alpha = p >> 24;
+            if (alpha == 0) continue;
+            unsigned int keep = 255 - alpha;
+            out[0] = (unsigned char)((p & 0xff) + (out[0] * keep + 127) / 255);
+            out[1] = (unsigned char)(((p >> 8) & 0xff) + (out[1] * keep + 127) / 255);
+            out[2] = (unsigned char)(((p >> 16) & 0xff) + (out[2] * keep + 127) / 255);
+        }
+    }
+    return covered;
+}
+
+void x11_source_copy(unsigned char *dst, int slot, const FrameRect *region) {
+    if (!image) return;
+    int stride = image->bytes_per_line;
+    bool full_frame = region->x == 0 && region->y == 0 && region->width == width && region->height == height;
+
+    if (full_frame) {
+        FrameRect dirty = frame_rect_intersect(slot_dirty[slot], screen_rect());
+        size_t row_bytes = (size_t)dirty.width * 4;
+        for (int y = dirty.y; y < dirty.y + dirty.height; y++) {
+            memcpy(dst + ((size_t)y * width + dirty.x) * 4,
+                   image->data + (size_t)y * stride + (size_t)dirty.x * 4, row_bytes);
+        }
+        slot_dirty[slot].width = slot_dirty[slot].height = 0;
+    } else {
+        // A cropped frame has another layout, the next full frame rewrites everything
+        copy_frame_region((const unsigned char *)image->data, stride, dst, 4, region);
+        slot_dirty[slot] = screen_rect();
+    }
+
+    if (draw_cursor) {
+        FrameRect pointer = blend_pointer(dst, region);
+        // Restored from the image on the next copy into this slot
+        if (full_frame) slot_dirty[slot] = frame_rect_union(slot_dirty[slot], pointer);
+    }
+}
+
+void x11_source_invalidate(void) {
+    slot_dirty[0] = slot_dirty[1] = screen_rect();
+}
+
+void x11_source_print_stats(FILE *out) {
+    if (!display) return;
+    fprintf(out, "X11 capture: %llu polls, %llu frames (%llu pointer only), %.1f%% of the rows fetched per frame\n",
+            (unsigned long long)polls, (unsigned long long)frames, (unsigned long long)pointer_only_frames,
+            frames && height ? 100.0 * fetched_rows / ((double)frames * height) : 0.0);
+    stats_histogram_print(&fetch_time, "X11 fetch", out);
+}
+
+#else // WITH_X11
+
+bool x11_source_init(const char *display_name, bool draw_cursor) {
+    (void)display_name;
+    (void)draw_cursor;
+    fprintf(stderr, "X11: built without X11 capture, rebuild with the X11 development packages installed\n");
+    return false;
+}
+
+void x11_source_cleanup(void) {}
+bool x11_source_active(void) { return false; }
+
+void x11_source_size(int *width, int *height) {
+    *width = 0;
+    *height = 0;
+}
+
+bool x11_source_grab(void) { return false; }
+
+const unsigned char *x11_source_image(int *stride) {
+    *stride = 0;
+    return NULL;
+}
+
+void x11_source_copy(unsigned char *dst, int slot, const FrameRect *region) {
+    (void)dst;
+    (void)slot;
+    (void)region;
+}
+
+void x11_source_invalidate(void) {}
+void x11_source_print_stats(FILE *out) { (void)out; }
+
+#endif // WITH_X11
@@ -0,0 +1,37 @@
+#ifndef X11_SOURCE_H
+#define X11_SOURCE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "utility.h"
+
+// Opens the X display (NULL or "" uses $DISPLAY) and maps a MIT-SHM image of the root
+// window. With draw_cursor the pointer, which X leaves out of the image, is drawn into
+// the frames. Needs a build with X11 (see the Makefile).
+bool x11_source_init(const char *display_name, bool draw_cursor);
+void x11_source_cleanup(void);
+bool x11_source_active(void);
+
+// Size of the root window, the frames are width x height BGRx pixels
+void x11_source_size(int *width, int *height);
+
+// Fetches what was damaged since the last call into the shared memory image. Returns
+// false if neither the screen nor the pointer changed, there is no new frame then.
+// The screen size may have changed afterwards, see x11_source_size().
+bool x11_source_grab(void);
+
+// The shared memory image (BGRx, stride bytes per row) for analysis, valid until the next grab
+const unsigned char *x11_source_image(int *stride);
+
+// Copies region of the last grabbed frame into dst, packed with region->width * 4 bytes
+// per row, and draws the pointer. slot (0 or 1) names the destination buffer: for a full
+// frame region only what changed since the last copy into that slot is copied.
+void x11_source_copy(unsigned char *dst, int slot, const FrameRect *region);
+
+// The next copy into each slot copies the whole region, e.g. after the buffers were reallocated
+void x11_source_invalidate(void);
+
+void x11_source_print_stats(FILE *out);
+
+#endif // X11_SOURCE_H
@@ -18,6 +18,7 @@
 #ifdef ARCH_X86_64
 #include "3rdparty/include/SimdLib.h"
 #endif
+#include "utility.h"
 
 // PipeWire includes
 #include <pipewire/pipewire.h>
@@ -84,6 +85,15 @@ static void on_open_pipewire_remote_completed(GObject *source_object, GAsyncResu
 static XDGFrameRequest *g_screencast_session = NULL;
 static gboolean g_screencast_initialized = FALSE;
 
+// Size offered first when negotiating the PipeWire format (0 = no preference)
+static int g_preferred_width = 0;
+static int g_preferred_height = 0;
+
+void xdg_set_preferred_size(int width, int height) {
+    g_preferred_width = width;
+    g_preferred_height = height;
+}
+
 // PipeWire stream event handlers
 static void on_stream_process(void *userdata)
 {
@@ -129,7 +139,8 @@ static void on_stream_process(void *userdata)
         pw_data->frame_height = 1080;
     }
 
-    pw_data->frame_stride = pw_data->frame_width * 4; // Assume BGRA format
+    // Assume BGRA format, the producer may pad rows
+    pw_data->frame_stride = (d->chunk && d->chunk->stride > 0) ? d->chunk->stride : pw_data->frame_width * 4;
     
     // Allocate frame buffer if needed
     size_t frame_size = pw_data->frame_height * pw_data->frame_width * 3; // RGB output
@@ -146,6 +157,10 @@ static void on_stream_process(void *userdata)
     SimdBgraToRgb(src, pw_data->frame_width, pw_data->frame_height, pw_data->frame_stride, dst, pw_data->frame_width * 3);
 #endif
 
+#if !defined(ARCH_X86_64) && !defined(ARCH_ARM64)
+    convert_bgra_to_rgb(src, pw_data->frame_stride, dst, pw_data->frame_width, pw_data->frame_height);
+#endif
+
 #ifdef ARCH_ARM64
     int step = 4;
     int line_start = frame_count % step;
@@ -209,6 +224,34 @@ static void on_stream_process(void *userdata)
     pw_stream_queue_buffer(pw_data->stream, b);
 }
 
+// The negotiated format decides the frame size, which can differ from the size the portal reported
+static void on_stream_param_changed(void *userdata, uint32_t id, const struct spa_pod *param)
+{
+    PipeWireStreamData *pw_data = userdata;
+    struct spa_video_info_raw info;
+
+    if (param == NULL || id != SPA_PARAM_Format) {
+        return;
+    }
+    if (spa_format_video_raw_parse(param, &info) < 0) {
+        g_printerr("PipeWire: Failed to parse negotiated video format\n");
+        return;
+    }
+
+    g_print("PipeWire negotiated format: %dx%d\n", info.size.width, info.size.height);
+
+    g_mutex_lock(&pw_data->frame_mutex);
+    if ((int)info.size.width != pw_data->frame_width || (int)info.size.height != pw_data->frame_height) {
+        pw_data->frame_width = info.size.width;
+        pw_data->frame_height = info.size.height;
+        // Reallocated with the new size on the next processed buffer
+        g_free(pw_data->frame_data);
+        pw_data->frame_data = NULL;
+        pw_data->frame_ready = FALSE;
+    }
+    g_mutex_unlock(&pw_data->frame_mutex);
+}
+
 static void on_stream_state_changed(void *userdata, enum pw_stream_state old, enum pw_stream_state state, const char *error)
 {
     PipeWireStreamData *pw_data = userdata;
@@ -228,6 +271,7 @@ static const struct pw_stream_events stream_events = {
     PW_VERSION_STREAM_EVENTS,
     .process = on_stream_process,
     .state_changed = on_stream_state_changed,
+    .param_changed = on_stream_param_changed,
 };
 
 
@@ -312,6 +356,13 @@ process_pipewire_stream(XDGFrameRequest *frame_request)
     uint8_t buffer[1024];
     struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
     const struct spa_pod *params[2];
+
+    // Prefer a reduced size when one was requested, the renderer can upscale it on the GPU
+    struct spa_rectangle preferred_size = SPA_RECTANGLE(320, 240);
+    if (g_preferred_width > 0 && g_preferred_height > 0) {
+        preferred_size = SPA_RECTANGLE(g_preferred_width, g_preferred_height);
+        g_print("Requesting PipeWire frame size %dx%d\n", g_preferred_width, g_preferred_height);
+    }
     
     params[0] = spa_pod_builder_add_object(&b,
         SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat,
@@ -322,7 +373,7 @@ process_pipewire_stream(XDGFrameRequest *frame_request)
             SPA_VIDEO_FORMAT_RGBA,
             SPA_VIDEO_FORMAT_BGRx),
         SPA_FORMAT_VIDEO_size, SPA_POD_CHOICE_RANGE_Rectangle(
-            &SPA_RECTANGLE(320, 240),
+            &preferred_size,
             &SPA_RECTANGLE(1, 1),
             &SPA_RECTANGLE(4096, 4096)),
         SPA_FORMAT_VIDEO_framerate, SPA_POD_CHOICE_RANGE_Fraction(
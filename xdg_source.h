@@ -62,4 +62,15 @@ void free_xdg_frame_request(XDGFrameRequest* frame_req);
 void cleanup_screencast_session(void);
 XDGFrameRequest* init_screencast_session(void);
 
+/**
+ * @brief Sets the frame size offered first when the PipeWire stream format is negotiated.
+ * 
+ * Must be called before init_screencast_session(). Whether the compositor honours the
+ * preferred size is up to the compositor, the negotiated size is always used for the frames.
+ * 
+ * @param width Preferred width in pixels, 0 for no preference.
+ * @param height Preferred height in pixels, 0 for no preference.
+ */
+void xdg_set_preferred_size(int width, int height);
+
 #endif // XDG_SOURCE_H
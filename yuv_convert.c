@@ -0,0 +1,166 @@
+/*  YUV to RGB conversion on the GPU for decoded H.264/HEVC frames.
+
+    The luma and chroma planes are uploaded as single channel textures (1.5 bytes per
+    pixel instead of 3 for RGB) and a fragment shader pass writes the RGB result into
+    the screen texture, so the CPU never touches the pixels after decoding. Chroma is
+    upsampled by the linear texture filter.
+
+    The shader only uses GLSL 1.20, like the upscale passes.
+*/
+
+#include "yuv_convert.h"
+
+#include <stdio.h>
+
+static const char *yuv_vertex_src =
+    "#version 120\n"
+    "void main() {\n"
+    "    gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+static const char *yuv_fragment_src =
+    "#version 120\n"
+    "uniform sampler2D y_plane;\n"
+    "uniform sampler2D u_plane;\n"
+    "uniform sampler2D v_plane;\n"
+    "uniform bool interleaved;\n"
+    "uniform vec3 offset;\n"
+    "uniform mat3 yuv_to_rgb;\n"
+    "\n"
+    "void main() {\n"
+    "    vec2 uv = gl_TexCoord[0].xy;\n"
+    "    // NV12 chroma is uploaded as luminance/alpha pairs: U in .r, V in .a\n"
+    "    vec4 u = texture2D(u_plane, uv);\n"
+    "    float v = interleaved ? u.a : texture2D(v_plane, uv).r;\n"
+    "    vec3 yuv = vec3(texture2D(y_plane, uv).r, u.r, v);\n"
+    "    gl_FragColor = vec4(clamp(yuv_to_rgb * (yuv - offset), 0.0, 1.0), 1.0);\n"
+    "}\n";
+
+static GLuint program = 0;
+static GLuint fbo = 0;
+static GLuint plane_textures[3] = {0, 0, 0};
+static int plane_width = 0;     // Size and layout the plane textures were specified for
+static int plane_height = 0;
+static YuvLayout plane_layout = YUV_LAYOUT_NONE;
+
+bool yuv_convert_init(void) {
+    program = gl_utility_compile_program("YUV convert", yuv_vertex_src, yuv_fragment_src);
+    if (!program) return false;
+
+    glGenFramebuffers(1, &fbo);
+    glGenTextures(3, plane_textures);
+    for (int i = 0; i < 3; i++) {
+        glBindTexture(GL_TEXTURE_2D, plane_textures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    plane_width = plane_height = 0;
+    plane_layout = YUV_LAYOUT_NONE;
+    printf("YUV convert: Shader compiled.\n");
+    return true;
+}
+
+void yuv_convert_cleanup(void) {
+    if (program) glDeleteProgram(program);
+    if (fbo) glDeleteFramebuffers(1, &fbo);
+    if (plane_textures[0]) glDeleteTextures(3, plane_textures);
+    program = 0;
+    fbo = 0;
+    plane_textures[0] = plane_textures[1] = plane_textures[2] = 0;
+}
+
+// Matrix (column major) and offset taking normalized Y'CbCr to R'G'B'
+static void yuv_matrix(const YuvFormat *format, float matrix[9], float offset[3]) {
+    double kr = format->bt709 ? 0.2126 : 0.299;
+    double kb = format->bt709 ? 0.0722 : 0.114;
+    double kg = 1.0 - kr - kb;
+    double y_scale = format->full_range ? 1.0 : 255.0 / 219.0;
+    double c_scale = format->full_range ? 1.0 : 255.0 / 224.0;
+
+    offset[0] = format->full_range ? 0.0f : 16.0f / 255.0f;
+    offset[1] = 128.0f / 255.0f;
+    offset[2] = 128.0f / 255.0f;
+
+    matrix[0] = matrix[1] = matrix[2] = (float)y_scale;                 // Y
+    matrix[3] = 0.0f;                                                   // Cb
+    matrix[4] = (float)(-c_scale * 2.0 * kb * (1.0 - kb) / kg);
+    matrix[5] = (float)(c_scale * 2.0 * (1.0 - kb));
+    matrix[6] = (float)(c_scale * 2.0 * (1.0 - kr));                    // Cr
+    matrix[7] = (float)(-c_scale * 2.0 * kr * (1.0 - kr) / kg);
+    matrix[8] = 0.0f;
+}
+
+static void upload_plane(int index, GLenum format, int width, int height, const unsigned char *data, bool respecify) {
+    glBindTexture(GL_TEXTURE_2D, plane_textures[index]);
+    if (respecify) {
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, data);
+    }
+}
+
+bool yuv_convert_to_texture(GLuint texture, const unsigned char *frame, int width, int height,
+                            const YuvFormat *format) {
+    if (!program || format->layout == YUV_LAYOUT_NONE) return false;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "YUV convert: Framebuffer %dx%d incomplete (0x%04X)\n", width, height, status);
+        return false;
+    }
+
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    const unsigned char *chroma = frame + (size_t)width * height;
+    bool respecify = width != plane_width || height != plane_height || format->layout != plane_layout;
+    bool interleaved = format->layout == YUV_LAYOUT_NV12;
+
+    glActiveTexture(GL_TEXTURE0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    upload_plane(0, GL_LUMINANCE, width, height, frame, respecify);
+    if (interleaved) {
+        upload_plane(1, GL_LUMINANCE_ALPHA, chroma_width, chroma_height, chroma, respecify);
+    } else {
+        upload_plane(1, GL_LUMINANCE, chroma_width, chroma_height, chroma, respecify);
+        upload_plane(2, GL_LUMINANCE, chroma_width, chroma_height,
+                     chroma + (size_t)chroma_width * chroma_height, respecify);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    plane_width = width;
+    plane_height = height;
+    plane_layout = format->layout;
+
+    float matrix[9], offset[3];
+    yuv_matrix(format, matrix, offset);
+
+    GLRenderTarget target = {fbo, texture, 0, width, height};
+    gl_utility_begin_pass(&target);
+    glUseProgram(program);
+    for (int i = 0; i < 3; i++) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, plane_textures[i]);
+    }
+    glUniform1i(glGetUniformLocation(program, "y_plane"), 0);
+    glUniform1i(glGetUniformLocation(program, "u_plane"), 1);
+    glUniform1i(glGetUniformLocation(program, "v_plane"), 2);
+    glUniform1i(glGetUniformLocation(program, "interleaved"), interleaved);
+    glUniform3fv(glGetUniformLocation(program, "offset"), 1, offset);
+    glUniformMatrix3fv(glGetUniformLocation(program, "yuv_to_rgb"), 1, GL_FALSE, matrix);
+    gl_utility_draw_fullscreen_quad();
+    gl_utility_end_pass();
+
+    for (int i = 2; i > 0; i--) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    return true;
+}
@@ -0,0 +1,21 @@
+#ifndef YUV_CONVERT_H
+#define YUV_CONVERT_H
+
+#include <stdbool.h>
+
+#include "gl_utility.h"
+#include "utility.h"
+
+// Compiles the conversion shader. Must be called with a current GL context.
+// Returns false if shaders or framebuffer objects are not available.
+bool yuv_convert_init(void);
+
+// Frees the program, the plane textures and the framebuffer.
+void yuv_convert_cleanup(void);
+
+// Uploads a packed 4:2:0 frame (see YuvLayout) of width x height pixels and converts it to RGB
+// into level 0 of texture, which must already have that size. Leaves texture bound to unit 0.
+bool yuv_convert_to_texture(GLuint texture, const unsigned char *frame, int width, int height,
+                            const YuvFormat *format);
+
+#endif // YUV_CONVERT_H